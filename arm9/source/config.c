@@ -27,6 +27,7 @@
 #define _GNU_SOURCE // for strchrnul
 
 #include <assert.h>
+#include <stddef.h>
 #include <strings.h>
 #include "config.h"
 #include "memory.h"
@@ -58,22 +59,6 @@ static_assert(sizeof(CfgDataMcu) > 0, "wrong data size");
 // INI parsing
 // ===========================================================
 
-static const char *singleOptionIniNamesBoot[] = {
-    "autoboot_emunand",
-    "enable_external_firm_and_modules",
-    "enable_game_patching",
-    "app_syscore_threads_on_core_2",
-    "show_system_settings_string",
-    "show_gba_boot_screen",
-};
-
-static const char *singleOptionIniNamesMisc[] = {
-    "use_dev_unitinfo",
-    "enable_dsi_external_filter",
-    "disable_arm11_exception_handlers",
-    "enable_safe_firm_rosalina",
-};
-
 static const char *keyNames[] = {
     "A", "B", "Select", "Start", "Right", "Left", "Up", "Down", "R", "L", "X", "Y",
     "?", "?",
@@ -184,9 +169,9 @@ static int parseDecFloatOption(s64 *out, const char *val, s64 minval, s64 maxval
         return -1;
     }
 
-    s64 intPartAbs = sign == -1 ? -intPart : intPart;
+    // The sign has already been stripped, it is only applied once at the end
     s64 res = 0;
-    bool of = __builtin_mul_overflow(intPartAbs, FLOAT_CONV_MULT, &res);
+    bool of = __builtin_mul_overflow(intPart, FLOAT_CONV_MULT, &res);
 
     if (of) {
         return -1;
@@ -297,7 +282,7 @@ static void menuComboToString(char *out, u32 combo)
     out[0] = 0;
     for(int i = 31; i >= 0; i--)
     {
-        if(combo & (1 << i))
+        if(combo & (1u << i))
         {
             strcpy(out, keyNames[i]);
             out += strlen(keyNames[i]);
@@ -311,321 +296,281 @@ static void menuComboToString(char *out, u32 combo)
 
 static int encodedFloatToString(char *out, s64 val)
 {
-    s64 sign = val >= 0 ? 1 : -1;
-
-    s64 intPart = (sign * val) / FLOAT_CONV_MULT;
-    s64 fracPart = (sign * val) % FLOAT_CONV_MULT;
-
-    while (fracPart % 10 != 0) {
-        // Remove trailing zeroes
-        fracPart /= 10;
-    }
+    s64 absVal = val >= 0 ? val : -val;
+    s64 intPart = absVal / FLOAT_CONV_MULT;
+    s64 fracPart = absVal % FLOAT_CONV_MULT;
 
-    int n = sprintf(out, "%lld", sign * intPart);
+    // The sign is written on its own, so that it isn't lost when the integer part is 0
+    int n = sprintf(out, "%s%lld", val < 0 ? "-" : "", intPart);
     if (fracPart != 0) {
         n += sprintf(out + n, ".%0*lld", (int)FLOAT_CONV_PRECISION, fracPart);
 
         // Remove trailing zeroes
-        int n2 = n - 1;
-        while (out[n2] == '0') {
-            out[n2--] = '\0';
+        while (out[n - 1] == '0') {
+            out[--n] = '\0';
         }
-
-        n = n2;
     }
 
     return n;
 }
 
-static bool hasIniParseError = false;
-static int iniParseErrorLine = 0;
-
-#define CHECK_PARSE_OPTION(res) do { if((res) < 0) { hasIniParseError = true; iniParseErrorLine = lineno; return 0; } } while(false)
+// Every option known to config.ini, sorted by section and then by name for
+// findIniOption. config_template.ini only provides the layout and comments.
+
+typedef enum IniOptionType {
+    INI_OPTION_BOOL,        // Bit 'bit' of the field
+    INI_OPTION_MULTI_NAME,  // Multi-choice option 'bit', stored as an index into 'names'
+    INI_OPTION_MULTI_VALUE, // Multi-choice option 'bit', stored as an index into 'values'
+    INI_OPTION_DEC_INT,
+    INI_OPTION_DEC_FLOAT,   // s64 field, multiplied by FLOAT_CONV_MULT
+    INI_OPTION_HEX_U64,
+    INI_OPTION_KEY_COMBO,
+} IniOptionType;
+
+typedef struct IniOption {
+    const char *section;
+    const char *name;
+    u8 type;
+    u8 size;
+    u8 bit;
+    u8 numChoices;
+    u16 offset;
+    s64 minval, maxval;
+    const char *const *names;
+    const s8 *values;
+} IniOption;
+
+#define INI_FIELD(field) .size = sizeof(((CfgData *)NULL)->field), .offset = offsetof(CfgData, field)
+
+#define INI_BOOL(sec, key, field, b) \
+    { .section = sec, .name = key, .type = INI_OPTION_BOOL, INI_FIELD(field), .bit = b }
+#define INI_MULTI_NAME(sec, key, opt, choices) \
+    { .section = sec, .name = key, .type = INI_OPTION_MULTI_NAME, INI_FIELD(multiConfig), .bit = opt, \
+      .numChoices = sizeof(choices)/sizeof(choices[0]), .names = choices }
+#define INI_MULTI_VALUE(sec, key, opt, choices, minv, maxv) \
+    { .section = sec, .name = key, .type = INI_OPTION_MULTI_VALUE, INI_FIELD(multiConfig), .bit = opt, \
+      .numChoices = sizeof(choices)/sizeof(choices[0]), .values = choices, .minval = minv, .maxval = maxv }
+#define INI_DEC_INT(sec, key, field, minv, maxv) \
+    { .section = sec, .name = key, .type = INI_OPTION_DEC_INT, INI_FIELD(field), .minval = minv, .maxval = maxv }
+#define INI_DEC_FLOAT(sec, key, field, minv, maxv) \
+    { .section = sec, .name = key, .type = INI_OPTION_DEC_FLOAT, INI_FIELD(field), .minval = minv, .maxval = maxv }
+#define INI_HEX_U64(sec, key, field) \
+    { .section = sec, .name = key, .type = INI_OPTION_HEX_U64, INI_FIELD(field) }
+#define INI_KEY_COMBO(sec, key, field) \
+    { .section = sec, .name = key, .type = INI_OPTION_KEY_COMBO, INI_FIELD(field) }
+
+static const char *const splashPositionNames[] = { "off", "before payloads", "after payloads" };
+static const char *const newCpuNames[] = { "off", "clock", "l2", "clock+l2" };
+static const char *const autobootModeNames[] = { "off", "3ds", "dsi" };
+static const char *const forceAudioOutputNames[] = { "off", "headphones", "speakers" };
+
+static const s8 defaultEmuNandValues[] = { 1, 2, 3, 4 };
+static const s8 brightnessValues[] = { 4, 3, 2, 1 };
+static const s8 pinNumDigitsValues[] = { 0, 4, 6, 8 };
+
+static const IniOption iniOptions[] = {
+    INI_DEC_INT("autoboot", "autoboot_3ds_app_mem_type", autobootCtrAppmemtype, 0, 4),
+    INI_HEX_U64("autoboot", "autoboot_dsi_titleid", autobootTwlTitleId),
+
+    INI_MULTI_NAME("boot", "app_launch_new_3ds_cpu", NEWCPU, newCpuNames),
+    INI_BOOL("boot", "app_syscore_threads_on_core_2", config, REDIRECTAPPTHREADS),
+    INI_BOOL("boot", "autoboot_emunand", config, AUTOBOOTEMU),
+    INI_MULTI_NAME("boot", "autoboot_mode", AUTOBOOTMODE, autobootModeNames),
+    INI_MULTI_VALUE("boot", "brightness_level", BRIGHTNESS, brightnessValues, 1, 4),
+    INI_MULTI_VALUE("boot", "default_emunand_number", DEFAULTEMU, defaultEmuNandValues, 1, 4),
+    INI_BOOL("boot", "enable_external_firm_and_modules", config, LOADEXTFIRMSANDMODULES),
+    INI_BOOL("boot", "enable_game_patching", config, PATCHGAMES),
+    INI_MULTI_VALUE("boot", "pin_lock_num_digits", PIN, pinNumDigitsValues, 0, 8),
+    INI_BOOL("boot", "show_gba_boot_screen", config, SHOWGBABOOT),
+    INI_BOOL("boot", "show_system_settings_string", config, PATCHVERSTRING),
+    INI_DEC_INT("boot", "splash_duration_ms", splashDurationMsec, 0, 0xFFFFFFFFu),
+    INI_MULTI_NAME("boot", "splash_position", SPLASH, splashPositionNames),
+
+    INI_DEC_INT("meta", "config_version_major", formatVersionMajor, 0, 0xFFFF),
+    INI_DEC_INT("meta", "config_version_minor", formatVersionMinor, 0, 0xFFFF),
+
+    INI_BOOL("misc", "disable_arm11_exception_handlers", config, DISABLEARM11EXCHANDLERS),
+    INI_BOOL("misc", "enable_dsi_external_filter", config, ENABLEDSIEXTFILTER),
+    INI_BOOL("misc", "enable_safe_firm_rosalina", config, ENABLESAFEFIRMROSALINA),
+    INI_MULTI_NAME("misc", "force_audio_output", FORCEAUDIOOUTPUT, forceAudioOutputNames),
+    INI_BOOL("misc", "use_dev_unitinfo", config, PATCHUNITINFO),
+    INI_DEC_INT("misc", "volume_slider_override", volumeSliderOverride, -1, 100),
+
+    INI_HEX_U64("rosalina", "hbldr_3dsx_titleid", hbldr3dsxTitleId),
+    INI_DEC_INT("rosalina", "ntp_tz_offset_min", ntpTzOffetMinutes, -779, 899),
+    INI_BOOL("rosalina", "plugin_loader_enabled", pluginLoaderFlags, 0),
+    INI_KEY_COMBO("rosalina", "rosalina_menu_combo", rosalinaMenuCombo),
+
+    INI_DEC_FLOAT("screen_filters", "screen_filters_bot_brightness", bottomScreenFilter.brightnessEnc, -1 * FLOAT_CONV_MULT, 1 * FLOAT_CONV_MULT),
+    INI_DEC_INT("screen_filters", "screen_filters_bot_cct", bottomScreenFilter.cct, 1000, 25100),
+    INI_DEC_INT("screen_filters", "screen_filters_bot_color_curve_adj", bottomScreenFilter.colorCurveCorrection, 0, 2),
+    INI_DEC_FLOAT("screen_filters", "screen_filters_bot_contrast", bottomScreenFilter.contrastEnc, 0, 255 * FLOAT_CONV_MULT),
+    INI_DEC_FLOAT("screen_filters", "screen_filters_bot_gamma", bottomScreenFilter.gammaEnc, 0, 8 * FLOAT_CONV_MULT),
+    INI_BOOL("screen_filters", "screen_filters_bot_invert", bottomScreenFilter.invert, 0),
+    INI_DEC_FLOAT("screen_filters", "screen_filters_top_brightness", topScreenFilter.brightnessEnc, -1 * FLOAT_CONV_MULT, 1 * FLOAT_CONV_MULT),
+    INI_DEC_INT("screen_filters", "screen_filters_top_cct", topScreenFilter.cct, 1000, 25100),
+    INI_DEC_INT("screen_filters", "screen_filters_top_color_curve_adj", topScreenFilter.colorCurveCorrection, 0, 2),
+    INI_DEC_FLOAT("screen_filters", "screen_filters_top_contrast", topScreenFilter.contrastEnc, 0, 255 * FLOAT_CONV_MULT),
+    INI_DEC_FLOAT("screen_filters", "screen_filters_top_gamma", topScreenFilter.gammaEnc, 0, 8 * FLOAT_CONV_MULT),
+    INI_BOOL("screen_filters", "screen_filters_top_invert", topScreenFilter.invert, 0),
+};
 
-static int configIniHandler(void* user, const char* section, const char* name, const char* value, int lineno)
+static const IniOption *findIniOption(const char *section, const char *name)
 {
-    CfgData *cfg = (CfgData *)user;
-    if (strcmp(section, "meta") == 0) {
-        if (strcmp(name, "config_version_major") == 0) {
-            s64 opt;
-            CHECK_PARSE_OPTION(parseDecIntOption(&opt, value, 0, 0xFFFF));
-            cfg->formatVersionMajor = (u16)opt;
-            return 1;
-        } else if (strcmp(name, "config_version_minor") == 0) {
-            s64 opt;
-            CHECK_PARSE_OPTION(parseDecIntOption(&opt, value, 0, 0xFFFF));
-            cfg->formatVersionMinor = (u16)opt;
-            return 1;
-        } else {
-            CHECK_PARSE_OPTION(-1);
+    size_t lo = 0, hi = sizeof(iniOptions)/sizeof(iniOptions[0]);
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(section, iniOptions[mid].section);
+        if (cmp == 0) {
+            cmp = strcmp(name, iniOptions[mid].name);
         }
-    } else if (strcmp(section, "boot") == 0) {
-        // Simple options displayed on the Luma3DS boot screen
-        for (size_t i = 0; i < sizeof(singleOptionIniNamesBoot)/sizeof(singleOptionIniNamesBoot[0]); i++) {
-            if (strcmp(name, singleOptionIniNamesBoot[i]) == 0) {
-                bool opt;
-                CHECK_PARSE_OPTION(parseBoolOption(&opt, value));
-                cfg->config |= (u32)opt << i;
-                return 1;
-            }
+
+        if (cmp == 0) {
+            return &iniOptions[mid];
+        } else if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
         }
+    }
+
+    return NULL;
+}
 
-        // Multi-choice options displayed on the Luma3DS boot screen
-
-        if (strcmp(name, "default_emunand_number") == 0) {
-            s64 opt;
-            CHECK_PARSE_OPTION(parseDecIntOption(&opt, value, 1, 4));
-            cfg->multiConfig |= (opt - 1) << (2 * (u32)DEFAULTEMU);
-            return 1;
-        } else if (strcmp(name, "brightness_level") == 0) {
-            s64 opt;
-            CHECK_PARSE_OPTION(parseDecIntOption(&opt, value, 1, 4));
-            cfg->multiConfig |= (4 - opt) << (2 * (u32)BRIGHTNESS);
-            return 1;
-        } else if (strcmp(name, "splash_position") == 0) {
-            if (strcasecmp(value, "off") == 0) {
-                cfg->multiConfig |= 0 << (2 * (u32)SPLASH);
-                return 1;
-            } else if (strcasecmp(value, "before payloads") == 0) {
-                cfg->multiConfig |= 1 << (2 * (u32)SPLASH);
-                return 1;
-            } else if (strcasecmp(value, "after payloads") == 0) {
-                cfg->multiConfig |= 2 << (2 * (u32)SPLASH);
-                return 1;
-            } else {
-                CHECK_PARSE_OPTION(-1);
+static u64 getIniOptionField(const CfgData *cfg, const IniOption *opt)
+{
+    u64 val = 0;
+    memcpy(&val, (const u8 *)cfg + opt->offset, opt->size);
+    return val;
+}
+
+static void setIniOptionField(CfgData *cfg, const IniOption *opt, u64 val)
+{
+    memcpy((u8 *)cfg + opt->offset, &val, opt->size);
+}
+
+static u32 getIniOptionChoice(const CfgData *cfg, const IniOption *opt)
+{
+    u32 choice = (cfg->multiConfig >> (2 * opt->bit)) & 3;
+    return choice < opt->numChoices ? choice : 0;
+}
+
+static int parseIniOption(CfgData *cfg, const IniOption *opt, const char *value)
+{
+    switch (opt->type) {
+        case INI_OPTION_BOOL: {
+            bool b;
+            if (parseBoolOption(&b, value) < 0) {
+                return -1;
             }
-        } else if (strcmp(name, "splash_duration_ms") == 0) {
-            // Not displayed in the menu anymore, but more configurable
-            s64 opt;
-            CHECK_PARSE_OPTION(parseDecIntOption(&opt, value, 0, 0xFFFFFFFFu));
-            cfg->splashDurationMsec = (u32)opt;
-            return 1;
+            u64 field = getIniOptionField(cfg, opt) & ~(1ull << opt->bit);
+            setIniOptionField(cfg, opt, field | (u64)b << opt->bit);
+            return 0;
         }
-        else if (strcmp(name, "pin_lock_num_digits") == 0) {
-            s64 opt;
-            u32 encodedOpt;
-            CHECK_PARSE_OPTION(parseDecIntOption(&opt, value, 0, 8));
-            // Only allow for 0 (off), 4, 6 or 8 'digits'
-            switch (opt) {
-                case 0: encodedOpt = 0; break;
-                case 4: encodedOpt = 1; break;
-                case 6: encodedOpt = 2; break;
-                case 8: encodedOpt = 3; break;
-                default: {
-                    CHECK_PARSE_OPTION(-1);
-                }
-            }
-            cfg->multiConfig |= encodedOpt << (2 * (u32)PIN);
-            return 1;
-        } else if (strcmp(name, "app_launch_new_3ds_cpu") == 0) {
-            if (strcasecmp(value, "off") == 0) {
-                cfg->multiConfig |= 0 << (2 * (u32)NEWCPU);
-                return 1;
-            } else if (strcasecmp(value, "clock") == 0) {
-                cfg->multiConfig |= 1 << (2 * (u32)NEWCPU);
-                return 1;
-            } else if (strcasecmp(value, "l2") == 0) {
-                cfg->multiConfig |= 2 << (2 * (u32)NEWCPU);
-                return 1;
-            } else if (strcasecmp(value, "clock+l2") == 0) {
-                cfg->multiConfig |= 3 << (2 * (u32)NEWCPU);
-                return 1;
-            } else {
-                CHECK_PARSE_OPTION(-1);
+        case INI_OPTION_MULTI_NAME:
+        case INI_OPTION_MULTI_VALUE: {
+            s64 n = 0;
+            if (opt->type == INI_OPTION_MULTI_VALUE && parseDecIntOption(&n, value, opt->minval, opt->maxval) < 0) {
+                return -1;
             }
-        } else if (strcmp(name, "autoboot_mode") == 0) {
-            if (strcasecmp(value, "off") == 0) {
-                cfg->multiConfig |= 0 << (2 * (u32)AUTOBOOTMODE);
-                return 1;
-            } else if (strcasecmp(value, "3ds") == 0) {
-                cfg->multiConfig |= 1 << (2 * (u32)AUTOBOOTMODE);
-                return 1;
-            } else if (strcasecmp(value, "dsi") == 0) {
-                cfg->multiConfig |= 2 << (2 * (u32)AUTOBOOTMODE);
-                return 1;
-            } else {
-                CHECK_PARSE_OPTION(-1);
+            for (u32 i = 0; i < opt->numChoices; i++) {
+                if (opt->type == INI_OPTION_MULTI_NAME ? strcasecmp(value, opt->names[i]) == 0 : opt->values[i] == n) {
+                    cfg->multiConfig = (cfg->multiConfig & ~(3u << (2 * opt->bit))) | (i << (2 * opt->bit));
+                    return 0;
+                }
             }
-        } else {
-            CHECK_PARSE_OPTION(-1);
-        }
-    } else if (strcmp(section, "rosalina") == 0) {
-        // Rosalina options
-        if (strcmp(name, "hbldr_3dsx_titleid") == 0) {
-            u64 opt;
-            CHECK_PARSE_OPTION(parseHexIntOption(&opt, value, 0, 0xFFFFFFFFFFFFFFFFull));
-            cfg->hbldr3dsxTitleId = opt;
-            return 1;
-        } else if (strcmp(name, "rosalina_menu_combo") == 0) {
-            u32 opt;
-            CHECK_PARSE_OPTION(parseKeyComboOption(&opt, value));
-            cfg->rosalinaMenuCombo = opt;
-            return 1;
-        } else if (strcmp(name, "plugin_loader_enabled") == 0) {
-            bool opt;
-            CHECK_PARSE_OPTION(parseBoolOption(&opt, value));
-            cfg->pluginLoaderFlags = opt ? cfg->pluginLoaderFlags | 1 : cfg->pluginLoaderFlags & ~1;
-            return 1;
-        } else if (strcmp(name, "ntp_tz_offset_min") == 0) {
-            s64 opt;
-            CHECK_PARSE_OPTION(parseDecIntOption(&opt, value, -779, 899));
-            cfg->ntpTzOffetMinutes = (s16)opt;
-            return 1;
-        } else {
-            CHECK_PARSE_OPTION(-1);
+            return -1;
         }
-    } else if (strcmp(section, "screen_filters") == 0) {
-        if (strcmp(name, "screen_filters_top_cct") == 0) {
-            s64 opt;
-            CHECK_PARSE_OPTION(parseDecIntOption(&opt, value, 1000, 25100));
-            cfg->topScreenFilter.cct = (u32)opt;
-            return 1;
-        } else if (strcmp(name, "screen_filters_top_gamma") == 0) {
-            s64 opt;
-            CHECK_PARSE_OPTION(parseDecFloatOption(&opt, value, 0, 8 * FLOAT_CONV_MULT));
-            cfg->topScreenFilter.gammaEnc = opt;
-            return 1;
-        } else if (strcmp(name, "screen_filters_top_contrast") == 0) {
-            s64 opt;
-            CHECK_PARSE_OPTION(parseDecFloatOption(&opt, value, 0, 255 * FLOAT_CONV_MULT));
-            cfg->topScreenFilter.contrastEnc = opt;
-            return 1;
-        } else if (strcmp(name, "screen_filters_top_brightness") == 0) {
-            s64 opt;
-            CHECK_PARSE_OPTION(parseDecFloatOption(&opt, value, -1 * FLOAT_CONV_MULT, 1 * FLOAT_CONV_MULT));
-            cfg->topScreenFilter.brightnessEnc = opt;
-            return 1;
-        } else if (strcmp(name, "screen_filters_top_invert") == 0) {
-            bool opt;
-            CHECK_PARSE_OPTION(parseBoolOption(&opt, value));
-            cfg->topScreenFilter.invert = opt;
-            return 1;
-        } else if (strcmp(name, "screen_filters_top_color_curve_adj") == 0) {
-            s64 opt;
-            CHECK_PARSE_OPTION(parseDecIntOption(&opt, value, 0, 2));
-            cfg->topScreenFilter.colorCurveCorrection = (u8)opt;
-            return 1;
-        } else if (strcmp(name, "screen_filters_bot_cct") == 0) {
-            s64 opt;
-            CHECK_PARSE_OPTION(parseDecIntOption(&opt, value, 1000, 25100));
-            cfg->bottomScreenFilter.cct = (u32)opt;
-            return 1;
-        } else if (strcmp(name, "screen_filters_bot_gamma") == 0) {
-            s64 opt;
-            CHECK_PARSE_OPTION(parseDecFloatOption(&opt, value, 0, 8 * FLOAT_CONV_MULT));
-            cfg->bottomScreenFilter.gammaEnc = opt;
-            return 1;
-        } else if (strcmp(name, "screen_filters_bot_contrast") == 0) {
-            s64 opt;
-            CHECK_PARSE_OPTION(parseDecFloatOption(&opt, value, 0, 255 * FLOAT_CONV_MULT));
-            cfg->bottomScreenFilter.contrastEnc = opt;
-            return 1;
-        } else if (strcmp(name, "screen_filters_bot_brightness") == 0) {
-            s64 opt;
-            CHECK_PARSE_OPTION(parseDecFloatOption(&opt, value, -1 * FLOAT_CONV_MULT, 1 * FLOAT_CONV_MULT));
-            cfg->bottomScreenFilter.brightnessEnc = opt;
-            return 1;
-        } else if (strcmp(name, "screen_filters_bot_invert") == 0) {
-            bool opt;
-            CHECK_PARSE_OPTION(parseBoolOption(&opt, value));
-            cfg->bottomScreenFilter.invert = opt;
-            return 1;
-        } else if (strcmp(name, "screen_filters_bot_color_curve_adj") == 0) {
-            s64 opt;
-            CHECK_PARSE_OPTION(parseDecIntOption(&opt, value, 0, 2));
-            cfg->bottomScreenFilter.colorCurveCorrection = (u8)opt;
-            return 1;
-        } else {
-            CHECK_PARSE_OPTION(-1);
+        case INI_OPTION_DEC_INT: {
+            s64 n;
+            if (parseDecIntOption(&n, value, opt->minval, opt->maxval) < 0) {
+                return -1;
+            }
+            setIniOptionField(cfg, opt, (u64)n);
+            return 0;
         }
-    } else if (strcmp(section, "autoboot") == 0) {
-        if (strcmp(name, "autoboot_dsi_titleid") == 0) {
-            u64 opt;
-            CHECK_PARSE_OPTION(parseHexIntOption(&opt, value, 0, 0xFFFFFFFFFFFFFFFFull));
-            cfg->autobootTwlTitleId = opt;
-            return 1;
-        } else if (strcmp(name, "autoboot_3ds_app_mem_type") == 0) {
-            s64 opt;
-            CHECK_PARSE_OPTION(parseDecIntOption(&opt, value, 0, 4));
-            cfg->autobootCtrAppmemtype = (u8)opt;
-            return 1;
-        } else {
-            CHECK_PARSE_OPTION(-1);
+        case INI_OPTION_DEC_FLOAT: {
+            s64 n;
+            if (parseDecFloatOption(&n, value, opt->minval, opt->maxval) < 0) {
+                return -1;
+            }
+            setIniOptionField(cfg, opt, (u64)n);
+            return 0;
         }
-    } else if (strcmp(section, "misc") == 0) {
-        for (size_t i = 0; i < sizeof(singleOptionIniNamesMisc)/sizeof(singleOptionIniNamesMisc[0]); i++) {
-            if (strcmp(name, singleOptionIniNamesMisc[i]) == 0) {
-                bool opt;
-                CHECK_PARSE_OPTION(parseBoolOption(&opt, value));
-                cfg->config |= (u32)opt << (i + (u32)PATCHUNITINFO);
-                return 1;
+        case INI_OPTION_HEX_U64: {
+            u64 n;
+            if (parseHexIntOption(&n, value, 0, 0xFFFFFFFFFFFFFFFFull) < 0) {
+                return -1;
             }
+            setIniOptionField(cfg, opt, n);
+            return 0;
         }
-
-        if (strcmp(name, "force_audio_output") == 0) {
-            if (strcasecmp(value, "off") == 0) {
-                cfg->multiConfig |= 0 << (2 * (u32)FORCEAUDIOOUTPUT);
-                return 1;
-            } else if (strcasecmp(value, "headphones") == 0) {
-                cfg->multiConfig |= 1 << (2 * (u32)FORCEAUDIOOUTPUT);
-                return 1;
-            } else if (strcasecmp(value, "speakers") == 0) {
-                cfg->multiConfig |= 2 << (2 * (u32)FORCEAUDIOOUTPUT);
-                return 1;
-            } else {
-                CHECK_PARSE_OPTION(-1);
+        case INI_OPTION_KEY_COMBO: {
+            u32 combo;
+            if (parseKeyComboOption(&combo, value) < 0) {
+                return -1;
             }
-        } else if (strcmp(name, "volume_slider_override") == 0) {
-            s64 opt;
-            CHECK_PARSE_OPTION(parseDecIntOption(&opt, value, -1, 100));
-            cfg->volumeSliderOverride = (s8)opt;
-            return 1;
-        } else {
-            CHECK_PARSE_OPTION(-1);
+            setIniOptionField(cfg, opt, combo);
+            return 0;
         }
-    } else {
-        CHECK_PARSE_OPTION(-1);
+        default:
+            return -1;
     }
 }
 
-static size_t saveLumaIniConfigToStr(char *out)
+static int formatIniOption(char *out, const CfgData *cfg, const IniOption *opt)
 {
-    const CfgData *cfg = &configData;
+    switch (opt->type) {
+        case INI_OPTION_BOOL:
+            return sprintf(out, "%d", (int)((getIniOptionField(cfg, opt) >> opt->bit) & 1));
+        case INI_OPTION_MULTI_NAME:
+            return sprintf(out, "%s", opt->names[getIniOptionChoice(cfg, opt)]);
+        case INI_OPTION_MULTI_VALUE:
+            return sprintf(out, "%d", (int)opt->values[getIniOptionChoice(cfg, opt)]);
+        case INI_OPTION_DEC_INT: {
+            // Sign-extend the field for options that can be negative
+            u32 shift = 64 - 8 * opt->size;
+            u64 field = getIniOptionField(cfg, opt);
+            s64 n = opt->minval < 0 ? (s64)(field << shift) >> shift : (s64)field;
+            return sprintf(out, "%lld", n);
+        }
+        case INI_OPTION_DEC_FLOAT:
+            encodedFloatToString(out, (s64)getIniOptionField(cfg, opt));
+            return strlen(out);
+        case INI_OPTION_HEX_U64:
+            return sprintf(out, "%016llx", getIniOptionField(cfg, opt));
+        case INI_OPTION_KEY_COMBO:
+            menuComboToString(out, (u32)getIniOptionField(cfg, opt));
+            return strlen(out);
+        default:
+            return 0;
+    }
+}
 
-    char lumaVerStr[64];
-    char lumaRevSuffixStr[16];
-    char rosalinaMenuComboStr[128];
+static bool hasIniParseError = false;
+static int iniParseErrorLine = 0;
 
-    const char *splashPosStr;
-    const char *n3dsCpuStr;
-    const char *autobootModeStr;
-    const char *forceAudioOutputStr;
+static int configIniHandler(void* user, const char* section, const char* name, const char* value, int lineno)
+{
+    CfgData *cfg = (CfgData *)user;
+    const IniOption *opt = findIniOption(section, name);
 
-    switch (MULTICONFIG(SPLASH)) {
-        default: case 0: splashPosStr = "off"; break;
-        case 1: splashPosStr = "before payloads"; break;
-        case 2: splashPosStr = "after payloads"; break;
+    if (opt == NULL || parseIniOption(cfg, opt, value) < 0) {
+        hasIniParseError = true;
+        iniParseErrorLine = lineno;
+        return 0;
     }
 
-    switch (MULTICONFIG(NEWCPU)) {
-        default: case 0: n3dsCpuStr = "off"; break;
-        case 1: n3dsCpuStr = "clock"; break;
-        case 2: n3dsCpuStr = "l2"; break;
-        case 3: n3dsCpuStr = "clock+l2"; break;
-    }
+    return 1;
+}
 
-    switch (MULTICONFIG(AUTOBOOTMODE)) {
-        default: case 0: autobootModeStr = "off"; break;
-        case 1: autobootModeStr = "3ds"; break;
-        case 2: autobootModeStr = "dsi"; break;
-    }
+static size_t saveLumaIniConfigToStr(char *out)
+{
+    const CfgData *cfg = &configData;
 
-    switch (MULTICONFIG(FORCEAUDIOOUTPUT)) {
-        default: case 0: forceAudioOutputStr = "off"; break;
-        case 1: forceAudioOutputStr = "headphones"; break;
-        case 2: forceAudioOutputStr = "speakers"; break;
-    }
+    char lumaVerStr[64];
+    char lumaRevSuffixStr[16];
 
     if (VERSION_BUILD != 0) {
         sprintf(lumaVerStr, "Luma3DS v%d.%d.%d", (int)VERSION_MAJOR, (int)VERSION_MINOR, (int)VERSION_BUILD);
@@ -639,59 +584,56 @@ static size_t saveLumaIniConfigToStr(char *out)
         sprintf(lumaRevSuffixStr, "-%08lx", (u32)COMMIT_HASH);
     }
 
-    menuComboToString(rosalinaMenuComboStr, cfg->rosalinaMenuCombo);
-
-    static const int pinOptionToDigits[] = { 0, 4, 6, 8 };
-    int pinNumDigits = pinOptionToDigits[MULTICONFIG(PIN)];
-
-    char topScreenFilterGammaStr[32];
-    char topScreenFilterContrastStr[32];
-    char topScreenFilterBrightnessStr[32];
-    encodedFloatToString(topScreenFilterGammaStr, cfg->topScreenFilter.gammaEnc);
-    encodedFloatToString(topScreenFilterContrastStr, cfg->topScreenFilter.contrastEnc);
-    encodedFloatToString(topScreenFilterBrightnessStr, cfg->topScreenFilter.brightnessEnc);
-
-    char bottomScreenFilterGammaStr[32];
-    char bottomScreenFilterContrastStr[32];
-    char bottomScreenFilterBrightnessStr[32];
-    encodedFloatToString(bottomScreenFilterGammaStr, cfg->bottomScreenFilter.gammaEnc);
-    encodedFloatToString(bottomScreenFilterContrastStr, cfg->bottomScreenFilter.contrastEnc);
-    encodedFloatToString(bottomScreenFilterBrightnessStr, cfg->bottomScreenFilter.brightnessEnc);
-
-    int n = sprintf(
-        out, (const char *)config_template_ini,
-        lumaVerStr, lumaRevSuffixStr,
-
-        (int)CONFIG_VERSIONMAJOR, (int)CONFIG_VERSIONMINOR,
-        (int)CONFIG(AUTOBOOTEMU), (int)CONFIG(LOADEXTFIRMSANDMODULES),
-        (int)CONFIG(PATCHGAMES), (int)CONFIG(REDIRECTAPPTHREADS),
-        (int)CONFIG(PATCHVERSTRING), (int)CONFIG(SHOWGBABOOT),
-
-        1 + (int)MULTICONFIG(DEFAULTEMU), 4 - (int)MULTICONFIG(BRIGHTNESS),
-        splashPosStr, (unsigned int)cfg->splashDurationMsec,
-        pinNumDigits, n3dsCpuStr,
-        autobootModeStr,
-
-        cfg->hbldr3dsxTitleId, rosalinaMenuComboStr, (int)(cfg->pluginLoaderFlags & 1),
-        (int)cfg->ntpTzOffetMinutes,
-
-        (int)cfg->topScreenFilter.cct, (int)cfg->bottomScreenFilter.cct,
-        (int)cfg->topScreenFilter.colorCurveCorrection, (int)cfg->bottomScreenFilter.colorCurveCorrection,
-        topScreenFilterGammaStr, bottomScreenFilterGammaStr,
-        topScreenFilterContrastStr, bottomScreenFilterContrastStr,
-        topScreenFilterBrightnessStr, bottomScreenFilterBrightnessStr,
-        (int)cfg->topScreenFilter.invert, (int)cfg->bottomScreenFilter.invert,
+    // Copy the template line by line, replacing the value of each "key = ..." line
+    char section[32] = "";
+    char line[256];
+    char *pos = out;
+    const char *tpl = (const char *)config_template_ini;
+
+    while (*tpl != '\0') {
+        const char *eol = strchrnul(tpl, '\n');
+        size_t len = eol - tpl;
+        len = len < sizeof(line) - 1 ? len : sizeof(line) - 1;
+        memcpy(line, tpl, len);
+        line[len] = '\0';
+
+        char *eq = strchr(line, '=');
+        if (line[0] == '[') {
+            char *end = strchrnul(line + 1, ']');
+            size_t n = end - (line + 1);
+            n = n < sizeof(section) - 1 ? n : sizeof(section) - 1;
+            memcpy(section, line + 1, n);
+            section[n] = '\0';
+            pos += sprintf(pos, "%s", line);
+        } else if (line[0] != ';' && eq != NULL) {
+            char *nameEnd = eq;
+            while (nameEnd > line && nameEnd[-1] == ' ') {
+                nameEnd--;
+            }
+            *nameEnd = '\0';
 
-        cfg->autobootTwlTitleId, (int)cfg->autobootCtrAppmemtype,
+            const IniOption *opt = findIniOption(section, line);
+            if (opt == NULL) {
+                // Template and option table are out of sync
+                return 0;
+            }
 
-        forceAudioOutputStr,
-        cfg->volumeSliderOverride,
+            pos += sprintf(pos, "%s = ", line);
+            pos += formatIniOption(pos, cfg, opt);
+        } else {
+            // Comments only contain the version placeholders and escaped '%'
+            pos += sprintf(pos, line, lumaVerStr, lumaRevSuffixStr);
+        }
 
-        (int)CONFIG(PATCHUNITINFO), (int)CONFIG(ENABLEDSIEXTFILTER),
-        (int)CONFIG(DISABLEARM11EXCHANDLERS), (int)CONFIG(ENABLESAFEFIRMROSALINA)
-    );
+        if (*eol == '\n') {
+            *pos++ = '\n';
+            eol++;
+        }
+        tpl = eol;
+    }
 
-    return n < 0 ? 0 : (size_t)n;
+    *pos = '\0';
+    return pos - out;
 }
 
 static char tmpIniBuffer[0x2000];
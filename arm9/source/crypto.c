@@ -45,7 +45,20 @@
 
 /* original version by megazig */
 
-#ifndef __thumb__
+#ifndef __arm__
+//Plain C, for the host-side checks (tests/arm9_ctrnand.c)
+#define BSWAP32(x) {x = __builtin_bswap32(x);}
+
+#define ADD_u128_u32(u128_0, u128_1, u128_2, u128_3, u32_0) {\
+    u64 sum = (u64)(u128_0) + (u32_0);\
+    u128_0 = (u32)sum;\
+    sum = (u64)(u128_1) + (u32)(sum >> 32);\
+    u128_1 = (u32)sum;\
+    sum = (u64)(u128_2) + (u32)(sum >> 32);\
+    u128_2 = (u32)sum;\
+    u128_3 += (u32)(sum >> 32);\
+}
+#elif !defined(__thumb__)
 #define BSWAP32(x) {\
     __asm__\
     (\
@@ -87,7 +100,7 @@ __asm__\
         : "cc", "r4"\
     );\
 }
-#endif /*__thumb__*/
+#endif /*__arm__, __thumb__*/
 
 static void aes_setkey(u8 keyslot, const void *key, u32 keyType, u32 mode)
 {
@@ -284,11 +297,14 @@ static void sha_wait_idle()
     while(*REG_SHA_CNT & 1);
 }
 
-void sha(void *res, const void *src, u32 size, u32 mode)
+void sha_start(u32 mode)
 {
     sha_wait_idle();
     *REG_SHA_CNT = mode | SHA_CNT_OUTPUT_ENDIAN | SHA_NORMAL_ROUND;
+}
 
+void sha_update(const void *src, u32 size)
+{
     const u8 *src8 = (const u8 *)src;
     while(size >= 0x40)
     {
@@ -301,7 +317,10 @@ void sha(void *res, const void *src, u32 size, u32 mode)
 
     sha_wait_idle();
     alignedseqmemcpy((void *)REG_SHA_INFIFO, src8, size);
+}
 
+void sha_finish(void *res, u32 mode)
+{
     *REG_SHA_CNT = (*REG_SHA_CNT & ~SHA_NORMAL_ROUND) | SHA_FINAL_ROUND;
 
     while(*REG_SHA_CNT & SHA_FINAL_ROUND);
@@ -316,6 +335,13 @@ void sha(void *res, const void *src, u32 size, u32 mode)
     alignedseqmemcpy(res, (void *)REG_SHA_HASH, hashSize);
 }
 
+void sha(void *res, const void *src, u32 size, u32 mode)
+{
+    sha_start(mode);
+    sha_update(src, size);
+    sha_finish(res, mode);
+}
+
 /*****************************************************************/
 
 __attribute__((aligned(4))) static u8 nandCtr[AES_BLOCK_SIZE];
@@ -333,6 +359,28 @@ __attribute__((aligned(4))) static const u8 key1s[2][AES_BLOCK_SIZE] = {
     {0xFF, 0x77, 0xA0, 0x9A, 0x99, 0x81, 0xE9, 0x48, 0xEC, 0x51, 0xC9, 0x32, 0x5D, 0x14, 0xEC, 0x25}
 };
 
+static int ctrNandReadSectors(u32 sector, u32 sectorCount, u8 *out)
+{
+    return ctrNandLocation == FIRMWARE_SYSNAND ? sdmmc_nand_readsectors(sector, sectorCount, out) :
+                                                 sdmmc_sdcard_readsectors(sector + emuOffset, sectorCount, out);
+}
+
+static void ctrNandCrypt(u8 *data, u32 size, u8 *ctr)
+{
+    aes_use_keyslot(nandSlot);
+    aes(data, data, size / AES_BLOCK_SIZE, ctr, AES_CTR_MODE, AES_INPUT_BE | AES_INPUT_NORMAL);
+}
+
+static const CtrNandBackend ctrNandHardwareBackend = {
+    .readSectors = ctrNandReadSectors,
+    .writeSectors = sdmmc_nand_writesectors,
+    .crypt = ctrNandCrypt,
+    .writeBuffer = (u8 *)0xFFF00000,
+    .writeBufferSize = 0x4000,
+};
+
+const CtrNandBackend *ctrNandBackend = &ctrNandHardwareBackend;
+
 int ctrNandInit(void)
 {
     __attribute__((aligned(4))) u8 cid[AES_BLOCK_SIZE],
@@ -374,31 +422,22 @@ int ctrNandRead(u32 sector, u32 sectorCount, u8 *outbuf)
     aes_advctr(tmpCtr, ((sector + fatStart) * 0x200) / AES_BLOCK_SIZE, AES_INPUT_BE | AES_INPUT_NORMAL);
 
     //Read
-    int result;
-    if(ctrNandLocation == FIRMWARE_SYSNAND)
-        result = sdmmc_nand_readsectors(sector + fatStart, sectorCount, outbuf);
-    else
-    {
-        sector += emuOffset;
-        result = sdmmc_sdcard_readsectors(sector + fatStart, sectorCount, outbuf);
-    }
+    int result = ctrNandBackend->readSectors(sector + fatStart, sectorCount, outbuf);
 
-    //Decrypt
-    aes_use_keyslot(nandSlot);
-    aes(outbuf, outbuf, sectorCount * 0x200 / AES_BLOCK_SIZE, tmpCtr, AES_CTR_MODE, AES_INPUT_BE | AES_INPUT_NORMAL);
+    //Decrypt, once the transfer is over: the controller FIFO is only polled while a command is in flight
+    if(!result) ctrNandBackend->crypt(outbuf, sectorCount * 0x200, tmpCtr);
 
     return result;
 }
 
 int ctrNandWrite(u32 sector, u32 sectorCount, const u8 *inbuf)
 {
-    u8 *buffer = (u8 *)0xFFF00000;
-    u32 bufferSize = 0x4000;
+    u8 *buffer = ctrNandBackend->writeBuffer;
+    u32 bufferSize = ctrNandBackend->writeBufferSize;
 
     __attribute__((aligned(4))) u8 tmpCtr[sizeof(nandCtr)];
     memcpy(tmpCtr, nandCtr, sizeof(nandCtr));
     aes_advctr(tmpCtr, ((sector + fatStart) * 0x200) / AES_BLOCK_SIZE, AES_INPUT_BE | AES_INPUT_NORMAL);
-    aes_use_keyslot(nandSlot);
 
     int result = 0;
     for(u32 tempSector = 0; tempSector < sectorCount && !result; tempSector += bufferSize / 0x200)
@@ -408,10 +447,10 @@ int ctrNandWrite(u32 sector, u32 sectorCount, const u8 *inbuf)
         memcpy(buffer, inbuf + (tempSector * 0x200), tempCount * 0x200);
 
         //Encrypt
-        aes(buffer, buffer, tempCount * 0x200 / AES_BLOCK_SIZE, tmpCtr, AES_CTR_MODE, AES_INPUT_BE | AES_INPUT_NORMAL);
+        ctrNandBackend->crypt(buffer, tempCount * 0x200, tmpCtr);
 
         //Write
-        result = sdmmc_nand_writesectors(tempSector + sector + fatStart, tempCount, buffer);
+        result = ctrNandBackend->writeSectors(tempSector + sector + fatStart, tempCount, buffer);
     }
 
     return result;
@@ -558,7 +597,7 @@ void setupKeyslots(void)
     }
 }
 
-void kernel9Loader(Arm9Bin *arm9Section)
+u8 kernel9LoaderSetupKeyslots(const Arm9Bin *arm9Section)
 {
     //Determine the kernel9loader version
     u32 k9lVersion;
@@ -574,16 +613,10 @@ void kernel9Loader(Arm9Bin *arm9Section)
             k9lVersion = 2;
     }
 
-    u32 *startOfArm9Bin = (u32 *)((u8 *)arm9Section + 0x800);
-    if(*startOfArm9Bin == 0x47704770 || *startOfArm9Bin == 0xB0862000) return; //Already decrypted
-
     aes_setkey(0x11, k9lVersion == 2 ? key2s[ISDEVUNIT ? 1 : 0] : key1s[ISDEVUNIT ? 1 : 0], AES_KEYNORMAL, AES_INPUT_BE | AES_INPUT_NORMAL);
 
     u8 arm9BinSlot = k9lVersion == 0 ? 0x15 : 0x16;
 
-    // Get size
-    u32 arm9SectionSize = decAtoi(arm9Section->size, 8);
-
     //Set keyX
     __attribute__((aligned(4))) u8 keyX[AES_BLOCK_SIZE];
     aes_use_keyslot(0x11);
@@ -595,6 +628,19 @@ void kernel9Loader(Arm9Bin *arm9Section)
     memcpy(keyY, arm9Section->keyY, sizeof(keyY));
     aes_setkey(arm9BinSlot, keyY, AES_KEYY, AES_INPUT_BE | AES_INPUT_NORMAL);
 
+    return arm9BinSlot;
+}
+
+bool kernel9Loader(Arm9Bin *arm9Section)
+{
+    u32 *startOfArm9Bin = (u32 *)((u8 *)arm9Section + 0x800);
+    if(*startOfArm9Bin == 0x47704770 || *startOfArm9Bin == 0xB0862000) return false; //Already decrypted
+
+    u8 arm9BinSlot = kernel9LoaderSetupKeyslots(arm9Section);
+
+    // Get size
+    u32 arm9SectionSize = decAtoi(arm9Section->size, 8);
+
     //Set CTR
     __attribute__((aligned(4))) u8 arm9BinCtr[AES_BLOCK_SIZE];
     memcpy(arm9BinCtr, arm9Section->ctr, sizeof(arm9BinCtr));
@@ -604,6 +650,8 @@ void kernel9Loader(Arm9Bin *arm9Section)
     aes(startOfArm9Bin, startOfArm9Bin, arm9SectionSize / AES_BLOCK_SIZE, arm9BinCtr, AES_CTR_MODE, AES_INPUT_BE | AES_INPUT_NORMAL);
 
     if(*startOfArm9Bin != 0x47704770 && *startOfArm9Bin != 0xB0862000) error("Echec du decryptage du binaire Arm9.");
+
+    return true;
 }
 
 void computePinHash(u8 *outbuf, const u8 *inbuf)
@@ -110,8 +110,26 @@
 #define SHA_224_HASH_SIZE   (224 / 8)
 #define SHA_1_HASH_SIZE     (160 / 8)
 
+//CTRNAND data path: raw sector I/O on one side, AES-CTR with the NAND key on the other.
+//Swappable so that ctrNandRead/ctrNandWrite can run off the console (see tests/arm9_ctrnand.c)
+typedef struct CtrNandBackend
+{
+    int (*readSectors)(u32 sector, u32 sectorCount, u8 *out);
+    int (*writeSectors)(u32 sector, u32 sectorCount, const u8 *in);
+    //In place, size is a multiple of AES_BLOCK_SIZE and ctr (big endian) is advanced past the data
+    void (*crypt)(u8 *data, u32 size, u8 *ctr);
+    //Writes are encrypted there, chunk by chunk, the caller's buffer is left alone
+    u8 *writeBuffer;
+    u32 writeBufferSize;
+} CtrNandBackend;
+
 extern FirmwareSource ctrNandLocation;
+extern const CtrNandBackend *ctrNandBackend;
 
+//Streamed hashing: every sha_update but the last one must be given a multiple of 0x40 bytes
+void sha_start(u32 mode);
+void sha_update(const void *src, u32 size);
+void sha_finish(void *res, u32 mode);
 void sha(void *res, const void *src, u32 size, u32 mode);
 
 int ctrNandInit(void);
@@ -120,5 +138,6 @@ int ctrNandWrite(u32 sector, u32 sectorCount, const u8 *inbuf);
 u32 decryptExeFs(Cxi *cxi);
 u32 decryptNusFirm(const Ticket *ticket, Cxi *cxi, u32 ncchSize);
 void setupKeyslots(void);
-void kernel9Loader(Arm9Bin *arm9Section);
+u8 kernel9LoaderSetupKeyslots(const Arm9Bin *arm9Section);
+bool kernel9Loader(Arm9Bin *arm9Section);
 void computePinHash(u8 *outbuf, const u8 *inbuf);
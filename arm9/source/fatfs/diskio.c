@@ -11,12 +11,127 @@
 #include "diskio.h"		/* Declarations of disk functions */
 #include "sdmmc/sdmmc.h"
 #include "../crypto.h"
+#include "../emunand.h"
 #include "../i2c.h"
+#include "../memory.h"
 
 /* Definitions of physical drive number for each drive */
 #define SDCARD        0
 #define CTRNAND       1
 
+/* Sector cache: set-associative, made of lines of several contiguous sectors */
+#define CACHE_LINE_SECTORS      4
+#define CACHE_SETS              8
+#define CACHE_WAYS              4
+#define CACHE_READAHEAD_LINES   2
+
+#define CACHE_CLASS_META        0   /* FAT, directory and other isolated sectors */
+#define CACHE_CLASS_DATA        1   /* Sectors read sequentially, i.e. file data */
+
+#define MAX_SECTORS_PER_READ    0x8000
+
+typedef struct CacheLine {
+    u32 volume;
+    LBA_t lineSector;
+    u32 lastUse;
+    u8 drive;
+    u8 valid;
+    u8 class;
+} CacheLine;
+
+static CacheLine cacheLines[CACHE_SETS][CACHE_WAYS];
+static u8 __attribute__((aligned(4))) cacheData[CACHE_SETS][CACHE_WAYS][CACHE_LINE_SECTORS * FF_MAX_SS];
+static u32 cacheClock = 0;
+static LBA_t lastSectorRead[FF_VOLUMES] = { (LBA_t)-2, (LBA_t)-2 };
+static DISKCACHESTATS cacheStats;
+
+/* CTRNAND can be backed by SysNAND or by any EmuNAND */
+static u32 getCacheVolume(BYTE pdrv)
+{
+    if(pdrv != CTRNAND) return 0;
+
+    return ctrNandLocation == FIRMWARE_SYSNAND ? 0xFFFFFFFF : emuOffset + emuHeader;
+}
+
+static u32 getCacheSet(BYTE pdrv, LBA_t lineSector)
+{
+    return ((lineSector / CACHE_LINE_SECTORS) ^ pdrv) % CACHE_SETS;
+}
+
+static int findCacheLine(BYTE pdrv, u32 volume, LBA_t lineSector)
+{
+    CacheLine *lines = cacheLines[getCacheSet(pdrv, lineSector)];
+
+    for(int way = 0; way < CACHE_WAYS; way++)
+        if(lines[way].valid && lines[way].drive == pdrv && lines[way].volume == volume && lines[way].lineSector == lineSector)
+            return way;
+
+    return -1;
+}
+
+/* Data lines never evict metadata lines, metadata lines evict data lines first */
+static int pickCacheVictim(u32 set, u8 class)
+{
+    CacheLine *lines = cacheLines[set];
+    int victim = -1;
+
+    for(int way = 0; way < CACHE_WAYS; way++)
+    {
+        if(!lines[way].valid) return way;
+        if(lines[way].class == CACHE_CLASS_DATA && (victim == -1 || lines[way].lastUse < lines[victim].lastUse)) victim = way;
+    }
+
+    if(victim != -1 || class == CACHE_CLASS_DATA) return victim;
+
+    victim = 0;
+    for(int way = 1; way < CACHE_WAYS; way++)
+        if(lines[way].lastUse < lines[victim].lastUse) victim = way;
+
+    return victim;
+}
+
+static void invalidateCacheLines(BYTE pdrv, LBA_t sector, UINT count)
+{
+    for(u32 set = 0; set < CACHE_SETS; set++)
+        for(u32 way = 0; way < CACHE_WAYS; way++)
+        {
+            CacheLine *line = &cacheLines[set][way];
+            if(line->valid && line->drive == pdrv && line->lineSector < sector + count && sector < line->lineSector + CACHE_LINE_SECTORS)
+                line->valid = 0;
+        }
+}
+
+static DRESULT readSectors(BYTE pdrv, BYTE *buff, LBA_t sector, UINT count)
+{
+    // The block count registers are 16-bit, and FatFs can read a whole fragment of a file at once
+    while (count > MAX_SECTORS_PER_READ)
+    {
+        DRESULT res = readSectors(pdrv, buff, sector, MAX_SECTORS_PER_READ);
+        if (res != RES_OK) return res;
+
+        buff += MAX_SECTORS_PER_READ * FF_MAX_SS;
+        sector += MAX_SECTORS_PER_READ;
+        count -= MAX_SECTORS_PER_READ;
+    }
+
+    switch (pdrv)
+    {
+        case SDCARD:
+            return sdmmc_sdcard_readsectors(sector, count, buff) == 0 ? RES_OK : RES_PARERR;
+        case CTRNAND:
+            return ctrNandRead(sector, count, buff) == 0 ? RES_OK : RES_PARERR;
+        default:
+            return RES_NOTRDY;
+    }
+}
+
+void disk_get_cache_stats (
+    DISKCACHESTATS *stats	/* Pointer to the structure to receive the counters */
+)
+{
+    memcpy(stats, &cacheStats, sizeof(DISKCACHESTATS));
+}
+
 /*-----------------------------------------------------------------------*/
 /* Get Drive Status                                                      */
 /*-----------------------------------------------------------------------*/
@@ -60,6 +175,13 @@ DSTATUS disk_initialize (
             break;
     }
 
+    // The underlying medium might have changed
+    if (pdrv < FF_VOLUMES)
+    {
+        invalidateCacheLines(pdrv, 0, (LBA_t)-1);
+        lastSectorRead[pdrv] = (LBA_t)-2;
+    }
+
     return res;
 }
 
@@ -76,22 +198,69 @@ DRESULT disk_read (
     UINT count		/* Number of sectors to read */
 )
 {
-    DRESULT res = RES_OK;
+    if (pdrv >= FF_VOLUMES) return RES_NOTRDY;
 
-    switch (pdrv)
+    // Multi-sector reads are file data going straight to the caller's buffer
+    if (count != 1)
     {
-        case SDCARD:
-            res = sdmmc_sdcard_readsectors(sector, count, buff) == 0 ? RES_OK : RES_PARERR;
-            break;
-        case CTRNAND:
-            res = ctrNandRead(sector, count, buff) == 0 ? RES_OK : RES_PARERR;
-            break;
-        default:
-            res = RES_NOTRDY;
-            break;
+        cacheStats.bypasses++;
+        lastSectorRead[pdrv] = sector + count - 1;
+        return readSectors(pdrv, buff, sector, count);
     }
 
-    return res;
+    u8 class = sector == lastSectorRead[pdrv] + 1 ? CACHE_CLASS_DATA : CACHE_CLASS_META;
+    u32 volume = getCacheVolume(pdrv);
+    LBA_t lineSector = sector - sector % CACHE_LINE_SECTORS;
+    int way = findCacheLine(pdrv, volume, lineSector);
+
+    lastSectorRead[pdrv] = sector;
+
+    if (way != -1)
+    {
+        u32 set = getCacheSet(pdrv, lineSector);
+        cacheLines[set][way].lastUse = ++cacheClock;
+        memcpy(buff, cacheData[set][way] + (sector - lineSector) * FF_MAX_SS, FF_MAX_SS);
+        cacheStats.hits[class]++;
+        return RES_OK;
+    }
+
+    cacheStats.misses[class]++;
+
+    // Fetch the whole line, and the following ones too when reading sequentially
+    bool isCached = false;
+    u32 nbLines = class == CACHE_CLASS_DATA ? CACHE_READAHEAD_LINES : 1;
+    for (u32 i = 0; i < nbLines; i++)
+    {
+        LBA_t curLineSector = lineSector + i * CACHE_LINE_SECTORS;
+
+        if (i != 0 && findCacheLine(pdrv, volume, curLineSector) != -1) continue;
+
+        u32 set = getCacheSet(pdrv, curLineSector);
+        int victim = pickCacheVictim(set, class);
+        if (victim == -1) break;
+
+        CacheLine *line = &cacheLines[set][victim];
+        line->valid = 0;
+
+        // This can fail for the last line of the medium, just read the sector alone then
+        if (readSectors(pdrv, cacheData[set][victim], curLineSector, CACHE_LINE_SECTORS) != RES_OK) break;
+
+        line->volume = volume;
+        line->lineSector = curLineSector;
+        line->lastUse = ++cacheClock;
+        line->drive = pdrv;
+        line->class = class;
+        line->valid = 1;
+
+        if (i == 0)
+        {
+            memcpy(buff, cacheData[set][victim] + (sector - lineSector) * FF_MAX_SS, FF_MAX_SS);
+            isCached = true;
+        }
+        else cacheStats.readaheadLines++;
+    }
+
+    return isCached ? RES_OK : readSectors(pdrv, buff, sector, 1);
 }
 
 
@@ -111,6 +280,8 @@ DRESULT disk_write (
 {
     DRESULT res = RES_OK;
 
+    if (pdrv < FF_VOLUMES) invalidateCacheLines(pdrv, sector, count);
+
     switch (pdrv)
     {
         case SDCARD:
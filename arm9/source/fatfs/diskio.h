@@ -21,6 +21,14 @@ typedef enum {
 	RES_PARERR		/* 4: Invalid Parameter */
 } DRESULT;
 
+/* Sector cache counters, indexed by class (0: FAT/directory, 1: data) */
+typedef struct {
+	DWORD hits[2];			/* Single-sector reads served from the cache */
+	DWORD misses[2];		/* Single-sector reads that had to fetch a line */
+	DWORD readaheadLines;	/* Lines prefetched ahead of a sequential read */
+	DWORD bypasses;			/* Multi-sector reads sent straight to the driver */
+} DISKCACHESTATS;
+
 
 /*---------------------------------------*/
 /* Prototypes for disk control functions */
@@ -31,6 +39,7 @@ DSTATUS disk_status (BYTE pdrv);
 DRESULT disk_read (BYTE pdrv, BYTE* buff, LBA_t sector, UINT count);
 DRESULT disk_write (BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count);
 DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
+void disk_get_cache_stats (DISKCACHESTATS* stats);
 
 
 /* Disk Status Bits (DSTATUS) */
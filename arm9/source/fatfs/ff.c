@@ -1645,6 +1645,28 @@ static DWORD clmt_clust (	/* <2:Error, >=2:Cluster number */
 	return cl + *tbl;	/* Return the cluster number */
 }
 
+
+static DWORD clmt_span (	/* Number of contiguous clusters from the one containing ofs to the end of its fragment */
+	FIL* fp,		/* Pointer to the file object */
+	FSIZE_t ofs		/* File offset */
+)
+{
+	DWORD cl, ncl;
+	DWORD *tbl;
+	FATFS *fs = fp->obj.fs;
+
+
+	tbl = fp->cltbl + 1;	/* Top of CLMT */
+	cl = (DWORD)(ofs / SS(fs) / fs->csize);	/* Cluster order from top of the file */
+	for (;;) {
+		ncl = *tbl++;			/* Number of cluters in the fragment */
+		if (ncl == 0) return 1;	/* End of table? (error, don't go past the current cluster) */
+		if (cl < ncl) break;	/* In this fragment? */
+		cl -= ncl; tbl++;		/* Next fragment */
+	}
+	return ncl - cl;
+}
+
 #endif	/* FF_USE_FASTSEEK */
 
 
@@ -3960,9 +3982,22 @@ FRESULT f_read (
 			cc = btr / SS(fs);					/* When remaining bytes >= sector size, */
 			if (cc > 0) {						/* Read maximum contiguous sectors directly */
 				if (csect + cc > fs->csize) {	/* Clip at cluster boundary */
-					cc = fs->csize - csect;
+#if FF_USE_FASTSEEK
+					if (fp->cltbl) {			/* Clip at fragment boundary instead, the following clusters are contiguous */
+						DWORD ncl = clmt_span(fp, fp->fptr);
+						if (csect + cc > fs->csize * ncl) cc = fs->csize * ncl - csect;
+					} else
+#endif
+					{
+						cc = fs->csize - csect;
+					}
 				}
 				if (disk_read(fs->pdrv, rbuff, sect, cc) != RES_OK) ABORT(fs, FR_DISK_ERR);
+#if FF_USE_FASTSEEK
+				if (fp->cltbl && csect + cc > fs->csize) {	/* Update current cluster to the one of the last sector read */
+					fp->clust = clmt_clust(fp, fp->fptr + (FSIZE_t)SS(fs) * cc - 1);
+				}
+#endif
 #if !FF_FS_READONLY && FF_FS_MINIMIZE <= 2		/* Replace one of the read sectors with cached data if it contains a dirty sector */
 #if FF_FS_TINY
 				if (fs->wflag && fs->winsect - sect < cc) {
@@ -37,10 +37,61 @@
 #include "screen.h"
 #include "fmt.h"
 #include "chainloader.h"
+#include "profiler.h"
+#include "lzss.h"
+#include "firmcheck.h"
+
+#define FIRM_CACHE_FORMAT_VERSION   2
+#define FIRM_CACHE_DATA_OFFSET      0x200
+
+typedef struct FirmCacheKey
+{
+    u32 commitHash;
+    u32 version;
+    u32 flags;
+    u32 firmType,
+        nandType,
+        emuOffset,
+        emuHeader;
+    u32 firmContentId;
+    CfgData config;
+    u16 launchedPath[80+1];
+    //The NCCH header covers the whole content: it holds the ExeFS header hash, which holds the FIRM hash
+    u8 firmNcchHeaderHash[SHA_256_HASH_SIZE],
+       extFirmHash[SHA_256_HASH_SIZE],
+       extCetkHash[SHA_256_HASH_SIZE],
+       extModulesHash[SHA_256_HASH_SIZE],
+       kextHash[SHA_256_HASH_SIZE],
+       sysmodulesHash[SHA_256_HASH_SIZE];
+} FirmCacheKey;
+
+typedef struct FirmCacheHeader
+{
+    char magic[4];
+    u32 formatVersion;
+    u8 key[SHA_256_HASH_SIZE];
+    u8 firmHash[SHA_256_HASH_SIZE],
+       section0Hash[SHA_256_HASH_SIZE],
+       kextHash[SHA_256_HASH_SIZE];
+    u32 firmSize,
+        section0Size,
+        kextSize;
+    bool restoreArm9BinKeyslots;
+    u64 coldBootMsec,
+        warmBootMsec;
+} FirmCacheHeader;
 
 static Firm *firm = (Firm *)0x20001000;
 u32 firmProtoVersion = 0;
 
+static __attribute__((aligned(4))) u8 firmCacheKey[SHA_256_HASH_SIZE];
+static char firmCachePath[32];
+static FirmCacheHeader firmCacheHeader;
+static bool isFirmCacheable = false,
+            isFirmCacheHit = false,
+            hasDecryptedArm9Bin = false;
+static u32 mergedSection0Size = 0;
+
 static __attribute__((noinline)) bool overlaps(u32 as, u32 ae, u32 bs, u32 be)
 {
     if(as <= bs && bs <= ae)
@@ -57,7 +108,8 @@ static __attribute__((noinline)) bool inRange(u32 as, u32 ae, u32 bs, u32 be)
    return false;
 }
 
-static bool checkFirm(u32 firmSize)
+//fileStamp identifies the file the FIRM was read from (0: always hash it), hasher is what was hashed while reading it, if anything
+static bool checkFirm(u32 firmSize, u32 fileStamp, FirmHasher *hasher)
 {
     if(memcmp(firm->magic, "FIRM", 4) != 0 || firm->arm9Entry == NULL) //Allow for the Arm11 entrypoint to be zero in which case nothing is done on the Arm11 side
         return false;
@@ -89,13 +141,6 @@ static bool checkFirm(u32 firmSize)
             (!inRange((u32)section->address, (u32)section->address + section->size, 0x20000000, 0x20000000 + 0x8000000))))
             return false;
 
-        __attribute__((aligned(4))) u8 hash[0x20];
-
-        sha(hash, (u8 *)firm + section->offset, section->size, SHA_256_MODE);
-
-        if(memcmp(hash, section->hash, 0x20) != 0)
-            return false;
-
         if(firm->arm9Entry >= section->address && firm->arm9Entry < (section->address + section->size))
             arm9EpFound = true;
 
@@ -103,7 +148,17 @@ static bool checkFirm(u32 firmSize)
             arm11EpFound = true;
     }
 
-    return arm9EpFound && (firm->arm11Entry == NULL || arm11EpFound);
+    if(!arm9EpFound || (firm->arm11Entry != NULL && !arm11EpFound))
+        return false;
+
+    FirmHasher localHasher;
+    if(hasher == NULL || !hasher->isStarted || hasher->firmSize != firmSize)
+    {
+        hasher = &localHasher;
+        firmHasherStart(hasher, firm, firmSize, fileStamp);
+    }
+
+    return firmHasherFinish(hasher);
 }
 
 static inline u32 loadFirmFromStorage(FirmwareType firmType)
@@ -123,7 +178,8 @@ static inline u32 loadFirmFromStorage(FirmwareType firmType)
         "cetk_sysupdater"
     };
 
-    u32 firmSize = fileRead(firm, firmwareFiles[(u32)firmType], 0x400000 + sizeof(Cxi) + 0x200);
+    FirmHasher hasher = { .fileStamp = getFileStamp(firmwareFiles[(u32)firmType]) };
+    u32 firmSize = fileReadStreamed(firm, firmwareFiles[(u32)firmType], 0x400000 + sizeof(Cxi) + 0x200, firmHasherOnRead, &hasher);
 
     if(!firmSize) return 0;
 
@@ -145,7 +201,7 @@ static inline u32 loadFirmFromStorage(FirmwareType firmType)
         if(!firmSize) error("Impossible de decrypter le FIRM externe.");
     }
 
-    if(!checkFirm(firmSize)) error("Le FIRM externe est invalide ou corrompu.");
+    if(!checkFirm(firmSize, hasher.fileStamp, &hasher)) error("Le FIRM externe est invalide ou corrompu.");
 
     return firmSize;
 }
@@ -174,14 +230,15 @@ u32 loadNintendoFirm(FirmwareType *firmType, FirmwareSource nandType, bool loadF
     if(!ctrNandError)
     {
         //Load FIRM from CTRNAND
-        firmVersion = firmRead(firm, (u32)*firmType);
+        u32 firmStamp;
+        firmVersion = firmRead(firm, (u32)*firmType, &firmStamp);
 
         if(firmVersion == 0xFFFFFFFF) ctrNandError = true;
         else
         {
             firmSize = decryptExeFs((Cxi *)firm);
 
-            if(!firmSize || !checkFirm(firmSize)) ctrNandError = true;
+            if(!firmSize || !checkFirm(firmSize, firmStamp, NULL)) ctrNandError = true;
         }
     }
     // If CTRNAND load failed, and it wasn't tried yet, load FIRM from sdmc.
@@ -281,10 +338,22 @@ void loadHomebrewFirm(u32 pressed)
 
     if(!found) return;
 
+    FirmHasher hasher = { .fileStamp = getFileStamp(path) };
     u32 maxPayloadSize = (u32)((u8 *)0x27FFE000 - (u8 *)firm),
-        payloadSize = fileRead(firm, path, maxPayloadSize);
+        payloadSize = fileReadStreamed(firm, path, maxPayloadSize, firmHasherOnRead, &hasher);
+
+    //The payload index was out of date, look again
+    if(!payloadSize && refreshPayloadIndex())
+    {
+        found = !pressed ? payloadMenu(path, &hasDisplayedMenu) : findPayload(path, pressed);
+
+        if(!found) return;
 
-    if(payloadSize <= 0x200 || !checkFirm(payloadSize)) error("Payload invalide ou corrompu.");
+        hasher = (FirmHasher){ .fileStamp = getFileStamp(path) };
+        payloadSize = fileReadStreamed(firm, path, maxPayloadSize, firmHasherOnRead, &hasher);
+    }
+
+    if(payloadSize <= 0x200 || !checkFirm(payloadSize, hasher.fileStamp, &hasher)) error("Payload invalide ou corrompu.");
 
     char absPath[24 + 255];
 
@@ -300,72 +369,6 @@ void loadHomebrewFirm(u32 pressed)
     launchFirm(wantsScreenInit ? 2 : 1, argv);
 }
 
-static int lzss_decompress(u8 *end)
-{
-    unsigned int v1; // r1@2
-    u8 *v2; // r2@2
-    u8 *v3; // r3@2
-    u8 *v4; // r1@2
-    char v5; // r5@4
-    char v6; // t1@4
-    signed int v7; // r6@4
-    int v9; // t1@7
-    u8 *v11; // r3@8
-    int v12; // r12@8
-    int v13; // t1@8
-    int v14; // t1@8
-    unsigned int v15; // r7@8
-    int v16; // r12@8
-    int ret;
-
-    ret = 0;
-    if ( end )
-    {
-        v1 = *((u32 *)end - 2);
-        v2 = &end[*((u32 *)end - 1)];
-        v3 = &end[-(v1 >> 24)];
-        v4 = &end[-(v1 & 0xFFFFFF)];
-        while ( v3 > v4 )
-        {
-            v6 = *(v3-- - 1);
-            v5 = v6;
-            v7 = 8;
-            while ( 1 )
-            {
-                if ( (v7-- < 1) )
-                    break;
-                if ( v5 & 0x80 )
-                {
-                    v13 = *(v3 - 1);
-                    v11 = v3 - 1;
-                    v12 = v13;
-                    v14 = *(v11 - 1);
-                    v3 = v11 - 1;
-                    v15 = ((v14 | (v12 << 8)) & 0xFFFF0FFF) + 2;
-                    v16 = v12 + 32;
-                    do
-                    {
-                        ret = v2[v15];
-                        *(v2-- - 1) = ret;
-                        v16 -= 16;
-                    }
-                    while ( !(v16 < 0) );
-                }
-                else
-                {
-                    v9 = *(v3-- - 1);
-                    ret = v9;
-                    *(v2-- - 1) = v9;
-                }
-                v5 *= 2;
-                if ( v3 <= v4 )
-                    return ret;
-            }
-        }
-    }
-    return ret;
-}
-
 typedef struct CopyKipResult {
     u32 cxiSize;
     u8 *codeDstAddr;
@@ -529,6 +532,7 @@ static void mergeSection0(FirmwareType firmType, u32 firmVersion, bool loadFromS
 
     //4) Patch kernel to take module size into account
     u32 newKipSectionSize = dst - firm->section[0].address;
+    mergedSection0Size = newKipSectionSize;
     u32 oldKipSectionSize = firm->section[0].size;
     u8 *kernel11Addr = (u8 *)firm + firm->section[1].offset;
     u32 kernel11Size = firm->section[1].size;
@@ -551,7 +555,7 @@ u32 patchNativeFirm(u32 firmVersion, FirmwareSource nandType, bool loadFromStora
     if(ISN3DS)
     {
         //Decrypt Arm9Bin and patch Arm9 entrypoint to skip kernel9loader
-        kernel9Loader((Arm9Bin *)arm9Section);
+        hasDecryptedArm9Bin = kernel9Loader((Arm9Bin *)arm9Section);
         firm->arm9Entry = (u8 *)0x801B01C;
     }
 
@@ -575,53 +579,53 @@ u32 patchNativeFirm(u32 firmVersion, FirmwareSource nandType, bool loadFromStora
             *arm11ExceptionsPage,
             *arm11SvcTable = getKernel11Info(arm11Section1, firm->section[1].size, &baseK11VA, &freeK11Space, &arm11SvcHandler, &arm11ExceptionsPage);
 
-        ret += installK11Extension(arm11Section1, firm->section[1].size, needToInitSd, baseK11VA, arm11ExceptionsPage, &freeK11Space);
-        ret += patchKernel11(arm11Section1, firm->section[1].size, baseK11VA, arm11SvcTable, arm11ExceptionsPage);
+        ret += PROFILE_PATCH(installK11Extension, arm11Section1, firm->section[1].size, needToInitSd, baseK11VA, arm11ExceptionsPage, &freeK11Space);
+        ret += PROFILE_PATCH(patchKernel11, arm11Section1, firm->section[1].size, baseK11VA, arm11SvcTable, arm11ExceptionsPage);
     }
 #else
     (void)needToInitSd;
 #endif
 
     //Apply signature patches
-    ret += patchSignatureChecks(process9Offset, process9Size);
+    ret += PROFILE_PATCH(patchSignatureChecks, process9Offset, process9Size);
 
     //Apply EmuNAND patches
-    if(nandType != FIRMWARE_SYSNAND) ret += patchEmuNand(process9Offset, process9Size, firmVersion);
+    if(nandType != FIRMWARE_SYSNAND) ret += PROFILE_PATCH(patchEmuNand, process9Offset, process9Size, firmVersion);
 
     //Apply FIRM0/1 writes patches on SysNAND to protect A9LH
-    else if(isFirmProtEnabled) ret += patchFirmWrites(process9Offset, process9Size);
+    else if(isFirmProtEnabled) ret += PROFILE_PATCH(patchFirmWrites, process9Offset, process9Size);
 
 #ifndef BUILD_FOR_EXPLOIT_DEV
     //Apply firmlaunch patches
-    ret += patchFirmlaunches(process9Offset, process9Size, process9MemAddr);
+    ret += PROFILE_PATCH(patchFirmlaunches, process9Offset, process9Size, process9MemAddr);
 #endif
 
     //Apply dev unit check patches related to NCCH encryption
     if(!ISDEVUNIT)
     {
-        ret += patchZeroKeyNcchEncryptionCheck(process9Offset, process9Size);
-        ret += patchNandNcchEncryptionCheck(process9Offset, process9Size);
+        ret += PROFILE_PATCH(patchZeroKeyNcchEncryptionCheck, process9Offset, process9Size);
+        ret += PROFILE_PATCH(patchNandNcchEncryptionCheck, process9Offset, process9Size);
     }
 
     //Apply anti-anti-DG patches on 11.0+
-    if(firmVersion >= (ISN3DS ? 0x21 : 0x52)) ret += patchTitleInstallMinVersionChecks(process9Offset, process9Size, firmVersion);
+    if(firmVersion >= (ISN3DS ? 0x21 : 0x52)) ret += PROFILE_PATCH(patchTitleInstallMinVersionChecks, process9Offset, process9Size, firmVersion);
 
     //Patch P9 AM ticket wrapper on 11.8+ to use 0 Key and IV, only with UNITINFO patch on to prevent NIM from actually sending any
-    if(doUnitinfoPatch && firmVersion >= (ISN3DS ? 0x35 : 0x64)) ret += patchP9AMTicketWrapperZeroKeyIV(process9Offset, process9Size, firmVersion);
+    if(doUnitinfoPatch && firmVersion >= (ISN3DS ? 0x35 : 0x64)) ret += PROFILE_PATCH(patchP9AMTicketWrapperZeroKeyIV, process9Offset, process9Size, firmVersion);
 
     //Apply UNITINFO patches
     if(doUnitinfoPatch)
     {
-        ret += patchUnitInfoValueSet(arm9Section, kernel9Size);
-        if(!ISDEVUNIT) ret += patchCheckForDevCommonKey(process9Offset, process9Size);
+        ret += PROFILE_PATCH(patchUnitInfoValueSet, arm9Section, kernel9Size);
+        if(!ISDEVUNIT) ret += PROFILE_PATCH(patchCheckForDevCommonKey, process9Offset, process9Size);
     }
 
     //Arm9 exception handlers
-    ret += patchArm9ExceptionHandlersInstall(arm9Section, kernel9Size);
-    ret += patchSvcBreak9(arm9Section, kernel9Size, (u32)firm->section[2].address);
-    ret += patchKernel9Panic(arm9Section, kernel9Size);
+    ret += PROFILE_PATCH(patchArm9ExceptionHandlersInstall, arm9Section, kernel9Size);
+    ret += PROFILE_PATCH(patchSvcBreak9, arm9Section, kernel9Size, (u32)firm->section[2].address);
+    ret += PROFILE_PATCH(patchKernel9Panic, arm9Section, kernel9Size);
 
-    ret += patchP9AccessChecks(process9Offset, process9Size);
+    ret += PROFILE_PATCH(patchP9AccessChecks, process9Offset, process9Size);
 
     mergeSection0(NATIVE_FIRM, firmVersion, loadFromStorage);
     firm->section[0].size = 0;
@@ -657,18 +661,18 @@ u32 patchTwlFirm(u32 firmVersion, bool loadFromStorage, bool doUnitinfoPatch)
     u32 kernel9Size = (u32)(process9Offset - arm9Section) - sizeof(Cxi) - 0x200,
         ret = 0;
 
-    ret += patchLgySignatureChecks(process9Offset, process9Size);
-    ret += patchTwlInvalidSignatureChecks(process9Offset, process9Size);
-    ret += patchTwlNintendoLogoChecks(process9Offset, process9Size);
-    ret += patchTwlWhitelistChecks(process9Offset, process9Size);
-    if(ISN3DS || firmVersion > 0x11) ret += patchTwlFlashcartChecks(process9Offset, process9Size, firmVersion);
-    else if(!ISN3DS && firmVersion == 0x11) ret += patchOldTwlFlashcartChecks(process9Offset, process9Size);
-    ret += patchTwlShaHashChecks(process9Offset, process9Size);
+    ret += PROFILE_PATCH(patchLgySignatureChecks, process9Offset, process9Size);
+    ret += PROFILE_PATCH(patchTwlInvalidSignatureChecks, process9Offset, process9Size);
+    ret += PROFILE_PATCH(patchTwlNintendoLogoChecks, process9Offset, process9Size);
+    ret += PROFILE_PATCH(patchTwlWhitelistChecks, process9Offset, process9Size);
+    if(ISN3DS || firmVersion > 0x11) ret += PROFILE_PATCH(patchTwlFlashcartChecks, process9Offset, process9Size, firmVersion);
+    else if(!ISN3DS && firmVersion == 0x11) ret += PROFILE_PATCH(patchOldTwlFlashcartChecks, process9Offset, process9Size);
+    ret += PROFILE_PATCH(patchTwlShaHashChecks, process9Offset, process9Size);
 
     //Apply UNITINFO patch
-    if(doUnitinfoPatch) ret += patchUnitInfoValueSet(arm9Section, kernel9Size);
+    if(doUnitinfoPatch) ret += PROFILE_PATCH(patchUnitInfoValueSet, arm9Section, kernel9Size);
 
-    ret += patchLgyK11(section1, section1Size, section2, section2Size);
+    ret += PROFILE_PATCH(patchLgyK11, section1, section1Size, section2, section2Size);
 
     // Also patch TwlBg here
     mergeSection0(TWL_FIRM, 0, loadFromStorage);
@@ -701,12 +705,12 @@ u32 patchAgbFirm(bool loadFromStorage, bool doUnitinfoPatch)
     u32 kernel9Size = (u32)(process9Offset - arm9Section) - sizeof(Cxi) - 0x200,
         ret = 0;
 
-    ret += patchLgySignatureChecks(process9Offset, process9Size);
-    if(CONFIG(SHOWGBABOOT)) ret += patchAgbBootSplash(process9Offset, process9Size);
-    ret += patchLgyK11(section1, section1Size, section2, section2Size);
+    ret += PROFILE_PATCH(patchLgySignatureChecks, process9Offset, process9Size);
+    if(CONFIG(SHOWGBABOOT)) ret += PROFILE_PATCH(patchAgbBootSplash, process9Offset, process9Size);
+    ret += PROFILE_PATCH(patchLgyK11, section1, section1Size, section2, section2Size);
 
     //Apply UNITINFO patch
-    if(doUnitinfoPatch) ret += patchUnitInfoValueSet(arm9Section, kernel9Size);
+    if(doUnitinfoPatch) ret += PROFILE_PATCH(patchUnitInfoValueSet, arm9Section, kernel9Size);
 
     if(loadFromStorage)
     {
@@ -736,13 +740,13 @@ u32 patch1x2xNativeAndSafeFirm(void)
     u32 kernel9Size = (u32)(process9Offset - arm9Section) - sizeof(Cxi) - 0x200,
         ret = 0;
 
-    ret += ISN3DS ? patchFirmWrites(process9Offset, process9Size) : patchOldFirmWrites(process9Offset, process9Size);
+    ret += ISN3DS ? PROFILE_PATCH(patchFirmWrites, process9Offset, process9Size) : PROFILE_PATCH(patchOldFirmWrites, process9Offset, process9Size);
 
-    ret += ISN3DS ? patchSignatureChecks(process9Offset, process9Size) : patchOldSignatureChecks(process9Offset, process9Size);
+    ret += ISN3DS ? PROFILE_PATCH(patchSignatureChecks, process9Offset, process9Size) : PROFILE_PATCH(patchOldSignatureChecks, process9Offset, process9Size);
 
     //Arm9 exception handlers
-    ret += patchArm9ExceptionHandlersInstall(arm9Section, kernel9Size);
-    ret += patchSvcBreak9(arm9Section, kernel9Size, (u32)firm->section[2].address);
+    ret += PROFILE_PATCH(patchArm9ExceptionHandlersInstall, arm9Section, kernel9Size);
+    ret += PROFILE_PATCH(patchSvcBreak9, arm9Section, kernel9Size, (u32)firm->section[2].address);
 
     //Apply firmlaunch patches
     //Doesn't work here if Luma is on SD. If you want to use SAFE_FIRM on 1.0, use Luma from NAND & uncomment this line:
@@ -758,13 +762,13 @@ u32 patch1x2xNativeAndSafeFirm(void)
             *arm11ExceptionsPage,
             *arm11SvcTable = getKernel11Info(arm11Section1, firm->section[1].size, &baseK11VA, &freeK11Space, &arm11SvcHandler, &arm11ExceptionsPage);
 
-        ret += installK11Extension(arm11Section1, firm->section[1].size, false, baseK11VA, arm11ExceptionsPage, &freeK11Space);
-        ret += patchKernel11(arm11Section1, firm->section[1].size, baseK11VA, arm11SvcTable, arm11ExceptionsPage);
+        ret += PROFILE_PATCH(installK11Extension, arm11Section1, firm->section[1].size, false, baseK11VA, arm11ExceptionsPage, &freeK11Space);
+        ret += PROFILE_PATCH(patchKernel11, arm11Section1, firm->section[1].size, baseK11VA, arm11SvcTable, arm11ExceptionsPage);
 
         // Add some other patches to the mix, as we can now launch homebrew on SAFE_FIRM:
 
-        ret += patchKernel9Panic(arm9Section, kernel9Size);
-        ret += patchP9AccessChecks(process9Offset, process9Size);
+        ret += PROFILE_PATCH(patchKernel9Panic, arm9Section, kernel9Size);
+        ret += PROFILE_PATCH(patchP9AccessChecks, process9Offset, process9Size);
 
         mergeSection0(NATIVE_FIRM, 0x45, false); // may change in the future
         firm->section[0].size = 0;
@@ -785,17 +789,194 @@ u32 patchPrototypeNative(FirmwareSource nandType)
     u32 kernel9Size = (u32)(process9Offset - arm9Section) - sizeof(Cxi) - 0x200,
         ret = 0;
 
-    ret += patchProtoNandSignatureCheck(process9Offset, process9Size);
+    ret += PROFILE_PATCH(patchProtoNandSignatureCheck, process9Offset, process9Size);
 
     //Arm9 exception handlers
-    ret += patchArm9ExceptionHandlersInstall(arm9Section, kernel9Size);
+    ret += PROFILE_PATCH(patchArm9ExceptionHandlersInstall, arm9Section, kernel9Size);
 
     //Apply EmuNAND patches
-    if(nandType != FIRMWARE_SYSNAND) ret += patchProtoEmuNand(process9Offset, process9Size);
+    if(nandType != FIRMWARE_SYSNAND) ret += PROFILE_PATCH(patchProtoEmuNand, process9Offset, process9Size);
 
     return ret;
 }
 
+static inline u32 getKextSize(void)
+{
+    return *(u32 *)0x18000020 - K11EXT_VA;
+}
+
+static u32 getEmbeddedSysmodulesSize(void)
+{
+    u8 *src;
+    for(src = (u8 *)0x18180000; memcmp(((Cxi *)src)->ncch.magic, "NCCH", 4) == 0; src += ((Cxi *)src)->ncch.contentSize * 0x200);
+
+    return src - (u8 *)0x18180000;
+}
+
+static void computeFirmCacheKey(FirmwareType firmType, FirmwareSource nandType, bool loadFromStorage, bool isFirmProtEnabled, bool needToInitSd, bool doUnitinfoPatch)
+{
+    FirmCacheKey key;
+    char path[128];
+
+    memset(&key, 0, sizeof(key));
+
+    key.commitHash = COMMIT_HASH;
+    key.version = (VERSION_MAJOR << 16) | (VERSION_MINOR << 8) | VERSION_BUILD;
+    key.flags = ((u32)ISN3DS << 0) | ((u32)ISDEVUNIT << 1) | ((u32)isSdMode << 2) | ((u32)loadFromStorage << 3) |
+                ((u32)isFirmProtEnabled << 4) | ((u32)needToInitSd << 5) | ((u32)doUnitinfoPatch << 6);
+    key.firmType = (u32)firmType;
+    key.nandType = (u32)nandType;
+
+    if(nandType != FIRMWARE_SYSNAND)
+    {
+        key.emuOffset = emuOffset;
+        key.emuHeader = emuHeader;
+    }
+
+    //Nothing is loaded in the FIRM buffer yet, use it as scratch space to hash the files the FIRM is built from
+    key.firmContentId = firmFindContent(path, (u32)firmType);
+    if(key.firmContentId != 0xFFFFFFFF && fileReadAt(firm, path, 0, 0x200))
+        sha(key.firmNcchHeaderHash, firm, 0x200, SHA_256_MODE);
+
+    if(loadFromStorage)
+    {
+        u32 size = fileRead(firm, "native.firm", 0x400000 + sizeof(Cxi) + 0x200);
+        if(size != 0) sha(key.extFirmHash, firm, size, SHA_256_MODE);
+        size = fileRead(firm, "cetk", 0xA50);
+        if(size != 0) sha(key.extCetkHash, firm, size, SHA_256_MODE);
+        getDirectoryHash(key.extModulesHash, "sysmodules", firm, 0x80000);
+    }
+
+    //The whole configuration ends up in the k11 extension parameters
+    memcpy(&key.config, &configData, sizeof(CfgData));
+    memcpy(key.launchedPath, launchedPath, sizeof(key.launchedPath));
+
+    //Hash the k11 extension up to its parameters, which get filled in when patching
+    sha(key.kextHash, (u8 *)0x18000000, *(u32 *)0x18000024 - K11EXT_VA, SHA_256_MODE);
+    sha(key.sysmodulesHash, (u8 *)0x18180000, getEmbeddedSysmodulesSize(), SHA_256_MODE);
+
+    sha(firmCacheKey, &key, sizeof(key), SHA_256_MODE);
+}
+
+bool loadCachedFirm(FirmwareType firmType, FirmwareSource nandType, bool loadFromStorage, bool isFirmProtEnabled, bool needToInitSd, bool doUnitinfoPatch)
+{
+    FirmCacheHeader *header = &firmCacheHeader;
+
+    //Only NATIVE_FIRM is booted often enough to be worth caching. Without a SD card, the cache would live on
+    //the same CTRNAND as the FIRM it replaces, for little gain and a rewrite of the NAND on every key change
+    isFirmCacheable = firmType == NATIVE_FIRM && isSdMode && remountCtrNandPartition(false);
+    if(!isFirmCacheable) return false;
+
+    //One slot per NAND, so that alternating between them doesn't rebuild the cache on every boot
+    if(nandType == FIRMWARE_SYSNAND) sprintf(firmCachePath, "firmcache_sysnand.bin");
+    else sprintf(firmCachePath, "firmcache_emunand_%08lx.bin", emuOffset);
+
+    computeFirmCacheKey(firmType, nandType, loadFromStorage, isFirmProtEnabled, needToInitSd, doUnitinfoPatch);
+
+    if(!fileReadAt(header, firmCachePath, 0, sizeof(FirmCacheHeader)) ||
+       memcmp(header->magic, "FCHE", 4) != 0 || header->formatVersion != FIRM_CACHE_FORMAT_VERSION ||
+       memcmp(header->key, firmCacheKey, sizeof(firmCacheKey)) != 0)
+        return false;
+
+    if(header->firmSize <= 0x200 || header->firmSize > 0x400000 + sizeof(Cxi) + 0x200 ||
+       header->section0Size > 0x80000 || header->kextSize != getKextSize())
+        return false;
+
+    u32 firmSize = (header->firmSize + 0x1FF) & ~0x1FF,
+        section0Size = (header->section0Size + 0x1FF) & ~0x1FF;
+    __attribute__((aligned(4))) u8 hash[SHA_256_HASH_SIZE];
+
+    //Read everything next to the FIRM and only copy it to its final location once verified
+    u8 *section0 = (u8 *)firm + firmSize,
+       *kext = section0 + section0Size;
+
+    if(!fileReadAt(firm, firmCachePath, FIRM_CACHE_DATA_OFFSET, header->firmSize) ||
+       !fileReadAt(section0, firmCachePath, FIRM_CACHE_DATA_OFFSET + firmSize, header->section0Size) ||
+       !fileReadAt(kext, firmCachePath, FIRM_CACHE_DATA_OFFSET + firmSize + section0Size, header->kextSize))
+        return false;
+
+    sha(hash, firm, header->firmSize, SHA_256_MODE);
+    if(memcmp(hash, header->firmHash, sizeof(hash)) != 0) return false;
+    sha(hash, section0, header->section0Size, SHA_256_MODE);
+    if(memcmp(hash, header->section0Hash, sizeof(hash)) != 0) return false;
+    sha(hash, kext, header->kextSize, SHA_256_MODE);
+    if(memcmp(hash, header->kextHash, sizeof(hash)) != 0) return false;
+
+    u32 section0Address = (u32)firm->section[0].address;
+    if(!inRange(section0Address, section0Address + header->section0Size, 0x1FF00000, 0x1FFFFC00) &&
+       !inRange(section0Address, section0Address + header->section0Size, 0x20000000, 0x20000000 + 0x8000000))
+        return false;
+    if(overlaps(section0Address, section0Address + header->section0Size, (u32)firm, (u32)kext + header->kextSize))
+        return false;
+
+    memcpy(firm->section[0].address, section0, header->section0Size);
+    memcpy((u8 *)0x18000000, kext, header->kextSize);
+
+    //kernel9Loader is skipped, so set up the keyslots it would have left behind
+    if(header->restoreArm9BinKeyslots) kernel9LoaderSetupKeyslots((Arm9Bin *)((u8 *)firm + firm->section[2].offset));
+
+    isFirmCacheHit = true;
+
+    return true;
+}
+
+void updateFirmCache(FirmwareType firmType, u64 bootMsec)
+{
+    FirmCacheHeader *header = &firmCacheHeader;
+
+    //Only record the first warm boot time, to avoid a write on every boot
+    if(isFirmCacheHit)
+    {
+        if(header->warmBootMsec == 0)
+        {
+            header->warmBootMsec = bootMsec;
+            fileWriteAt(header, firmCachePath, 0, sizeof(FirmCacheHeader));
+        }
+
+        setK11ExtensionFirmLoadTimes((u32)bootMsec, (u32)header->coldBootMsec, true);
+        return;
+    }
+
+    if(!isFirmCacheable || firmType != NATIVE_FIRM)
+    {
+        setK11ExtensionFirmLoadTimes((u32)bootMsec, (u32)bootMsec, false);
+        return;
+    }
+
+    u32 firmSize = 0x200;
+    for(u32 i = 1; i < 4; i++)
+        if(firm->section[i].size != 0 && firm->section[i].offset + firm->section[i].size > firmSize)
+            firmSize = firm->section[i].offset + firm->section[i].size;
+
+    memset(header, 0, sizeof(FirmCacheHeader));
+    memcpy(header->magic, "FCHE", 4);
+    header->formatVersion = FIRM_CACHE_FORMAT_VERSION;
+    memcpy(header->key, firmCacheKey, sizeof(firmCacheKey));
+    header->firmSize = firmSize;
+    header->section0Size = mergedSection0Size;
+    header->kextSize = getKextSize();
+    header->restoreArm9BinKeyslots = hasDecryptedArm9Bin;
+    header->coldBootMsec = bootMsec;
+
+    sha(header->firmHash, firm, header->firmSize, SHA_256_MODE);
+    sha(header->section0Hash, firm->section[0].address, header->section0Size, SHA_256_MODE);
+    sha(header->kextHash, (u8 *)0x18000000, header->kextSize, SHA_256_MODE);
+
+    u32 alignedFirmSize = (header->firmSize + 0x1FF) & ~0x1FF,
+        alignedSection0Size = (header->section0Size + 0x1FF) & ~0x1FF;
+
+    //Write the header last so that an interrupted write never looks valid
+    fileDelete(firmCachePath);
+    if(!fileWriteAt(firm, firmCachePath, FIRM_CACHE_DATA_OFFSET, header->firmSize) ||
+       !fileWriteAt(firm->section[0].address, firmCachePath, FIRM_CACHE_DATA_OFFSET + alignedFirmSize, header->section0Size) ||
+       !fileWriteAt((u8 *)0x18000000, firmCachePath, FIRM_CACHE_DATA_OFFSET + alignedFirmSize + alignedSection0Size, header->kextSize) ||
+       !fileWriteAt(header, firmCachePath, 0, sizeof(FirmCacheHeader)))
+        fileDelete(firmCachePath);
+
+    //Shown by Rosalina. Set after writing the cache, so that its copy of the k11 extension doesn't hold them
+    setK11ExtensionFirmLoadTimes((u32)bootMsec, (u32)bootMsec, false);
+}
+
 void launchFirm(int argc, char **argv)
 {
     prepareArm11ForFirmlaunch();
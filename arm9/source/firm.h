@@ -37,3 +37,5 @@ u32 patchAgbFirm(bool loadFromStorage, bool doUnitinfoPatch);
 u32 patch1x2xNativeAndSafeFirm(void);
 u32 patchPrototypeNative(FirmwareSource nandType);
 void launchFirm(int argc, char **argv);
+bool loadCachedFirm(FirmwareType firmType, FirmwareSource nandType, bool loadFromStorage, bool isFirmProtEnabled, bool needToInitSd, bool doUnitinfoPatch);
+void updateFirmCache(FirmwareType firmType, u64 bootMsec);
@@ -0,0 +1,224 @@
+/*
+*   This file is part of Luma3DS
+*   Copyright (C) 2016-2022 Aurora Wright, TuxSH
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+*       * Requiring preservation of specified reasonable legal notices or
+*         author attributions in that material or in the Appropriate Legal
+*         Notices displayed by works containing it.
+*       * Prohibiting misrepresentation of the origin of that material,
+*         or requiring that modified versions of such material be marked in
+*         reasonable ways as different from the original version.
+*/
+
+#include "firmcheck.h"
+#include "fs.h"
+#include "memory.h"
+
+//Images whose sections were all found to match their hashes, most recently used first
+#define FIRM_CHECK_CACHE_PATH       "firmverify.bin"
+#define FIRM_CHECK_CACHE_MAGIC      0x4B484346 //'FCHK'
+#define FIRM_CHECK_CACHE_ENTRIES    8
+
+typedef struct FirmCheckCacheEntry
+{
+    u8 headerHash[SHA_256_HASH_SIZE];
+    u32 firmSize,
+        fileStamp;
+} FirmCheckCacheEntry;
+
+typedef struct FirmCheckCache
+{
+    u32 magic;
+    u32 entryNum;
+    FirmCheckCacheEntry entries[FIRM_CHECK_CACHE_ENTRIES];
+} FirmCheckCache;
+
+static FirmCheckCache firmCheckCache;
+static bool isFirmCheckCacheLoaded = false;
+
+static void loadFirmCheckCache(void)
+{
+    if(isFirmCheckCacheLoaded) return;
+
+    isFirmCheckCacheLoaded = true;
+
+    if(fileRead(&firmCheckCache, FIRM_CHECK_CACHE_PATH, sizeof(FirmCheckCache)) != sizeof(FirmCheckCache) ||
+       firmCheckCache.magic != FIRM_CHECK_CACHE_MAGIC || firmCheckCache.entryNum > FIRM_CHECK_CACHE_ENTRIES)
+    {
+        memset(&firmCheckCache, 0, sizeof(FirmCheckCache));
+        firmCheckCache.magic = FIRM_CHECK_CACHE_MAGIC;
+    }
+}
+
+//Moves (or adds) the entry to the front, the file is only written when that changes it
+static void touchFirmCheckCacheEntry(const FirmCheckCacheEntry *entry, u32 index)
+{
+    if(index == firmCheckCache.entryNum)
+    {
+        if(firmCheckCache.entryNum < FIRM_CHECK_CACHE_ENTRIES) firmCheckCache.entryNum++;
+        index = firmCheckCache.entryNum - 1;
+    }
+    else if(index == 0) return;
+
+    memmove(&firmCheckCache.entries[1], &firmCheckCache.entries[0], index * sizeof(FirmCheckCacheEntry));
+    firmCheckCache.entries[0] = *entry;
+
+    fileWrite(&firmCheckCache, FIRM_CHECK_CACHE_PATH, sizeof(FirmCheckCache));
+}
+
+//The header holds the offset, size and hash of every section: with the same header and the same file, the data was already checked
+static u32 findFirmCheckCacheEntry(const FirmCheckCacheEntry *entry)
+{
+    loadFirmCheckCache();
+
+    u32 i;
+    for(i = 0; i < firmCheckCache.entryNum; i++)
+        if(memcmp(&firmCheckCache.entries[i], entry, sizeof(FirmCheckCacheEntry)) == 0) break;
+
+    return i;
+}
+
+static void getFirmCheckCacheEntry(FirmCheckCacheEntry *entry, const FirmHasher *hasher)
+{
+    memcpy(entry->headerHash, hasher->headerHash, sizeof(entry->headerHash));
+    entry->firmSize = hasher->firmSize;
+    entry->fileStamp = hasher->fileStamp;
+}
+
+void firmHasherStart(FirmHasher *hasher, const Firm *firm, u32 firmSize, u32 fileStamp)
+{
+    memset(hasher, 0, sizeof(FirmHasher));
+    hasher->firm = firm;
+    hasher->firmSize = firmSize;
+    hasher->fileStamp = fileStamp;
+    hasher->isStarted = true;
+    hasher->isStreamable = true;
+
+    sha(hasher->headerHash, firm, 0x200, SHA_256_MODE);
+
+    if(fileStamp != 0)
+    {
+        FirmCheckCacheEntry entry;
+        getFirmCheckCacheEntry(&entry, hasher);
+
+        u32 index = findFirmCheckCacheEntry(&entry);
+        hasher->isCached = index != firmCheckCache.entryNum;
+        if(hasher->isCached)
+        {
+            touchFirmCheckCacheEntry(&entry, index);
+            return;
+        }
+    }
+
+    //Sections are hashed in file order as the data comes in, unaligned ones or ones past the end of the file once everything has been read
+    for(u32 i = 0; i < 4; i++)
+    {
+        const FirmSection *section = &firm->section[i];
+
+        if(section->size == 0) continue;
+
+        if(((section->offset | section->size) & 0x1FF) != 0 || section->offset + section->size < section->offset ||
+           section->offset + section->size > firmSize)
+            hasher->isStreamable = false;
+
+        u32 j;
+        for(j = hasher->sectionNum; j > 0 && firm->section[hasher->sectionOrder[j - 1]].offset > section->offset; j--)
+            hasher->sectionOrder[j] = hasher->sectionOrder[j - 1];
+
+        hasher->sectionOrder[j] = (u8)i;
+        hasher->sectionNum++;
+    }
+}
+
+//readSize bytes of the image are in memory
+void firmHasherUpdate(FirmHasher *hasher, u32 readSize)
+{
+    if(hasher->isCached || !hasher->isStreamable) return;
+
+    while(hasher->currentSection < hasher->sectionNum)
+    {
+        const FirmSection *section = &hasher->firm->section[hasher->sectionOrder[hasher->currentSection]];
+        u32 start = section->offset + hasher->hashedSize,
+            end = section->offset + section->size;
+
+        //Whole SHA blocks only, until the end of the section
+        if(readSize < end) end = readSize > start ? start + ((readSize - start) & ~0x3F) : start;
+
+        if(end == start) return;
+
+        if(hasher->hashedSize == 0) sha_start(SHA_256_MODE);
+        sha_update((const u8 *)hasher->firm + start, end - start);
+        hasher->hashedSize += end - start;
+
+        if(hasher->hashedSize != section->size) return;
+
+        __attribute__((aligned(4))) u8 hash[SHA_256_HASH_SIZE];
+        sha_finish(hash, SHA_256_MODE);
+
+        if(memcmp(hash, section->hash, sizeof(hash)) != 0) hasher->isMismatched = true;
+
+        hasher->currentSection++;
+        hasher->hashedSize = 0;
+    }
+}
+
+bool firmHasherFinish(FirmHasher *hasher)
+{
+    if(hasher->isCached) return true;
+
+    if(hasher->isStreamable)
+        firmHasherUpdate(hasher, hasher->firmSize);
+    else for(u32 i = 0; i < 4; i++)
+    {
+        const FirmSection *section = &hasher->firm->section[i];
+
+        if(section->size == 0) continue;
+
+        if(section->offset > hasher->firmSize || section->size > hasher->firmSize - section->offset) return false;
+
+        __attribute__((aligned(4))) u8 hash[SHA_256_HASH_SIZE];
+        sha(hash, (const u8 *)hasher->firm + section->offset, section->size, SHA_256_MODE);
+
+        if(memcmp(hash, section->hash, sizeof(hash)) != 0) hasher->isMismatched = true;
+    }
+
+    if(hasher->isMismatched || (hasher->isStreamable && hasher->currentSection != hasher->sectionNum)) return false;
+
+    if(hasher->fileStamp != 0)
+    {
+        FirmCheckCacheEntry entry;
+        getFirmCheckCacheEntry(&entry, hasher);
+        touchFirmCheckCacheEntry(&entry, findFirmCheckCacheEntry(&entry));
+    }
+
+    return true;
+}
+
+//fileReadStreamed callback, the hasher's fileStamp is set beforehand. Encrypted images are left for checkFirm
+void firmHasherOnRead(void *hasher, const void *dest, u32 readSize, u32 fileSize)
+{
+    FirmHasher *firmHasher = (FirmHasher *)hasher;
+
+    if(!firmHasher->isStarted)
+    {
+        if(readSize < 0x200 || memcmp(dest, "FIRM", 4) != 0) return;
+
+        firmHasherStart(firmHasher, (const Firm *)dest, fileSize, firmHasher->fileStamp);
+    }
+
+    firmHasherUpdate(firmHasher, readSize);
+}
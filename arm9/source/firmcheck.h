@@ -0,0 +1,53 @@
+/*
+*   This file is part of Luma3DS
+*   Copyright (C) 2016-2022 Aurora Wright, TuxSH
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+*       * Requiring preservation of specified reasonable legal notices or
+*         author attributions in that material or in the Appropriate Legal
+*         Notices displayed by works containing it.
+*       * Prohibiting misrepresentation of the origin of that material,
+*         or requiring that modified versions of such material be marked in
+*         reasonable ways as different from the original version.
+*/
+
+#pragma once
+
+#include "types.h"
+#include "3dsheaders.h"
+#include "crypto.h"
+
+//Section hashes of a FIRM image, checked while it is read in and remembered across boots
+typedef struct FirmHasher
+{
+    const Firm *firm;
+    u32 firmSize,
+        fileStamp;      //Of the file the image comes from, 0 when there is none: always hashed, never remembered
+    __attribute__((aligned(4))) u8 headerHash[SHA_256_HASH_SIZE];
+    u8 sectionOrder[4];
+    u32 sectionNum,
+        currentSection,
+        hashedSize;     //Of the current section
+    bool isStarted,
+         isCached,
+         isStreamable,
+         isMismatched;
+} FirmHasher;
+
+void firmHasherStart(FirmHasher *hasher, const Firm *firm, u32 firmSize, u32 fileStamp);
+void firmHasherUpdate(FirmHasher *hasher, u32 readSize);
+bool firmHasherFinish(FirmHasher *hasher);
+void firmHasherOnRead(void *hasher, const void *dest, u32 readSize, u32 fileSize);
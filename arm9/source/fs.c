@@ -40,9 +40,61 @@
 #include "alignedseqmemcpy.h"
 #include "i2c.h"
 
+//Files at least this big get a cluster link map, so that FatFs can read whole fragments at once
+#define LINKMAP_MIN_FILE_SIZE   0x40000
+#define LINKMAP_SIZE            0x80
+
+//fileReadStreamed hands the data over in pieces this big
+#define STREAMED_READ_CHUNK_SIZE    0x20000
+
+//Button combo and menu entries of the payloads folder, rebuilt when its timestamp changes
+#define PAYLOAD_INDEX_PATH      "payloads.idx"
+#define PAYLOAD_INDEX_MAGIC     0x58444950 //'PIDX'
+#define MAX_MENU_PAYLOADS       20
+
+typedef struct PayloadIndex
+{
+    u32 magic;
+    u32 dirStamp;
+    u32 menuPayloadNum;
+    char hotkeyPayloads[11][FF_MAX_LFN + 1];
+    char menuPayloads[MAX_MENU_PAYLOADS][49];
+} PayloadIndex;
+
+//In order of precedence, SELECT is used when nothing else is pressed
+static const struct
+{
+    u32 button;
+    const char *name;
+} payloadHotkeys[] = {
+    {BUTTON_LEFT, "left"},
+    {BUTTON_RIGHT, "right"},
+    {BUTTON_UP, "up"},
+    {BUTTON_DOWN, "down"},
+    {BUTTON_START, "start"},
+    {BUTTON_B, "b"},
+    {BUTTON_X, "x"},
+    {BUTTON_Y, "y"},
+    {BUTTON_R1, "r"},
+    {BUTTON_A, "a"},
+    {0, "select"},
+};
+
+static PayloadIndex payloadIndex;
+static bool isPayloadIndexRebuilt = false;
+
 static FATFS sdFs,
              nandFs;
 
+static void createLinkMap(FIL *file, DWORD *linkMap)
+{
+    linkMap[0] = LINKMAP_SIZE;
+    file->cltbl = linkMap;
+
+    //Too fragmented, just follow the FAT chain
+    if(f_lseek(file, CREATE_LINKMAP) != FR_OK) file->cltbl = NULL;
+}
+
 static bool switchToMainDir(bool isSd)
 {
     const char *mainDir = isSd ? "/luma" : "/rw/luma";
@@ -109,7 +161,45 @@ u32 fileRead(void *dest, const char *path, u32 maxSize)
     u32 size = f_size(&file);
     if(dest == NULL) ret = size;
     else if(size <= maxSize)
+    {
+        DWORD linkMap[LINKMAP_SIZE];
+        if(size >= LINKMAP_MIN_FILE_SIZE) createLinkMap(&file, linkMap);
+
         result = f_read(&file, dest, size, (unsigned int *)&ret);
+    }
+    result |= f_close(&file);
+
+    return result == FR_OK ? ret : 0;
+}
+
+//Like fileRead, onRead is told how much of the file is in dest after every piece so that it can be processed while the rest is read
+u32 fileReadStreamed(void *dest, const char *path, u32 maxSize, void (*onRead)(void *context, const void *dest, u32 readSize, u32 fileSize), void *context)
+{
+    FIL file;
+    FRESULT result = FR_OK;
+    u32 ret = 0;
+
+    if(f_open(&file, path, FA_READ) != FR_OK) return ret;
+
+    u32 size = f_size(&file);
+    if(size <= maxSize)
+    {
+        DWORD linkMap[LINKMAP_SIZE];
+        if(size >= LINKMAP_MIN_FILE_SIZE) createLinkMap(&file, linkMap);
+
+        while(result == FR_OK && ret < size)
+        {
+            u32 chunkSize = size - ret < STREAMED_READ_CHUNK_SIZE ? size - ret : STREAMED_READ_CHUNK_SIZE,
+                read;
+
+            result = f_read(&file, (u8 *)dest + ret, chunkSize, (unsigned int *)&read);
+            ret += read;
+
+            if(result != FR_OK || read != chunkSize) break;
+
+            onRead(context, dest, ret, size);
+        }
+    }
     result |= f_close(&file);
 
     return result == FR_OK ? ret : 0;
@@ -120,6 +210,85 @@ u32 getFileSize(const char *path)
     return fileRead(NULL, path, 0);
 }
 
+bool fileReadAt(void *dest, const char *path, u32 offset, u32 size)
+{
+    FIL file;
+    FRESULT result;
+    unsigned int read = 0;
+
+    if(f_open(&file, path, FA_READ) != FR_OK) return false;
+
+    result = f_lseek(&file, offset);
+    if(result == FR_OK) result = f_read(&file, dest, size, &read);
+    result |= f_close(&file);
+
+    return result == FR_OK && (u32)read == size;
+}
+
+bool fileWriteAt(const void *buffer, const char *path, u32 offset, u32 size)
+{
+    FIL file;
+    FRESULT result;
+    unsigned int written = 0;
+
+    if(f_open(&file, path, FA_WRITE | FA_OPEN_ALWAYS) != FR_OK) return false;
+
+    result = f_lseek(&file, offset);
+    if(result == FR_OK) result = f_write(&file, buffer, size, &written);
+    result |= f_close(&file);
+
+    return result == FR_OK && (u32)written == size;
+}
+
+bool getDirectoryHash(u8 *hash, const char *path, void *tmpBuffer, u32 maxSize)
+{
+    DIR dir;
+    FILINFO info;
+    //Previous hash, hash of the file contents, file name
+    struct __attribute__((aligned(4)))
+    {
+        u8 hashes[2][SHA_256_HASH_SIZE];
+        char name[FF_LFN_BUF + 1];
+    } chain;
+
+    memset(&chain, 0, sizeof(chain));
+
+    if(f_opendir(&dir, path) != FR_OK) return false;
+
+    //Chain the name and contents of every file, in directory order. Files larger than maxSize are only named
+    while(f_readdir(&dir, &info) == FR_OK && info.fname[0] != 0)
+    {
+        if(info.fattrib & AM_DIR) continue;
+
+        char filePath[FF_LFN_BUF + 32];
+        sprintf(filePath, "%s/%s", path, info.fname);
+
+        u32 size = fileRead(tmpBuffer, filePath, maxSize);
+        memset(chain.hashes[1], 0, SHA_256_HASH_SIZE);
+        if(size != 0) sha(chain.hashes[1], tmpBuffer, size, SHA_256_MODE);
+
+        u32 nameLength = strlen(info.fname);
+        memcpy(chain.name, info.fname, nameLength);
+        sha(chain.hashes[0], &chain, sizeof(chain.hashes) + nameLength, SHA_256_MODE);
+    }
+
+    f_closedir(&dir);
+    memcpy(hash, chain.hashes[0], SHA_256_HASH_SIZE);
+
+    return true;
+}
+
+u32 getFileStamp(const char *path)
+{
+    FILINFO info;
+
+    if(f_stat(path, &info) != FR_OK) return 0;
+
+    u32 stamp = crc32(&info.fsize, sizeof(info.fsize), 0xFFFFFFFF);
+    stamp = crc32(&info.fdate, sizeof(info.fdate), stamp);
+    return crc32(&info.ftime, sizeof(info.ftime), stamp);
+}
+
 bool fileWrite(const void *buffer, const char *path, u32 size)
 {
     FIL file;
@@ -169,6 +338,9 @@ bool fileCopy(const char *pathSrc, const char *pathDst, bool replace, void *tmpB
 
     size_t szSrc = f_size(&fileSrc), rem = szSrc;
 
+    DWORD linkMap[LINKMAP_SIZE];
+    if (szSrc >= LINKMAP_MIN_FILE_SIZE) createLinkMap(&fileSrc, linkMap);
+
     res = f_open(&fileDst, pathDst, FA_WRITE | (replace ? FA_CREATE_ALWAYS : FA_CREATE_NEW));
 
     if (res == FR_EXIST)
@@ -238,68 +410,124 @@ bool createDir(const char *path)
     return res == FR_OK || res == FR_EXIST;
 }
 
-bool findPayload(char *path, u32 pressed)
+static bool isHotkeyPayload(const char *name, u32 nameLength, const char *key)
 {
-    const char *pattern;
-
-    if(pressed & BUTTON_LEFT) pattern = PATTERN("left");
-    else if(pressed & BUTTON_RIGHT) pattern = PATTERN("right");
-    else if(pressed & BUTTON_UP) pattern = PATTERN("up");
-    else if(pressed & BUTTON_DOWN) pattern = PATTERN("down");
-    else if(pressed & BUTTON_START) pattern = PATTERN("start");
-    else if(pressed & BUTTON_B) pattern = PATTERN("b");
-    else if(pressed & BUTTON_X) pattern = PATTERN("x");
-    else if(pressed & BUTTON_Y) pattern = PATTERN("y");
-    else if(pressed & BUTTON_R1) pattern = PATTERN("r");
-    else if(pressed & BUTTON_A) pattern = PATTERN("a");
-    else pattern = PATTERN("select");
+    u32 keyLength = strlen(key);
 
-    DIR dir;
-    FILINFO info;
-    FRESULT result;
+    //Same as the "<key>_*.firm" pattern f_findfirst used to be called with, which is case-insensitive
+    if(nameLength < keyLength + 6 || name[keyLength] != '_') return false;
 
-    result = f_findfirst(&dir, &info, "payloads", pattern);
+    for(u32 i = 0; i < keyLength; i++)
+        if((name[i] | 0x20) != key[i]) return false;
 
-    if(result != FR_OK) return false;
-
-    f_closedir(&dir);
-
-    if(!info.fname[0]) return false;
-
-    sprintf(path, "payloads/%s", info.fname);
+    for(u32 i = 0; i < 5; i++)
+        if((name[nameLength - 5 + i] | 0x20) != ".firm"[i]) return false;
 
     return true;
 }
 
-bool payloadMenu(char *path, bool *hasDisplayedMenu)
+static bool rebuildPayloadIndex(void)
 {
     DIR dir;
+    FILINFO info;
 
-    *hasDisplayedMenu = false;
-    if(f_opendir(&dir, "payloads") != FR_OK) return false;
+    isPayloadIndexRebuilt = true;
+    memset(&payloadIndex, 0, sizeof(PayloadIndex));
 
-    FILINFO info;
-    u32 payloadNum = 0;
-    char payloadList[20][49];
+    if(f_opendir(&dir, "payloads") != FR_OK) return false;
 
-    while(f_readdir(&dir, &info) == FR_OK && info.fname[0] != 0 && payloadNum < 20)
+    while(f_readdir(&dir, &info) == FR_OK && info.fname[0] != 0)
     {
         if(info.fname[0] == '.') continue;
 
         u32 nameLength = strlen(info.fname);
 
-        if(nameLength < 6 || nameLength > 52) continue;
+        //The first match in directory order wins, as with f_findfirst
+        for(u32 i = 0; i < sizeof(payloadHotkeys) / sizeof(payloadHotkeys[0]); i++)
+            if(!payloadIndex.hotkeyPayloads[i][0] && isHotkeyPayload(info.fname, nameLength, payloadHotkeys[i].name))
+                strcpy(payloadIndex.hotkeyPayloads[i], info.fname);
+
+        if(payloadIndex.menuPayloadNum == MAX_MENU_PAYLOADS || nameLength < 6 || nameLength > 52) continue;
 
         nameLength -= 5;
 
         if(memcmp(info.fname + nameLength, ".firm", 5) != 0) continue;
 
-        memcpy(payloadList[payloadNum], info.fname, nameLength);
-        payloadList[payloadNum][nameLength] = 0;
-        payloadNum++;
+        memcpy(payloadIndex.menuPayloads[payloadIndex.menuPayloadNum], info.fname, nameLength);
+        payloadIndex.menuPayloads[payloadIndex.menuPayloadNum][nameLength] = 0;
+        payloadIndex.menuPayloadNum++;
     }
 
-    if(f_closedir(&dir) != FR_OK || !payloadNum) return false;
+    if(f_closedir(&dir) != FR_OK) return false;
+
+    payloadIndex.magic = PAYLOAD_INDEX_MAGIC;
+    payloadIndex.dirStamp = getFileStamp("payloads");
+    fileWrite(&payloadIndex, PAYLOAD_INDEX_PATH, sizeof(PayloadIndex));
+
+    return true;
+}
+
+//The names are used as is, don't trust a damaged file with them
+static bool isPayloadIndexValid(u32 dirStamp)
+{
+    if(payloadIndex.magic != PAYLOAD_INDEX_MAGIC || payloadIndex.dirStamp != dirStamp || payloadIndex.menuPayloadNum > MAX_MENU_PAYLOADS) return false;
+
+    for(u32 i = 0; i < sizeof(payloadIndex.hotkeyPayloads) / sizeof(payloadIndex.hotkeyPayloads[0]); i++)
+        if(memchr(payloadIndex.hotkeyPayloads[i], 0, sizeof(payloadIndex.hotkeyPayloads[i])) == NULL) return false;
+
+    for(u32 i = 0; i < payloadIndex.menuPayloadNum; i++)
+        if(memchr(payloadIndex.menuPayloads[i], 0, sizeof(payloadIndex.menuPayloads[i])) == NULL) return false;
+
+    return true;
+}
+
+static bool loadPayloadIndex(void)
+{
+    //Already loaded during this boot
+    if(payloadIndex.magic == PAYLOAD_INDEX_MAGIC) return true;
+
+    //A single directory entry lookup, the folder itself is only listed when the index is rebuilt
+    u32 dirStamp = getFileStamp("payloads");
+
+    if(!dirStamp) return false;
+
+    if(fileRead(&payloadIndex, PAYLOAD_INDEX_PATH, sizeof(PayloadIndex)) == sizeof(PayloadIndex) &&
+       isPayloadIndexValid(dirStamp)) return true;
+
+    return rebuildPayloadIndex();
+}
+
+bool refreshPayloadIndex(void)
+{
+    return !isPayloadIndexRebuilt && rebuildPayloadIndex();
+}
+
+bool findPayload(char *path, u32 pressed)
+{
+    u32 hotkey;
+
+    for(hotkey = 0; payloadHotkeys[hotkey].button != 0 && !(pressed & payloadHotkeys[hotkey].button); hotkey++);
+
+    if(!loadPayloadIndex()) return false;
+
+    //Not every FAT driver updates the directory timestamp when adding files, so look again before giving up
+    if(!payloadIndex.hotkeyPayloads[hotkey][0] && (!refreshPayloadIndex() || !payloadIndex.hotkeyPayloads[hotkey][0])) return false;
+
+    sprintf(path, "payloads/%s", payloadIndex.hotkeyPayloads[hotkey]);
+
+    return true;
+}
+
+bool payloadMenu(char *path, bool *hasDisplayedMenu)
+{
+    *hasDisplayedMenu = false;
+
+    if(!loadPayloadIndex()) return false;
+
+    if(!payloadIndex.menuPayloadNum && (!refreshPayloadIndex() || !payloadIndex.menuPayloadNum)) return false;
+
+    u32 payloadNum = payloadIndex.menuPayloadNum;
+    char (*payloadList)[49] = payloadIndex.menuPayloads;
 
     u32 pressed = 0,
         selectedPayload = 0;
@@ -366,7 +594,7 @@ bool payloadMenu(char *path, bool *hasDisplayedMenu)
     return false;
 }
 
-u32 firmRead(void *dest, u32 firmType)
+u32 firmFindContent(char *path, u32 firmType)
 {
     static const char *firmFolders[][2] = {{"00000002", "20000002"},
                                            {"00000102", "20000102"},
@@ -374,8 +602,7 @@ u32 firmRead(void *dest, u32 firmType)
                                            {"00000003", "20000003"},
                                            {"00000001", "20000001"}};
 
-    char folderPath[64],
-         path[128];
+    char folderPath[64];
 
     sprintf(folderPath, "nand:/title/00040138/%s/content", firmFolders[firmType][ISN3DS ? 1 : 0]);
 
@@ -403,12 +630,22 @@ u32 firmRead(void *dest, u32 firmType)
     //Complete the string with the .app name
     sprintf(path, "%s/%08lx.app", folderPath, firmVersion);
 
-    if(fileRead(dest, path, 0x400000 + sizeof(Cxi) + 0x200) <= sizeof(Cxi) + 0x400) firmVersion = 0xFFFFFFFF;
-
 exit:
     return firmVersion;
 }
 
+u32 firmRead(void *dest, u32 firmType, u32 *fileStamp)
+{
+    char path[128];
+    u32 firmVersion = firmFindContent(path, firmType);
+
+    if(firmVersion != 0xFFFFFFFF && fileRead(dest, path, 0x400000 + sizeof(Cxi) + 0x200) <= sizeof(Cxi) + 0x400) firmVersion = 0xFFFFFFFF;
+
+    *fileStamp = firmVersion != 0xFFFFFFFF ? getFileStamp(path) : 0;
+
+    return firmVersion;
+}
+
 void findDumpFile(const char *folderPath, char *fileName)
 {
     DIR dir;
@@ -28,21 +28,26 @@
 
 #include "types.h"
 
-#define PATTERN(a) a "_*.firm"
-
 bool mountSdCardPartition(bool switchMainDir);
 bool remountCtrNandPartition(bool switchMainDir);
 void unmountPartitions(void);
 
 u32 fileRead(void *dest, const char *path, u32 maxSize);
+u32 fileReadStreamed(void *dest, const char *path, u32 maxSize, void (*onRead)(void *context, const void *dest, u32 readSize, u32 fileSize), void *context);
 u32 getFileSize(const char *path);
+bool fileReadAt(void *dest, const char *path, u32 offset, u32 size);
+bool fileWriteAt(const void *buffer, const char *path, u32 offset, u32 size);
+bool getDirectoryHash(u8 *hash, const char *path, void *tmpBuffer, u32 maxSize);
+u32 getFileStamp(const char *path);
 bool fileWrite(const void *buffer, const char *path, u32 size);
 bool fileDelete(const char *path);
 bool fileCopy(const char *pathSrc, const char *pathDst, bool replace, void *tmpBuffer, size_t bufferSize);
 bool createDir(const char *path);
+bool refreshPayloadIndex(void);
 bool findPayload(char *path, u32 pressed);
 bool payloadMenu(char *path, bool *hasDisplayedMenu);
-u32 firmRead(void *dest, u32 firmType);
+u32 firmFindContent(char *path, u32 firmType);
+u32 firmRead(void *dest, u32 firmType, u32 *fileStamp);
 void findDumpFile(const char *folderPath, char *fileName);
 
 bool doLumaUpgradeProcess(void);
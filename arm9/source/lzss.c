@@ -0,0 +1,126 @@
+/*
+*   This file is part of Luma3DS
+*   Copyright (C) 2016-2020 Aurora Wright, TuxSH
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+*       * Requiring preservation of specified reasonable legal notices or
+*         author attributions in that material or in the Appropriate Legal
+*         Notices displayed by works containing it.
+*       * Prohibiting misrepresentation of the origin of that material,
+*         or requiring that modified versions of such material be marked in
+*         reasonable ways as different from the original version.
+*/
+
+#include "lzss.h"
+#include "memory.h"
+
+// Copies a back-reference below out and returns its new position. The runs are copied downwards,
+// byte by byte in the format, so only 8-byte moves whose source is entirely above them give the same result.
+static inline u8 *copyRun(u8 *out, u8 **in)
+{
+    u32 hi = *--*in;
+    u32 lo = *--*in;
+    u32 len = (hi >> 4) + 3;
+    u32 disp = (((hi << 8) | lo) & 0xFFF) + 3;
+    u8 *dst = out - len;
+    const u8 *src = dst + disp;
+
+    // Short runs are the common case, avoid a memcpy call of a variable size for them: copy whole
+    // 8-byte blocks down from out. What lands below dst is only output that will be overwritten,
+    // as long as it stays above the input that hasn't been read yet.
+    if(disp >= 8 && out - *in >= 24)
+    {
+        memcpy(out - 8, out - 8 + disp, 8);
+        memcpy(out - 16, out - 16 + disp, 8);
+        if(len > 16)
+            memcpy(out - 24, out - 24 + disp, 8);
+
+        return dst;
+    }
+
+    while(len > 0)
+    {
+        len--;
+        dst[len] = src[len];
+    }
+
+    return dst;
+}
+
+// Decompress a backwards LZSS (BLZ) blob in place, end being the end of the compressed data.
+// The output extends past end by the size stored in the footer.
+void lzss_decompress(u8 *end)
+{
+    if(end == NULL) return;
+
+    u32 footer = *((u32 *)end - 2);
+    u8 *out = end + *((u32 *)end - 1),
+       *in = end - (footer >> 24);
+    const u8 *inStart = end - (footer & 0xFFFFFF);
+
+    while(in > inStart)
+    {
+        u8 flags = *--in;
+
+        // No back-references at all: copy 8 literals at once when they can't overlap
+        if(flags == 0 && in - inStart >= 8 && out - in >= 8)
+        {
+            in -= 8;
+            out -= 8;
+            memcpy(out, in, 8);
+            continue;
+        }
+
+        // A group takes at most 16 bytes of input, only check for the end of it when it could be reached.
+        // Consecutive literals are moved 8 bytes at a time, what lands below out is overwritten later as in copyRun.
+        if(in - inStart >= 16)
+        {
+            u32 bits = (u32)flags << 24;
+            for(u32 left = 8; left != 0;)
+            {
+                if(bits & 0x80000000)
+                {
+                    out = copyRun(out, &in);
+                    bits <<= 1;
+                    left--;
+                }
+                else
+                {
+                    u32 n = bits == 0 ? left : (u32)__builtin_clz(bits);
+                    if(n > left) n = left;
+                    if(out - in >= 8 && in - inStart >= 8)
+                    {
+                        memcpy(out - 8, in - 8, 8);
+                        out -= n;
+                        in -= n;
+                    }
+                    else for(u32 j = 0; j < n; j++) *--out = *--in;
+                    bits <<= n;
+                    left -= n;
+                }
+            }
+            continue;
+        }
+
+        for(u32 i = 0; i < 8; i++, flags <<= 1)
+        {
+            if(flags & 0x80) out = copyRun(out, &in);
+            else *--out = *--in;
+
+            if(in <= inStart) return;
+        }
+    }
+}
@@ -39,6 +39,7 @@
 #include "screen.h"
 #include "i2c.h"
 #include "fmt.h"
+#include "profiler.h"
 #include "fatfs/sdmmc/sdmmc.h"
 
 extern u8 __itcm_start__[], __itcm_lma__[], __itcm_bss_start__[], __itcm_end__[];
@@ -131,6 +132,8 @@ void main(int argc, char **argv, u32 magicWord)
     memset(__itcm_bss_start__, 0, __itcm_end__ - __itcm_bss_start__);
     I2C_init();
 
+    PROFILE_PHASE("init");
+
     u8 mcuFwVerHi = I2C_readReg(I2C_DEV_MCU, 0) - 0x10;
     u8 mcuFwVerLo = I2C_readReg(I2C_DEV_MCU, 1);
     mcuFwVersion = ((u16)mcuFwVerHi << 16) | mcuFwVerLo;
@@ -144,6 +147,8 @@ void main(int argc, char **argv, u32 magicWord)
 
     installArm9Handlers();
 
+    PROFILE_PHASE("mount");
+
     if(memcmp(launchedPath, u"sdmc", 8) == 0)
     {
         if(!mountSdCardPartition(true)) error("Echec du montage de la carte SD.");
@@ -181,6 +186,8 @@ void main(int argc, char **argv, u32 magicWord)
 
     detectAndProcessExceptionDumps();
 
+    PROFILE_PHASE("config");
+
     //Attempt to read the configuration file
     needConfig = readConfig() ? MODIFY_CONFIGURATION : CREATE_CONFIGURATION;
 
@@ -253,6 +260,8 @@ void main(int argc, char **argv, u32 magicWord)
         }
     }
 
+    PROFILE_PHASE("menus");
+
     u32 pinMode = MULTICONFIG(PIN);
     bool shouldLoadConfigMenu = needConfig == CREATE_CONFIGURATION || ((pressed & (BUTTON_SELECT | BUTTON_L1)) == BUTTON_SELECT);
     bool pinExists = pinMode != 0 && verifyPin(pinMode);
@@ -347,6 +356,8 @@ void main(int argc, char **argv, u32 magicWord)
 
 boot:
 
+    PROFILE_PHASE("boot_setup");
+
     //If we need to boot EmuNAND, make sure it exists
     if(nandType != FIRMWARE_SYSNAND)
     {
@@ -363,35 +374,53 @@ boot:
         writeConfig(false);
     }
 
-    bool loadFromStorage = CONFIG(LOADEXTFIRMSANDMODULES);
-    u32 firmVersion = loadNintendoFirm(&firmType, nandType, loadFromStorage, isSafeMode);
+    bool loadFromStorage = CONFIG(LOADEXTFIRMSANDMODULES),
+         doUnitinfoPatch = CONFIG(PATCHUNITINFO);
 
-    bool doUnitinfoPatch = CONFIG(PATCHUNITINFO);
-    u32 res = 0;
-    switch(firmType)
+    startChrono();
+    u64 firmLoadStart = chrono();
+
+    PROFILE_PHASE("firm_load");
+
+    //Skip loading and patching the FIRM entirely if the result from a previous boot is still valid
+    if(!loadCachedFirm(firmType, nandType, loadFromStorage, isFirmProtEnabled, needToInitSd, doUnitinfoPatch))
     {
-        case NATIVE_FIRM:
+        u32 firmVersion = loadNintendoFirm(&firmType, nandType, loadFromStorage, isSafeMode);
+
+        PROFILE_PHASE("firm_patch");
+
+        u32 res = 0;
+        switch(firmType)
         {
-            res = patchNativeFirm(firmVersion, nandType, loadFromStorage, isFirmProtEnabled, needToInitSd, doUnitinfoPatch);
-            break;
+            case NATIVE_FIRM:
+            {
+                res = patchNativeFirm(firmVersion, nandType, loadFromStorage, isFirmProtEnabled, needToInitSd, doUnitinfoPatch);
+                break;
+            }
+            case TWL_FIRM:
+                res = patchTwlFirm(firmVersion, loadFromStorage, doUnitinfoPatch);
+                break;
+            case AGB_FIRM:
+                res = patchAgbFirm(loadFromStorage, doUnitinfoPatch);
+                break;
+            case SAFE_FIRM:
+            case SYSUPDATER_FIRM:
+            case NATIVE_FIRM1X2X:
+                res = patch1x2xNativeAndSafeFirm();
+                break;
+            case NATIVE_PROTOTYPE:
+                res = patchPrototypeNative(nandType);
+                break;
         }
-        case TWL_FIRM:
-            res = patchTwlFirm(firmVersion, loadFromStorage, doUnitinfoPatch);
-            break;
-        case AGB_FIRM:
-            res = patchAgbFirm(loadFromStorage, doUnitinfoPatch);
-            break;
-        case SAFE_FIRM:
-        case SYSUPDATER_FIRM:
-        case NATIVE_FIRM1X2X:
-            res = patch1x2xNativeAndSafeFirm();
-            break;
-        case NATIVE_PROTOTYPE:
-            res = patchPrototypeNative(nandType);
-            break;
+
+        if(res != 0) error("Echec du chargement de %u patch(s) du FIRM.", res);
     }
 
-    if(res != 0) error("Echec du chargement de %u patch(s) du FIRM.", res);
+    PROFILE_PHASE("firm_cache");
+
+    updateFirmCache(firmType, chrono() - firmLoadStart);
+
+    PROFILE_WRITE(firmType, nandType);
 
     unmountPartitions();
     if(bootType != FIRMLAUNCH) deinitScreens();
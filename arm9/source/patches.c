@@ -42,8 +42,6 @@
 #include "arm9_exception_handlers.h"
 #include "large_patches.h"
 
-#define K11EXT_VA         0x70000000
-
 extern u16 launchedPath[];
 extern u32 firmProtoVersion;
 
@@ -116,49 +114,52 @@ static inline u32 *getKernel11HandlerVAPos(u8 *pos, u32 *arm11ExceptionsPage, u3
     return (u32 *)(pos + pointedInstructionVA - baseK11VA + 8);
 }
 
-u32 installK11Extension(u8 *pos, u32 size, bool needToInitSd, u32 baseK11VA, u32 *arm11ExceptionsPage, u8 **freeK11Space)
+//The parameters to be passed on to the kernel ext
+//Please keep that in sync with the definition in k11_extension/source/main.c
+struct KExtParameters
 {
-    //The parameters to be passed on to the kernel ext
-    //Please keep that in sync with the definition in k11_extension/source/main.c
-    struct KExtParameters
-    {
-        u32 basePA;
-        u32 stolenSystemMemRegionSize;
-        void *originalHandlers[4];
-        u32 L1MMUTableAddrs[4];
+    u32 basePA;
+    u32 stolenSystemMemRegionSize;
+    void *originalHandlers[4];
+    u32 L1MMUTableAddrs[4];
 
-        volatile bool done;
+    volatile bool done;
 
-        struct CfwInfo
-        {
-            char magic[4];
+    struct CfwInfo
+    {
+        char magic[4];
 
-            u8 versionMajor;
-            u8 versionMinor;
-            u8 versionBuild;
-            u8 flags;
+        u8 versionMajor;
+        u8 versionMinor;
+        u8 versionBuild;
+        u8 flags;
 
-            u32 commitHash;
+        u32 commitHash;
 
-            u16 configFormatVersionMajor, configFormatVersionMinor;
-            u32 config, multiConfig, bootConfig;
-            u32 splashDurationMsec;
-            s8 volumeSliderOverride;
-            u64 hbldr3dsxTitleId;
-            u32 rosalinaMenuCombo;
-            u32 pluginLoaderFlags;
-            s16 ntpTzOffetMinutes;
+        u16 configFormatVersionMajor, configFormatVersionMinor;
+        u32 config, multiConfig, bootConfig;
+        u32 splashDurationMsec;
+        s8 volumeSliderOverride;
+        u64 hbldr3dsxTitleId;
+        u32 rosalinaMenuCombo;
+        u32 pluginLoaderFlags;
+        s16 ntpTzOffetMinutes;
 
-            ScreenFiltersCfgData topScreenFilter;
-            ScreenFiltersCfgData bottomScreenFilter;
+        ScreenFiltersCfgData topScreenFilter;
+        ScreenFiltersCfgData bottomScreenFilter;
 
-            u64 autobootTwlTitleId;
-            u8 autobootCtrAppmemtype;
+        u64 autobootTwlTitleId;
+        u8 autobootCtrAppmemtype;
 
-            u16 launchedPath[80+1];
-        } info;
-    };
+        u16 launchedPath[80+1];
 
+        u32 firmLoadMsec, firmColdLoadMsec;
+        bool isFirmFromCache;
+    } info;
+};
+
+u32 installK11Extension(u8 *pos, u32 size, bool needToInitSd, u32 baseK11VA, u32 *arm11ExceptionsPage, u8 **freeK11Space)
+{
     static const u8 patternHook1[] = {0x02, 0xC2, 0xA0, 0xE3, 0xFF}; //MMU setup hook
     static const u8 patternHook2[] = {0x08, 0x00, 0xA4, 0xE5, 0x02, 0x10, 0x80, 0xE0, 0x08, 0x10, 0x84, 0xE5}; //FCRAM layout setup hook
     static const u8 patternHook3_4[] = {0x00, 0x00, 0xA0, 0xE1, 0x03, 0xF0, 0x20, 0xE3, 0xFD, 0xFF, 0xFF, 0xEA}; //SGI0 setup code, etc.
@@ -250,6 +251,18 @@ u32 installK11Extension(u8 *pos, u32 size, bool needToInitSd, u32 baseK11VA, u32
     return 0;
 }
 
+void setK11ExtensionFirmLoadTimes(u32 loadMsec, u32 coldLoadMsec, bool isFromCache)
+{
+    struct KExtParameters *p = (struct KExtParameters *)(*(u32 *)0x18000024 - K11EXT_VA + 0x18000000);
+
+    //Only once installK11Extension has filled in the parameters
+    if(memcmp(p->info.magic, "LUMA", 4) != 0) return;
+
+    p->info.firmLoadMsec = loadMsec;
+    p->info.firmColdLoadMsec = coldLoadMsec;
+    p->info.isFirmFromCache = isFromCache;
+}
+
 u32 patchKernel11(u8 *pos, u32 size, u32 baseK11VA, u32 *arm11SvcTable, u32 *arm11ExceptionsPage)
 {
     static const u8 patternKPanic[] = {0x02, 0x0B, 0x44, 0xE2};
@@ -511,8 +524,9 @@ u32 patchK11ModuleLoadingLgy(u32 newKipSectionSize, u8 *pos, u32 size)
     // This is where we can also automatically obtain the section size
 
     u16 *off = (u16 *)pos;
-    for (; (u8 *)off < pos + size && (off[0] != 0x06C9 || off[1] != 0x0600); off++);
-    if ((u8 *)off >= pos + size)
+    // The size is 7 halfwords after the match
+    for (; (u8 *)(off + 9) <= pos + size && (off[0] != 0x06C9 || off[1] != 0x0600); off++);
+    if ((u8 *)(off + 9) > pos + size)
         return 3;
 
     off += 7;
@@ -521,8 +535,8 @@ u32 patchK11ModuleLoadingLgy(u32 newKipSectionSize, u8 *pos, u32 size)
     off += 2;
 
     u32 *off2 = (u32 *)off;
-    for (; (u8 *)off2 < pos + size && *off2 != oldKipSectionSize; off2++);
-    if ((u8 *)off2 >= pos + size)
+    for (; (u8 *)(off2 + 1) <= pos + size && *off2 != oldKipSectionSize; off2++);
+    if ((u8 *)(off2 + 1) > pos + size)
         return 4;
     *off2 = newKipSectionSize;
 
@@ -816,9 +830,9 @@ u32 patchLgyK11(u8 *section1, u32 section1Size, u8 *section2, u32 section2Size)
 
     // Fix a bug where Legacy K11 maps user TLS with "user no access" permissions
     // Map it as RWX (just like the rest of other user-accessible pages) instead
-    for (off = (u32 *)section1; (u8 *)off <= section1 + section1Size && *off != 0xE0100000; off++);
+    for (off = (u32 *)section1; (u8 *)(off + 2) <= section1 + section1Size && *off != 0xE0100000; off++);
 
-    if ((u8 *)off >= section1 + section1Size)
+    if ((u8 *)(off + 2) > section1 + section1Size)
         return 1;
 
     ++off;
@@ -828,8 +842,8 @@ u32 patchLgyK11(u8 *section1, u32 section1Size, u8 *section2, u32 section2Size)
 
     // Patch two pointer-to-bool to point to a non-zero byte, enabling user exception handling.
     // It is impossible to enable it by normal means, otherwise
-    for (off = (u32 *)section2; (u8 *)off <= section2 + section2Size && *off != 0x100021F; off++);
-    if ((u8 *)off >= section2 + section2Size)
+    for (off = (u32 *)section2; (u8 *)(off + 3) <= section2 + section2Size && *off != 0x100021F; off++);
+    if ((u8 *)(off + 3) > section2 + section2Size)
         return 1;
     off[1] = 0xFFFF0F00;
     off[2] = 0xFFFF0F04;
@@ -838,8 +852,8 @@ u32 patchLgyK11(u8 *section1, u32 section1Size, u8 *section2, u32 section2Size)
     // LGY K11 doesn't do any memory management, so these checks will always fail.
     // Patch with b +0x38 to skip all those checks
     u16 *off2;
-    for (off2 = (u16 *)section2; (u8 *)off2 <= section2 + section2Size && (off2[0] != 0xDB1F || off2[1] != 0x4915); off2++);
-    if ((u8 *)off2 >= section2 + section2Size)
+    for (off2 = (u16 *)section2; (u8 *)(off2 + 2) <= section2 + section2Size && (off2[0] != 0xDB1F || off2[1] != 0x4915); off2++);
+    if ((u8 *)(off2 + 2) > section2 + section2Size)
         return 1;
     *off2 = 0xE01A;
 
@@ -0,0 +1,127 @@
+/*
+*   This file is part of Luma3DS
+*   Copyright (C) 2016-2022 Aurora Wright, TuxSH
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+*       * Requiring preservation of specified reasonable legal notices or
+*         author attributions in that material or in the Appropriate Legal
+*         Notices displayed by works containing it.
+*       * Prohibiting misrepresentation of the origin of that material,
+*         or requiring that modified versions of such material be marked in
+*         reasonable ways as different from the original version.
+*/
+
+#ifdef BUILD_FOR_BOOT_PROFILING
+
+#include "profiler.h"
+#include "utils.h"
+#include "fs.h"
+#include "fmt.h"
+#include "fatfs/ff.h"
+#include "fatfs/diskio.h"
+
+typedef struct ProfileEntry
+{
+    const char *name;
+    u64 start;
+    u64 end;
+    bool isPatch;
+    u32 result;
+} ProfileEntry;
+
+static ProfileEntry entries[PROFILE_MAX_ENTRIES];
+static u32 entryCount = 0;
+static ProfileEntry *currentPhase = NULL;
+
+static inline u32 ticksToUsec(u64 ticks)
+{
+    return (u32)(ticks * 1000000ULL / TICKS_PER_SEC);
+}
+
+static void profileAdd(const char *name, u64 start, u64 end, bool isPatch, u32 result)
+{
+    if(entryCount == PROFILE_MAX_ENTRIES) return;
+
+    ProfileEntry *entry = &entries[entryCount++];
+    entry->name = name;
+    entry->start = start;
+    entry->end = end;
+    entry->isPatch = isPatch;
+    entry->result = result;
+
+    if(!isPatch) currentPhase = entry;
+}
+
+void profilePhase(const char *name)
+{
+    startChrono();
+
+    u64 now = chronoTicks();
+
+    if(currentPhase != NULL) currentPhase->end = now;
+    profileAdd(name, now, now, false, 0);
+}
+
+u32 profilePatch(const char *name, u64 startTicks, u32 ret)
+{
+    profileAdd(name, startTicks, chronoTicks(), true, ret);
+
+    return ret;
+}
+
+void profileWrite(u32 firmType, u32 nandType)
+{
+    static char buf[160 + PROFILE_MAX_ENTRIES * 96];
+    u64 now = chronoTicks();
+    char *pos = buf;
+    u32 failedPatches = 0;
+
+    if(currentPhase != NULL) currentPhase->end = now;
+
+    pos += sprintf(pos, "boot %u %u\n", firmType, nandType);
+    for(u32 i = 0; i < entryCount; i++)
+    {
+        pos += sprintf(pos, "%s %.40s %u %u", entries[i].isPatch ? "patch" : "phase", entries[i].name,
+                       ticksToUsec(entries[i].start), ticksToUsec(entries[i].end - entries[i].start));
+
+        if(entries[i].isPatch)
+        {
+            pos += sprintf(pos, " %u", entries[i].result);
+            if(entries[i].result != 0) failedPatches++;
+        }
+
+        *pos++ = '\n';
+    }
+
+    DISKCACHESTATS cacheStats;
+    disk_get_cache_stats(&cacheStats);
+    pos += sprintf(pos, "cache %u %u %u %u %u %u\n", cacheStats.hits[0], cacheStats.misses[0], cacheStats.hits[1], cacheStats.misses[1],
+                   cacheStats.readaheadLines, cacheStats.bypasses);
+
+    pos += sprintf(pos, "end %u %u\n", ticksToUsec(now), failedPatches);
+
+    //Start over once the log gets too big, a few dozen boots are plenty for statistics
+    u32 logSize = getFileSize(PROFILE_LOG_PATH);
+    if(logSize + (u32)(pos - buf) > PROFILE_LOG_MAX_SIZE)
+    {
+        fileDelete(PROFILE_LOG_PATH);
+        logSize = 0;
+    }
+
+    fileWriteAt(buf, PROFILE_LOG_PATH, logSize, pos - buf);
+}
+
+#endif
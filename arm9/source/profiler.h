@@ -0,0 +1,70 @@
+/*
+*   This file is part of Luma3DS
+*   Copyright (C) 2016-2022 Aurora Wright, TuxSH
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+*       * Requiring preservation of specified reasonable legal notices or
+*         author attributions in that material or in the Appropriate Legal
+*         Notices displayed by works containing it.
+*       * Prohibiting misrepresentation of the origin of that material,
+*         or requiring that modified versions of such material be marked in
+*         reasonable ways as different from the original version.
+*/
+
+#pragma once
+
+#include "types.h"
+
+/*
+*   Boot timeline profiler, only built with BUILD_FOR_BOOT_PROFILING=1.
+*
+*   Each boot appends one record to /luma/boot_profile.log, times in microseconds
+*   since the first checkpoint:
+*
+*       boot <firm type> <nand type>
+*       phase <name> <start> <duration>
+*       patch <name> <start> <duration> <failed>
+*       cache <FAT/dir hits> <FAT/dir misses> <data hits> <data misses> <readahead lines> <bypassed reads>
+*       end <total> <failed patches>
+*
+*   A phase lasts until the next PROFILE_PHASE() or until the log is written.
+*   <failed> is the patch function's return value, 0 when every pattern was found.
+*   The cache line holds the FatFs sector cache counters (see disk_get_cache_stats) since power on.
+*   The patched FIRM itself is kept in /luma/firmcache_*.bin (one per NAND) and can be compared
+*   against a known good image on a computer.
+*/
+
+#define PROFILE_LOG_PATH        "boot_profile.log"
+#define PROFILE_LOG_MAX_SIZE    0x10000
+#define PROFILE_MAX_ENTRIES     64
+
+#ifdef BUILD_FOR_BOOT_PROFILING
+
+void profilePhase(const char *name);
+u32 profilePatch(const char *name, u64 startTicks, u32 ret);
+void profileWrite(u32 firmType, u32 nandType);
+
+#define PROFILE_PHASE(name)             profilePhase(name)
+#define PROFILE_PATCH(func, ...)        ({ u64 _start = chronoTicks(); profilePatch(#func, _start, func(__VA_ARGS__)); })
+#define PROFILE_WRITE(firmType, nandType) profileWrite((u32)(firmType), (u32)(nandType))
+
+#else
+
+#define PROFILE_PHASE(name)             ((void)0)
+#define PROFILE_PATCH(func, ...)        func(__VA_ARGS__)
+#define PROFILE_WRITE(firmType, nandType) ((void)0)
+
+#endif
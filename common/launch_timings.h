@@ -0,0 +1,49 @@
+/*
+*   This file is part of Luma3DS
+*   Copyright (C) 2016-2020 Aurora Wright, TuxSH
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+*       * Requiring preservation of specified reasonable legal notices or
+*         author attributions in that material or in the Appropriate Legal
+*         Notices displayed by works containing it.
+*       * Prohibiting misrepresentation of the origin of that material,
+*         or requiring that modified versions of such material be marked in
+*         reasonable ways as different from the original version.
+*/
+
+#pragma once
+
+// Shared between the loader and Rosalina
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Reply of loader command 0x104 (GetLastLaunchTimings), after the result code
+typedef struct LaunchTimings
+{
+    uint64_t titleId;
+    uint32_t codeSize;          // size of the code image in bytes
+    bool fromCodeCache;
+    uint32_t totalUsec;
+    uint32_t loadCodeUsec;      // read, decompression and patches
+    uint32_t patchUsec;
+    uint32_t createProcessUsec;
+    uint32_t pluginUsec;
+    uint32_t readCalls;         // IFile_Read calls made by the loader
+    uint32_t fsReadCalls;       // FSFILE_Read requests they needed
+} LaunchTimings;
+
+_Static_assert(sizeof(LaunchTimings) == 48, "LaunchTimings is copied as is in the reply of loader command 0x104");
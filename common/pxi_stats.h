@@ -0,0 +1,41 @@
+/*
+*   This file is part of Luma3DS
+*   Copyright (C) 2016-2020 Aurora Wright, TuxSH
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+*       * Requiring preservation of specified reasonable legal notices or
+*         author attributions in that material or in the Appropriate Legal
+*         Notices displayed by works containing it.
+*       * Prohibiting misrepresentation of the origin of that material,
+*         or requiring that modified versions of such material be marked in
+*         reasonable ways as different from the original version.
+*/
+
+#pragma once
+
+// Shared between the PXI sysmodule and Rosalina
+
+#include <stdint.h>
+
+#define PXI_STATS_SERVICE_NAME  "pxi:luma"
+
+// Reply of "pxi:luma" command 1 (GetStats), after the result code
+typedef struct PXIStats
+{
+    uint32_t nbCommandsSent, nbSendBatches;         // commands sent per PXITransferMutex acquisition = nbCommandsSent / nbSendBatches
+    uint32_t nbRepliesReceived, nbReceiverWakeups;  // replies drained per sync IRQ wakeup = nbRepliesReceived / nbReceiverWakeups
+    uint64_t sendFIFOStallTicks;                    // time spent waiting for send FIFO space, in system ticks
+} PXIStats;
@@ -0,0 +1,119 @@
+/*
+*   This file is part of Luma3DS
+*   Copyright (C) 2016-2020 Aurora Wright, TuxSH
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+*       * Requiring preservation of specified reasonable legal notices or
+*         author attributions in that material or in the Appropriate Legal
+*         Notices displayed by works containing it.
+*       * Prohibiting misrepresentation of the origin of that material,
+*         or requiring that modified versions of such material be marked in
+*         reasonable ways as different from the original version.
+*/
+
+#pragma once
+
+// Shared between the kernel extension, Rosalina and the host decoder in tests/k11_svc_trace.c.
+// /luma/svc_trace.bin and the network stream (see Rosalina's svc_trace_streaming.c) are both a plain sequence of
+// committed SvcTraceEntry records, in sequence order for each core.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SVC_TRACE_RING_SIZE         0x100 // entries per core, must be a power of 2
+#define SVC_TRACE_STREAMING_PORT    4960
+
+#define SVC_TRACE_FLAG_RETURN       (1 << 0)
+#define SVC_TRACE_CORE_SHIFT        6
+
+typedef struct SvcTraceEntry
+{
+    // Per-core entry number, starting at 1. Written before the commit word, see svcTraceEntryIsCommitted.
+    uint32_t sequence;
+    // Low 32 bits of the cycle counter of the core that wrote the entry (bits 6-7 of flags). Each core has its own
+    // counter, started at a different time, so timestamps can only be compared between entries of the same core.
+    uint32_t timestamp;
+    // For returns: cycles since the entry of the same thread into that SVC, 0 if unknown, that is when the thread
+    // returned on another core than the one it entered the SVC on (each core has its own counter).
+    uint32_t duration;
+    uint32_t thread;    // KThread address
+    uint32_t ipcHeader; // cmdbuf[0] for SendSyncRequest (request on entry, reply on return), 0 otherwise
+    uint16_t pid;
+    uint8_t svcId;
+    uint8_t flags;      // SVC_TRACE_FLAG_*, core ID in bits 6-7
+    uint32_t reserved;
+    // Written last, equal to sequence once every other field is: a reader copying the ring while the kernel
+    // writes to it sees a different (or zero) value here for a torn entry.
+    uint32_t commit;
+} SvcTraceEntry;
+
+typedef struct SvcTraceRing
+{
+    uint32_t lastSequence; // sequence of the last entry written, entry N is entries[(N - 1) % SVC_TRACE_RING_SIZE]
+    uint32_t padding;
+    SvcTraceEntry entries[SVC_TRACE_RING_SIZE];
+} SvcTraceRing;
+
+_Static_assert(sizeof(SvcTraceEntry) == 32, "SvcTraceEntry must stay 32 bytes, it is written to svc_trace.bin");
+
+static inline bool svcTraceEntryIsCommitted(const SvcTraceEntry *entry)
+{
+    return entry->sequence != 0 && entry->commit == entry->sequence;
+}
+
+static inline void svcTraceReverseEntries(SvcTraceEntry *entries, uint32_t lo, uint32_t hi)
+{
+    while(lo + 1 < hi)
+    {
+        SvcTraceEntry tmp = entries[lo];
+        entries[lo++] = entries[--hi];
+        entries[hi] = tmp;
+    }
+}
+
+// Moves the committed entries of a ring snapshot that are newer than afterSequence to the start of ring->entries,
+// oldest first, and returns their count. Torn entries, and those the kernel was writing during the copy, are dropped.
+static inline uint32_t svcTraceCollectRing(SvcTraceRing *ring, uint32_t afterSequence)
+{
+    SvcTraceEntry *entries = ring->entries, tmp;
+    uint32_t count = 0, oldest = 0;
+
+    for(uint32_t i = 0; i < SVC_TRACE_RING_SIZE; i++)
+    {
+        if(!svcTraceEntryIsCommitted(&entries[i]) || (int32_t)(entries[i].sequence - afterSequence) <= 0)
+            continue;
+
+        if(count != 0 && entries[i].sequence - afterSequence < entries[oldest].sequence - afterSequence)
+            oldest = count;
+        entries[count++] = entries[i];
+    }
+
+    // Slot order is sequence order starting from the oldest entry: rotate it to the front
+    svcTraceReverseEntries(entries, 0, oldest);
+    svcTraceReverseEntries(entries, oldest, count);
+    svcTraceReverseEntries(entries, 0, count);
+
+    // Entries written while the ring was being copied may still be out of place
+    for(uint32_t i = 1; i < count; i++)
+    {
+        uint32_t j = i;
+        for(tmp = entries[i]; j > 0 && entries[j - 1].sequence - afterSequence > tmp.sequence - afterSequence; j--)
+            entries[j] = entries[j - 1];
+        entries[j] = tmp;
+    }
+
+    return count;
+}
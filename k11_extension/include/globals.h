@@ -164,6 +164,9 @@ typedef struct CfwInfo
     u8 autobootCtrAppmemtype;
 
     u16 launchedPath[80+1];
+
+    u32 firmLoadMsec, firmColdLoadMsec;
+    bool isFirmFromCache;
 } CfwInfo;
 
 extern CfwInfo cfwInfo;
@@ -33,6 +33,26 @@
 
 #define MAX_SESSION     345
 
+// Services the IPC hooks care about. Sessions are tagged with one of these when they are registered,
+// by giving them a vtable specific to the service (see SessionInfo_GetServiceId)
+typedef enum SessionServiceId
+{
+    SERVICEID_NONE = -1, // not a registered session
+    SERVICEID_OTHER = 0,
+    SERVICEID_SRV,       // "srv:"
+    SERVICEID_SRV_PM,    // "srv:pm"
+    SERVICEID_CFG_U,     // "cfg:u"
+    SERVICEID_CFG_S,     // "cfg:s"
+    SERVICEID_CFG_I,     // "cfg:i"
+    SERVICEID_NDM_U,     // "ndm:u"
+    SERVICEID_ERR_F,     // "err:f"
+    SERVICEID_APT,       // "APT:*"
+
+    SERVICEID_COUNT,
+} SessionServiceId;
+
+#define SESSION_VTABLE_SIZE 0x10 // should be enough
+
 // the structure of sessions is apparently not the same on older versions...
 
 typedef struct SessionInfo
@@ -41,6 +61,18 @@ typedef struct SessionInfo
     char name[12];
 } SessionInfo;
 
+extern void *customSessionVtables[SERVICEID_COUNT][SESSION_VTABLE_SIZE];
+
+// Lock-free, only requires a reference on the session
+static inline SessionServiceId SessionInfo_GetServiceId(KSession *session)
+{
+    void **vtable = (void **)session->autoObject.vtable;
+    if(vtable < customSessionVtables[0] || vtable >= customSessionVtables[SERVICEID_COUNT])
+        return SERVICEID_NONE;
+    else
+        return (SessionServiceId)((vtable - customSessionVtables[0]) / SESSION_VTABLE_SIZE);
+}
+
 typedef struct LangemuAttributes
 {
     u64 titleId;
@@ -52,7 +84,7 @@ extern LangemuAttributes processLangemuAttributes[0x40];
 
 SessionInfo *SessionInfo_Lookup(KSession *session);
 SessionInfo *SessionInfo_FindFirst(const char *name);
-void SessionInfo_ChangeVtable(KSession *session);
+void SessionInfo_ChangeVtable(KSession *session, const char *name);
 void SessionInfo_Add(KSession *session, const char *name);
 void SessionInfo_Remove(KSession *session);
 
@@ -102,6 +102,24 @@ static inline bool __strex16(s16* addr, s16 val)
     return res;
 }
 
+// Bit operations on flag bytes that other cores may update at the same time
+
+static inline void atomicSetBits8(u8 *addr, u8 bits)
+{
+    s8 val;
+    do
+        val = __ldrex8((s8 *)addr);
+    while(__strex8((s8 *)addr, val | bits));
+}
+
+static inline void atomicClearBits8(u8 *addr, u8 bits)
+{
+    s8 val;
+    do
+        val = __ldrex8((s8 *)addr);
+    while(__strex8((s8 *)addr, val & ~bits));
+}
+
 static inline u32 __get_cpsr(void)
 {
     u32 cpsr;
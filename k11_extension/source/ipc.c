@@ -27,37 +27,59 @@
 
 #include "ipc.h"
 
-static SessionInfo sessionInfos[MAX_SESSION] = { {NULL} };
+// Open-addressed (linear probing) hash table, keyed by session address
+#define SESSION_INFO_TABLE_BITS 9
+#define SESSION_INFO_TABLE_SIZE (1 << SESSION_INFO_TABLE_BITS)
+
+static SessionInfo sessionInfos[SESSION_INFO_TABLE_SIZE] = { {NULL} };
 static u32 nbActiveSessions = 0;
 static KRecursiveLock sessionInfosLock = { NULL };
 
 KRecursiveLock processLangemuLock;
 LangemuAttributes processLangemuAttributes[0x40];
 
-static void *customSessionVtable[0x10] = { NULL }; // should be enough
+void *customSessionVtables[SERVICEID_COUNT][SESSION_VTABLE_SIZE] = { { NULL } };
 
-static u32 SessionInfo_FindClosestSlot(KSession *session)
+static inline u32 SessionInfo_Hash(KSession *session)
 {
-    if(nbActiveSessions == 0 || session <= sessionInfos[0].session)
-        return 0;
-    else if(session > sessionInfos[nbActiveSessions - 1].session)
-        return nbActiveSessions;
+    // Multiplicative hashing: the top bits of the product are the well-mixed ones
+    return (((u32)session >> 2) * 0x9E3779B1) >> (32 - SESSION_INFO_TABLE_BITS);
+}
 
-    u32 a = 0, b = nbActiveSessions - 1, m;
+// Returns the slot holding session, or the empty slot where it would be inserted
+static u32 SessionInfo_FindSlot(KSession *session)
+{
+    u32 id = SessionInfo_Hash(session);
+    while(sessionInfos[id].session != NULL && sessionInfos[id].session != session)
+        id = (id + 1) % SESSION_INFO_TABLE_SIZE;
+
+    return id;
+}
 
-    do
+static SessionServiceId SessionInfo_InternServiceName(const char *name)
+{
+    static const struct
+    {
+        const char *name;
+        SessionServiceId id;
+    } serviceNames[] =
     {
-        m = (a + b) / 2;
-        if(sessionInfos[m].session < session)
-            a = m;
-        else if(sessionInfos[m].session > session)
-            b = m;
-        else
-            return m;
+        { "srv:",   SERVICEID_SRV },
+        { "srv:pm", SERVICEID_SRV_PM },
+        { "cfg:u",  SERVICEID_CFG_U },
+        { "cfg:s",  SERVICEID_CFG_S },
+        { "cfg:i",  SERVICEID_CFG_I },
+        { "ndm:u",  SERVICEID_NDM_U },
+        { "err:f",  SERVICEID_ERR_F },
+    };
+
+    for(u32 i = 0; i < sizeof(serviceNames) / sizeof(serviceNames[0]); i++)
+    {
+        if(strncmp(name, serviceNames[i].name, 12) == 0)
+            return serviceNames[i].id;
     }
-    while(b - a > 1);
 
-    return b;
+    return strncmp(name, "APT:", 4) == 0 ? SERVICEID_APT : SERVICEID_OTHER;
 }
 
 SessionInfo *SessionInfo_Lookup(KSession *session)
@@ -66,11 +88,11 @@ SessionInfo *SessionInfo_Lookup(KSession *session)
     KRecursiveLock__Lock(&sessionInfosLock);
 
     SessionInfo *ret;
-    u32 id = SessionInfo_FindClosestSlot(session);
-    if(id == nbActiveSessions)
+    u32 id = SessionInfo_FindSlot(session);
+    if(sessionInfos[id].session == NULL)
         ret = NULL;
     else
-        ret = (void **)(sessionInfos[id].session->autoObject.vtable) == customSessionVtable ? &sessionInfos[id] : NULL;
+        ret = SessionInfo_GetServiceId(sessionInfos[id].session) != SERVICEID_NONE ? &sessionInfos[id] : NULL;
 
     KRecursiveLock__Unlock(&sessionInfosLock);
     KRecursiveLock__Unlock(criticalSectionLock);
@@ -83,13 +105,13 @@ SessionInfo *SessionInfo_FindFirst(const char *name)
     KRecursiveLock__Lock(criticalSectionLock);
     KRecursiveLock__Lock(&sessionInfosLock);
 
-    SessionInfo *ret;
-    u32 id;
-    for(id = 0; id < nbActiveSessions && strncmp(sessionInfos[id].name, name, 12) != 0; id++);
-    if(id == nbActiveSessions)
-        ret = NULL;
-    else
-        ret = (void **)(sessionInfos[id].session->autoObject.vtable) == customSessionVtable ? &sessionInfos[id] : NULL;
+    SessionInfo *ret = NULL;
+    for(u32 id = 0; id < SESSION_INFO_TABLE_SIZE && ret == NULL; id++)
+    {
+        if(sessionInfos[id].session != NULL && strncmp(sessionInfos[id].name, name, 12) == 0 &&
+           SessionInfo_GetServiceId(sessionInfos[id].session) != SERVICEID_NONE)
+            ret = &sessionInfos[id];
+    }
 
     KRecursiveLock__Unlock(&sessionInfosLock);
     KRecursiveLock__Unlock(criticalSectionLock);
@@ -99,31 +121,21 @@ SessionInfo *SessionInfo_FindFirst(const char *name)
 
 void SessionInfo_Add(KSession *session, const char *name)
 {
-    KAutoObject__AddReference(&session->autoObject);
-    SessionInfo_ChangeVtable(session);
-    session->autoObject.vtable->DecrementReferenceCount(&session->autoObject);
-
     KRecursiveLock__Lock(criticalSectionLock);
     KRecursiveLock__Lock(&sessionInfosLock);
 
-    if(nbActiveSessions == MAX_SESSION)
-    {
-        KRecursiveLock__Unlock(&sessionInfosLock);
-        KRecursiveLock__Unlock(criticalSectionLock);
-        return;
-    }
+    u32 id = SessionInfo_FindSlot(session);
 
-    u32 id = SessionInfo_FindClosestSlot(session);
-
-    if(id != nbActiveSessions && sessionInfos[id].session == session)
+    if(nbActiveSessions == MAX_SESSION || sessionInfos[id].session == session)
     {
         KRecursiveLock__Unlock(&sessionInfosLock);
         KRecursiveLock__Unlock(criticalSectionLock);
         return;
     }
 
-    for(u32 i = nbActiveSessions; i > id && i != 0; i--)
-        sessionInfos[i] = sessionInfos[i - 1];
+    KAutoObject__AddReference(&session->autoObject);
+    SessionInfo_ChangeVtable(session, name);
+    session->autoObject.vtable->DecrementReferenceCount(&session->autoObject);
 
     nbActiveSessions++;
 
@@ -139,26 +151,29 @@ void SessionInfo_Remove(KSession *session)
     KRecursiveLock__Lock(criticalSectionLock);
     KRecursiveLock__Lock(&sessionInfosLock);
 
-    if(nbActiveSessions == MAX_SESSION)
+    u32 hole = SessionInfo_FindSlot(session);
+
+    if(sessionInfos[hole].session == NULL)
     {
         KRecursiveLock__Unlock(&sessionInfosLock);
         KRecursiveLock__Unlock(criticalSectionLock);
         return;
     }
 
-    u32 id = SessionInfo_FindClosestSlot(session);
-
-    if(id == nbActiveSessions)
+    // Backward-shift deletion, so that no tombstones are needed
+    memset(&sessionInfos[hole], 0, sizeof(SessionInfo));
+    for(u32 id = (hole + 1) % SESSION_INFO_TABLE_SIZE; sessionInfos[id].session != NULL; id = (id + 1) % SESSION_INFO_TABLE_SIZE)
     {
-        KRecursiveLock__Unlock(&sessionInfosLock);
-        KRecursiveLock__Unlock(criticalSectionLock);
-        return;
+        u32 home = SessionInfo_Hash(sessionInfos[id].session);
+        if(((id - home) % SESSION_INFO_TABLE_SIZE) >= ((id - hole) % SESSION_INFO_TABLE_SIZE))
+        {
+            sessionInfos[hole] = sessionInfos[id];
+            memset(&sessionInfos[id], 0, sizeof(SessionInfo));
+            hole = id;
+        }
     }
 
-    for(u32 i = id; i < nbActiveSessions - 1; i++)
-        sessionInfos[i] = sessionInfos[i + 1];
-
-    memset(&sessionInfos[--nbActiveSessions], 0, sizeof(SessionInfo));
+    --nbActiveSessions;
 
     KRecursiveLock__Unlock(&sessionInfosLock);
     KRecursiveLock__Unlock(criticalSectionLock);
@@ -171,15 +186,18 @@ static void KSession__dtor_hook(KAutoObject *this)
     SessionInfo_Remove((KSession *)this);
 }
 
-void SessionInfo_ChangeVtable(KSession *session)
+void SessionInfo_ChangeVtable(KSession *session, const char *name)
 {
-    if(customSessionVtable[2] == NULL)
+    if(customSessionVtables[0][2] == NULL)
     {
-        memcpy(customSessionVtable, session->autoObject.vtable, 0x40);
         KSession__dtor_orig = session->autoObject.vtable->dtor;
-        customSessionVtable[2] = (void *)KSession__dtor_hook;
+        for(u32 i = 0; i < SERVICEID_COUNT; i++)
+        {
+            memcpy(customSessionVtables[i], session->autoObject.vtable, sizeof(customSessionVtables[i]));
+            customSessionVtables[i][2] = (void *)KSession__dtor_hook;
+        }
     }
-    session->autoObject.vtable = (Vtable__KAutoObject *)customSessionVtable;
+    session->autoObject.vtable = (Vtable__KAutoObject *)customSessionVtables[SessionInfo_InternServiceName(name)];
 }
 
 bool doLangEmu(Result *res, u32 *cmdbuf)
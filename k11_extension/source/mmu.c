@@ -1,6 +1,7 @@
 #include "mmu.h"
 #include "globals.h"
 #include "utils.h"
+#include "synchronization.h"
 
 extern u8 svcSignalingEnabled;
 
@@ -301,7 +302,7 @@ KProcessHwInfo *PatchDescriptorAccessControl(KProcessHwInfo *hwInfo, u32 **outSt
     u32 flags =  KPROCESS_GET_RVALUE(process, customFlags);
 
     if (flags & SignalOnMemLayoutChanges) {
-        svcSignalingEnabled |= 2;
+        atomicSetBits8(&svcSignalingEnabled, 2);
         *KPROCESS_GET_PTR(process, customFlags) |= MemLayoutChanged;
     }        
 
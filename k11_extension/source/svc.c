@@ -49,6 +49,7 @@
 #include "svc/CopyHandle.h"
 #include "svc/TranslateHandle.h"
 #include "svc/ControlMemoryUnsafe.h"
+#include "trace.h"
 
 void *officialSVCs[0x7E] = {NULL};
 void *alteredSvcTable[0x100] = {NULL};
@@ -109,6 +110,9 @@ void signalSvcEntry(u32 svcId)
 {
     KProcess *currentProcess = currentCoreContext->objectContext.currentProcess;
 
+    if((svcSignalingEnabled & 4) != 0 && svcId != 0xFF)
+        traceSvc(currentProcess, svcId, false);
+
     // Since DBGEVENT_SYSCALL_ENTRY is non blocking, we'll cheat using EXCEVENT_UNDEFINED_SYSCALL (debug->svcId is fortunately an u16!)
     if(debugOfProcess(currentProcess) != NULL && svcId != 0xFF && shouldSignalSyscallDebugEvent(currentProcess, svcId))
         SignalDebugEvent(DBGEVENT_OUTPUT_STRING, 0xFFFFFFFE, svcId);
@@ -119,6 +123,9 @@ void signalSvcReturn(u32 svcId)
     KProcess *currentProcess = currentCoreContext->objectContext.currentProcess;
     u32      flags = KPROCESS_GET_RVALUE(currentProcess, customFlags);
 
+    if((svcSignalingEnabled & 4) != 0 && svcId != 0xFF)
+        traceSvc(currentProcess, svcId, true);
+
     // Since DBGEVENT_SYSCALL_RETURN is non blocking, we'll cheat using EXCEVENT_UNDEFINED_SYSCALL (debug->svcId is fortunately an u16!)
     if((svcSignalingEnabled & 1) != 0 && (currentProcess) != NULL && svcId != 0xFF && shouldSignalSyscallDebugEvent(currentProcess, svcId))
         SignalDebugEvent(DBGEVENT_OUTPUT_STRING, 0xFFFFFFFF, svcId);
@@ -127,7 +134,7 @@ void signalSvcReturn(u32 svcId)
     {
         *KPROCESS_GET_PTR(currentProcess, customFlags) = flags & ~MemLayoutChanged;
         SignalEvent(KPROCESS_GET_RVALUE(currentProcess, onMemoryLayoutChangeEvent));
-        svcSignalingEnabled &= ~2;
+        atomicClearBits8(&svcSignalingEnabled, 2);
     }
 }
 
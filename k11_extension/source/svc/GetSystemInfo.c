@@ -144,6 +144,15 @@ Result GetSystemInfoHook(s64 *out, s32 type, s32 param)
                 case 0x203: // isSdMode
                     *out = (cfwInfo.flags >> 6) & 1;
                     break;
+                case 0x204: // FIRM load and patch time of this boot, in ms
+                    *out = cfwInfo.firmLoadMsec;
+                    break;
+                case 0x205: // same without the FIRM cache, 0 if unknown
+                    *out = cfwInfo.firmColdLoadMsec;
+                    break;
+                case 0x206: // isFirmFromCache
+                    *out = (s64)cfwInfo.isFirmFromCache;
+                    break;
 
                 case 0x300: // K11Ext size
                     *out = (s64)(((u64)kextBasePa << 32) | (u64)(__end__ - __start__));
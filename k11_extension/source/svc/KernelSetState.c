@@ -29,6 +29,7 @@
 #include "synchronization.h"
 #include "ipc.h"
 #include "debug.h"
+#include "trace.h"
 
 #define MAX_DEBUG 3
 
@@ -37,7 +38,7 @@ static u32 maskedPids[MAX_DEBUG];
 static u32 masks[MAX_DEBUG][8] = {0};
 static bool forceBetterSoc = false;
 
-u8 svcSignalingEnabled = 0;
+u8 svcSignalingEnabled = 0; // 1: syscall debug events, 2: memory layout change events, 4: SVC tracing. Only update it atomically
 
 bool shouldSignalSyscallDebugEvent(KProcess *process, u8 svcId)
 {
@@ -68,7 +69,7 @@ Result SetSyscallDebugEventMask(u32 pid, bool enable, const u32 *mask)
     {
         maskedPids[nbEnabled] = pid;
         memcpy(&masks[nbEnabled++], tmpMask, 32);
-        svcSignalingEnabled |= 1;
+        atomicSetBits8(&svcSignalingEnabled, 1);
     }
     else
     {
@@ -88,7 +89,7 @@ Result SetSyscallDebugEventMask(u32 pid, bool enable, const u32 *mask)
         }
         maskedPids[--nbEnabled] = 0;
         memset(&masks[nbEnabled], 0, 32);
-        svcSignalingEnabled &= ~1;
+        atomicClearBits8(&svcSignalingEnabled, 1);
     }
 
     KRecursiveLock__Unlock(&syscallDebugEventMaskLock);
@@ -210,6 +211,16 @@ Result KernelSetStateHook(u32 type, u32 varg1, u32 varg2, u32 varg3)
             }
             break;
         }
+        case 0x10008:
+        {
+            res = SetSvcTraceEnabled(varg1 != 0, varg2);
+            break;
+        }
+        case 0x10009:
+        {
+            res = CopySvcTraceRing(varg1, (SvcTraceRing *)varg2);
+            break;
+        }
         case 0x10080:
         {
             disableThreadRedirection = varg1 != 0;
@@ -28,9 +28,14 @@
 #include "svc/SendSyncRequest.h"
 #include "ipc.h"
 
-static inline bool isNdmuWorkaround(const SessionInfo *info, u32 pid)
+static inline bool isNdmuWorkaround(SessionServiceId serviceId, u32 pid)
 {
-    return info != NULL && strcmp(info->name, "ndm:u") == 0 && hasStartedRosalinaNetworkFuncsOnce && pid >= nbSection0Modules;
+    return serviceId == SERVICEID_NDM_U && hasStartedRosalinaNetworkFuncsOnce && pid >= nbSection0Modules;
+}
+
+static inline bool isCfgService(SessionServiceId serviceId, bool allowUser)
+{
+    return (allowUser && serviceId == SERVICEID_CFG_U) || serviceId == SERVICEID_CFG_S || serviceId == SERVICEID_CFG_I;
 }
 
 Result SendSyncRequestHook(Handle handle)
@@ -49,12 +54,12 @@ Result SendSyncRequestHook(Handle handle)
 
     if(isValidClientSession)
     {
+        SessionServiceId serviceId = SessionInfo_GetServiceId(clientSession->parentSession);
         switch (cmdbuf[0])
         {
             case 0x10042:
             {
-                SessionInfo *info = SessionInfo_Lookup(clientSession->parentSession);
-                if(isNdmuWorkaround(info, pid))
+                if(isNdmuWorkaround(serviceId, pid))
                 {
                     cmdbuf[0] = 0x10040;
                     cmdbuf[1] = 0;
@@ -66,8 +71,7 @@ Result SendSyncRequestHook(Handle handle)
 
             case 0x10082:
             {
-                SessionInfo *info = SessionInfo_Lookup(clientSession->parentSession);
-                if(info != NULL && (strcmp(info->name, "cfg:u") == 0 || strcmp(info->name, "cfg:s") == 0 || strcmp(info->name, "cfg:i") == 0)) // GetConfigInfoBlk2
+                if(isCfgService(serviceId, true)) // GetConfigInfoBlk2
                     skip = doLangEmu(&res, cmdbuf);
 
                 break;
@@ -75,8 +79,7 @@ Result SendSyncRequestHook(Handle handle)
 
             case 0x10800:
             {
-                SessionInfo *info = SessionInfo_Lookup(clientSession->parentSession);
-                if(info != NULL && strcmp(info->name, "err:f") == 0) // Throw
+                if(serviceId == SERVICEID_ERR_F) // Throw
                     skip = doErrfThrowHook(cmdbuf);
 
                 break;
@@ -84,8 +87,7 @@ Result SendSyncRequestHook(Handle handle)
 
             case 0x20000:
             {
-                SessionInfo *info = SessionInfo_Lookup(clientSession->parentSession);
-                if(info != NULL && (strcmp(info->name, "cfg:u") == 0 || strcmp(info->name, "cfg:s") == 0 || strcmp(info->name, "cfg:i") == 0)) // SecureInfoGetRegion
+                if(isCfgService(serviceId, true)) // SecureInfoGetRegion
                     skip = doLangEmu(&res, cmdbuf);
 
                 break;
@@ -93,8 +95,7 @@ Result SendSyncRequestHook(Handle handle)
 
             case 0x20002:
             {
-                SessionInfo *info = SessionInfo_Lookup(clientSession->parentSession);
-                if(isNdmuWorkaround(info, pid))
+                if(isNdmuWorkaround(serviceId, pid))
                 {
                     cmdbuf[0] = 0x20040;
                     cmdbuf[1] = 0;
@@ -106,8 +107,7 @@ Result SendSyncRequestHook(Handle handle)
 
             case 0x50100:
             {
-                SessionInfo *info = SessionInfo_Lookup(clientSession->parentSession);
-                if(info != NULL && (strcmp(info->name, "srv:") == 0 || (GET_VERSION_MINOR(kernelVersion) < 39 && strcmp(info->name, "srv:pm") == 0)))
+                if(serviceId == SERVICEID_SRV || (GET_VERSION_MINOR(kernelVersion) < 39 && serviceId == SERVICEID_SRV_PM))
                 {
                     char name[9] = { 0 };
                     memcpy(name, cmdbuf + 1, 8);
@@ -141,8 +141,7 @@ Result SendSyncRequestHook(Handle handle)
             {
                 if(!hasStartedRosalinaNetworkFuncsOnce)
                     break;
-                SessionInfo *info = SessionInfo_Lookup(clientSession->parentSession);
-                skip = isNdmuWorkaround(info, pid); // SuspendScheduler
+                skip = isNdmuWorkaround(serviceId, pid); // SuspendScheduler
                 if(skip)
                     cmdbuf[1] = 0;
                 break;
@@ -152,8 +151,7 @@ Result SendSyncRequestHook(Handle handle)
             {
                 if(!hasStartedRosalinaNetworkFuncsOnce)
                     break;
-                SessionInfo *info = SessionInfo_Lookup(clientSession->parentSession);
-                if(isNdmuWorkaround(info, pid)) // ResumeScheduler
+                if(isNdmuWorkaround(serviceId, pid)) // ResumeScheduler
                 {
                     cmdbuf[0] = 0x90040;
                     cmdbuf[1] = 0;
@@ -164,9 +162,7 @@ Result SendSyncRequestHook(Handle handle)
 
             case 0x00C0080: // srv: publishToSubscriber
             {
-                SessionInfo *info = SessionInfo_Lookup(clientSession->parentSession);
-
-                if (info != NULL && strcmp(info->name, "srv:") == 0 && cmdbuf[1] == 0x1002)
+                if (serviceId == SERVICEID_SRV && cmdbuf[1] == 0x1002)
                 {
                     // Wake up application thread
                     PLG__WakeAppThread();
@@ -179,9 +175,7 @@ Result SendSyncRequestHook(Handle handle)
 
             case 0x00D0080: // APT:ReceiveParameter
             {
-                SessionInfo *info = SessionInfo_Lookup(clientSession->parentSession);
-
-                if (info != NULL && strncmp(info->name, "APT:", 4) == 0 && cmdbuf[1] == 0x300)
+                if (serviceId == SERVICEID_APT && cmdbuf[1] == 0x300)
                 {
                     res = SendSyncRequest(handle);
                     skip = true;
@@ -201,8 +195,7 @@ Result SendSyncRequestHook(Handle handle)
 
             case 0x4010082:
             {
-                SessionInfo *info = SessionInfo_Lookup(clientSession->parentSession);
-                if(info != NULL && (strcmp(info->name, "cfg:s") == 0 || strcmp(info->name, "cfg:i") == 0)) // GetConfigInfoBlk4
+                if(isCfgService(serviceId, false)) // GetConfigInfoBlk4
                     skip = doLangEmu(&res, cmdbuf);
 
                 break;
@@ -210,8 +203,7 @@ Result SendSyncRequestHook(Handle handle)
 
             case 0x4020082:
             {
-                SessionInfo *info = SessionInfo_Lookup(clientSession->parentSession);
-                if(info != NULL && (strcmp(info->name, "cfg:s") == 0 || strcmp(info->name, "cfg:i") == 0)) // GetConfigInfoBlk8
+                if(isCfgService(serviceId, false)) // GetConfigInfoBlk8
                     skip = doLangEmu(&res, cmdbuf);
 
                 break;
@@ -219,8 +211,7 @@ Result SendSyncRequestHook(Handle handle)
 
             case 0x8010082:
             {
-                SessionInfo *info = SessionInfo_Lookup(clientSession->parentSession);
-                if(info != NULL && (strcmp(info->name, "cfg:s") == 0 || strcmp(info->name, "cfg:i") == 0)) // GetConfigInfoBlk4
+                if(isCfgService(serviceId, false)) // GetConfigInfoBlk4
                     skip = doLangEmu(&res, cmdbuf);
 
                 break;
@@ -228,8 +219,7 @@ Result SendSyncRequestHook(Handle handle)
 
             case 0x8020082:
             {
-                SessionInfo *info = SessionInfo_Lookup(clientSession->parentSession);
-                if(info != NULL && strcmp(info->name, "cfg:i") == 0) // GetConfigInfoBlk8
+                if(serviceId == SERVICEID_CFG_I) // GetConfigInfoBlk8
                     skip = doLangEmu(&res, cmdbuf);
 
                 break;
@@ -237,8 +227,7 @@ Result SendSyncRequestHook(Handle handle)
 
             case 0x4060000:
             {
-                SessionInfo *info = SessionInfo_Lookup(clientSession->parentSession); // SecureInfoGetRegion
-                if(info != NULL && (strcmp(info->name, "cfg:s") == 0 || strcmp(info->name, "cfg:i") == 0))
+                if(isCfgService(serviceId, false)) // SecureInfoGetRegion
                     skip = doLangEmu(&res, cmdbuf);
 
                 break;
@@ -246,8 +235,7 @@ Result SendSyncRequestHook(Handle handle)
 
             case 0x8160000:
             {
-                SessionInfo *info = SessionInfo_Lookup(clientSession->parentSession); // SecureInfoGetRegion
-                if(info != NULL && strcmp(info->name, "cfg:i") == 0)
+                if(serviceId == SERVICEID_CFG_I) // SecureInfoGetRegion
                     skip = doLangEmu(&res, cmdbuf);
 
                 break;
@@ -0,0 +1,144 @@
+/*
+*   This file is part of Luma3DS
+*   Copyright (C) 2016-2020 Aurora Wright, TuxSH
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+*       * Requiring preservation of specified reasonable legal notices or
+*         author attributions in that material or in the Appropriate Legal
+*         Notices displayed by works containing it.
+*       * Prohibiting misrepresentation of the origin of that material,
+*         or requiring that modified versions of such material be marked in
+*         reasonable ways as different from the original version.
+*/
+
+#include <string.h>
+#include "trace.h"
+#include "synchronization.h"
+#include "svc/KernelSetState.h"
+
+SvcTraceRing CTR_ALIGN(32) svcTraceRings[4] = { { 0 } };
+static u32 svcTracePidFilter = (u32)-1;
+
+// Entry timestamps of the SVCs in progress, to compute durations on return. Direct-mapped by thread: a thread
+// whose slot got reused by another one in the meantime returns with an unknown duration (0).
+typedef struct SvcTraceOpenCall
+{
+    u32 thread;
+    u32 timestamp;
+    u32 coreId;
+    u32 check; // the slot may be written by two cores at once on a collision, reject torn ones
+} SvcTraceOpenCall;
+
+#define SVC_TRACE_OPEN_CALLS_BITS   7
+
+static SvcTraceOpenCall svcTraceOpenCalls[1 << SVC_TRACE_OPEN_CALLS_BITS];
+
+static inline u32 getCycleCounter(void)
+{
+    u32 val;
+    __asm__ volatile("mrc p15, 0, %0, c15, c12, 1" : "=r"(val));
+    return val;
+}
+
+static inline SvcTraceOpenCall *getOpenCall(KThread *thread)
+{
+    return &svcTraceOpenCalls[((u32)thread * 0x9E3779B1) >> (32 - SVC_TRACE_OPEN_CALLS_BITS)];
+}
+
+static u32 getSvcDuration(KThread *thread, u32 coreId, u32 timestamp, bool isReturn)
+{
+    SvcTraceOpenCall *call = getOpenCall(thread);
+
+    if(!isReturn)
+    {
+        call->thread = (u32)thread;
+        call->timestamp = timestamp;
+        call->coreId = coreId;
+        call->check = (u32)thread ^ timestamp ^ coreId;
+        return 0;
+    }
+
+    u32 callThread = call->thread, callTimestamp = call->timestamp, callCoreId = call->coreId;
+    if(callThread != (u32)thread || callCoreId != coreId || call->check != (callThread ^ callTimestamp ^ callCoreId))
+        return 0;
+
+    call->thread = 0;
+    return timestamp - callTimestamp;
+}
+
+void traceSvc(KProcess *process, u32 svcId, bool isReturn)
+{
+    u32 pid = idOfProcess(process);
+    if(svcTracePidFilter != (u32)-1 && pid != svcTracePidFilter)
+        return;
+
+    KThread *currentThread = currentCoreContext->objectContext.currentThread;
+    u32 ipcHeader = svcId == 0x32 ? *(u32 *)((u8 *)currentThread->threadLocalStorage + 0x80) : 0;
+
+    // Each core only writes to its own ring: with interrupts disabled we can't be preempted nor migrated, the
+    // core ID, the timestamp and the slot all belong to the same core and nothing else can take that slot
+    u32 cpsr = __get_cpsr();
+    __disable_irq();
+
+    u32 coreId = getCurrentCoreID();
+    u32 timestamp = getCycleCounter();
+    SvcTraceRing *ring = &svcTraceRings[coreId];
+    u32 sequence = ring->lastSequence + 1 != 0 ? ring->lastSequence + 1 : 1;
+    SvcTraceEntry *entry = &ring->entries[(sequence - 1) % SVC_TRACE_RING_SIZE];
+
+    // Readers (CopySvcTraceRing, from any core) only accept entries whose commit word matches their sequence
+    entry->commit = 0;
+    __dmb();
+
+    entry->timestamp = timestamp;
+    entry->duration = getSvcDuration(currentThread, coreId, timestamp, isReturn);
+    entry->thread = (u32)currentThread;
+    entry->ipcHeader = ipcHeader;
+    entry->pid = (u16)pid;
+    entry->svcId = (u8)svcId;
+    entry->flags = (isReturn ? SVC_TRACE_FLAG_RETURN : 0) | (coreId << SVC_TRACE_CORE_SHIFT);
+    entry->reserved = 0;
+    entry->sequence = sequence;
+    __dmb();
+
+    entry->commit = sequence;
+    ring->lastSequence = sequence;
+
+    __set_cpsr_cx(cpsr);
+}
+
+Result SetSvcTraceEnabled(bool enable, u32 pid)
+{
+    svcTracePidFilter = pid;
+    // Don't pair returns with entries from a previous tracing session
+    memset(svcTraceOpenCalls, 0, sizeof(svcTraceOpenCalls));
+    __dmb();
+
+    if(enable)
+        atomicSetBits8(&svcSignalingEnabled, 4);
+    else
+        atomicClearBits8(&svcSignalingEnabled, 4);
+
+    return 0;
+}
+
+Result CopySvcTraceRing(u32 coreId, SvcTraceRing *out)
+{
+    if(coreId >= getNumberOfCores())
+        return 0xE0E01BFD; // out of range
+
+    return kernelToUsrMemcpy32((u32 *)out, (u32 *)&svcTraceRings[coreId], sizeof(SvcTraceRing)) ? 0 : 0xE0E01BF5;
+}
@@ -32,7 +32,7 @@
 
 #define Log_PrintP(...) ((void)0)
 
-#define MAXRELOCS 512
+#define MAXRELOCS 4096
 static _3DSX_Reloc s_relocBuf[MAXRELOCS];
 u32 ldrArgvBuf[ARGVBUF_SIZE/4];
 
@@ -45,13 +45,37 @@ typedef struct
     u32 segSizes[3];
 } _3DSX_LoadInfo;
 
-static inline u32 TranslateAddr(u32 off, _3DSX_LoadInfo* d, u32* offsets)
+// Reads the relocation tables sequentially, MAXRELOCS entries at a time regardless of table boundaries
+typedef struct
+{
+    IFile* file;
+    u32 readOffset;
+    u32 bufPos, bufCount;
+    u32 left;
+} _3DSX_RelocStream;
+
+static u32 RelocStream_Get(_3DSX_RelocStream* s, const _3DSX_Reloc** pRelocs, u32 wanted)
 {
-    if (off < offsets[0])
-        return d->segAddrs[0] + off;
-    if (off < offsets[1])
-        return d->segAddrs[1] + off - offsets[0];
-    return d->segAddrs[2] + off - offsets[1];
+    if (s->bufPos == s->bufCount)
+    {
+        u32 toRead = s->left > MAXRELOCS ? MAXRELOCS : s->left;
+        u32 readSize = toRead*sizeof(_3DSX_Reloc);
+        if (toRead == 0 || IFile_Read2(s->file, s_relocBuf, readSize, s->readOffset) != readSize)
+            return 0;
+
+        s->readOffset += readSize;
+        s->left -= toRead;
+        s->bufPos = 0;
+        s->bufCount = toRead;
+    }
+
+    u32 n = s->bufCount - s->bufPos;
+    if (n > wanted)
+        n = wanted;
+
+    *pRelocs = &s_relocBuf[s->bufPos];
+    s->bufPos += n;
+    return n;
 }
 
 bool Ldr_Get3dsxSize(u32* pSize, IFile *file)
@@ -91,7 +115,7 @@ static inline u32 min(u32 a, u32 b)
 
 Handle Ldr_CodesetFrom3dsx(const char* name, u32* codePages, u32 baseAddr, IFile *file, u64 tid)
 {
-    u32 i,j,k,m;
+    u32 i,j,k;
     Result res;
     _3DSX_Header hdr;
     IFile_Read2(file, &hdr, sizeof(hdr), 0);
@@ -107,7 +131,6 @@ Handle Ldr_CodesetFrom3dsx(const char* name, u32* codePages, u32 baseAddr, IFile
     d.segAddrs[1] = d.segAddrs[0] + d.segSizes[0];
     d.segAddrs[2] = d.segAddrs[1] + d.segSizes[1];
 
-    u32 offsets[2] = { d.segSizes[0], d.segSizes[0] + d.segSizes[1] };
     u32* segLimit = d.segPtrs[2] + d.segSizes[2];
 
     u32 readOffset = hdr.headerSize;
@@ -117,54 +140,41 @@ Handle Ldr_CodesetFrom3dsx(const char* name, u32* codePages, u32 baseAddr, IFile
     u32* extraPage = (u32*)((char*)d.segPtrs[2] + d.segSizes[2]);
     u32 extraPageAddr = d.segAddrs[2] + d.segSizes[2];
 
-    // Read the relocation headers
-    for (i = 0; i < 3; i ++)
-    {
-        if (IFile_Read2(file, &extraPage[i*nRelocTables], hdr.relocHdrSize, readOffset) != hdr.relocHdrSize)
-        {
-            Log_PrintP("Impossible de lire le relheader %d", i);
-            return 0;
-        }
-        readOffset += hdr.relocHdrSize;
-    }
-
-    // Read the code segment
-    if (IFile_Read2(file, d.segPtrs[0], hdr.codeSegSize, readOffset) != hdr.codeSegSize)
+    // Read the relocation headers, they are contiguous both in the file and in the extra page
+    if (IFile_Read2(file, extraPage, 3*hdr.relocHdrSize, readOffset) != 3*hdr.relocHdrSize)
     {
-        Log_PrintP("Impossible de lire le segment de code");
+        Log_PrintP("Impossible de lire les relheaders");
         return 0;
     }
-    readOffset += hdr.codeSegSize;
+    readOffset += 3*hdr.relocHdrSize;
 
-    // Read the rodata segment
-    if (IFile_Read2(file, d.segPtrs[1], hdr.rodataSegSize, readOffset) != hdr.rodataSegSize)
+    // Read the code, rodata and data segments. They follow each other in the file, and in memory
+    // too whenever the previous segment fills its pages, in which case they are read together
+    u32 loadSizes[3] = { hdr.codeSegSize, hdr.rodataSegSize, hdr.dataSegSize - hdr.bssSize };
+    for (i = 0; i < 3; i = j)
     {
-        Log_PrintP("Impossible de lire le segment rodata");
-        return 0;
-    }
-    readOffset += hdr.rodataSegSize;
+        u32 readSize = loadSizes[i];
+        for (j = i + 1; j < 3 && loadSizes[j - 1] == d.segSizes[j - 1]; j ++)
+            readSize += loadSizes[j];
 
-    // Read the data segment
-    u32 dataLoadSegSize = hdr.dataSegSize - hdr.bssSize;
-    if (IFile_Read2(file, d.segPtrs[2], dataLoadSegSize, readOffset) != dataLoadSegSize)
-    {
-        Log_PrintP("Impossible de lire le segment de donnees");
-        return 0;
+        if (IFile_Read2(file, d.segPtrs[i], readSize, readOffset) != readSize)
+        {
+            Log_PrintP("Impossible de lire le segment %d", i);
+            return 0;
+        }
+        readOffset += readSize;
     }
-    readOffset += dataLoadSegSize;
 
-    // Relocate the segments
+    // Relocate the segments, the relocation tables are all read in large sequential chunks
+    _3DSX_RelocStream stream = { file, readOffset, 0, 0, 0 };
+    for (i = 0; i < 3*nRelocTables; i ++)
+        stream.left += extraPage[i];
+
     for (i = 0; i < 3; i ++)
     {
         for (j = 0; j < nRelocTables; j ++)
         {
-            int nRelocs = extraPage[i*nRelocTables + j];
-            if (j >= (sizeof(_3DSX_RelocHdr)/4))
-            {
-                // Not using this header
-                readOffset += nRelocs;
-                continue;
-            }
+            u32 nRelocs = extraPage[i*nRelocTables + j];
 
             u32* pos = (u32*)d.segPtrs[i];
             u32* endPos = pos + (d.segSizes[i]/4);
@@ -172,55 +182,58 @@ Handle Ldr_CodesetFrom3dsx(const char* name, u32* codePages, u32 baseAddr, IFile
 
             while (nRelocs)
             {
-                u32 toDo = nRelocs > MAXRELOCS ? MAXRELOCS : nRelocs;
-                nRelocs -= toDo;
-
-                u32 readSize = toDo*sizeof(_3DSX_Reloc);
-                if (IFile_Read2(file, s_relocBuf, readSize, readOffset) != readSize)
+                const _3DSX_Reloc* relocs;
+                u32 toDo = RelocStream_Get(&stream, &relocs, nRelocs);
+                if (toDo == 0)
                 {
                     Log_PrintP("Impossible de lire la table de relocalisation (%d,%d)", i, j);
                     return 0;
                 }
-                readOffset += readSize;
+                nRelocs -= toDo;
+
+                // Not using this header
+                if (j >= (sizeof(_3DSX_RelocHdr)/4))
+                    continue;
 
                 for (k = 0; k < toDo && pos < endPos; k ++)
                 {
-                    pos += s_relocBuf[k].skip;
-                    u32 nPatches = s_relocBuf[k].patch;
-                    for (m = 0; m < nPatches && pos < endPos; m ++)
+                    pos += relocs[k].skip;
+                    u32* patchEnd = pos + relocs[k].patch;
+                    if (patchEnd > endPos)
+                        patchEnd = endPos;
+
+                    // The segments are laid out contiguously from baseAddr, so translating
+                    // an offset of the original layout is just adding baseAddr to it
+                    if (j == 0)
                     {
-                        u32 inAddr = baseAddr + 4*(pos - codePages);
-                        u32 origData = *pos;
-                        u32 subType = origData >> (32-4);
-                        u32 addr = TranslateAddr(origData &~ 0xF0000000, &d, offsets);
-                        //Log_PrintP("%08lX<-%08lX", inAddr, addr);
-                        switch (j)
+                        for (; pos < patchEnd; pos ++)
                         {
-                            case 0:
+                            u32 origData = *pos;
+                            if (origData >> (32-4) != 0)
                             {
-                                if (subType != 0)
-                                {
-                                    Log_PrintP("Sous-type de relocalisation absolue non pris en charge (%lu)", subType);
-                                    return 0;
-                                }
-                                *pos = addr;
-                                break;
+                                Log_PrintP("Sous-type de relocalisation absolue non pris en charge (%lu)", origData >> (32-4));
+                                return 0;
                             }
-                            case 1:
+                            *pos = baseAddr + origData;
+                        }
+                    }
+                    else
+                    {
+                        // Both the target and the patched word are relative to baseAddr
+                        u32 inOffset = 4*(pos - codePages);
+                        for (; pos < patchEnd; pos ++, inOffset += 4)
+                        {
+                            u32 origData = *pos;
+                            u32 data = (origData &~ 0xF0000000) - inOffset;
+                            switch (origData >> (32-4))
                             {
-                                u32 data = addr - inAddr;
-                                switch (subType)
-                                {
-                                    case 0: *pos = data;            break; // 32-bit signed offset
-                                    case 1: *pos = data &~ BIT(31); break; // 31-bit signed offset
-                                    default:
-                                        Log_PrintP("Sous-type de relocalisation relative non pris en charge (%lu)", subType);
-                                        return 0;
-                                }
-                                break;
+                                case 0: *pos = data;            break; // 32-bit signed offset
+                                case 1: *pos = data &~ BIT(31); break; // 31-bit signed offset
+                                default:
+                                    Log_PrintP("Sous-type de relocalisation relative non pris en charge (%lu)", origData >> (32-4));
+                                    return 0;
                             }
                         }
-                        pos++;
                     }
                 }
             }
@@ -262,7 +262,7 @@ static inline bool ApplyCodeBpsPatch(u64 prog_id, u8 *code, u32 size)
     {
         char bps_path[] = "/luma/titles/0000000000000000/code.bps";
         progIdToStr(bps_path + 28, prog_id);
-        if(!patch_file.Open(bps_path, FS_OPEN_READ))
+        if(!(getTitleOverrides(prog_id) & TITLE_OVERRIDE_CODE_BPS) || !patch_file.Open(bps_path, FS_OPEN_READ))
             return true;
     }
 
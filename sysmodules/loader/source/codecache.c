@@ -0,0 +1,205 @@
+#include <3ds.h>
+#include "codecache.h"
+#include "patcher.h"
+#include "ifile.h"
+#include "strings.h"
+
+#define CODE_CACHE_FORMAT_VERSION   2
+
+typedef struct CodeCacheFileStamp
+{
+    u64 size,
+        mtime;
+} CodeCacheFileStamp;
+
+typedef struct CodeCacheKey
+{
+    u32 lumaCommitHash; //The patches, and where the LayeredFS payload keeps its data, depend on the build
+    u8 lumaVersionMajor,
+       lumaVersionMinor,
+       lumaVersionBuild;
+    ExHeader_Info exheaderInfo; //Title ID, remaster version and code layout
+    u32 config,
+        multiConfig,
+        bootConfig;
+    bool isN3DS,
+         isLumaWithKext,
+         hasLayeredFs;
+    CodeCacheFileStamp codeStamp,
+                       ipsStamp,
+                       bpsStamp;
+} CodeCacheKey;
+
+typedef struct CodeCacheHeader
+{
+    char magic[4];
+    u32 formatVersion;
+    CodeCacheKey key;
+    LayeredFsLayout layeredFs;
+    u32 codeSize;
+    u64 coldLaunchMsec,
+        warmLaunchMsec;
+} CodeCacheHeader;
+
+static CodeCacheHeader codeCacheHeader;
+static bool isCodeCacheKeyValid = false;
+static char codeCachePath[] = "/luma/codecache/0000000000000000.bin";
+
+static inline FS_ArchiveID getLumaArchiveId(void)
+{
+    return isSdMode ? ARCHIVE_SDMC : ARCHIVE_NAND_RW;
+}
+
+static inline u64 ticksToMsec(u64 ticks)
+{
+    return ticks / (SYSCLOCK_ARM11 / 1000);
+}
+
+static void stampLumaFile(CodeCacheFileStamp *stamp, FS_Archive archive, const char *path)
+{
+    IFile file;
+    u16 path16[64];
+    u32 i;
+
+    stamp->size = 0;
+    stamp->mtime = 0;
+
+    if(R_FAILED(IFile_OpenFromArchive(&file, archive, fsMakePath(PATH_ASCII, path), FS_OPEN_READ))) return;
+
+    //Keep the stamp of a missing file distinct from the one of an empty file
+    if(R_FAILED(IFile_GetSize(&file, &stamp->size))) stamp->size = 0;
+    stamp->size |= 1ULL << 63;
+    IFile_Close(&file);
+
+    for(i = 0; path[i] != 0 && i < sizeof(path16) / sizeof(u16) - 1; i++) path16[i] = path[i];
+    path16[i] = 0;
+
+    FSUSER_ControlArchive(archive, ARCHIVE_ACTION_GET_TIMESTAMP, path16, (i + 1) * sizeof(u16), &stamp->mtime, sizeof(stamp->mtime));
+}
+
+static bool lumaDirExists(FS_Archive archive, const char *path)
+{
+    Handle handle;
+
+    if(R_FAILED(FSUSER_OpenDirectory(&handle, archive, fsMakePath(PATH_ASCII, path)))) return false;
+
+    FSDIR_Close(handle);
+
+    return true;
+}
+
+static bool computeCodeCacheKey(CodeCacheKey *key, const ExHeader_Info *exhi)
+{
+    u64 titleId = exhi->aci.local_caps.title_id;
+    FS_Archive archive;
+
+    memset(key, 0, sizeof(CodeCacheKey));
+    key->lumaCommitHash = COMMIT_HASH;
+    key->lumaVersionMajor = VERSION_MAJOR;
+    key->lumaVersionMinor = VERSION_MINOR;
+    key->lumaVersionBuild = VERSION_BUILD;
+    memcpy(&key->exheaderInfo, exhi, sizeof(ExHeader_Info));
+    key->config = config;
+    key->multiConfig = multiConfig;
+    key->bootConfig = bootConfig;
+    key->isN3DS = isN3DS;
+    key->isLumaWithKext = isLumaWithKext;
+
+    if(R_FAILED(FSUSER_OpenArchive(&archive, getLumaArchiveId(), fsMakePath(PATH_EMPTY, "")))) return false;
+
+    if(!lumaDirExists(archive, "/luma/codecache"))
+    {
+        FSUSER_CloseArchive(archive);
+        return false;
+    }
+
+    //Stamp the files themselves rather than trusting the folder listing, they can be replaced in place
+    char path[] = "/luma/titles/0000000000000000/code.bin";
+    progIdToStr(path + 28, titleId);
+    stampLumaFile(&key->codeStamp, archive, path);
+
+    memcpy(path + 30, "code.ips", 8);
+    stampLumaFile(&key->ipsStamp, archive, path);
+
+    memcpy(path + 30, "code.bps", 8);
+    stampLumaFile(&key->bpsStamp, archive, path);
+
+    //The manifest is rebuilt on every launch, only whether the folder exists matters
+    key->hasLayeredFs = (getTitleOverrides(titleId) & TITLE_OVERRIDE_ROMFS) != 0;
+
+    FSUSER_CloseArchive(archive);
+
+    return true;
+}
+
+bool codeCacheLoad(const ExHeader_Info *exhi, u8 *code, u32 size, u64 startTick)
+{
+    CodeCacheHeader *header = &codeCacheHeader;
+    IFile file;
+    u64 total;
+
+    progIdToStr(codeCachePath + 31, exhi->aci.local_caps.title_id);
+
+    memset(header, 0, sizeof(CodeCacheHeader));
+    isCodeCacheKeyValid = computeCodeCacheKey(&header->key, exhi);
+    if(!isCodeCacheKeyValid) return false;
+
+    if(R_FAILED(IFile_Open(&file, getLumaArchiveId(), fsMakePath(PATH_EMPTY, ""), fsMakePath(PATH_ASCII, codeCachePath), FS_OPEN_READ | FS_OPEN_WRITE)))
+        return false;
+
+    static CodeCacheHeader cached;
+    bool ret = false;
+
+    if(R_FAILED(IFile_Read(&file, &total, &cached, sizeof(CodeCacheHeader))) || total != sizeof(CodeCacheHeader) ||
+       memcmp(cached.magic, "CCHE", 4) != 0 || cached.formatVersion != CODE_CACHE_FORMAT_VERSION ||
+       memcmp(&cached.key, &header->key, sizeof(CodeCacheKey)) != 0 || cached.codeSize != size ||
+       (cached.layeredFs.manifestSize != 0 && cached.layeredFs.manifestOffset + cached.layeredFs.manifestSize > size) ||
+       R_FAILED(IFile_Read(&file, &total, code, size)) || total != size ||
+       !patchCachedCode(exhi->aci.local_caps.title_id, code, size, &cached.layeredFs))
+        goto exit;
+
+    //Only the first warm launch is recorded, the later ones don't write to the SD card
+    if(cached.warmLaunchMsec == 0)
+    {
+        cached.warmLaunchMsec = ticksToMsec(svcGetSystemTick() - startTick);
+        file.pos = 0;
+        IFile_Write(&file, &total, &cached, sizeof(CodeCacheHeader), 0);
+    }
+
+    ret = true;
+
+exit:
+    IFile_Close(&file);
+
+    return ret;
+}
+
+void codeCacheStore(const u8 *code, u32 size, u64 startTick)
+{
+    CodeCacheHeader *header = &codeCacheHeader;
+    IFile file;
+    u64 total;
+
+    if(!isCodeCacheKeyValid ||
+       R_FAILED(IFile_Open(&file, getLumaArchiveId(), fsMakePath(PATH_EMPTY, ""), fsMakePath(PATH_ASCII, codeCachePath), FS_OPEN_WRITE | FS_OPEN_CREATE)))
+        return;
+
+    memcpy(&header->layeredFs, &layeredFsLayout, sizeof(LayeredFsLayout));
+    header->codeSize = size;
+    header->coldLaunchMsec = ticksToMsec(svcGetSystemTick() - startTick);
+    header->warmLaunchMsec = 0;
+
+    //Write the magic last so that an interrupted write can't be mistaken for a valid cache
+    if(R_SUCCEEDED(IFile_Write(&file, &total, header, sizeof(CodeCacheHeader), 0)) && total == sizeof(CodeCacheHeader) &&
+       R_SUCCEEDED(IFile_SetSize(&file, sizeof(CodeCacheHeader) + size)) &&
+       R_SUCCEEDED(IFile_Write(&file, &total, code, size, 0)) && total == size)
+    {
+        memcpy(header->magic, "CCHE", 4);
+        header->formatVersion = CODE_CACHE_FORMAT_VERSION;
+
+        file.pos = 0;
+        IFile_Write(&file, &total, header, sizeof(CodeCacheHeader), FS_WRITE_FLUSH);
+    }
+
+    IFile_Close(&file);
+}
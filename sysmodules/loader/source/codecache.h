@@ -0,0 +1,9 @@
+#pragma once
+
+#include <3ds/types.h>
+#include <3ds/exheader.h>
+
+/* Per-title cache of the decompressed and patched code, opt-in by creating /luma/codecache.
+   codeCacheStore must follow a codeCacheLoad that missed, for the same launch */
+bool codeCacheLoad(const ExHeader_Info *exhi, u8 *code, u32 size, u64 startTick);
+void codeCacheStore(const u8 *code, u32 size, u64 startTick);
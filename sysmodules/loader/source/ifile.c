@@ -1,6 +1,9 @@
 #include <3ds.h>
+#include <string.h>
 #include "ifile.h"
 
+static IFileReadStats readStats; // not synchronized, only meant as a rough indication
+
 Result IFile_Open(IFile *file, FS_ArchiveID archiveId, FS_Path archivePath, FS_Path filePath, u32 flags)
 {
   Result res;
@@ -8,6 +11,7 @@ Result IFile_Open(IFile *file, FS_ArchiveID archiveId, FS_Path archivePath, FS_P
   res = FSUSER_OpenFileDirectly(&file->handle, archiveId, archivePath, filePath, flags, 0);
   file->pos = 0;
   file->size = 0;
+  file->readBuffer = NULL;
   return res;
 }
 
@@ -18,6 +22,7 @@ Result IFile_OpenFromArchive(IFile *file, FS_Archive archive, FS_Path filePath,
   res = FSUSER_OpenFile(&file->handle, archive, filePath, flags, 0);
   file->pos = 0;
   file->size = 0;
+  file->readBuffer = NULL;
   return res;
 }
 
@@ -43,10 +48,25 @@ Result IFile_SetSize(IFile *file, u64 size)
 
   res = FSFILE_SetSize(file->handle, size);
   if (R_SUCCEEDED(res)) file->size = size;
+  file->readBufferLen = 0;
   return res;
 }
 
-Result IFile_Read(IFile *file, u64 *total, void *buffer, u32 len)
+void IFile_SetReadBuffer(IFile *file, void *buffer, u32 size)
+{
+  file->readBuffer = (u8 *)buffer;
+  file->readBufferSize = size;
+  file->readBufferLen = 0;
+  file->readBufferPos = 0;
+  file->readWindow = size < IFILE_READAHEAD_MIN ? size : IFILE_READAHEAD_MIN;
+}
+
+void IFile_GetReadStats(IFileReadStats *out)
+{
+  *out = readStats;
+}
+
+static Result IFile_ReadDirect(IFile *file, u64 *total, void *buffer, u32 len)
 {
   u32 read;
   u32 left;
@@ -66,11 +86,14 @@ Result IFile_Read(IFile *file, u64 *total, void *buffer, u32 len)
   while (1)
   {
     res = FSFILE_Read(file->handle, &read, file->pos, buf, left);
+    readStats.fsCalls++;
     if (R_FAILED(res) || read == 0)
     {
       break;
     }
 
+    readStats.fsBytes += read;
+
     cur += read;
     file->pos += read;
     if (read == left)
@@ -85,6 +108,90 @@ Result IFile_Read(IFile *file, u64 *total, void *buffer, u32 len)
   return res;
 }
 
+static Result IFile_ReadBuffered(IFile *file, u64 *total, void *buffer, u32 len)
+{
+  u32 read;
+  u32 left;
+  char *buf;
+  u64 cur;
+  u64 bufferEnd;
+  Result res;
+
+  buf = (char *)buffer;
+  cur = 0;
+  left = len;
+  res = 0;
+  while (left > 0)
+  {
+    bufferEnd = file->readBufferPos + file->readBufferLen;
+    if (file->pos >= file->readBufferPos && file->pos < bufferEnd)
+    {
+      u32 offset = (u32)(file->pos - file->readBufferPos);
+      read = file->readBufferLen - offset;
+      if (read > left) read = left;
+
+      memcpy(buf, file->readBuffer + offset, read);
+      cur += read;
+      file->pos += read;
+      buf += read;
+      left -= read;
+      continue;
+    }
+
+    if (file->readBufferLen != 0 && file->pos == bufferEnd)
+    {
+      file->readWindow *= 2;
+      if (file->readWindow > file->readBufferSize) file->readWindow = file->readBufferSize;
+    }
+    else
+      file->readWindow = file->readBufferSize < IFILE_READAHEAD_MIN ? file->readBufferSize : IFILE_READAHEAD_MIN;
+
+    // Large reads go straight to the caller's buffer
+    if (left >= file->readWindow)
+    {
+      u64 direct;
+      res = IFile_ReadDirect(file, &direct, buf, left);
+      cur += direct;
+      file->readBufferPos = file->pos;
+      file->readBufferLen = 0;
+      break;
+    }
+
+    res = FSFILE_Read(file->handle, &read, file->pos, file->readBuffer, file->readWindow);
+    readStats.fsCalls++;
+    file->readBufferPos = file->pos;
+    file->readBufferLen = R_SUCCEEDED(res) ? read : 0;
+    readStats.fsBytes += file->readBufferLen;
+    if (file->readBufferLen == 0)
+    {
+      break;
+    }
+  }
+
+  *total = cur;
+  return res;
+}
+
+Result IFile_Read(IFile *file, u64 *total, void *buffer, u32 len)
+{
+  Result res;
+
+  if (len == 0)
+  {
+    *total = 0;
+    return 0;
+  }
+
+  if (file->readBuffer != NULL)
+    res = IFile_ReadBuffered(file, total, buffer, len);
+  else
+    res = IFile_ReadDirect(file, total, buffer, len);
+
+  readStats.calls++;
+  readStats.bytes += *total;
+  return res;
+}
+
 Result IFile_Write(IFile *file, u64 *total, const void *buffer, u32 len, u32 flags)
 {
   u32 written;
@@ -99,6 +206,7 @@ Result IFile_Write(IFile *file, u64 *total, const void *buffer, u32 len, u32 fla
     return 0;
   }
 
+  file->readBufferLen = 0;
   buf = (char *)buffer;
   cur = 0;
   left = len;
@@ -0,0 +1,136 @@
+#include <3ds.h>
+#include "layeredfs.h"
+#include "memory.h"
+
+#define LAYEREDFS_MANIFEST_MAX_DEPTH    16
+#define LAYEREDFS_MANIFEST_MAX_PATH     0x200
+#define LAYEREDFS_MANIFEST_PENDING_SIZE 0x1000
+#define LAYEREDFS_MANIFEST_BATCH_SIZE   4
+
+u32 hashLayeredFsPath(const u16 *path)
+{
+    u32 hash = 0x811C9DC5;
+
+    for(; *path != 0; path++)
+    {
+        u32 c = *path;
+
+        if(c - 'A' <= 'Z' - 'A') c += 0x20;
+        hash = (hash ^ c) * 0x01000193;
+    }
+
+    return hash;
+}
+
+//Depth first but without recursion, the loader's stack is small. Found folders wait in pending as their depth followed by their
+//name: popped in reverse order, a folder's parent is always the last folder listed at the depth above it
+static bool addLayeredFsDirectories(FS_Archive archive, u16 *path, u32 rootLength, u32 *manifest, u32 mask)
+{
+    static u16 pending[LAYEREDFS_MANIFEST_PENDING_SIZE];
+    static FS_DirectoryEntry entries[LAYEREDFS_MANIFEST_BATCH_SIZE];
+    u32 pathLengths[LAYEREDFS_MANIFEST_MAX_DEPTH + 1],
+        pendingLength = 0,
+        length = rootLength,
+        depth = 0;
+    bool ret = true;
+
+    for(;;)
+    {
+        Handle handle;
+        u32 entriesRead;
+
+        pathLengths[depth] = length;
+
+        if(R_FAILED(FSUSER_OpenDirectory(&handle, archive, fsMakePath(PATH_UTF16, path)))) return false;
+
+        path[length] = '/';
+
+        while(ret)
+        {
+            if(R_FAILED(FSDIR_Read(handle, &entriesRead, LAYEREDFS_MANIFEST_BATCH_SIZE, entries)))
+            {
+                ret = false;
+                break;
+            }
+
+            if(entriesRead == 0) break;
+
+            for(u32 i = 0; ret && i < entriesRead; i++)
+            {
+                const FS_DirectoryEntry *entry = &entries[i];
+                u32 nameLength;
+                bool isAscii = true;
+
+                for(nameLength = 0; entry->name[nameLength] != 0; nameLength++)
+                    if(entry->name[nameLength] >= 0x80) isAscii = false;
+
+                //The hash only folds ASCII letters, as does checkManifest, while FAT folds the case of other letters too
+                if(!isAscii || length + 1 + nameLength >= LAYEREDFS_MANIFEST_MAX_PATH)
+                {
+                    ret = false;
+                    break;
+                }
+
+                if(entry->attributes & FS_ATTRIBUTE_DIRECTORY)
+                {
+                    if(depth + 1 > LAYEREDFS_MANIFEST_MAX_DEPTH || pendingLength + nameLength + 2 > LAYEREDFS_MANIFEST_PENDING_SIZE) ret = false;
+                    else
+                    {
+                        pending[pendingLength] = (u16)(depth + 1);
+                        memcpy(pending + pendingLength + 1, entry->name, (nameLength + 1) * sizeof(u16));
+                        pendingLength += nameLength + 2;
+                    }
+                }
+                else
+                {
+                    memcpy(path + length + 1, entry->name, (nameLength + 1) * sizeof(u16));
+
+                    u32 hash = hashLayeredFsPath(path + rootLength),
+                        bit1 = hash & mask,
+                        bit2 = ((hash >> 16) | (hash << 16)) & mask;
+
+                    manifest[bit1 >> 5] |= 1u << (bit1 & 31);
+                    manifest[bit2 >> 5] |= 1u << (bit2 & 31);
+                }
+            }
+        }
+
+        FSDIR_Close(handle);
+
+        if(!ret || pendingLength == 0) break;
+
+        //Next folder: the last one found
+        u32 start;
+        for(start = pendingLength - 1; start > 0 && pending[start - 1] != 0; start--);
+
+        depth = pending[start];
+        length = pathLengths[depth - 1];
+        path[length] = '/';
+        memcpy(path + length + 1, pending + start + 1, (pendingLength - start - 1) * sizeof(u16));
+        length += pendingLength - start - 1;
+        pendingLength = start;
+    }
+
+    return ret;
+}
+
+u32 buildLayeredFsManifest(u32 archiveId, const char *dirPath, u32 *manifest, u32 manifestSize)
+{
+    static u16 path[LAYEREDFS_MANIFEST_MAX_PATH];
+    FS_Archive archive;
+    u32 length,
+        mask = manifestSize * 8 - 1;
+
+    for(length = 0; dirPath[length] != 0; length++) path[length] = dirPath[length];
+    path[length] = 0;
+
+    memset(manifest, 0, manifestSize);
+
+    if(R_FAILED(FSUSER_OpenArchive(&archive, archiveId, fsMakePath(PATH_EMPTY, "")))) return 0;
+
+    if(!addLayeredFsDirectories(archive, path, length, manifest, mask)) mask = 0;
+
+    FSUSER_CloseArchive(archive);
+
+    return mask;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <3ds/types.h>
+
+#define LAYEREDFS_MANIFEST_MIN_SIZE     0x40
+#define LAYEREDFS_MANIFEST_MAX_SIZE     0x1000
+
+/* Manifest of a LayeredFS folder: a bloom filter of the hashes of the paths of its files, relative
+   to the folder, that checkManifest in romfsredir.s looks paths up in before probing the SD card.
+   Each file sets two bits: the hash and the hash rotated by 16, both masked */
+
+//Must match checkManifest in romfsredir.s
+u32 hashLayeredFsPath(const u16 *path);
+
+//manifestSize is a power of two. Returns the bit mask of the manifest, 0 (always look in the folder) if it couldn't be built
+u32 buildLayeredFsManifest(u32 archiveId, const char *dirPath, u32 *manifest, u32 manifestSize);
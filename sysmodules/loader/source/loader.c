@@ -5,6 +5,8 @@
 #include "ifile.h"
 #include "util.h"
 #include "hbldr.h"
+#include "codecache.h"
+#include "launch_timings.h"
 
 #define SYSMODULE_CXI_COOKIE_MASK 0xEEEE000000000000ull
 
@@ -28,9 +30,12 @@ static ExHeader_Info g_exheaderInfo;
 // Last application exheader info, for use with custom cmd 0x102
 static ExHeader_Info g_lastAppExheaderInfo;
 
+// Timings of the last LoadProcess, for use with custom cmd 0x104
+static LaunchTimings g_lastLaunchTimings;
+
 static IFile g_cached_sysmoduleCxiFile;
 static u64 g_cached_sysmoduleCxiCookie;
-static Ncch g_cached_sysmoduleCxiNcch;
+static const SysmoduleCxiHeaders *g_cached_sysmoduleCxiHeaders;
 
 typedef struct ContentPath {
     u32 contentType;
@@ -53,7 +58,62 @@ typedef struct prog_addrs_t
     u32 total_size;
 } prog_addrs_t;
 
-static int lzss_decompress(u8 *end)
+// Compressed code is read backwards, chunk by chunk, by a helper thread so that
+// decompression (which also walks the data backwards) overlaps with the reads
+#define CODE_READ_CHUNK_SIZE    0x20000
+
+typedef struct CodeReader
+{
+    IFile *file;
+    u8 *dst;
+    u32 size;
+    const u8 *volatile readFrom; //< [readFrom, dst + size) has been read
+    volatile Result res;
+    Handle chunkReadEvent;
+} CodeReader;
+
+static CodeReader g_codeReader;
+static u8 CTR_ALIGN(8) g_codeReaderStack[0x1000];
+
+static void codeReaderThreadMain(void *arg)
+{
+    CodeReader *reader = (CodeReader *)arg;
+    u32 end = reader->size;
+
+    while (end > 0)
+    {
+        u32 start = (end - 1) & ~(CODE_READ_CHUNK_SIZE - 1);
+        u64 total = 0;
+        Result res = IFile_ReadAt(reader->file, &total, reader->dst + start, start, end - start);
+
+        if (R_FAILED(res))
+        {
+            reader->res = res;
+            svcSignalEvent(reader->chunkReadEvent);
+            break;
+        }
+
+        __dmb();
+        reader->readFrom = reader->dst + start;
+        svcSignalEvent(reader->chunkReadEvent);
+        end = start;
+    }
+
+    svcExitThread();
+}
+
+static bool waitForCode(CodeReader *reader, const u8 *ptr)
+{
+    if (reader == NULL)
+        return true;
+
+    while (ptr < reader->readFrom && R_SUCCEEDED(reader->res))
+        svcWaitSynchronization(reader->chunkReadEvent, -1LL);
+
+    return ptr >= reader->readFrom;
+}
+
+static int lzss_decompress(u8 *end, CodeReader *reader)
 {
     unsigned int v1; // r1@2
     u8 *v2; // r2@2
@@ -72,7 +132,7 @@ static int lzss_decompress(u8 *end)
     int ret;
 
     ret = 0;
-    if ( end )
+    if ( end && waitForCode(reader, end - 8) )
     {
         v1 = *((u32 *)end - 2);
         v2 = &end[*((u32 *)end - 1)];
@@ -80,6 +140,9 @@ static int lzss_decompress(u8 *end)
         v4 = &end[-(v1 & 0xFFFFFF)];
         while ( v3 > v4 )
         {
+            // One flag byte and up to 8 tokens of at most 2 bytes each
+            if ( !waitForCode(reader, v3 - 17 > v4 ? v3 - 17 : v4) )
+                return ret;
             v6 = *(v3-- - 1);
             v5 = v6;
             v7 = 8;
@@ -119,6 +182,11 @@ static int lzss_decompress(u8 *end)
     return ret;
 }
 
+static inline u32 ticksToUsec(u64 ticks)
+{
+    return (u32)(ticks * 1000000 / SYSCLOCK_ARM11);
+}
+
 static inline bool IsSysmoduleId(u64 tid)
 {
     return (tid >> 32) == 0x00040130;
@@ -141,6 +209,7 @@ static void InvalidateCachedCxiFile(void)
     memset(&g_cached_sysmoduleCxiFile, 0, sizeof(IFile));
 
     g_cached_sysmoduleCxiCookie = 0;
+    g_cached_sysmoduleCxiHeaders = NULL;
 }
 
 static Result allocateProgramMemoryWrapper(prog_addrs_t *mapped, const ExHeader_Info *exhi, const prog_addrs_t *vaddr)
@@ -152,6 +221,41 @@ static Result allocateProgramMemoryWrapper(prog_addrs_t *mapped, const ExHeader_
     return allocateProgramMemory(exhi, mapped->text_addr, mapped->total_size << 12);
 }
 
+// Returns false if the code hasn't been touched and has to be read the usual way
+static bool readAndDecompressCode(IFile *file, u8 *dst, u32 size)
+{
+    CodeReader *reader = &g_codeReader;
+    Handle thread;
+
+    if (size <= CODE_READ_CHUNK_SIZE)
+        return false;
+
+    reader->file = file;
+    reader->dst = dst;
+    reader->size = size;
+    reader->readFrom = dst + size;
+    reader->res = 0;
+
+    if (R_FAILED(svcCreateEvent(&reader->chunkReadEvent, RESET_ONESHOT)))
+        return false;
+
+    u32 *stackTop = (u32 *)(g_codeReaderStack + sizeof(g_codeReaderStack));
+    if (R_FAILED(svcCreateThread(&thread, codeReaderThreadMain, (u32)reader, stackTop, 20, -2)))
+    {
+        svcCloseHandle(reader->chunkReadEvent);
+        return false;
+    }
+
+    lzss_decompress(dst + size, reader);
+
+    svcWaitSynchronization(thread, -1LL);
+    svcCloseHandle(thread);
+    svcCloseHandle(reader->chunkReadEvent);
+
+    assertSuccess(reader->res);
+    return true;
+}
+
 static Result loadCode(const ExHeader_Info *exhi, u64 programHandle, const prog_addrs_t *mapped)
 {
     IFile file;
@@ -168,7 +272,9 @@ static Result loadCode(const ExHeader_Info *exhi, u64 programHandle, const prog_
     if (IsSysmoduleCxiCookie(programHandle))
     {
         u32 sz_ = 0;
-        bool ok = readSysmoduleCxiCode((u8 *)mapped->text_addr, &sz_, (u64)mapped->total_size << 12, &g_cached_sysmoduleCxiFile, &g_cached_sysmoduleCxiNcch);
+        if (g_cached_sysmoduleCxiHeaders == NULL)
+            g_cached_sysmoduleCxiHeaders = readSysmoduleCxiHeaders(&g_cached_sysmoduleCxiFile, titleId);
+        bool ok = readSysmoduleCxiCode((u8 *)mapped->text_addr, &sz_, (u64)mapped->total_size << 12, &g_cached_sysmoduleCxiFile, g_cached_sysmoduleCxiHeaders);
         size = sz_;
 
         if (!ok)
@@ -176,13 +282,23 @@ static Result loadCode(const ExHeader_Info *exhi, u64 programHandle, const prog_
 
         // Decompress
         if (isCompressed)
-            lzss_decompress((u8 *)mapped->text_addr + size);
+            lzss_decompress((u8 *)mapped->text_addr + size, NULL);
 
         // No need to keep the file open at this point
         InvalidateCachedCxiFile();
         return 0;
     }
 
+    // Applications can have their final code image cached on the SD card
+    u64 startTick = svcGetSystemTick();
+    bool isCodeCacheable = IsApplicationId(titleId) && !nextGamePatchDisabled;
+
+    if (isCodeCacheable && codeCacheLoad(exhi, (u8 *)mapped->text_addr, mapped->total_size << 12, startTick))
+    {
+        g_lastLaunchTimings.fromCodeCache = true;
+        return 0;
+    }
+
     bool codeLoadedExternally = false;
     if (CONFIG(PATCHGAMES))
     {
@@ -216,16 +332,26 @@ static Result loadCode(const ExHeader_Info *exhi, u64 programHandle, const prog_
             return 0xC900464F;
         }
 
-        // read code
-        assertSuccess(IFile_Read(&file, &total, (void *)mapped->text_addr, size));
-        IFile_Close(&file); // done reading
+        // read code, and decompress it while the rest is being read if needed
+        if (isCompressed && readAndDecompressCode(&file, (u8 *)mapped->text_addr, (u32)size))
+            IFile_Close(&file);
+        else
+        {
+            assertSuccess(IFile_Read(&file, &total, (void *)mapped->text_addr, size));
+            IFile_Close(&file); // done reading
 
-        // decompress
-        if (isCompressed)
-            lzss_decompress((u8 *)mapped->text_addr + size);
+            // decompress
+            if (isCompressed)
+                lzss_decompress((u8 *)mapped->text_addr + size, NULL);
+        }
     }
 
+    u64 patchTick = svcGetSystemTick();
     patchCode(titleId, csi->flags.remaster_version, (u8 *)mapped->text_addr, mapped->total_size << 12, csi->text.size, csi->rodata.size, csi->data.size, csi->rodata.address, csi->data.address);
+    g_lastLaunchTimings.patchUsec = ticksToUsec(svcGetSystemTick() - patchTick);
+
+    if (isCodeCacheable)
+        codeCacheStore((u8 *)mapped->text_addr, mapped->total_size << 12, startTick);
 
     return 0;
 }
@@ -322,12 +448,13 @@ static Result GetProgramInfoImpl(ExHeader_Info *exheaderInfo, u64 programHandle)
             g_cached_sysmoduleCxiCookie = programHandle;
         }
 
-        bool ok = readSysmoduleCxiNcchHeader(&g_cached_sysmoduleCxiNcch, &g_cached_sysmoduleCxiFile);
-        if (!ok)
-            return (Result)-2;
-        ok = readSysmoduleCxiExHeaderInfo(exheaderInfo, &g_cached_sysmoduleCxiNcch, &g_cached_sysmoduleCxiFile);
-        if (!ok)
+        // Looked up once per opened file, a .cxi edited since it was last parsed has another timestamp
+        if (g_cached_sysmoduleCxiHeaders == NULL)
+            g_cached_sysmoduleCxiHeaders = readSysmoduleCxiHeaders(&g_cached_sysmoduleCxiFile, titleId);
+        if (g_cached_sysmoduleCxiHeaders == NULL)
             return (Result)-2;
+
+        memcpy(exheaderInfo, &g_cached_sysmoduleCxiHeaders->exheaderInfo, sizeof(ExHeader_Info));
         return 0;
     }
 
@@ -395,6 +522,9 @@ static Result GetProgramInfo(u64 programHandle)
 static Result LoadProcessImpl(Handle *outProcessHandle, const ExHeader_Info *exhi, u64 programHandle)
 {
     const ExHeader_CodeSetInfo *csi = &exhi->sci.codeset_info;
+    u64 startTick = svcGetSystemTick();
+    u64 tick;
+    IFileReadStats startReadStats, readStats;
 
     Result res = 0;
     u32 dummy;
@@ -426,9 +556,18 @@ static Result LoadProcessImpl(Handle *outProcessHandle, const ExHeader_Info *exh
     vaddr.total_size = vaddr.text_size + vaddr.ro_size + vaddr.data_size;
     TRY(allocateProgramMemoryWrapper(&mapped, exhi, &vaddr));
 
-    // load code
     u64 titleId = exhi->aci.local_caps.title_id;
-    if (R_SUCCEEDED(res = loadCode(exhi, programHandle, &mapped)))
+    memset(&g_lastLaunchTimings, 0, sizeof(LaunchTimings));
+    g_lastLaunchTimings.titleId = titleId;
+    g_lastLaunchTimings.codeSize = mapped.total_size << 12;
+    IFile_GetReadStats(&startReadStats);
+
+    // load code
+    tick = svcGetSystemTick();
+    res = loadCode(exhi, programHandle, &mapped);
+    g_lastLaunchTimings.loadCodeUsec = ticksToUsec(svcGetSystemTick() - tick);
+
+    if (R_SUCCEEDED(res))
     {
         u32     *code = (u32 *)mapped.text_addr;
         bool    isHomebrew = code[0] == 0xEA000006 && code[8] == 0xE1A0400E;
@@ -444,6 +583,7 @@ static Result LoadProcessImpl(Handle *outProcessHandle, const ExHeader_Info *exh
         csh.rw_addr = vaddr.data_addr;
         csh.rw_size = vaddr.data_size;
         csh.rw_size_total = dataMemSize;
+        tick = svcGetSystemTick();
         res = svcCreateCodeSet(&codeset, &csh, mapped.text_addr, mapped.ro_addr, mapped.data_addr);
         if (R_SUCCEEDED(res))
         {
@@ -451,20 +591,28 @@ static Result LoadProcessImpl(Handle *outProcessHandle, const ExHeader_Info *exh
             res = svcCreateProcess(outProcessHandle, codeset, exhi->aci.kernel_caps.descriptors, count);
             svcCloseHandle(codeset);
             res = R_SUCCEEDED(res) ? 0 : res;
+            g_lastLaunchTimings.createProcessUsec = ticksToUsec(svcGetSystemTick() - tick);
             
             // check for plugin
             if (!res && ((u32)((titleId >> 0x20) & 0xFFFFFFEDULL) == 0x00040000))
             {
+                tick = svcGetSystemTick();
                 u32 processID;
                 assertSuccess(svcGetProcessId(&processID, *outProcessHandle));
                 assertSuccess(plgldrInit());
                 assertSuccess(PLGLDR_LoadPlugin(processID, isHomebrew));
                 plgldrExit();
+                g_lastLaunchTimings.pluginUsec = ticksToUsec(svcGetSystemTick() - tick);
             }
         }
     }
 
     svcControlMemory(&dummy, mapped.text_addr, 0, mapped.total_size << 12, MEMOP_FREE, 0);
+    g_lastLaunchTimings.totalUsec = ticksToUsec(svcGetSystemTick() - startTick);
+
+    IFile_GetReadStats(&readStats);
+    g_lastLaunchTimings.readCalls = readStats.calls - startReadStats.calls;
+    g_lastLaunchTimings.fsReadCalls = readStats.fsCalls - startReadStats.fsCalls;
     return res;
 }
 
@@ -608,6 +756,16 @@ void loaderHandleCommands(void *ctx)
             cmdbuf[2] = IPC_Desc_StaticBuffer(sizeof(ExHeader_Info), 0);
             cmdbuf[3] = (u32)&g_lastAppExheaderInfo;
             break;
+        case 0x103: // InvalidateTitleOverrides
+            invalidateTitleOverrides();
+            cmdbuf[0] = IPC_MakeHeader(0x103, 1, 0);
+            cmdbuf[1] = (Result)0;
+            break;
+        case 0x104: // GetLastLaunchTimings
+            cmdbuf[0] = IPC_MakeHeader(0x104, 1 + sizeof(LaunchTimings) / 4, 0);
+            cmdbuf[1] = (Result)0;
+            memcpy(&cmdbuf[2], &g_lastLaunchTimings, sizeof(LaunchTimings));
+            break;
         default: // error
             cmdbuf[0] = IPC_MakeHeader(0, 1, 0);
             cmdbuf[1] = 0xD900182F;
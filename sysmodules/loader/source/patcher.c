@@ -4,8 +4,42 @@
 #include "memory.h"
 #include "strings.h"
 #include "romfsredir.h"
+#include "layeredfs.h"
 #include "util.h"
 
+#define TITLE_OVERRIDES_CACHE_SIZE      8
+#define TITLE_OVERRIDES_RECHECK_TICKS   (2ULL * SYSCLOCK_ARM11)
+
+#define SYSMODULE_CXI_CACHE_SIZE        4
+#define SYSMODULE_CXI_HEADERS_READ_SIZE 0xC00 //NCCH header, exheader and access descriptor, ExeFS header
+
+typedef struct TitleOverrides
+{
+    u64 progId,
+        checkTick;
+    u32 files;
+    bool isValid;
+} TitleOverrides;
+
+typedef struct SysmoduleCxiCacheEntry
+{
+    u64 progId,
+        fileSize,
+        mtime;
+    u32 lastUse;
+    bool isValid;
+    SysmoduleCxiHeaders headers;
+} SysmoduleCxiCacheEntry;
+
+LayeredFsLayout layeredFsLayout;
+
+static TitleOverrides titleOverridesCache[TITLE_OVERRIDES_CACHE_SIZE];
+static u32 titleOverridesCacheNext = 0;
+
+static SysmoduleCxiCacheEntry sysmoduleCxiCache[SYSMODULE_CXI_CACHE_SIZE];
+static u32 sysmoduleCxiCacheUses = 0;
+static u8 CTR_ALIGN(8) sysmoduleCxiHeadersBuffer[SYSMODULE_CXI_HEADERS_READ_SIZE];
+
 static u32 patchMemory(u8 *start, u32 size, const void *pattern, u32 patSize, s32 offset, const void *replace, u32 repSize, u32 count)
 {
     u32 i;
@@ -34,35 +68,120 @@ static Result fileOpen(IFile *file, FS_ArchiveID archiveId, const char *path, u3
     return IFile_Open(file, archiveId, fsMakePath(PATH_EMPTY, ""), fsMakePath(PATH_ASCII, path), flags);
 }
 
-static bool dirCheck(FS_ArchiveID archiveId, const char *path)
+static bool openLumaFile(IFile *file, const char *path)
 {
-    bool ret;
-    Handle handle;
+    FS_ArchiveID archiveId = isSdMode ? ARCHIVE_SDMC : ARCHIVE_NAND_RW;
+
+    return R_SUCCEEDED(fileOpen(file, archiveId, path, FS_OPEN_READ));
+}
+
+static u32 scanTitleOverrides(Handle handle)
+{
+    static const struct
+    {
+        const char *name;
+        u32 flag;
+        bool isDirectory;
+    } overrideFiles[] = {
+        { "code.bin",     TITLE_OVERRIDE_CODE_BIN, false },
+        { "code.ips",     TITLE_OVERRIDE_CODE_IPS, false },
+        { "code.bps",     TITLE_OVERRIDE_CODE_BPS, false },
+        { "exheader.bin", TITLE_OVERRIDE_EXHEADER, false },
+        { "locale.txt",   TITLE_OVERRIDE_LOCALE,   false },
+        { "romfs",        TITLE_OVERRIDE_ROMFS,    true  },
+    };
+
+    //Enough for all the override files in one read
+    static FS_DirectoryEntry entries[8];
+    u32 files = 0,
+        entriesRead;
+
+    while(R_SUCCEEDED(FSDIR_Read(handle, &entriesRead, sizeof(entries) / sizeof(FS_DirectoryEntry), entries)) && entriesRead != 0)
+    {
+        for(u32 i = 0; i < entriesRead; i++)
+        {
+            const FS_DirectoryEntry *entry = &entries[i];
+            bool isDirectory = (entry->attributes & FS_ATTRIBUTE_DIRECTORY) != 0;
+
+            for(u32 j = 0; j < sizeof(overrideFiles) / sizeof(overrideFiles[0]); j++)
+            {
+                const char *name = overrideFiles[j].name;
+                u32 k;
+
+                //The SD card is case-insensitive
+                for(k = 0; name[k] != 0; k++)
+                {
+                    u32 c = entry->name[k];
+
+                    if(c - 'A' <= 'Z' - 'A') c += 0x20;
+                    if(c != (u32)name[k]) break;
+                }
+
+                if(name[k] == 0 && entry->name[k] == 0 && isDirectory == overrideFiles[j].isDirectory)
+                    files |= overrideFiles[j].flag;
+            }
+        }
+    }
+
+    return files;
+}
+
+u32 getTitleOverrides(u64 progId)
+{
+    TitleOverrides *entry = NULL;
+    u64 now = svcGetSystemTick();
+
+    for(u32 i = 0; entry == NULL && i < TITLE_OVERRIDES_CACHE_SIZE; i++)
+        if(titleOverridesCache[i].isValid && titleOverridesCache[i].progId == progId) entry = &titleOverridesCache[i];
+
+    //All the lookups of a launch happen in a row, only look at the folder again for the next launch
+    if(entry != NULL && now - entry->checkTick < TITLE_OVERRIDES_RECHECK_TICKS) return entry->files;
+
+    if(entry == NULL)
+    {
+        entry = &titleOverridesCache[titleOverridesCacheNext];
+        titleOverridesCacheNext = (titleOverridesCacheNext + 1) % TITLE_OVERRIDES_CACHE_SIZE;
+    }
+
+    /* Here we look for "/luma/titles/[u64 titleID in hex, uppercase]"
+       It is listed once per launch: the folder's timestamp isn't updated by every FAT driver when files are added */
+
+    char path[] = "/luma/titles/0000000000000000";
+    progIdToStr(path + 28, progId);
+
     FS_Archive archive;
+    Handle handle;
+    u32 files = 0;
 
-    if(R_FAILED(FSUSER_OpenArchive(&archive, archiveId, fsMakePath(PATH_EMPTY, "")))) ret = false;
-    else
+    if(R_SUCCEEDED(FSUSER_OpenArchive(&archive, isSdMode ? ARCHIVE_SDMC : ARCHIVE_NAND_RW, fsMakePath(PATH_EMPTY, ""))))
     {
-        ret = R_SUCCEEDED(FSUSER_OpenDirectory(&handle, archive, fsMakePath(PATH_ASCII, path)));
-        if(ret) FSDIR_Close(handle);
+        if(R_SUCCEEDED(FSUSER_OpenDirectory(&handle, archive, fsMakePath(PATH_ASCII, path))))
+        {
+            files = scanTitleOverrides(handle);
+            FSDIR_Close(handle);
+        }
+
         FSUSER_CloseArchive(archive);
     }
 
-    return ret;
+    entry->progId = progId;
+    entry->checkTick = now;
+    entry->files = files;
+    entry->isValid = true;
+
+    return files;
 }
 
-static bool openLumaFile(IFile *file, const char *path)
+void invalidateTitleOverrides(void)
 {
-    FS_ArchiveID archiveId = isSdMode ? ARCHIVE_SDMC : ARCHIVE_NAND_RW;
-
-    return R_SUCCEEDED(fileOpen(file, archiveId, path, FS_OPEN_READ));
+    memset(titleOverridesCache, 0, sizeof(titleOverridesCache));
 }
 
-static u32 checkLumaDir(const char *path)
+static u32 getLayeredFsArchiveId(u64 progId)
 {
-    FS_ArchiveID archiveId = isSdMode ? ARCHIVE_SDMC : ARCHIVE_NAND_RW;
+    if(!(getTitleOverrides(progId) & TITLE_OVERRIDE_ROMFS)) return 0;
 
-    return dirCheck(archiveId, path) ? archiveId : 0;
+    return isSdMode ? ARCHIVE_SDMC : ARCHIVE_NAND_RW;
 }
 
 static inline bool secureInfoExists(void)
@@ -279,9 +398,13 @@ static inline bool applyCodeIpsPatch(u64 progId, u8 *code, u32 size)
     {
         char path[] = "/luma/titles/0000000000000000/code.ips";
         progIdToStr(path + 28, progId);
-        if(!openLumaFile(&file, path)) return true;
+        if(!(getTitleOverrides(progId) & TITLE_OVERRIDE_CODE_IPS) || !openLumaFile(&file, path)) return true;
     }
 
+    //IPS records are a few bytes each, let the file layer batch them
+    static u8 readBuffer[0x1000];
+    IFile_SetReadBuffer(&file, readBuffer, sizeof(readBuffer));
+
     bool ret = false;
     u8 buffer[5];
     u64 total;
@@ -329,67 +452,151 @@ exit:
     return ret;
 }
 
-Result openSysmoduleCxi(IFile *outFile, u64 progId)
+static void getSysmoduleCxiPath(char *path, u64 progId)
 {
     progId &= ~0xF0000000ull; // clear N3DS bit
-    char path[] = "/luma/sysmodules/0000000000000000.cxi";
+    memcpy(path, "/luma/sysmodules/0000000000000000.cxi", sizeof("/luma/sysmodules/0000000000000000.cxi"));
     progIdToStr(path + sizeof("/luma/sysmodules/0000000000000000") - 2, progId);
-
-    FS_ArchiveID archiveId = isSdMode ? ARCHIVE_SDMC : ARCHIVE_NAND_RW;
-    return fileOpen(outFile, archiveId, path, FS_OPEN_READ);
 }
 
-bool readSysmoduleCxiNcchHeader(Ncch *outNcchHeader, IFile *file)
+static bool getSysmoduleCxiTimestamp(u64 *out, u64 progId)
 {
-    u64 total = 0;
-    return R_SUCCEEDED(IFile_ReadAt(file, &total, outNcchHeader, 0, sizeof(Ncch))) && total == sizeof(Ncch);
+    char path[] = "/luma/sysmodules/0000000000000000.cxi";
+    u16 path16[sizeof(path)];
+    FS_Archive archive;
+
+    getSysmoduleCxiPath(path, progId);
+    for (u32 i = 0; i < sizeof(path); i++)
+        path16[i] = path[i];
+
+    if (R_FAILED(FSUSER_OpenArchive(&archive, isSdMode ? ARCHIVE_SDMC : ARCHIVE_NAND_RW, fsMakePath(PATH_EMPTY, ""))))
+        return false;
+
+    Result res = FSUSER_ControlArchive(archive, ARCHIVE_ACTION_GET_TIMESTAMP, path16, sizeof(path16), out, sizeof(u64));
+    FSUSER_CloseArchive(archive);
+
+    return R_SUCCEEDED(res);
 }
 
-bool readSysmoduleCxiExHeaderInfo(ExHeader_Info *outExhi, const Ncch *ncchHeader, IFile *file)
+Result openSysmoduleCxi(IFile *outFile, u64 progId)
 {
-    u64 total = 0;
-    u32 size = ncchHeader->exHeaderSize;
-    if (size < sizeof(ExHeader_Info))
-        return false;
-    return R_SUCCEEDED(IFile_ReadAt(file, &total, outExhi, sizeof(Ncch), size)) && total == size;
+    char path[] = "/luma/sysmodules/0000000000000000.cxi";
+    getSysmoduleCxiPath(path, progId);
+
+    FS_ArchiveID archiveId = isSdMode ? ARCHIVE_SDMC : ARCHIVE_NAND_RW;
+    return fileOpen(outFile, archiveId, path, FS_OPEN_READ);
 }
 
-bool readSysmoduleCxiCode(u8 *outCode, u32 *outSize, u32 maxSize, IFile *file, const Ncch *ncchHeader)
+static bool parseSysmoduleCxiHeaders(SysmoduleCxiHeaders *out, IFile *file, u32 fileSize)
 {
-    u32 contentUnitShift = 9 + ncchHeader->flags[6];
-    u32 exeFsOffset = ncchHeader->exeFsOffset << contentUnitShift;
-    u32 exeFsSize = ncchHeader->exeFsSize << contentUnitShift;
+    // The headers are laid out back to back in practice, fetch them all at once
+    u8 *buf = sysmoduleCxiHeadersBuffer;
+    u32 bufSize = fileSize < sizeof(sysmoduleCxiHeadersBuffer) ? fileSize : sizeof(sysmoduleCxiHeadersBuffer);
+    u64 total = 0;
 
-    if (exeFsSize < sizeof(ExeFsHeader) || exeFsOffset < 0x200 + ncchHeader->exHeaderSize)
+    if (R_FAILED(IFile_ReadAt(file, &total, buf, 0, bufSize)) || total != bufSize || bufSize < sizeof(Ncch))
         return false;
 
-    // Read ExeFs header
-    ExeFsHeader hdr;
-    u64 total = 0;
-    u32 size = sizeof(ExeFsHeader);
-    Result res = IFile_ReadAt(file, &total, &hdr, exeFsOffset, size);
+    memcpy(&out->ncch, buf, sizeof(Ncch));
 
-    if (R_FAILED(res) || total != size)
+    u32 exHeaderSize = out->ncch.exHeaderSize;
+    if (exHeaderSize < sizeof(ExHeader_Info) || sizeof(Ncch) + sizeof(ExHeader_Info) > bufSize)
         return false;
 
+    memcpy(&out->exheaderInfo, buf + sizeof(Ncch), sizeof(ExHeader_Info));
+
+    // Missing or broken ExeFS only makes LoadProcess fail, like before
+    memset(&out->codeHeader, 0, sizeof(ExeFsFileHeader));
+
+    u32 contentUnitShift = 9 + out->ncch.flags[6];
+    u32 exeFsOffset = out->ncch.exeFsOffset << contentUnitShift;
+    u32 exeFsSize = out->ncch.exeFsSize << contentUnitShift;
+
+    out->exeFsOffset = exeFsOffset;
+
+    if (exeFsSize < sizeof(ExeFsHeader) || exeFsOffset < 0x200 + exHeaderSize)
+        return true;
+
+    const ExeFsHeader *hdr = (const ExeFsHeader *)(buf + exeFsOffset);
+    if (exeFsOffset > bufSize - sizeof(ExeFsHeader))
+    {
+        // Unusual layout, fall back to a separate read
+        hdr = (const ExeFsHeader *)buf;
+        if (R_FAILED(IFile_ReadAt(file, &total, buf, exeFsOffset, sizeof(ExeFsHeader))) || total != sizeof(ExeFsHeader))
+            return true;
+    }
+
     // Get .code section info
-    ExeFsFileHeader *codeHdr = NULL;
     for (u32 i = 0; i < 8; i++)
     {
-        ExeFsFileHeader *fileHdr = &hdr.fileHeaders[i];
+        const ExeFsFileHeader *fileHdr = &hdr->fileHeaders[i];
         if (strncmp(fileHdr->name, ".code", 8) == 0)
-            codeHdr = fileHdr;
+            out->codeHeader = *fileHdr;
+    }
+
+    return true;
+}
+
+const SysmoduleCxiHeaders *readSysmoduleCxiHeaders(IFile *file, u64 progId)
+{
+    SysmoduleCxiCacheEntry *entry = NULL;
+    u64 fileSize, mtime = 0;
+
+    progId &= ~0xF0000000ull;
+    if (R_FAILED(IFile_GetSize(file, &fileSize)))
+        return NULL;
+
+    // A .cxi edited in place usually keeps its size, the timestamp tells it apart. Without one, it is parsed every time
+    bool hasTimestamp = getSysmoduleCxiTimestamp(&mtime, progId);
+
+    for (u32 i = 0; entry == NULL && i < SYSMODULE_CXI_CACHE_SIZE; i++)
+    {
+        if (sysmoduleCxiCache[i].isValid && sysmoduleCxiCache[i].progId == progId)
+            entry = &sysmoduleCxiCache[i];
+    }
+
+    if (entry != NULL && hasTimestamp && entry->fileSize == fileSize && entry->mtime == mtime)
+    {
+        entry->lastUse = ++sysmoduleCxiCacheUses;
+        return &entry->headers;
+    }
+
+    // Take a free entry, or the least recently used one
+    if (entry == NULL)
+    {
+        entry = &sysmoduleCxiCache[0];
+        for (u32 i = 1; i < SYSMODULE_CXI_CACHE_SIZE && entry->isValid; i++)
+        {
+            if (!sysmoduleCxiCache[i].isValid || sysmoduleCxiCache[i].lastUse < entry->lastUse)
+                entry = &sysmoduleCxiCache[i];
+        }
     }
 
-    if (codeHdr == NULL)
+    bool isParsed = parseSysmoduleCxiHeaders(&entry->headers, file, (u32)fileSize);
+
+    entry->progId = progId;
+    entry->fileSize = fileSize;
+    entry->mtime = mtime;
+    entry->lastUse = ++sysmoduleCxiCacheUses;
+    entry->isValid = isParsed && hasTimestamp;
+
+    return isParsed ? &entry->headers : NULL;
+}
+
+bool readSysmoduleCxiCode(u8 *outCode, u32 *outSize, u32 maxSize, IFile *file, const SysmoduleCxiHeaders *headers)
+{
+    if (headers == NULL || headers->codeHeader.name[0] == '\0')
         return false;
 
-    size = codeHdr->size;
+    const ExeFsFileHeader *codeHdr = &headers->codeHeader;
+
+    u64 total = 0;
+    u32 size = codeHdr->size;
     *outSize = size;
     if (size > maxSize)
         return false;
 
-    res = IFile_ReadAt(file, &total, outCode, exeFsOffset + sizeof(ExeFsHeader) + codeHdr->offset, size);
+    Result res = IFile_ReadAt(file, &total, outCode, headers->exeFsOffset + sizeof(ExeFsHeader) + codeHdr->offset, size);
     return R_SUCCEEDED(res) && total == size;
 }
 
@@ -403,7 +610,7 @@ bool loadTitleCodeSection(u64 progId, u8 *code, u32 size)
 
     IFile file;
 
-    if(!openLumaFile(&file, path)) return false;
+    if(!(getTitleOverrides(progId) & TITLE_OVERRIDE_CODE_BIN) || !openLumaFile(&file, path)) return false;
 
     u64 fileSize;
 
@@ -436,7 +643,7 @@ bool loadTitleExheaderInfo(u64 progId, ExHeader_Info *exheaderInfo)
 
     IFile file;
 
-    if(!openLumaFile(&file, path)) return false;
+    if(!(getTitleOverrides(progId) & TITLE_OVERRIDE_EXHEADER) || !openLumaFile(&file, path)) return false;
 
     u64 fileSize;
 
@@ -468,6 +675,8 @@ static inline bool loadTitleLocaleConfig(u64 progId, u8 *mask, u8 *regionId, u8
     progIdToStr(path + 28, progId);
     *mask = *regionId = *languageId = *countryId = *stateId = 0;
 
+    if(!(getTitleOverrides(progId) & TITLE_OVERRIDE_LOCALE)) return false;
+
     IFile file;
 
     if(!openLumaFile(&file, path)) return false;
@@ -556,6 +765,18 @@ exit:
     return ret;
 }
 
+static inline void setTitleLocale(u64 progId)
+{
+    u8 mask,
+       regionId,
+       languageId,
+       countryId,
+       stateId;
+
+    if(isLumaWithKext && loadTitleLocaleConfig(progId, &mask, &regionId, &languageId, &countryId, &stateId))
+        svcKernelSetState(0x10001, ((u32)stateId << 24) | ((u32)countryId << 16) | ((u32)languageId << 8) | ((u32)regionId << 4) | (u32)mask , progId);
+}
+
 static inline bool patchLayeredFs(u64 progId, u8 *code, u32 size, u32 textSize, u32 roSize, u32 dataSize, u32 roAddress, u32 dataAddress)
 {
     /* Here we look for "/luma/titles/[u64 titleID in hex, uppercase]/romfs"
@@ -564,7 +785,7 @@ static inline bool patchLayeredFs(u64 progId, u8 *code, u32 size, u32 textSize,
     char path[] = "/luma/titles/0000000000000000/romfs";
     progIdToStr(path + 28, progId);
 
-    u32 archiveId = checkLumaDir(path);
+    u32 archiveId = getLayeredFsArchiveId(progId);
 
     if(!archiveId) return true;
 
@@ -629,6 +850,24 @@ static inline bool patchLayeredFs(u64 progId, u8 *code, u32 size, u32 textSize,
     romfsRedirPatchArchiveId = archiveId;
     memcpy(&romfsRedirPatchUpdateRomFsMount, updateRomFsMount, 4);
 
+    layeredFsLayout.payloadOffset = payloadOffset;
+
+    //Put the manifest in what is left of the .text padding, if the payload went there
+    u32 manifestOffset = (payloadOffset + romfsRedirPatchSize + 3) & ~3,
+        manifestEnd = (textSize + 4095) & 0xFFFFF000,
+        manifestSize = LAYEREDFS_MANIFEST_MAX_SIZE;
+
+    while(manifestSize >= LAYEREDFS_MANIFEST_MIN_SIZE && manifestOffset + manifestSize > manifestEnd) manifestSize >>= 1;
+
+    if(payloadOffset == textSize && manifestSize >= LAYEREDFS_MANIFEST_MIN_SIZE)
+    {
+        layeredFsLayout.manifestOffset = manifestOffset;
+        layeredFsLayout.manifestSize = manifestSize;
+        romfsRedirPatchManifest = 0x100000 + manifestOffset;
+        romfsRedirPatchManifestMask = buildLayeredFsManifest(archiveId, path, (u32 *)(code + manifestOffset), manifestSize);
+    }
+    else romfsRedirPatchManifestMask = 0;
+
     memcpy(payload, romfsRedirPatch, romfsRedirPatchSize);
 
     memcpy(code + pathOffset, "lf:", 3);
@@ -643,6 +882,8 @@ static inline bool patchLayeredFs(u64 progId, u8 *code, u32 size, u32 textSize,
 
 void patchCode(u64 progId, u16 progVer, u8 *code, u32 size, u32 textSize, u32 roSize, u32 dataSize, u32 roAddress, u32 dataAddress)
 {
+    memset(&layeredFsLayout, 0, sizeof(layeredFsLayout));
+
     bool isHomeMenu = progId == 0x0004003000008F02LL || //USA Home Menu
                       progId == 0x0004003000008202LL || //JPN Home Menu
                       progId == 0x0004003000009802LL || //EUR Home Menu
@@ -960,14 +1201,7 @@ void patchCode(u64 progId, u16 progVer, u8 *code, u32 size, u32 textSize, u32 ro
 
         if(isApp || isApplet)
         {
-            u8 mask,
-               regionId,
-               languageId,
-               countryId,
-               stateId;
-
-            if(isLumaWithKext && loadTitleLocaleConfig(progId, &mask, &regionId, &languageId, &countryId, &stateId))
-                svcKernelSetState(0x10001, ((u32)stateId << 24) | ((u32)countryId << 16) | ((u32)languageId << 8) | ((u32)regionId << 4) | (u32)mask , progId);
+            setTitleLocale(progId);
             if(!patchLayeredFs(progId, code, size, textSize, roSize, dataSize, roAddress, dataAddress)) goto error;
         }
     }
@@ -978,3 +1212,35 @@ void patchCode(u64 progId, u16 progVer, u8 *code, u32 size, u32 textSize, u32 ro
 error:
     svcBreak(USERBREAK_ASSERT);
 }
+
+bool patchCachedCode(u64 progId, u8 *code, u32 size, const LayeredFsLayout *layout)
+{
+    if(layout->manifestSize != 0)
+    {
+        //The payload must be where the layout says, with the manifest address patchCode gave it
+        u32 manifestPointerOffset = layout->payloadOffset + (u32)&romfsRedirPatchManifest - (u32)romfsRedirPatch,
+            maskOffset = layout->payloadOffset + (u32)&romfsRedirPatchManifestMask - (u32)romfsRedirPatch;
+
+        if(((layout->payloadOffset | layout->manifestOffset | layout->manifestSize) & 3) != 0 ||
+           layout->payloadOffset > size || size - layout->payloadOffset < romfsRedirPatchSize ||
+           layout->manifestOffset > size || size - layout->manifestOffset < layout->manifestSize ||
+           *(u32 *)(code + manifestPointerOffset) != 0x100000 + layout->manifestOffset)
+            return false;
+
+        char path[] = "/luma/titles/0000000000000000/romfs";
+        progIdToStr(path + 28, progId);
+
+        u32 archiveId = getLayeredFsArchiveId(progId),
+            mask = archiveId ? buildLayeredFsManifest(archiveId, path, (u32 *)(code + layout->manifestOffset), layout->manifestSize) : 0;
+
+        *(u32 *)(code + maskOffset) = mask;
+    }
+
+    //Redo what patchCode does besides patching the code
+    if(CONFIG(PATCHGAMES))
+        setTitleLocale(progId);
+
+    nextGamePatchDisabled = false;
+
+    return true;
+}
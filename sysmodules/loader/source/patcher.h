@@ -42,14 +42,46 @@ enum singleOptions
     ENABLESAFEFIRMROSALINA,
 };
 
+//Files found in /luma/titles/[titleID]
+enum titleOverrides
+{
+    TITLE_OVERRIDE_CODE_BIN = BIT(0),
+    TITLE_OVERRIDE_CODE_IPS = BIT(1),
+    TITLE_OVERRIDE_CODE_BPS = BIT(2),
+    TITLE_OVERRIDE_EXHEADER = BIT(3),
+    TITLE_OVERRIDE_LOCALE   = BIT(4),
+    TITLE_OVERRIDE_ROMFS    = BIT(5),
+};
+
+//Where patchCode put the LayeredFS payload and its manifest, all 0 if it wasn't used
+typedef struct LayeredFsLayout
+{
+    u32 payloadOffset,
+        manifestOffset,
+        manifestSize;
+} LayeredFsLayout;
+
+typedef struct SysmoduleCxiHeaders
+{
+    Ncch ncch;
+    ExHeader_Info exheaderInfo;
+    u32 exeFsOffset;
+    ExeFsFileHeader codeHeader; //< all zeroes if there is no .code
+} SysmoduleCxiHeaders;
+
 extern u32 config, multiConfig, bootConfig;
 extern bool isN3DS, isSdMode, nextGamePatchDisabled, isLumaWithKext;
+extern LayeredFsLayout layeredFsLayout;
 
 void patchCode(u64 progId, u16 progVer, u8 *code, u32 size, u32 textSize, u32 roSize, u32 dataSize, u32 roAddress, u32 dataAddress);
+bool patchCachedCode(u64 progId, u8 *code, u32 size, const LayeredFsLayout *layout);
+u32 getTitleOverrides(u64 progId);
+void invalidateTitleOverrides(void);
 bool loadTitleCodeSection(u64 progId, u8 *code, u32 size);
 bool loadTitleExheaderInfo(u64 progId, ExHeader_Info *exheaderInfo);
 
 Result openSysmoduleCxi(IFile *outFile, u64 progId);
-bool readSysmoduleCxiNcchHeader(Ncch *outNcchHeader, IFile *file);
-bool readSysmoduleCxiExHeaderInfo(ExHeader_Info *outExhi, const Ncch *ncchHeader, IFile *file);
-bool readSysmoduleCxiCode(u8 *outCode, u32 *outSize, u32 maxSize, IFile *file, const Ncch *ncchHeader);
+//Parses the headers of an open /luma/sysmodules .cxi, or takes them from the last few parsed if its size and timestamp didn't change.
+//The result stays valid until the next call
+const SysmoduleCxiHeaders *readSysmoduleCxiHeaders(IFile *file, u64 progId);
+bool readSysmoduleCxiCode(u8 *outCode, u32 *outSize, u32 maxSize, IFile *file, const SysmoduleCxiHeaders *headers);
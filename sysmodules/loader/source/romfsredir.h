@@ -15,3 +15,5 @@ extern u32 romfsRedirPatchArchiveId;
 extern u32 romfsRedirPatchRomFsMount;
 extern u32 romfsRedirPatchUpdateRomFsMount;
 extern u32 romfsRedirPatchCustomPath;
+extern u32 romfsRedirPatchManifest;
+extern u32 romfsRedirPatchManifestMask;
@@ -57,6 +57,8 @@ romfsRedirPatch:
         adrne   r3, romfsRedirPatchUpdateRomFsMount
         blne    compare
         bne     endRedir
+        bl      checkManifest
+        bne     endRedir
         sub     sp, sp, #0x400
         pathRedir:
             stmfd   sp!, {r0-r3}
@@ -104,6 +106,59 @@ romfsRedirPatch:
             bne     loop
         bx lr
 
+    @ Look the path up in the manifest of the LayeredFS folder
+    @ built by the loader, a bloom filter of the hashes of the
+    @ paths it contains. Sets Z if the file may be there.
+    @ r0-r3 are the iFileOpen arguments, only r4-r12 are used
+    checkManifest:
+        ldr     r12, romfsRedirPatchManifestMask
+        cmp     r12, #0
+        bxeq    lr
+        mov     r9, r1
+        manifest_1:
+            ldrh    r4, [r9], #2
+            cmp     r4, #0x3A @ ':'
+            bne     manifest_1
+        @ Skip the doubled slash like pathRedir does
+        ldrh    r4, [r9, #2]
+        cmp     r4, #0x2F @ '/'
+        addeq   r9, r9, #2
+        @ FNV-1a over the UTF-16 path, ASCII letters folded to
+        @ lowercase as the SD card is case-insensitive
+        ldr     r10, =0x811C9DC5
+        ldr     r11, =0x01000193
+        manifest_2:
+            ldrh    r4, [r9], #2
+            cmp     r4, #0
+            beq     manifest_3
+            sub     r5, r4, #0x41 @ 'A'
+            cmp     r5, #25
+            addls   r4, r4, #0x20
+            eor     r10, r10, r4
+            mul     r10, r11, r10
+            b       manifest_2
+        manifest_3:
+            ldr     r9, romfsRedirPatchManifest
+            and     r4, r10, r12
+            mov     r5, r4, lsr #5
+            ldr     r5, [r9, r5, lsl #2]
+            and     r4, r4, #31
+            mov     r5, r5, lsr r4
+            tst     r5, #1
+            beq     manifest_4
+            and     r4, r12, r10, ror #16
+            mov     r5, r4, lsr #5
+            ldr     r5, [r9, r5, lsl #2]
+            and     r4, r4, #31
+            mov     r5, r5, lsr r4
+            tst     r5, #1
+            beq     manifest_4
+            cmp     r0, r0
+            bx      lr
+        manifest_4:
+            cmp     r12, #0
+            bx      lr
+
 .pool
 .balign 4
 
@@ -114,6 +169,8 @@ romfsRedirPatch:
     .global romfsRedirPatchRomFsMount
     .global romfsRedirPatchUpdateRomFsMount
     .global romfsRedirPatchCustomPath
+    .global romfsRedirPatchManifest
+    .global romfsRedirPatchManifestMask
 
     romfsRedirPatchArchiveName       : .ascii "lf:\0"
     romfsRedirPatchFsMountArchive    : .word 0xdead0005
@@ -122,6 +179,8 @@ romfsRedirPatch:
     romfsRedirPatchRomFsMount        : .ascii "rom:"
     romfsRedirPatchUpdateRomFsMount  : .word 0xdead0008
     romfsRedirPatchCustomPath        : .word 0xdead0004
+    romfsRedirPatchManifest          : .word 0xdead0009
+    romfsRedirPatchManifestMask      : .word 0
 
 _romfsRedirPatchEnd:
 
@@ -44,13 +44,23 @@ void PXISendWord(u32 word)
     REG_PXI_SEND = word;
 }
 
-void PXISendBuffer(const u32 *buffer, u32 nbWords)
+// Returns the number of system ticks spent waiting for the send FIFO to have space
+u64 PXISendBuffer(const u32 *buffer, u32 nbWords)
 {
+    u64 stallTicks = 0;
     for(; nbWords > 0; nbWords--)
     {
-        while(REG_PXI_CNT & CNT_SEND_FIFO_FULL_STATUS);
+        if(REG_PXI_CNT & CNT_SEND_FIFO_FULL_STATUS)
+        {
+            u64 startTick = svcGetSystemTick();
+            while(REG_PXI_CNT & CNT_SEND_FIFO_FULL_STATUS);
+            stallTicks += svcGetSystemTick() - startTick;
+        }
+
         REG_PXI_SEND = *buffer++;
     }
+
+    return stallTicks;
 }
 
 bool PXIIsReceiveFIFOEmpty(void)
@@ -36,7 +36,7 @@ void PXITriggerSync9IRQ(void);
 bool PXIIsSendFIFOFull(void);
 void PXISendByte(u8 byte);
 void PXISendWord(u32 word);
-void PXISendBuffer(const u32 *buffer, u32 nbWords);
+u64 PXISendBuffer(const u32 *buffer, u32 nbWords);
 
 bool PXIIsReceiveFIFOEmpty(void);
 u8 PXIReceiveByte(void);
@@ -9,6 +9,7 @@ This is part of 3ds_pxi, which is licensed under the MIT license (see LICENSE fo
 #pragma once
 
 #include <3ds.h>
+#include "pxi_stats.h"
 
 typedef enum SessionState
 {
@@ -39,8 +40,11 @@ typedef struct SessionManager
     RecursiveLock senderLock;
     bool sendingDisabled;
     SessionData sessionData[10];
+    Handle statsSession; // PXI_STATS_SERVICE_NAME, answered by the sender thread
 
     u32 currentlyProvidedStaticBuffers, freeStaticBuffers;
+
+    PXIStats stats;
 } SessionManager;
 
 //Page alignment is mandatory there
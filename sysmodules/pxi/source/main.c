@@ -152,10 +152,11 @@ void initSystem(void)
 
 int main(void)
 {
-    Handle handles[10] = {0}; //notification handle + service handles
+    Handle handles[11] = {0}; //notification handle + service handles + statistics service handle
 
     for(u32 i = 0; i < 9; i++)
         assertSuccess(srvRegisterService(handles + 1 + i, serviceNames[i], 1));
+    assertSuccess(srvRegisterService(handles + 10, PXI_STATS_SERVICE_NAME, 1));
 
     assertSuccess(MyThread_Create(&receiverThread, receiver, receiverStack, THREAD_STACK_SIZE, 0x2D, -2));
     assertSuccess(MyThread_Create(&senderThread, sender, senderStack, THREAD_STACK_SIZE, 0x2D, -2));
@@ -166,7 +167,7 @@ int main(void)
     while(!shouldTerminate)
     {
         s32 index = 0;
-        assertSuccess(svcWaitSynchronizationN(&index, handles, 10, false, -1LL));
+        assertSuccess(svcWaitSynchronizationN(&index, handles, 11, false, -1LL));
 
         if(index == 0)
         {
@@ -175,6 +176,23 @@ int main(void)
             if(notificationId == 0x100) shouldTerminate = true;
         }
 
+        else if(index == 10)
+        {
+            Handle session = 0;
+            assertSuccess(svcAcceptSession(&session, handles[index]));
+
+            // One client at a time, its commands are answered by the sender thread
+            RecursiveLock_Lock(&sessionManager.senderLock);
+            if(sessionManager.statsSession != 0)
+                svcCloseHandle(session);
+            else
+            {
+                sessionManager.statsSession = session;
+                assertSuccess(svcSignalEvent(sessionManager.sendAllBuffersToArm9Event));
+            }
+            RecursiveLock_Unlock(&sessionManager.senderLock);
+        }
+
         else
         {
             Handle session = 0;
@@ -201,7 +219,7 @@ int main(void)
     assertSuccess(MyThread_Join(&senderThread, -1LL));
     assertSuccess(MyThread_Join(&PXISRV11HandlerThread, -1LL));
 
-    for(u32 i = 0; i < 10; i++)
+    for(u32 i = 0; i < 11; i++)
         svcCloseHandle(handles[i]);
 
     return 0;
@@ -31,6 +31,7 @@ static inline void receiveFromArm9(void)
     buf[0] = replyHeader;
     PXIReceiveBuffer(buf + 1, replySizeWords - 1);
     sessionManager.sessionData[serviceId].state = STATE_RECEIVED_FROM_ARM9;
+    sessionManager.stats.nbRepliesReceived++;
     RecursiveLock_Unlock(&sessionManager.sessionData[serviceId].lock);
 
     if(serviceId == 0 && shouldTerminate)
@@ -64,6 +65,9 @@ void receiver(void)
         assertSuccess(svcWaitSynchronizationN(&index, handles, 2, false, -1LL));
 
         if(index == 1) return;
+
+        // Drain every queued reply before sleeping again
+        sessionManager.stats.nbReceiverWakeups++;
         while(!PXIIsReceiveFIFOEmpty())
             receiveFromArm9();
     }
@@ -12,9 +12,8 @@ This is part of 3ds_pxi, which is licensed under the MIT license (see LICENSE fo
 #include "sender.h"
 #include "PXI.h"
 
-Result sendPXICmdbuf(Handle *additionalHandle, u32 serviceId, u32 *buffer)
+static Result acquirePXITransferMutex(Handle *additionalHandle)
 {
-
     Result res = 0;
 
     if(additionalHandle != NULL)
@@ -38,9 +37,26 @@ Result sendPXICmdbuf(Handle *additionalHandle, u32 serviceId, u32 *buffer)
     else
         assertSuccess(svcWaitSynchronization(PXITransferMutex, -1LL));
 
+    return 0;
+}
+
+// PXITransferMutex must be held. Process9 expects one sync IRQ per command
+static void sendPXICmdbufLocked(u32 serviceId, u32 *buffer)
+{
     PXISendWord(serviceId & 0xFF);
     PXITriggerSync9IRQ(); //notify arm9
-    PXISendBuffer(buffer, (buffer[0] & 0x3F) + ((buffer[0] & 0xFC0) >> 6) + 1);
+    sessionManager.stats.sendFIFOStallTicks += PXISendBuffer(buffer, (buffer[0] & 0x3F) + ((buffer[0] & 0xFC0) >> 6) + 1);
+    sessionManager.stats.nbCommandsSent++;
+}
+
+Result sendPXICmdbuf(Handle *additionalHandle, u32 serviceId, u32 *buffer)
+{
+    Result res = acquirePXITransferMutex(additionalHandle);
+    if(R_FAILED(res))
+        return res;
+
+    sendPXICmdbufLocked(serviceId, buffer);
+    sessionManager.stats.nbSendBatches++;
 
     svcReleaseMutex(PXITransferMutex);
     return 0;
@@ -82,12 +98,29 @@ static void releaseStaticBuffers(u32 *src, u32 nb)
     *src = val;
 }
 
+static void handleStatsCommand(u32 *cmdbuf)
+{
+    switch(cmdbuf[0] >> 16)
+    {
+        case 1: // GetStats
+            cmdbuf[0] = IPC_MakeHeader(1, 1 + sizeof(PXIStats) / 4, 0);
+            cmdbuf[1] = 0;
+            memcpy(&cmdbuf[2], &sessionManager.stats, sizeof(PXIStats));
+            break;
+
+        default:
+            cmdbuf[0] = IPC_MakeHeader(0, 1, 0);
+            cmdbuf[1] = 0xD900182F;
+            break;
+    }
+}
+
 void sender(void)
 {
-    Handle handles[12] = {terminationRequestedEvent, sessionManager.sendAllBuffersToArm9Event, sessionManager.replySemaphore};
+    Handle handles[13] = {terminationRequestedEvent, sessionManager.sendAllBuffersToArm9Event, sessionManager.replySemaphore};
     Handle replyTarget = 0;
     Result res = 0;
-    s32 index;
+    s32 index, statsIndex, nbHandles;
 
     u32 *cmdbuf = getThreadCommandBuffer();
 
@@ -103,6 +136,8 @@ void sender(void)
     {
         if(replyTarget == 0) //send to arm9
         {
+            // Send all ready commands in one burst, under a single mutex acquisition
+            bool transferMutexAcquired = false;
             for(u32 i = 0; i < 9; i++)
             {
                 SessionData *data = &sessionManager.sessionData[i];
@@ -118,14 +153,24 @@ void sender(void)
                 else
                     sessionManager.pendingArm9Commands++;
 
+                if(!transferMutexAcquired)
+                {
+                    res = acquirePXITransferMutex(&terminationRequestedEvent);
+                    if(R_FAILED(res))
+                        goto terminate;
+                    transferMutexAcquired = true;
+                }
+
                 RecursiveLock_Lock(&data->lock);
                 data->state = STATE_SENT_TO_ARM9;
-                res = sendPXICmdbuf(&terminationRequestedEvent, i, data->buffer);
+                sendPXICmdbufLocked(i, data->buffer);
                 RecursiveLock_Unlock(&data->lock);
+            }
 
-                if(R_FAILED(res))
-                    goto terminate;
-
+            if(transferMutexAcquired)
+            {
+                sessionManager.stats.nbSendBatches++;
+                svcReleaseMutex(PXITransferMutex);
             }
             cmdbuf[0] = 0xFFFF0000; //Kernel11
         }
@@ -140,11 +185,27 @@ void sender(void)
             }
         }
 
+        nbHandles = 3 + nbIdleSessions;
+        statsIndex = -1;
+        if(sessionManager.statsSession != 0)
+        {
+            statsIndex = nbHandles;
+            handles[nbHandles++] = sessionManager.statsSession;
+        }
+
         RecursiveLock_Unlock(&sessionManager.senderLock);
-        res = svcReplyAndReceive(&index, handles, 3 + nbIdleSessions, replyTarget);
+        res = svcReplyAndReceive(&index, handles, nbHandles, replyTarget);
         RecursiveLock_Lock(&sessionManager.senderLock);
 
-        if((u32)res == 0xC920181A) //session closed by remote
+        if((u32)res == 0xC920181A && sessionManager.statsSession != 0 &&
+           (index == statsIndex || (index == -1 && replyTarget == sessionManager.statsSession)))
+        {
+            svcCloseHandle(sessionManager.statsSession);
+            sessionManager.statsSession = replyTarget = 0;
+            continue;
+        }
+
+        else if((u32)res == 0xC920181A) //session closed by remote
         {
             u32 i;
 
@@ -161,9 +222,16 @@ void sender(void)
             continue;
         }
 
-        else if(R_FAILED(res) || (u32)index >= 3 + nbIdleSessions)
+        else if(R_FAILED(res) || index >= nbHandles)
             svcBreak(USERBREAK_PANIC);
 
+        if(index == statsIndex)
+        {
+            handleStatsCommand(cmdbuf);
+            replyTarget = sessionManager.statsSession;
+            continue;
+        }
+
         switch(index)
         {
             case 0: //terminaton requested
@@ -250,6 +318,9 @@ terminate:
             svcCloseHandle(sessionManager.sessionData[i].handle);
     }
 
+    if(sessionManager.statsSession != 0)
+        svcCloseHandle(sessionManager.statsSession);
+
     RecursiveLock_Unlock(&sessionManager.senderLock);
 }
 
@@ -22,6 +22,10 @@
 #define MAX_DEBUG           3
 #define MAX_DEBUG_THREAD    127
 #define MAX_BREAKPOINT      64
+#define MAX_BREAKPOINT_CONDITION_DATA   0x400
+#define MAX_TRACEPOINT      16
+#define MAX_TRACEPOINT_DATA 0x400
+#define MAX_TRACE_STATE_VARIABLE    16
 
 #define MAX_TIO_OPEN_FILE   32
 
@@ -44,8 +48,57 @@ typedef struct Breakpoint
     u32 savedInstruction;
     u8 instructionSize;
     bool persistent;
+
+    // Set by Z0 packets; the same svc 0xFF is shared by the tracepoints at that address
+    bool gdbBreakpoint;
+    u8 nbTracepoints;
+
+    // Agent expressions ([u16 size][bytecode]...) in GDBContext::breakpointConditions, stop if any is true
+    u16 conditionOffset;
+    u16 conditionSize;
+    u32 hitCount, skipCount;
+    u32 forcedStopCount; // Stops with no condition met, because the instruction couldn't be stepped over
 } Breakpoint;
 
+typedef struct BreakpointKind
+{
+    u32 address;
+    u8 instructionSize;
+} BreakpointKind;
+
+typedef struct Tracepoint
+{
+    u32 number;
+    u32 address;
+    bool enabled;
+    bool inserted;
+    u32 passCount; // 0: no limit
+    u32 hitCount;
+    u32 traceFrameUsage;
+
+    // In GDBContext::tracepointData: condition bytecode, then the encoded actions
+    u16 dataOffset;
+    u16 conditionSize;
+    u16 actionsSize;
+} Tracepoint;
+
+typedef struct TraceStateVariable
+{
+    u32 number;
+    s64 initialValue;
+    s64 value;
+} TraceStateVariable;
+
+typedef enum TraceStatus
+{
+    TRACE_STATUS_NOT_RUN,
+    TRACE_STATUS_RUNNING,
+    TRACE_STATUS_STOPPED,
+    TRACE_STATUS_BUFFER_FULL,
+    TRACE_STATUS_PASS_COUNT,
+    TRACE_STATUS_ERROR,
+} TraceStatus;
+
 typedef struct PackedGdbHioRequest
 {
     char magic[4]; // "GDB\x00"
@@ -138,9 +191,38 @@ typedef struct GDBContext
     u32 nbBreakpoints;
     Breakpoint breakpoints[MAX_BREAKPOINT];
 
+    // Instruction set GDB chose in its Z0 packets, kept after it removes the breakpoints (tracepoint packets don't say)
+    u32 nbBreakpointKinds;
+    BreakpointKind breakpointKinds[MAX_BREAKPOINT];
+
+    u8 breakpointConditions[MAX_BREAKPOINT_CONDITION_DATA];
+    u32 breakpointConditionsSize;
+
+    // Conditional breakpoint being stepped over, with the temporary breakpoint placed after it
+    u32 stepOverAddress;
+    u32 stepOverTempAddress;
+    u32 stepOverTempInstruction;
+    u8 stepOverTempSize;
+
     u32 nbWatchpoints;
     u32 watchpoints[2];
 
+    u32 nbTracepoints;
+    Tracepoint tracepoints[MAX_TRACEPOINT];
+    u8 tracepointData[MAX_TRACEPOINT_DATA];
+    u32 tracepointDataSize;
+
+    u32 nbTraceStateVariables;
+    TraceStateVariable traceStateVariables[MAX_TRACE_STATE_VARIABLE];
+
+    TraceStatus traceStatus;
+    u32 traceStopTracepoint;
+    bool circularTraceBuffer;
+
+    // Trace frame selected by QTFrame, 'g', 'p' and 'm' then read from it
+    bool traceFrameSelected;
+    u32 selectedTraceFrame;
+
     u32 currentHioRequestTargetAddr;
     PackedGdbHioRequest currentHioRequest;
 
@@ -0,0 +1,34 @@
+/*
+*   This file is part of Luma3DS.
+*   Copyright (C) 2016-2020 Aurora Wright, TuxSH
+*
+*   SPDX-License-Identifier: (MIT OR GPL-2.0-or-later)
+*/
+
+#pragma once
+
+#include <3ds/types.h>
+
+// GDB agent expressions (bytecode sent in "X len,expr" blocks, see the GDB manual)
+// This only depends on the callbacks below, so that it can be built on its own.
+
+#define AGENT_EXPR_STACK_SIZE   32
+#define AGENT_EXPR_MAX_STEPS    0x1000
+
+typedef struct AgentExprEnvironment
+{
+    void *userData;
+
+    // Return 0 or -errno
+    int (*readRegister)(void *userData, u32 regNum, u64 *out);
+    int (*readMemory)(void *userData, void *out, u32 addr, u32 size);
+
+    // Tracepoint collection and trace state variables, all NULL when evaluating conditions
+    int (*collectMemory)(void *userData, u32 addr, u32 size);
+    int (*collectTraceStateVariable)(void *userData, u32 id);
+    int (*getTraceStateVariable)(void *userData, u32 id, s64 *out);
+    int (*setTraceStateVariable)(void *userData, u32 id, s64 value);
+} AgentExprEnvironment;
+
+// Returns 0 and the value on top of the stack at "end" in *result, or -errno
+int GDB_EvaluateAgentExpression(s64 *result, const AgentExprEnvironment *env, const u8 *code, u32 size);
@@ -15,6 +15,18 @@
 
 u32 GDB_FindClosestBreakpointSlot(GDBContext *ctx, u32 address);
 int GDB_GetBreakpointInstruction(u32 *instr, GDBContext *ctx, u32 address);
-int GDB_AddBreakpoint(GDBContext *ctx, u32 address, bool thumb, bool persist);
+// 2 (Thumb) or 4 (ARM) if there is or was a breakpoint at that address, 0 if unknown
+u32 GDB_GetBreakpointInstructionSize(GDBContext *ctx, u32 address);
+// Records it without a breakpoint, for "monitor tracepointmode"
+void GDB_RememberBreakpointKind(GDBContext *ctx, u32 address, u8 instructionSize);
+int GDB_AddBreakpoint(GDBContext *ctx, u32 address, bool thumb, bool persist, const u8 *conditions, u32 conditionsSize);
 int GDB_DisableBreakpointById(GDBContext *ctx, u32 id);
 int GDB_RemoveBreakpoint(GDBContext *ctx, u32 address);
+
+// Returns true if the breakpoint stop of that thread should be hidden from GDB and execution continued
+bool GDB_HandleBreakpointHit(GDBContext *ctx, u32 threadId);
+void GDB_FinishBreakpointStepOver(GDBContext *ctx);
+
+// Tracepoints share the breakpoint list, and must be at instructions that can't branch
+int GDB_AddTracepointBreakpoint(GDBContext *ctx, u32 address, bool thumb);
+int GDB_RemoveTracepointBreakpoint(GDBContext *ctx, u32 address);
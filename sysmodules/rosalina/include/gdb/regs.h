@@ -9,6 +9,9 @@
 
 #include "gdb.h"
 
+// gdbNum as in the 'p' packet, returns 0 or -EINVAL
+int GDB_ReadThreadContextRegister(u64 *out, const ThreadContext *regs, u32 gdbNum);
+
 GDB_DECLARE_HANDLER(ReadRegisters);
 GDB_DECLARE_HANDLER(WriteRegisters);
 GDB_DECLARE_HANDLER(ReadRegister);
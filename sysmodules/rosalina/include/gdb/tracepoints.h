@@ -0,0 +1,35 @@
+/*
+*   This file is part of Luma3DS.
+*   Copyright (C) 2016-2020 Aurora Wright, TuxSH
+*
+*   SPDX-License-Identifier: (MIT OR GPL-2.0-or-later)
+*/
+
+#pragma once
+
+#include "gdb.h"
+
+// Shared by all contexts, only one of them can own it at a time
+#define TRACE_BUFFER_SIZE       0x8000
+#define TRACE_FRAME_MAX_SIZE    0x800
+
+// Returns true if the trace has stopped (and its breakpoints have been removed) as a result
+bool GDB_CollectTraceFrames(GDBContext *ctx, u32 address, const ThreadContext *regs);
+void GDB_ClearTracepoints(GDBContext *ctx);
+
+// For the frame selected by QTFrame. Returns 1 if all registers were collected, 0 if only the pc is known, or -errno
+int GDB_GetTraceFrameRegisters(GDBContext *ctx, ThreadContext *regs);
+int GDB_SendTraceFrameMemory(GDBContext *ctx, u32 addr, u32 len);
+
+GDB_DECLARE_QUERY_HANDLER(TraceInit);
+GDB_DECLARE_QUERY_HANDLER(TraceDefineTracepoint);
+GDB_DECLARE_QUERY_HANDLER(TraceDefineVariable);
+GDB_DECLARE_QUERY_HANDLER(TraceReadOnlyRegions);
+GDB_DECLARE_QUERY_HANDLER(TraceBufferOptions);
+GDB_DECLARE_QUERY_HANDLER(TraceStart);
+GDB_DECLARE_QUERY_HANDLER(TraceStop);
+GDB_DECLARE_QUERY_HANDLER(TraceStatus);
+GDB_DECLARE_QUERY_HANDLER(TracepointStatus);
+GDB_DECLARE_QUERY_HANDLER(TraceVariableValue);
+GDB_DECLARE_QUERY_HANDLER(TraceFrame);
+GDB_DECLARE_QUERY_HANDLER(TraceBuffer);
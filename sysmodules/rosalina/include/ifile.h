@@ -30,13 +30,31 @@
 
 #define PATH_MAX 255
 
+#define IFILE_READAHEAD_MIN 0x200
+
 typedef struct
 {
     Handle handle;
     u64 pos;
     u64 size;
+
+    // Optional readahead buffer, see IFile_SetReadBuffer
+    u8 *readBuffer;
+    u32 readBufferSize;
+    u32 readBufferLen;
+    u64 readBufferPos;
+    u32 readWindow;
 } IFile;
 
+// Totals over all files, the average read size is bytes / calls
+typedef struct
+{
+    u32 calls;      //< IFile_Read calls
+    u64 bytes;      //< bytes they returned
+    u32 fsCalls;    //< FSFILE_Read requests actually sent
+    u64 fsBytes;    //< bytes those returned
+} IFileReadStats;
+
 Result IFile_Open(IFile *file, FS_ArchiveID archiveId, FS_Path archivePath, FS_Path filePath, u32 flags);
 Result IFile_OpenFromArchive(IFile *file, FS_Archive archive, FS_Path filePath, u32 flags);
 Result IFile_Close(IFile *file);
@@ -45,3 +63,8 @@ Result IFile_SetSize(IFile *file, u64 size);
 Result IFile_Read(IFile *file, u64 *total, void *buffer, u32 len);
 Result IFile_Write(IFile *file, u64 *total, const void *buffer, u32 len, u32 flags);
 Result IFile_Flush(IFile *file);
+
+// Reads smaller than the current window are served from the buffer, which is refilled
+// with a window that doubles on sequential access and shrinks back on seeks
+void IFile_SetReadBuffer(IFile *file, void *buffer, u32 size);
+void IFile_GetReadStats(IFileReadStats *out);
@@ -37,3 +37,6 @@ Result debuggerDisable(s64 timeout);
 void DebuggerMenu_EnableDebugger(void);
 void DebuggerMenu_DisableDebugger(void);
 void DebuggerMenu_DebugNextApplicationByForce(void);
+void DebuggerMenu_ToggleSvcTracing(void);
+void DebuggerMenu_DumpSvcTrace(void);
+void DebuggerMenu_ToggleSvcTraceStreaming(void);
@@ -38,3 +38,6 @@ void MiscellaneousMenu_InputRedirection(void);
 void MiscellaneousMenu_UpdateTimeDateNtp(void);
 void MiscellaneousMenu_NullifyUserTimeOffset(void);
 void MiscellaneousMenu_DumpDspFirm(void);
+void MiscellaneousMenu_ReloadTitleOverrides(void);
+void MiscellaneousMenu_ShowLastLaunchTimings(void);
+void MiscellaneousMenu_ShowPxiStats(void);
@@ -13,6 +13,7 @@
 
 #include "gdb/watchpoints.h"
 #include "gdb/breakpoints.h"
+#include "gdb/tracepoints.h"
 #include "gdb/stop_point.h"
 
 void GDB_InitializeContext(GDBContext *ctx)
@@ -111,6 +112,8 @@ Result GDB_AttachToProcess(GDBContext *ctx)
 void GDB_DetachFromProcess(GDBContext *ctx)
 {
     DebugEventInfo dummy;
+    GDB_ClearTracepoints(ctx);
+    GDB_FinishBreakpointStepOver(ctx);
     for(u32 i = 0; i < ctx->nbBreakpoints; i++)
     {
         if(!ctx->breakpoints[i].persistent)
@@ -118,6 +121,8 @@ void GDB_DetachFromProcess(GDBContext *ctx)
     }
     memset(&ctx->breakpoints, 0, sizeof(ctx->breakpoints));
     ctx->nbBreakpoints = 0;
+    ctx->breakpointConditionsSize = 0;
+    ctx->nbBreakpointKinds = 0;
 
     for(u32 i = 0; i < ctx->nbWatchpoints; i++)
     {
@@ -0,0 +1,370 @@
+/*
+*   This file is part of Luma3DS.
+*   Copyright (C) 2016-2020 Aurora Wright, TuxSH
+*
+*   SPDX-License-Identifier: (MIT OR GPL-2.0-or-later)
+*/
+
+#include "gdb/agent_expr.h"
+
+#define _REENT_ONLY
+#include <errno.h>
+
+enum
+{
+    AX_FLOAT = 0x01,
+    AX_ADD,
+    AX_SUB,
+    AX_MUL,
+    AX_DIV_SIGNED,
+    AX_DIV_UNSIGNED,
+    AX_REM_SIGNED,
+    AX_REM_UNSIGNED,
+    AX_LSH,
+    AX_RSH_SIGNED,
+    AX_RSH_UNSIGNED,
+    AX_TRACE,
+    AX_TRACE_QUICK,
+    AX_LOG_NOT,
+    AX_BIT_AND,
+    AX_BIT_OR,
+    AX_BIT_XOR,
+    AX_BIT_NOT,
+    AX_EQUAL,
+    AX_LESS_SIGNED,
+    AX_LESS_UNSIGNED,
+    AX_EXT,
+    AX_REF8,
+    AX_REF16,
+    AX_REF32,
+    AX_REF64,
+    AX_REF_FLOAT,
+    AX_REF_DOUBLE,
+    AX_REF_LONG_DOUBLE,
+    AX_L_TO_D,
+    AX_D_TO_L,
+    AX_IF_GOTO,
+    AX_GOTO,
+    AX_CONST8,
+    AX_CONST16,
+    AX_CONST32,
+    AX_CONST64,
+    AX_REG,
+    AX_END,
+    AX_DUP,
+    AX_POP,
+    AX_ZERO_EXT,
+    AX_SWAP,
+    AX_GETV,
+    AX_SETV,
+    AX_TRACEV,
+    AX_TRACENZ,
+    AX_TRACE16,
+    AX_PICK = 0x32,
+    AX_ROT,
+    AX_PRINTF,
+};
+
+// Number of immediate bytes following each opcode, -1 for opcodes we don't implement
+static const s8 operandSizes[AX_PRINTF + 1] =
+{
+    [0]                     = -1,
+    [AX_FLOAT]              = -1,
+    [AX_TRACE_QUICK]        = 1,
+    [AX_EXT]                = 1,
+    [AX_REF_FLOAT]          = -1,
+    [AX_REF_DOUBLE]         = -1,
+    [AX_REF_LONG_DOUBLE]    = -1,
+    [AX_L_TO_D]             = -1,
+    [AX_D_TO_L]             = -1,
+    [AX_IF_GOTO]            = 2,
+    [AX_GOTO]               = 2,
+    [AX_CONST8]             = 1,
+    [AX_CONST16]            = 2,
+    [AX_CONST32]            = 4,
+    [AX_CONST64]            = 8,
+    [AX_REG]                = 2,
+    [AX_ZERO_EXT]           = 1,
+    [AX_GETV]               = 2,
+    [AX_SETV]               = 2,
+    [AX_TRACEV]             = 2,
+    [AX_TRACE16]            = 2,
+    [0x31]                  = -1,
+    [AX_PICK]               = 1,
+    [AX_PRINTF]             = -1,
+};
+
+static int GDB_AgentExprCollectString(const AgentExprEnvironment *env, u32 addr, u32 maxSize)
+{
+    u8 buf[32];
+    u32 size = 0;
+    bool foundNul = false;
+
+    // Collect up to and including the NUL terminator. Reads stop at page ends, the string
+    // can end right before an unmapped page
+    while(size < maxSize && !foundNul)
+    {
+        u32 chunk = maxSize - size < sizeof(buf) ? maxSize - size : sizeof(buf);
+        u32 pageLeft = 0x1000 - ((addr + size) & 0xFFF);
+        if(chunk > pageLeft)
+            chunk = pageLeft;
+        int r = env->readMemory(env->userData, buf, addr + size, chunk);
+        if(r != 0)
+            return r;
+
+        u32 i;
+        for(i = 0; i < chunk && buf[i] != 0; i++);
+        foundNul = i < chunk;
+        size += foundNul ? i + 1 : chunk;
+    }
+
+    return env->collectMemory(env->userData, addr, size);
+}
+
+int GDB_EvaluateAgentExpression(s64 *result, const AgentExprEnvironment *env, const u8 *code, u32 size)
+{
+    s64 stack[AGENT_EXPR_STACK_SIZE];
+    u32 sp = 0; // number of items
+    u32 pc = 0;
+    int r = 0;
+
+    for(u32 steps = 0; steps < AGENT_EXPR_MAX_STEPS; steps++)
+    {
+        if(pc >= size)
+            return -EINVAL;
+
+        u8 op = code[pc++];
+        if(op > AX_PRINTF || operandSizes[op] < 0)
+            return -ENOSYS;
+
+        u32 nbOperandBytes = (u32)operandSizes[op];
+        if(pc + nbOperandBytes > size)
+            return -EINVAL;
+
+        // Immediates are big-endian
+        u64 imm = 0;
+        for(u32 i = 0; i < nbOperandBytes; i++)
+            imm = (imm << 8) | code[pc++];
+
+        // Stack requirements
+        u32 nbPopped = 0, nbPushed = 0;
+        switch(op)
+        {
+            case AX_ADD: case AX_SUB: case AX_MUL: case AX_DIV_SIGNED: case AX_DIV_UNSIGNED:
+            case AX_REM_SIGNED: case AX_REM_UNSIGNED: case AX_LSH: case AX_RSH_SIGNED: case AX_RSH_UNSIGNED:
+            case AX_BIT_AND: case AX_BIT_OR: case AX_BIT_XOR: case AX_EQUAL: case AX_LESS_SIGNED: case AX_LESS_UNSIGNED:
+                nbPopped = 2; nbPushed = 1; break;
+            case AX_TRACE: case AX_TRACENZ:
+                nbPopped = 2; break;
+            case AX_TRACE_QUICK: case AX_TRACE16: case AX_LOG_NOT: case AX_BIT_NOT: case AX_EXT: case AX_ZERO_EXT:
+            case AX_REF8: case AX_REF16: case AX_REF32: case AX_REF64: case AX_SETV:
+                nbPopped = 1; nbPushed = 1; break;
+            case AX_IF_GOTO: case AX_POP:
+                nbPopped = 1; break;
+            case AX_CONST8: case AX_CONST16: case AX_CONST32: case AX_CONST64: case AX_REG: case AX_GETV:
+                nbPushed = 1; break;
+            case AX_DUP:
+                nbPopped = 1; nbPushed = 2; break;
+            case AX_SWAP:
+                nbPopped = 2; nbPushed = 2; break;
+            case AX_PICK:
+                nbPopped = imm + 1; nbPushed = imm + 2; break;
+            case AX_ROT:
+                nbPopped = 3; nbPushed = 3; break;
+            default:
+                break;
+        }
+
+        if(sp < nbPopped)
+            return -EINVAL;
+        else if(sp - nbPopped + nbPushed > AGENT_EXPR_STACK_SIZE)
+            return -ENOMEM;
+
+        s64 *top = stack + sp - 1; // only dereferenced when the opcode pops something
+        s64 a = sp >= 2 ? top[-1] : 0, b = sp >= 1 ? *top : 0;
+        u64 ua = (u64)a, ub = (u64)b;
+
+        switch(op)
+        {
+            case AX_ADD:            a = (s64)(ua + ub); break;
+            case AX_SUB:            a = (s64)(ua - ub); break;
+            case AX_MUL:            a = (s64)(ua * ub); break;
+            case AX_DIV_SIGNED:
+            case AX_REM_SIGNED:
+                if(b == 0)
+                    return -EDOM;
+                else if(b == -1) // avoid INT64_MIN / -1
+                    a = op == AX_DIV_SIGNED ? (s64)(0 - ua) : 0;
+                else
+                    a = op == AX_DIV_SIGNED ? a / b : a % b;
+                break;
+            case AX_DIV_UNSIGNED:
+            case AX_REM_UNSIGNED:
+                if(ub == 0)
+                    return -EDOM;
+                a = (s64)(op == AX_DIV_UNSIGNED ? ua / ub : ua % ub);
+                break;
+            case AX_LSH:            a = ub >= 64 ? 0 : (s64)(ua << ub); break;
+            case AX_RSH_SIGNED:     a = ub >= 64 ? (a < 0 ? -1 : 0) : a >> ub; break;
+            case AX_RSH_UNSIGNED:   a = ub >= 64 ? 0 : (s64)(ua >> ub); break;
+            case AX_BIT_AND:        a = a & b; break;
+            case AX_BIT_OR:         a = a | b; break;
+            case AX_BIT_XOR:        a = a ^ b; break;
+            case AX_EQUAL:          a = a == b; break;
+            case AX_LESS_SIGNED:    a = a < b; break;
+            case AX_LESS_UNSIGNED:  a = ua < ub; break;
+            default: break;
+        }
+
+        switch(op)
+        {
+            case AX_ADD: case AX_SUB: case AX_MUL: case AX_DIV_SIGNED: case AX_DIV_UNSIGNED:
+            case AX_REM_SIGNED: case AX_REM_UNSIGNED: case AX_LSH: case AX_RSH_SIGNED: case AX_RSH_UNSIGNED:
+            case AX_BIT_AND: case AX_BIT_OR: case AX_BIT_XOR: case AX_EQUAL: case AX_LESS_SIGNED: case AX_LESS_UNSIGNED:
+                top[-1] = a;
+                sp--;
+                break;
+
+            case AX_LOG_NOT:
+                *top = *top == 0;
+                break;
+            case AX_BIT_NOT:
+                *top = ~*top;
+                break;
+            case AX_EXT:
+            case AX_ZERO_EXT:
+                if(imm == 0)
+                    return -EINVAL;
+                else if(imm < 64)
+                {
+                    u64 v = (u64)*top & ((1ull << imm) - 1);
+                    if(op == AX_EXT && (v & (1ull << (imm - 1))) != 0)
+                        v |= ~((1ull << imm) - 1);
+                    *top = (s64)v;
+                }
+                break;
+
+            case AX_REF8:
+            case AX_REF16:
+            case AX_REF32:
+            case AX_REF64:
+            {
+                u32 refSize = 1 << (op - AX_REF8);
+                u8 buf[8];
+                u64 v = 0;
+                r = env->readMemory(env->userData, buf, (u32)*top, refSize);
+                if(r != 0)
+                    return r;
+                // Target is little-endian
+                for(u32 i = refSize; i > 0; i--)
+                    v = (v << 8) | buf[i - 1];
+                *top = (s64)v;
+                break;
+            }
+
+            case AX_IF_GOTO:
+                sp--;
+                if(*top != 0)
+                    pc = (u32)imm;
+                break;
+            case AX_GOTO:
+                pc = (u32)imm;
+                break;
+
+            case AX_CONST8:
+            case AX_CONST16:
+            case AX_CONST32:
+            case AX_CONST64:
+                stack[sp++] = (s64)imm;
+                break;
+
+            case AX_REG:
+            {
+                u64 v;
+                r = env->readRegister(env->userData, (u32)imm, &v);
+                if(r != 0)
+                    return r;
+                stack[sp++] = (s64)v;
+                break;
+            }
+
+            case AX_END:
+                if(sp == 0)
+                    return -EINVAL;
+                *result = *top;
+                return 0;
+
+            case AX_DUP:
+                stack[sp] = *top;
+                sp++;
+                break;
+            case AX_POP:
+                sp--;
+                break;
+            case AX_SWAP:
+                *top = a;
+                top[-1] = b;
+                break;
+            case AX_PICK:
+                stack[sp] = stack[sp - 1 - imm];
+                sp++;
+                break;
+            case AX_ROT:
+            {
+                // a b c => c a b
+                s64 c = *top;
+                top[0] = top[-1];
+                top[-1] = top[-2];
+                top[-2] = c;
+                break;
+            }
+
+            case AX_GETV:
+            case AX_SETV:
+            case AX_TRACEV:
+                if(env->getTraceStateVariable == NULL)
+                    return -ENOSYS;
+                if(op == AX_GETV)
+                {
+                    s64 v;
+                    r = env->getTraceStateVariable(env->userData, (u32)imm, &v);
+                    stack[sp++] = v;
+                }
+                else if(op == AX_SETV)
+                    r = env->setTraceStateVariable(env->userData, (u32)imm, *top);
+                else
+                    r = env->collectTraceStateVariable(env->userData, (u32)imm);
+                if(r != 0)
+                    return r;
+                break;
+
+            case AX_TRACE:
+            case AX_TRACE_QUICK:
+            case AX_TRACE16:
+            case AX_TRACENZ:
+            {
+                if(env->collectMemory == NULL)
+                    return -ENOSYS;
+
+                u32 addr = (u32)(op == AX_TRACE || op == AX_TRACENZ ? a : b);
+                u32 traceSize = (u32)(op == AX_TRACE || op == AX_TRACENZ ? b : (s64)imm);
+
+                if(op == AX_TRACENZ)
+                    r = GDB_AgentExprCollectString(env, addr, traceSize);
+                else
+                    r = env->collectMemory(env->userData, addr, traceSize);
+                if(r != 0)
+                    return r;
+
+                if(op == AX_TRACE || op == AX_TRACENZ)
+                    sp -= 2;
+                break;
+            }
+
+            default:
+                return -ENOSYS;
+        }
+    }
+
+    return -ELOOP;
+}
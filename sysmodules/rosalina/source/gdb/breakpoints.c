@@ -6,10 +6,19 @@
 */
 
 #include "gdb/breakpoints.h"
+#include "gdb/agent_expr.h"
+#include "gdb/regs.h"
+#include "gdb/tracepoints.h"
 
 #define _REENT_ONLY
 #include <errno.h>
 
+typedef struct BreakpointConditionData
+{
+    GDBContext *ctx;
+    const ThreadContext *regs;
+} BreakpointConditionData;
+
 u32 GDB_FindClosestBreakpointSlot(GDBContext *ctx, u32 address)
 {
     if(ctx->nbBreakpoints == 0 || address <= ctx->breakpoints[0].address)
@@ -47,14 +56,97 @@ int GDB_GetBreakpointInstruction(u32 *instruction, GDBContext *ctx, u32 address)
     return 0;
 }
 
-int GDB_AddBreakpoint(GDBContext *ctx, u32 address, bool thumb, bool persist)
+u32 GDB_GetBreakpointInstructionSize(GDBContext *ctx, u32 address)
+{
+    u32 id = GDB_FindClosestBreakpointSlot(ctx, address);
+    if(id != ctx->nbBreakpoints && ctx->breakpoints[id].address == address)
+        return ctx->breakpoints[id].instructionSize;
+
+    for(u32 i = 0; i < ctx->nbBreakpointKinds; i++)
+    {
+        if(ctx->breakpointKinds[i].address == address)
+            return ctx->breakpointKinds[i].instructionSize;
+    }
+
+    return 0;
+}
+
+void GDB_RememberBreakpointKind(GDBContext *ctx, u32 address, u8 instructionSize)
+{
+    u32 i = 0;
+    while(i < ctx->nbBreakpointKinds && ctx->breakpointKinds[i].address != address)
+        i++;
+
+    if(i == MAX_BREAKPOINT)
+    {
+        // Forget the oldest one
+        memmove(ctx->breakpointKinds, ctx->breakpointKinds + 1, (MAX_BREAKPOINT - 1) * sizeof(BreakpointKind));
+        i--;
+    }
+    else if(i == ctx->nbBreakpointKinds)
+        ctx->nbBreakpointKinds++;
+
+    ctx->breakpointKinds[i].address = address;
+    ctx->breakpointKinds[i].instructionSize = instructionSize;
+}
+
+static void GDB_ReleaseBreakpointConditions(GDBContext *ctx, Breakpoint *bkpt)
+{
+    u32 offset = bkpt->conditionOffset, size = bkpt->conditionSize;
+    if(size == 0)
+        return;
+
+    memmove(ctx->breakpointConditions + offset, ctx->breakpointConditions + offset + size, ctx->breakpointConditionsSize - offset - size);
+    ctx->breakpointConditionsSize -= size;
+
+    for(u32 i = 0; i < ctx->nbBreakpoints; i++)
+    {
+        if(ctx->breakpoints[i].conditionSize != 0 && ctx->breakpoints[i].conditionOffset > offset)
+            ctx->breakpoints[i].conditionOffset -= size;
+    }
+
+    bkpt->conditionOffset = bkpt->conditionSize = 0;
+}
+
+static void GDB_SetBreakpointConditions(GDBContext *ctx, Breakpoint *bkpt, const u8 *conditions, u32 conditionsSize)
+{
+    GDB_ReleaseBreakpointConditions(ctx, bkpt);
+
+    // If they don't fit, the breakpoint becomes unconditional and GDB gets to see every hit
+    if(conditionsSize == 0 || conditionsSize > sizeof(ctx->breakpointConditions) - ctx->breakpointConditionsSize)
+        return;
+
+    memcpy(ctx->breakpointConditions + ctx->breakpointConditionsSize, conditions, conditionsSize);
+    bkpt->conditionOffset = ctx->breakpointConditionsSize;
+    bkpt->conditionSize = conditionsSize;
+    ctx->breakpointConditionsSize += conditionsSize;
+}
+
+static void GDB_FreeBreakpointSlot(GDBContext *ctx, u32 id)
+{
+    for(u32 i = id; i < ctx->nbBreakpoints - 1; i++)
+        ctx->breakpoints[i] = ctx->breakpoints[i + 1];
+
+    memset(&ctx->breakpoints[--ctx->nbBreakpoints], 0, sizeof(Breakpoint));
+}
+
+static int GDB_InsertBreakpoint(GDBContext *ctx, u32 *outId, u32 address, bool thumb)
 {
     if(!thumb && (address & 3) != 0)
         return -EINVAL;
 
     address &= ~1;
 
+    // Don't save our own temporary breakpoint as the original instruction
+    if(ctx->stepOverTempSize != 0 && ctx->stepOverTempAddress == address)
+    {
+        svcWriteProcessMemory(ctx->debug, &ctx->stepOverTempInstruction, address, ctx->stepOverTempSize);
+        ctx->stepOverTempAddress = ctx->stepOverTempInstruction = 0;
+        ctx->stepOverTempSize = 0;
+    }
+
     u32 id = GDB_FindClosestBreakpointSlot(ctx, address);
+    *outId = id;
 
     if(id != ctx->nbBreakpoints && ctx->breakpoints[id].instructionSize != 0 && ctx->breakpoints[id].address == address)
         return 0;
@@ -71,16 +163,37 @@ int GDB_AddBreakpoint(GDBContext *ctx, u32 address, bool thumb, bool persist)
     if(R_FAILED(svcReadProcessMemory(&bkpt->savedInstruction, ctx->debug, address, thumb ? 2 : 4)) ||
        R_FAILED(svcWriteProcessMemory(ctx->debug, &instr, address, thumb ? 2 : 4)))
     {
-        for(u32 i = id; i < ctx->nbBreakpoints - 1; i++)
-            ctx->breakpoints[i] = ctx->breakpoints[i + 1];
-
-        memset(&ctx->breakpoints[--ctx->nbBreakpoints], 0, sizeof(Breakpoint));
+        GDB_FreeBreakpointSlot(ctx, id);
         return -EFAULT;
     }
 
     bkpt->instructionSize = thumb ? 2 : 4;
     bkpt->address = address;
-    bkpt->persistent = persist;
+    bkpt->persistent = bkpt->gdbBreakpoint = false;
+    bkpt->nbTracepoints = 0;
+    bkpt->conditionOffset = bkpt->conditionSize = 0;
+    bkpt->hitCount = bkpt->skipCount = bkpt->forcedStopCount = 0;
+
+    return 0;
+}
+
+int GDB_AddBreakpoint(GDBContext *ctx, u32 address, bool thumb, bool persist, const u8 *conditions, u32 conditionsSize)
+{
+    u32 id;
+    int r = GDB_InsertBreakpoint(ctx, &id, address, thumb);
+    if(r != 0)
+        return r;
+
+    Breakpoint *bkpt = &ctx->breakpoints[id];
+    GDB_RememberBreakpointKind(ctx, bkpt->address, bkpt->instructionSize);
+    if(!bkpt->gdbBreakpoint)
+    {
+        bkpt->gdbBreakpoint = true;
+        bkpt->persistent = persist;
+        bkpt->hitCount = bkpt->skipCount = bkpt->forcedStopCount = 0;
+    }
+
+    GDB_SetBreakpointConditions(ctx, bkpt, conditions, conditionsSize);
 
     return 0;
 }
@@ -98,19 +211,259 @@ int GDB_RemoveBreakpoint(GDBContext *ctx, u32 address)
     address &= ~1;
 
     u32 id = GDB_FindClosestBreakpointSlot(ctx, address);
-    if(id == ctx->nbBreakpoints || ctx->breakpoints[id].address != address)
+    if(id == ctx->nbBreakpoints || ctx->breakpoints[id].address != address || !ctx->breakpoints[id].gdbBreakpoint)
         return -EINVAL;
 
+    Breakpoint *bkpt = &ctx->breakpoints[id];
+    if(bkpt->nbTracepoints != 0)
+    {
+        // Still needed by a running trace
+        GDB_ReleaseBreakpointConditions(ctx, bkpt);
+        bkpt->gdbBreakpoint = bkpt->persistent = false;
+        return 0;
+    }
+
     int r = GDB_DisableBreakpointById(ctx, id);
     if(r != 0)
         return r;
+
+    GDB_ReleaseBreakpointConditions(ctx, bkpt);
+    GDB_FreeBreakpointSlot(ctx, id);
+
+    return 0;
+}
+
+static int GDB_EnableBreakpointById(GDBContext *ctx, u32 id)
+{
+    Breakpoint *bkpt = &ctx->breakpoints[id];
+    u32 instr = bkpt->instructionSize == 2 ? BREAKPOINT_INSTRUCTION_THUMB : BREAKPOINT_INSTRUCTION_ARM;
+    if(R_FAILED(svcWriteProcessMemory(ctx->debug, &instr, bkpt->address, bkpt->instructionSize)))
+        return -EFAULT;
+    else return 0;
+}
+
+static bool GDB_InstructionMayBranch(u32 instr, bool thumb)
+{
+    if(thumb)
+    {
+        instr &= 0xFFFF;
+        if((instr & 0xF000) == 0xD000)                          // b<cond> (svc is 0xDFxx)
+            return (instr & 0xFF00) != 0xDF00;
+        else if(instr >= 0xE000)                                // b, and the 32-bit bl/blx pairs
+            return true;
+        else if((instr & 0xFF00) == 0x4700)                     // bx/blx
+            return true;
+        else if((instr & 0xFD00) == 0x4400)                     // add/mov with hi registers, pc as destination
+            return (((instr & 0x80) >> 4) | (instr & 7)) == 15;
+        else if((instr & 0xF500) == 0xB100)                     // cbz/cbnz
+            return true;
+        else
+            return (instr & 0xFF00) == 0xBD00;                  // pop {..., pc}
+    }
     else
     {
-        for(u32 i = id; i < ctx->nbBreakpoints - 1; i++)
-            ctx->breakpoints[i] = ctx->breakpoints[i + 1];
+        u32 rd = (instr >> 12) & 0xF;
+        if((instr >> 28) == 0xF)                                // unconditional space (blx imm, etc.)
+            return true;
+        else if((instr & 0x0E000000) == 0x0A000000)             // b/bl
+            return true;
+        else if((instr & 0x0FFFFF00) == 0x012FFF00)             // bx/blx/bxj
+            return true;
+        else if((instr & 0x0C000000) == 0)                      // data processing
+            return rd == 15;
+        else if((instr & 0x0C100000) == 0x04100000)             // ldr
+            return rd == 15;
+        else if((instr & 0x0E100000) == 0x08100000)             // ldm
+            return (instr & (1 << 15)) != 0;
+        else
+            return false;
+    }
+}
 
-        memset(&ctx->breakpoints[--ctx->nbBreakpoints], 0, sizeof(Breakpoint));
+static bool GDB_InstructionIsSvc(u32 instr, bool thumb)
+{
+    if(thumb)
+        return (instr & 0xFF00) == 0xDF00;
+    else
+        return (instr & 0x0F000000) == 0x0F000000;
+}
 
-        return 0;
+// A svc can block for as long as it likes, or not return at all, with the breakpoint left disabled
+static bool GDB_CanStepOverInstruction(u32 instr, bool thumb)
+{
+    return !GDB_InstructionMayBranch(instr, thumb) && !GDB_InstructionIsSvc(instr, thumb);
+}
+
+static int GDB_ReadConditionRegister(void *userData, u32 regNum, u64 *out)
+{
+    return GDB_ReadThreadContextRegister(out, ((BreakpointConditionData *)userData)->regs, regNum);
+}
+
+static int GDB_ReadConditionMemory(void *userData, void *out, u32 addr, u32 size)
+{
+    GDBContext *ctx = ((BreakpointConditionData *)userData)->ctx;
+    return R_SUCCEEDED(svcReadProcessMemory(out, ctx->debug, addr, size)) ? 0 : -EFAULT;
+}
+
+static bool GDB_EvaluateBreakpointConditions(GDBContext *ctx, const Breakpoint *bkpt, const ThreadContext *regs)
+{
+    BreakpointConditionData data = { ctx, regs };
+    AgentExprEnvironment env = { 0 };
+    env.userData = &data;
+    env.readRegister = GDB_ReadConditionRegister;
+    env.readMemory = GDB_ReadConditionMemory;
+
+    const u8 *pos = ctx->breakpointConditions + bkpt->conditionOffset;
+    const u8 *end = pos + bkpt->conditionSize;
+    while(pos < end)
+    {
+        u32 size = pos[0] | (pos[1] << 8);
+        s64 value;
+
+        // Let GDB deal with conditions we can't evaluate
+        if(GDB_EvaluateAgentExpression(&value, &env, pos + 2, size) != 0 || value != 0)
+            return true;
+
+        pos += 2 + size;
+    }
+
+    return false;
+}
+
+static int GDB_BeginBreakpointStepOver(GDBContext *ctx, u32 id)
+{
+    Breakpoint *bkpt = &ctx->breakpoints[id];
+    bool thumb = bkpt->instructionSize == 2;
+
+    // We can't tell where a branch goes without emulating it, so only step over straight-line code
+    if(!GDB_CanStepOverInstruction(bkpt->savedInstruction, thumb))
+        return -EINVAL;
+
+    u32 next = bkpt->address + bkpt->instructionSize;
+    u32 nextId = GDB_FindClosestBreakpointSlot(ctx, next);
+    if(nextId == ctx->nbBreakpoints || ctx->breakpoints[nextId].address != next)
+    {
+        u32 instr = thumb ? BREAKPOINT_INSTRUCTION_THUMB : BREAKPOINT_INSTRUCTION_ARM;
+        ctx->stepOverTempInstruction = 0;
+        if(R_FAILED(svcReadProcessMemory(&ctx->stepOverTempInstruction, ctx->debug, next, bkpt->instructionSize)) ||
+           R_FAILED(svcWriteProcessMemory(ctx->debug, &instr, next, bkpt->instructionSize)))
+            return -EFAULT;
+
+        ctx->stepOverTempAddress = next;
+        ctx->stepOverTempSize = bkpt->instructionSize;
+    }
+
+    ctx->stepOverAddress = bkpt->address;
+    int r = GDB_DisableBreakpointById(ctx, id);
+    if(r != 0)
+        GDB_FinishBreakpointStepOver(ctx);
+
+    return r;
+}
+
+void GDB_FinishBreakpointStepOver(GDBContext *ctx)
+{
+    if(ctx->stepOverTempSize != 0)
+    {
+        svcWriteProcessMemory(ctx->debug, &ctx->stepOverTempInstruction, ctx->stepOverTempAddress, ctx->stepOverTempSize);
+        ctx->stepOverTempAddress = ctx->stepOverTempInstruction = 0;
+        ctx->stepOverTempSize = 0;
+    }
+
+    if(ctx->stepOverAddress != 0)
+    {
+        u32 id = GDB_FindClosestBreakpointSlot(ctx, ctx->stepOverAddress);
+        if(id != ctx->nbBreakpoints && ctx->breakpoints[id].address == ctx->stepOverAddress)
+            GDB_EnableBreakpointById(ctx, id);
+
+        ctx->stepOverAddress = 0;
+    }
+}
+
+bool GDB_HandleBreakpointHit(GDBContext *ctx, u32 threadId)
+{
+    ThreadContext regs;
+    if(R_FAILED(svcGetDebugThreadContext(&regs, ctx->debug, threadId, THREADCONTEXT_CONTROL_ALL)))
+        return false;
+
+    u32 pc = regs.cpu_registers.pc;
+    bool isStepOverTemp = ctx->stepOverTempSize != 0 && ctx->stepOverTempAddress == pc;
+
+    // Any breakpoint hit (most likely the one right after) ends the current step-over
+    GDB_FinishBreakpointStepOver(ctx);
+    if(isStepOverTemp)
+        return true;
+
+    u32 id = GDB_FindClosestBreakpointSlot(ctx, pc);
+    if(id == ctx->nbBreakpoints || ctx->breakpoints[id].address != pc)
+        return false;
+
+    Breakpoint *bkpt = &ctx->breakpoints[id];
+    if(bkpt->nbTracepoints != 0 && GDB_CollectTraceFrames(ctx, pc, &regs))
+    {
+        // The trace has just stopped and its breakpoints are gone, maybe along with this one
+        id = GDB_FindClosestBreakpointSlot(ctx, pc);
+        if(id == ctx->nbBreakpoints || ctx->breakpoints[id].address != pc)
+            return true;
+
+        bkpt = &ctx->breakpoints[id];
+    }
+
+    bool stop = bkpt->gdbBreakpoint && (bkpt->conditionSize == 0 || GDB_EvaluateBreakpointConditions(ctx, bkpt, &regs));
+    if(stop)
+    {
+        bkpt->hitCount++;
+        return false;
+    }
+    else if(GDB_BeginBreakpointStepOver(ctx, id) != 0)
+    {
+        // GDB gets the stop it didn't ask for, and resumes on its own
+        bkpt->forcedStopCount++;
+        return false;
+    }
+
+    if(bkpt->gdbBreakpoint)
+        bkpt->skipCount++;
+
+    return true;
+}
+
+int GDB_AddTracepointBreakpoint(GDBContext *ctx, u32 address, bool thumb)
+{
+    u32 id;
+    int r = GDB_InsertBreakpoint(ctx, &id, address, thumb);
+    if(r != 0)
+        return r;
+
+    // Tracepoint hits are always stepped over, which can't be done for branches and svcs
+    Breakpoint *bkpt = &ctx->breakpoints[id];
+    if(bkpt->instructionSize != (thumb ? 2 : 4) || !GDB_CanStepOverInstruction(bkpt->savedInstruction, thumb))
+    {
+        if(!bkpt->gdbBreakpoint && bkpt->nbTracepoints == 0 && GDB_DisableBreakpointById(ctx, id) == 0)
+            GDB_FreeBreakpointSlot(ctx, id);
+
+        return -EINVAL;
     }
+
+    bkpt->nbTracepoints++;
+    return 0;
+}
+
+int GDB_RemoveTracepointBreakpoint(GDBContext *ctx, u32 address)
+{
+    address &= ~1;
+
+    u32 id = GDB_FindClosestBreakpointSlot(ctx, address);
+    if(id == ctx->nbBreakpoints || ctx->breakpoints[id].address != address || ctx->breakpoints[id].nbTracepoints == 0)
+        return -EINVAL;
+
+    Breakpoint *bkpt = &ctx->breakpoints[id];
+    if(--bkpt->nbTracepoints != 0 || bkpt->gdbBreakpoint)
+        return 0;
+
+    int r = GDB_DisableBreakpointById(ctx, id);
+    if(r == 0)
+        GDB_FreeBreakpointSlot(ctx, id);
+
+    return r;
 }
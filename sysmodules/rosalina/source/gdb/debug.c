@@ -14,6 +14,7 @@
 #include "gdb/mem.h"
 #include "gdb/hio.h"
 #include "gdb/watchpoints.h"
+#include "gdb/breakpoints.h"
 #include "fmt.h"
 
 #include <stdlib.h>
@@ -696,6 +697,14 @@ int GDB_HandleDebugEvents(GDBContext *ctx)
 
     GDB_PreprocessDebugEvent(ctx, &info);
 
+    // Breakpoints whose conditions are all false are stepped over without GDB seeing them
+    if(info.type == DBGEVENT_EXCEPTION && info.exception.type == EXCEVENT_STOP_POINT &&
+       info.exception.stop_point.type == STOPPOINT_SVC_FF && GDB_HandleBreakpointHit(ctx, info.thread_id))
+    {
+        Result r = svcContinueDebugEvent(ctx->debug, ctx->continueFlags);
+        return r == (Result)0xD8A02008 ? -2 : -3; // process ended
+    }
+
     int ret = 0;
     bool continueAutomatically = (info.type == DBGEVENT_OUTPUT_STRING  && !GDB_IsHioInProgress(ctx)) ||
                                 info.type == DBGEVENT_ATTACH_PROCESS ||
@@ -12,6 +12,7 @@
 #include "gdb/mem.h"
 #include "gdb/net.h"
 #include "gdb/remote_command.h"
+#include "gdb/tracepoints.h"
 
 typedef enum GDBQueryDirection
 {
@@ -46,6 +47,18 @@ static const struct
     GDB_QUERY_HANDLER_LIST_ITEM_3("Search", SearchMemory, READ),
     GDB_QUERY_HANDLER_LIST_ITEM(CatchSyscalls, WRITE),
     GDB_QUERY_HANDLER_LIST_ITEM(Rcmd, READ),
+    GDB_QUERY_HANDLER_LIST_ITEM_3("Tinit", TraceInit, WRITE),
+    GDB_QUERY_HANDLER_LIST_ITEM_3("TDP", TraceDefineTracepoint, WRITE),
+    GDB_QUERY_HANDLER_LIST_ITEM_3("TDV", TraceDefineVariable, WRITE),
+    GDB_QUERY_HANDLER_LIST_ITEM_3("Tro", TraceReadOnlyRegions, WRITE),
+    GDB_QUERY_HANDLER_LIST_ITEM_3("TBuffer", TraceBufferOptions, WRITE),
+    GDB_QUERY_HANDLER_LIST_ITEM_3("TStart", TraceStart, WRITE),
+    GDB_QUERY_HANDLER_LIST_ITEM_3("TStop", TraceStop, WRITE),
+    GDB_QUERY_HANDLER_LIST_ITEM_3("TFrame", TraceFrame, WRITE),
+    GDB_QUERY_HANDLER_LIST_ITEM_3("TStatus", TraceStatus, READ),
+    GDB_QUERY_HANDLER_LIST_ITEM_3("TP", TracepointStatus, READ),
+    GDB_QUERY_HANDLER_LIST_ITEM_3("TV", TraceVariableValue, READ),
+    GDB_QUERY_HANDLER_LIST_ITEM_3("TBuffer", TraceBuffer, READ),
 };
 
 static int GDB_HandleQuery(GDBContext *ctx, GDBQueryDirection direction)
@@ -106,7 +119,7 @@ GDB_DECLARE_QUERY_HANDLER(Supported)
         "PacketSize=%x;"
         "qXfer:features:read+;qXfer:osdata:read+;"
         "QStartNoAckMode+;QThreadEvents+;QCatchSyscalls+;"
-        "vContSupported+;swbreak+;multiprocess+",
+        "vContSupported+;swbreak+;multiprocess+;ConditionalBreakpoints+;ConditionalTracepoints+;tracenz+",
 
         GDB_BUF_LEN // should have been sizeof(ctx->buffer) but GDB memory functions are bugged
     );
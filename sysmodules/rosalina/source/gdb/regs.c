@@ -7,6 +7,7 @@
 
 #include "gdb/regs.h"
 #include "gdb/net.h"
+#include "gdb/tracepoints.h"
 
 GDB_DECLARE_HANDLER(ReadRegisters)
 {
@@ -14,6 +15,24 @@ GDB_DECLARE_HANDLER(ReadRegisters)
         ctx->selectedThreadId = ctx->currentThreadId;
 
     ThreadContext regs;
+
+    if(ctx->traceFrameSelected)
+    {
+        int n = GDB_GetTraceFrameRegisters(ctx, &regs);
+        if(n < 0)
+            return GDB_ReplyErrno(ctx, -n);
+        else if(n == 0)
+        {
+            // Registers weren't collected, only the pc is known
+            char buf[2 * sizeof(ThreadContext)];
+            memset(buf, 'x', sizeof(buf));
+            GDB_EncodeHex(buf + 2 * offsetof(ThreadContext, cpu_registers.pc), &regs.cpu_registers.pc, 4);
+            return GDB_SendPacket(ctx, buf, sizeof(buf));
+        }
+        else
+            return GDB_SendHexPacket(ctx, &regs, sizeof(ThreadContext));
+    }
+
     Result r = svcGetDebugThreadContext(&regs, ctx->debug, ctx->selectedThreadId, THREADCONTEXT_CONTROL_ALL);
 
     if(R_FAILED(r))
@@ -68,6 +87,25 @@ static u32 GDB_ConvertRegisterNumber(ThreadContextControlFlags *flags, u32 gdbNu
     }
 }
 
+int GDB_ReadThreadContextRegister(u64 *out, const ThreadContext *regs, u32 gdbNum)
+{
+    ThreadContextControlFlags flags;
+    u32 n = GDB_ConvertRegisterNumber(&flags, gdbNum);
+
+    if(flags & THREADCONTEXT_CONTROL_CPU_GPRS)
+        *out = regs->cpu_registers.r[n];
+    else if(flags & THREADCONTEXT_CONTROL_CPU_SPRS)
+        *out = (&regs->cpu_registers.sp)[n - 13]; // hacky
+    else if(flags & THREADCONTEXT_CONTROL_FPU_GPRS)
+        memcpy(out, &regs->fpu_registers.d[n], 8);
+    else if(flags & THREADCONTEXT_CONTROL_FPU_SPRS)
+        *out = (&regs->fpu_registers.fpscr)[n]; // hacky
+    else
+        return -EINVAL;
+
+    return 0;
+}
+
 GDB_DECLARE_HANDLER(ReadRegister)
 {
     if(ctx->selectedThreadId == 0)
@@ -84,6 +122,20 @@ GDB_DECLARE_HANDLER(ReadRegister)
     if(!flags)
         return GDB_ReplyErrno(ctx, EINVAL);
 
+    if(ctx->traceFrameSelected)
+    {
+        u64 value;
+        u32 size = (flags & THREADCONTEXT_CONTROL_FPU_GPRS) ? 8 : 4;
+        int res = GDB_GetTraceFrameRegisters(ctx, &regs);
+        if(res < 0)
+            return GDB_ReplyErrno(ctx, -res);
+        else if(res == 0 && gdbRegNum != 15)
+            return GDB_SendPacket(ctx, "xxxxxxxxxxxxxxxx", 2 * size);
+
+        GDB_ReadThreadContextRegister(&value, &regs, gdbRegNum);
+        return GDB_SendHexPacket(ctx, &value, size);
+    }
+
     Result r = svcGetDebugThreadContext(&regs, ctx->debug, ctx->selectedThreadId, flags);
 
     if(R_FAILED(r))
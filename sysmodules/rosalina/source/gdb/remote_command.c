@@ -29,7 +29,9 @@ struct
     { "flushcaches"       , GDB_REMOTE_COMMAND_HANDLER(FlushCaches) },
     { "toggleextmemaccess", GDB_REMOTE_COMMAND_HANDLER(ToggleExternalMemoryAccess) },
     { "catchsvc"          , GDB_REMOTE_COMMAND_HANDLER(CatchSvc) },
-    { "getthreadpriority" , GDB_REMOTE_COMMAND_HANDLER(GetThreadPriority)}
+    { "getthreadpriority" , GDB_REMOTE_COMMAND_HANDLER(GetThreadPriority)},
+    { "breakpointstats"   , GDB_REMOTE_COMMAND_HANDLER(BreakpointStats) },
+    { "tracepointmode"    , GDB_REMOTE_COMMAND_HANDLER(TracepointMode) },
 };
 
 static const char *GDB_SkipSpaces(const char *pos)
@@ -448,6 +450,62 @@ GDB_DECLARE_REMOTE_COMMAND_HANDLER(GetThreadPriority)
     return GDB_SendHexPacket(ctx, outbuf, n);
 }
 
+GDB_DECLARE_REMOTE_COMMAND_HANDLER(BreakpointStats)
+{
+    u32 n = 0;
+    char outbuf[GDB_BUF_LEN / 2 + 1];
+
+    if(ctx->nbBreakpoints == 0)
+    {
+        n = sprintf(outbuf, "Aucun point d'arret.\n");
+        return GDB_SendHexPacket(ctx, outbuf, n);
+    }
+
+    for(u32 i = 0; i < ctx->nbBreakpoints; i++)
+    {
+        const Breakpoint *bkpt = &ctx->breakpoints[i];
+        if(n + 128 > GDB_BUF_LEN / 2)
+        {
+            n += sprintf(outbuf + n, "...\n");
+            break;
+        }
+
+        n += sprintf(outbuf + n, "0x%08lx : %lu arret(s), %lu ignore(s), %lu arret(s) force(s)%s%s\n", bkpt->address, bkpt->hitCount,
+                     bkpt->skipCount, bkpt->forcedStopCount,
+                     bkpt->conditionSize != 0 ? " (conditionnel)" : "", bkpt->nbTracepoints != 0 ? " (trace)" : "");
+    }
+
+    return GDB_SendHexPacket(ctx, outbuf, n);
+}
+
+// The tracepoint packets don't say whether an address is ARM or Thumb code: "tracepointmode <address> arm|thumb"
+// gives it for QTStart, like a breakpoint set there earlier would
+GDB_DECLARE_REMOTE_COMMAND_HANDLER(TracepointMode)
+{
+    bool ok;
+    int n;
+    u32 address;
+    char *end;
+    char outbuf[GDB_BUF_LEN / 2 + 1];
+
+    if(ctx->commandData[0] == 0)
+        return GDB_ReplyErrno(ctx, EILSEQ);
+
+    address = xstrtoul(ctx->commandData, &end, 0, true, &ok);
+    const char *mode = GDB_SkipSpaces(end);
+    if(!ok || end == mode || (strcmp(mode, "arm") != 0 && strcmp(mode, "thumb") != 0))
+        return GDB_ReplyErrno(ctx, EILSEQ);
+
+    bool thumb = mode[0] == 't';
+    if(!thumb && (address & 3) != 0)
+        return GDB_ReplyErrno(ctx, EINVAL);
+
+    GDB_RememberBreakpointKind(ctx, address & ~1, thumb ? 2 : 4);
+
+    n = sprintf(outbuf, "Points de trace a 0x%08lx : mode %s.\n", address & ~1, thumb ? "Thumb" : "ARM");
+    return GDB_SendHexPacket(ctx, outbuf, n);
+}
+
 GDB_DECLARE_QUERY_HANDLER(Rcmd)
 {
     char commandData[GDB_BUF_LEN / 2 + 1];
@@ -18,6 +18,41 @@ GDB_DECLARE_HANDLER(ToggleStopPoint)
     const char *pos = GDB_ParseHexIntegerList(lst, ctx->commandData, 3, ';');
     if(pos == NULL)
         return GDB_ReplyErrno(ctx, EILSEQ);
+
+    // Conditions: ";Xlen,expr" followed by more "Xlen,expr", stored as [u16 len][expr] for the breakpoint code
+    u8 conditions[MAX_BREAKPOINT_CONDITION_DATA];
+    u32 conditionsSize = 0;
+    bool conditionsFit = true;
+    if(pos[0] == ';' && pos[1] == 'X')
+    {
+        pos++;
+        while(*pos == 'X')
+        {
+            u32 len;
+            pos = GDB_ParseHexIntegerList(&len, pos + 1, 1, ',');
+            if(pos == NULL || *pos != ',' || len == 0 || len > GDB_BUF_LEN || strnlen(pos + 1, 2 * len) != 2 * len)
+                return GDB_ReplyErrno(ctx, EILSEQ);
+
+            pos++;
+            if(conditionsSize + 2 + len <= sizeof(conditions))
+            {
+                conditions[conditionsSize] = len & 0xFF;
+                conditions[conditionsSize + 1] = len >> 8;
+                if(GDB_DecodeHex(conditions + conditionsSize + 2, pos, len) != len)
+                    return GDB_ReplyErrno(ctx, EILSEQ);
+                conditionsSize += 2 + len;
+            }
+            else
+                conditionsFit = false;
+
+            pos += 2 * len;
+        }
+    }
+
+    // Dropping only some of them would hide stops GDB expects, drop them all
+    if(!conditionsFit)
+        conditionsSize = 0;
+
     bool persist = *pos != 0 && strncmp(pos, ";cmds:1", 7) == 0;
 
     u32 kind = lst[0];
@@ -33,7 +68,7 @@ GDB_DECLARE_HANDLER(ToggleStopPoint)
                 return GDB_ReplyEmpty(ctx);
             else
             {
-                res = add ? GDB_AddBreakpoint(ctx, addr, size == 2, persist) :
+                res = add ? GDB_AddBreakpoint(ctx, addr, size == 2, persist, conditions, conditionsSize) :
                             GDB_RemoveBreakpoint(ctx, addr);
                 return res == 0 ? GDB_ReplyOk(ctx) : GDB_ReplyErrno(ctx, -res);
             }
@@ -0,0 +1,987 @@
+/*
+*   This file is part of Luma3DS.
+*   Copyright (C) 2016-2020 Aurora Wright, TuxSH
+*
+*   SPDX-License-Identifier: (MIT OR GPL-2.0-or-later)
+*/
+
+#include "gdb/tracepoints.h"
+#include "gdb/breakpoints.h"
+#include "gdb/agent_expr.h"
+#include "gdb/regs.h"
+#include "gdb/mem.h"
+#include "gdb/net.h"
+#include "fmt.h"
+
+/*
+    Trace frames use the layout of GDB's trace files, so that qTBuffer can hand them out as-is:
+    u16 tracepoint number, u32 data size, then blocks:
+        'R' + register block (the same as the 'g' reply, that is, ThreadContext)
+        'M' + u64 address + u16 size + data
+        'V' + u32 variable number + s64 value
+
+    Frames are never split. When there isn't enough room left at the end of the buffer, we wrap around
+    and overwrite the oldest frames if the buffer is circular, otherwise the trace is stopped.
+*/
+
+#define TRACE_FRAME_HEADER_SIZE     6
+#define TRACE_ACTION_MEMORY_SIZE    13 // 'M' + s32 base register + u32 offset + u32 size
+
+typedef struct TraceBuffer
+{
+    GDBContext *owner;
+    u32 head, tail, wrapEnd; // valid data: [head, tail), or [head, wrapEnd) then [0, tail) when wrapped
+    bool wrapped;
+    u32 nbFrames, nbFramesCreated;
+    u8 data[TRACE_BUFFER_SIZE];
+} TraceBuffer;
+
+typedef struct TraceFrameBuilder
+{
+    GDBContext *ctx;
+    const ThreadContext *regs;
+    bool hasRegisters;
+    u32 size;
+    u8 data[TRACE_FRAME_MAX_SIZE];
+} TraceFrameBuilder;
+
+static TraceBuffer traceBuffer;
+static TraceFrameBuilder traceFrameBuilder;
+
+static Tracepoint *GDB_FindTracepoint(GDBContext *ctx, u32 number, u32 address)
+{
+    for(u32 i = 0; i < ctx->nbTracepoints; i++)
+    {
+        if(ctx->tracepoints[i].number == number && ctx->tracepoints[i].address == address)
+            return &ctx->tracepoints[i];
+    }
+
+    return NULL;
+}
+
+static TraceStateVariable *GDB_FindTraceStateVariable(GDBContext *ctx, u32 number)
+{
+    for(u32 i = 0; i < ctx->nbTraceStateVariables; i++)
+    {
+        if(ctx->traceStateVariables[i].number == number)
+            return &ctx->traceStateVariables[i];
+    }
+
+    return NULL;
+}
+
+static const char *GDB_ParseTraceHex(u64 *out, const char *pos)
+{
+    const char *start = pos;
+    u64 n = 0;
+
+    for(;; pos++)
+    {
+        if(*pos >= '0' && *pos <= '9') n = (n << 4) | (*pos - '0');
+        else if(*pos >= 'a' && *pos <= 'f') n = (n << 4) | (0xA + *pos - 'a');
+        else if(*pos >= 'A' && *pos <= 'F') n = (n << 4) | (0xA + *pos - 'A');
+        else break;
+    }
+
+    *out = n;
+    return pos == start ? NULL : pos;
+}
+
+static void GDB_ResetTraceBuffer(GDBContext *owner)
+{
+    traceBuffer.owner = owner;
+    traceBuffer.head = traceBuffer.tail = traceBuffer.wrapEnd = 0;
+    traceBuffer.wrapped = false;
+    traceBuffer.nbFrames = traceBuffer.nbFramesCreated = 0;
+}
+
+static u32 GDB_GetTraceBufferUsedSize(void)
+{
+    if(traceBuffer.wrapped)
+        return traceBuffer.wrapEnd - traceBuffer.head + traceBuffer.tail;
+    else
+        return traceBuffer.tail - traceBuffer.head;
+}
+
+static u32 GDB_GetTraceFrameSize(u32 offset)
+{
+    u32 dataSize;
+    memcpy(&dataSize, traceBuffer.data + offset + 2, 4);
+    return TRACE_FRAME_HEADER_SIZE + dataSize;
+}
+
+static u32 GDB_GetNextTraceFrame(u32 offset)
+{
+    offset += GDB_GetTraceFrameSize(offset);
+    return (traceBuffer.wrapped && offset == traceBuffer.wrapEnd) ? 0 : offset;
+}
+
+// Returns the offset of the frame, or -1 if it isn't in the buffer (anymore)
+static s32 GDB_FindTraceFrame(GDBContext *ctx, u32 number)
+{
+    u32 first = traceBuffer.nbFramesCreated - traceBuffer.nbFrames;
+    if(traceBuffer.owner != ctx || number < first || number >= traceBuffer.nbFramesCreated)
+        return -1;
+
+    u32 offset = traceBuffer.head;
+    for(u32 i = first; i < number; i++)
+        offset = GDB_GetNextTraceFrame(offset);
+
+    return (s32)offset;
+}
+
+static u32 GDB_GetTraceFrameBlockSize(const u8 *block)
+{
+    u16 size;
+    switch(block[0])
+    {
+        case 'R':
+            return 1 + sizeof(ThreadContext);
+        case 'M':
+            memcpy(&size, block + 9, 2);
+            return 11 + size;
+        case 'V':
+            return 13;
+        default:
+            return 0;
+    }
+}
+
+static u32 GDB_ReadTraceBuffer(void *out, u32 offset, u32 len)
+{
+    u8 *out8 = (u8 *)out;
+    u32 firstPartSize = (traceBuffer.wrapped ? traceBuffer.wrapEnd : traceBuffer.tail) - traceBuffer.head;
+    u32 total = 0;
+
+    if(offset < firstPartSize)
+    {
+        total = len < firstPartSize - offset ? len : firstPartSize - offset;
+        memcpy(out8, traceBuffer.data + traceBuffer.head + offset, total);
+    }
+
+    if(traceBuffer.wrapped && total < len && offset + total - firstPartSize < traceBuffer.tail)
+    {
+        u32 secondPartOffset = offset + total - firstPartSize;
+        u32 n = len - total < traceBuffer.tail - secondPartOffset ? len - total : traceBuffer.tail - secondPartOffset;
+        memcpy(out8 + total, traceBuffer.data + secondPartOffset, n);
+        total += n;
+    }
+
+    return total;
+}
+
+static u8 *GDB_ReserveTraceFrame(u32 size, bool circular)
+{
+    while(true)
+    {
+        u32 limit = traceBuffer.wrapped ? traceBuffer.head : TRACE_BUFFER_SIZE;
+        if(traceBuffer.tail + size <= limit)
+        {
+            u8 *frame = traceBuffer.data + traceBuffer.tail;
+            traceBuffer.tail += size;
+            return frame;
+        }
+        else if(!circular)
+            return NULL;
+        else if(!traceBuffer.wrapped)
+        {
+            traceBuffer.wrapEnd = traceBuffer.tail;
+            traceBuffer.tail = 0;
+            traceBuffer.wrapped = true;
+        }
+        else
+        {
+            // Drop the oldest frame
+            traceBuffer.head += GDB_GetTraceFrameSize(traceBuffer.head);
+            traceBuffer.nbFrames--;
+            if(traceBuffer.head == traceBuffer.wrapEnd)
+            {
+                traceBuffer.head = traceBuffer.wrapEnd = 0;
+                traceBuffer.wrapped = false;
+            }
+        }
+    }
+}
+
+// Returns 1 if all registers were collected, 0 if only the pc is known
+static int GDB_ReadTraceFrameRegisters(GDBContext *ctx, u32 offset, ThreadContext *regs)
+{
+    const u8 *block = traceBuffer.data + offset + TRACE_FRAME_HEADER_SIZE;
+    const u8 *end = traceBuffer.data + offset + GDB_GetTraceFrameSize(offset);
+    u32 blockSize;
+
+    for(; block < end && (blockSize = GDB_GetTraceFrameBlockSize(block)) != 0; block += blockSize)
+    {
+        if(block[0] == 'R')
+        {
+            memcpy(regs, block + 1, sizeof(ThreadContext));
+            return 1;
+        }
+    }
+
+    // Like gdbserver, use the address of the tracepoint (of its first location) for the pc
+    u16 number;
+    memcpy(&number, traceBuffer.data + offset, 2);
+    memset(regs, 0, sizeof(ThreadContext));
+    for(u32 i = 0; i < ctx->nbTracepoints; i++)
+    {
+        if(ctx->tracepoints[i].number == number)
+        {
+            regs->cpu_registers.pc = ctx->tracepoints[i].address & ~1;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+int GDB_GetTraceFrameRegisters(GDBContext *ctx, ThreadContext *regs)
+{
+    s32 offset = ctx->traceFrameSelected ? GDB_FindTraceFrame(ctx, ctx->selectedTraceFrame) : -1;
+    if(offset < 0)
+        return -ENOENT;
+
+    return GDB_ReadTraceFrameRegisters(ctx, (u32)offset, regs);
+}
+
+int GDB_SendTraceFrameMemory(GDBContext *ctx, u32 addr, u32 len)
+{
+    s32 offset = ctx->traceFrameSelected ? GDB_FindTraceFrame(ctx, ctx->selectedTraceFrame) : -1;
+    if(offset < 0)
+        return GDB_ReplyErrno(ctx, ENOENT);
+
+    const u8 *block = traceBuffer.data + offset + TRACE_FRAME_HEADER_SIZE;
+    const u8 *end = traceBuffer.data + offset + GDB_GetTraceFrameSize((u32)offset);
+    u32 blockSize;
+
+    if(len > (GDB_BUF_LEN - 4) / 2)
+        len = (GDB_BUF_LEN - 4) / 2;
+
+    for(; block < end && (blockSize = GDB_GetTraceFrameBlockSize(block)) != 0; block += blockSize)
+    {
+        u64 blockAddr;
+        u16 blockLen;
+        if(block[0] != 'M')
+            continue;
+
+        memcpy(&blockAddr, block + 1, 8);
+        memcpy(&blockLen, block + 9, 2);
+        if(addr >= blockAddr && addr < blockAddr + blockLen)
+        {
+            // Only what is contiguous in this block, GDB will ask for the rest
+            u32 n = blockAddr + blockLen - addr;
+            return GDB_SendHexPacket(ctx, block + 11 + (addr - (u32)blockAddr), n < len ? n : len);
+        }
+    }
+
+    return GDB_ReplyErrno(ctx, EFAULT);
+}
+
+// Blocks that don't fit in the frame are dropped, collection is best-effort
+static u8 *GDB_AllocateTraceFrameBlock(TraceFrameBuilder *builder, u32 size)
+{
+    if(size > TRACE_FRAME_MAX_SIZE - builder->size)
+        return NULL;
+
+    u8 *block = builder->data + builder->size;
+    builder->size += size;
+    return block;
+}
+
+static void GDB_CollectRegisters(TraceFrameBuilder *builder)
+{
+    if(builder->hasRegisters)
+        return;
+
+    u8 *block = GDB_AllocateTraceFrameBlock(builder, 1 + sizeof(ThreadContext));
+    if(block != NULL)
+    {
+        block[0] = 'R';
+        memcpy(block + 1, builder->regs, sizeof(ThreadContext));
+        builder->hasRegisters = true;
+    }
+}
+
+static int GDB_CollectMemory(void *userData, u32 addr, u32 size)
+{
+    TraceFrameBuilder *builder = (TraceFrameBuilder *)userData;
+
+    while(size > 0 && TRACE_FRAME_MAX_SIZE - builder->size > 11)
+    {
+        u8 *block = builder->data + builder->size;
+        u32 n = TRACE_FRAME_MAX_SIZE - builder->size - 11;
+        n = size < n ? size : n;
+
+        // Unreadable memory isn't an error, it just isn't collected
+        u32 total = GDB_ReadTargetMemory(block + 11, builder->ctx, addr, n);
+        if(total == 0)
+            break;
+
+        u64 addr64 = addr;
+        u16 len = (u16)total;
+        block[0] = 'M';
+        memcpy(block + 1, &addr64, 8);
+        memcpy(block + 9, &len, 2);
+        builder->size += 11 + total;
+
+        if(total != n)
+            break;
+
+        addr += total;
+        size -= total;
+    }
+
+    return 0;
+}
+
+static int GDB_CollectTraceStateVariable(void *userData, u32 id)
+{
+    TraceFrameBuilder *builder = (TraceFrameBuilder *)userData;
+    TraceStateVariable *var = GDB_FindTraceStateVariable(builder->ctx, id);
+    if(var == NULL)
+        return -EINVAL;
+
+    u8 *block = GDB_AllocateTraceFrameBlock(builder, 13);
+    if(block != NULL)
+    {
+        block[0] = 'V';
+        memcpy(block + 1, &var->number, 4);
+        memcpy(block + 5, &var->value, 8);
+    }
+
+    return 0;
+}
+
+static int GDB_GetTraceStateVariable(void *userData, u32 id, s64 *out)
+{
+    TraceStateVariable *var = GDB_FindTraceStateVariable(((TraceFrameBuilder *)userData)->ctx, id);
+    if(var == NULL)
+        return -EINVAL;
+
+    *out = var->value;
+    return 0;
+}
+
+static int GDB_SetTraceStateVariable(void *userData, u32 id, s64 value)
+{
+    TraceStateVariable *var = GDB_FindTraceStateVariable(((TraceFrameBuilder *)userData)->ctx, id);
+    if(var == NULL)
+        return -EINVAL;
+
+    var->value = value;
+    return 0;
+}
+
+static int GDB_ReadTraceRegister(void *userData, u32 regNum, u64 *out)
+{
+    return GDB_ReadThreadContextRegister(out, ((TraceFrameBuilder *)userData)->regs, regNum);
+}
+
+static int GDB_ReadTraceMemory(void *userData, void *out, u32 addr, u32 size)
+{
+    return GDB_ReadTargetMemory(out, ((TraceFrameBuilder *)userData)->ctx, addr, size) == size ? 0 : -EFAULT;
+}
+
+static int GDB_RunTracepointActions(TraceFrameBuilder *builder, const AgentExprEnvironment *env, const Tracepoint *tp)
+{
+    const u8 *pos = builder->ctx->tracepointData + tp->dataOffset + tp->conditionSize;
+    const u8 *end = pos + tp->actionsSize;
+
+    while(pos < end)
+    {
+        switch(*pos)
+        {
+            case 'R':
+            {
+                GDB_CollectRegisters(builder);
+                pos++;
+                break;
+            }
+
+            case 'M':
+            {
+                s32 baseReg;
+                u32 offset, size;
+                u64 base = 0;
+                memcpy(&baseReg, pos + 1, 4);
+                memcpy(&offset, pos + 5, 4);
+                memcpy(&size, pos + 9, 4);
+
+                if(baseReg != -1 && GDB_ReadThreadContextRegister(&base, builder->regs, (u32)baseReg) != 0)
+                    return -EINVAL;
+
+                GDB_CollectMemory(builder, (u32)base + offset, size);
+                pos += TRACE_ACTION_MEMORY_SIZE;
+                break;
+            }
+
+            case 'X':
+            {
+                u16 size;
+                s64 value;
+                memcpy(&size, pos + 1, 2);
+
+                int r = GDB_EvaluateAgentExpression(&value, env, pos + 3, size);
+                if(r != 0)
+                    return r;
+
+                pos += 3 + size;
+                break;
+            }
+
+            default:
+                return -EINVAL;
+        }
+    }
+
+    return 0;
+}
+
+static void GDB_StopTrace(GDBContext *ctx, TraceStatus status, u32 tracepoint)
+{
+    for(u32 i = 0; i < ctx->nbTracepoints; i++)
+    {
+        Tracepoint *tp = &ctx->tracepoints[i];
+        if(tp->inserted)
+        {
+            GDB_RemoveTracepointBreakpoint(ctx, tp->address);
+            tp->inserted = false;
+        }
+    }
+
+    ctx->traceStatus = status;
+    ctx->traceStopTracepoint = tracepoint;
+}
+
+bool GDB_CollectTraceFrames(GDBContext *ctx, u32 address, const ThreadContext *regs)
+{
+    if(ctx->traceStatus != TRACE_STATUS_RUNNING || traceBuffer.owner != ctx)
+        return false;
+
+    TraceFrameBuilder *builder = &traceFrameBuilder;
+    AgentExprEnvironment env;
+    env.userData = builder;
+    env.readRegister = GDB_ReadTraceRegister;
+    env.readMemory = GDB_ReadTraceMemory;
+    env.collectMemory = GDB_CollectMemory;
+    env.collectTraceStateVariable = GDB_CollectTraceStateVariable;
+    env.getTraceStateVariable = GDB_GetTraceStateVariable;
+    env.setTraceStateVariable = GDB_SetTraceStateVariable;
+
+    for(u32 i = 0; i < ctx->nbTracepoints; i++)
+    {
+        Tracepoint *tp = &ctx->tracepoints[i];
+        if(!tp->inserted || (tp->address & ~1) != address)
+            continue;
+
+        builder->ctx = ctx;
+        builder->regs = regs;
+        builder->hasRegisters = false;
+        builder->size = TRACE_FRAME_HEADER_SIZE;
+
+        if(tp->conditionSize != 0)
+        {
+            s64 value;
+            if(GDB_EvaluateAgentExpression(&value, &env, ctx->tracepointData + tp->dataOffset, tp->conditionSize) != 0)
+            {
+                GDB_StopTrace(ctx, TRACE_STATUS_ERROR, tp->number);
+                return true;
+            }
+            else if(value == 0)
+                continue;
+        }
+
+        tp->hitCount++;
+        if(GDB_RunTracepointActions(builder, &env, tp) != 0)
+        {
+            GDB_StopTrace(ctx, TRACE_STATUS_ERROR, tp->number);
+            return true;
+        }
+
+        u16 number = (u16)tp->number;
+        u32 dataSize = builder->size - TRACE_FRAME_HEADER_SIZE;
+        memcpy(builder->data, &number, 2);
+        memcpy(builder->data + 2, &dataSize, 4);
+
+        u8 *frame = GDB_ReserveTraceFrame(builder->size, ctx->circularTraceBuffer);
+        if(frame == NULL)
+        {
+            GDB_StopTrace(ctx, TRACE_STATUS_BUFFER_FULL, 0);
+            return true;
+        }
+
+        memcpy(frame, builder->data, builder->size);
+        traceBuffer.nbFrames++;
+        traceBuffer.nbFramesCreated++;
+        tp->traceFrameUsage += builder->size;
+
+        if(tp->passCount != 0 && tp->hitCount >= tp->passCount)
+        {
+            GDB_StopTrace(ctx, TRACE_STATUS_PASS_COUNT, tp->number);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void GDB_ClearTracepoints(GDBContext *ctx)
+{
+    if(ctx->traceStatus == TRACE_STATUS_RUNNING)
+        GDB_StopTrace(ctx, TRACE_STATUS_STOPPED, 0);
+
+    if(traceBuffer.owner == ctx)
+        GDB_ResetTraceBuffer(NULL);
+
+    memset(ctx->tracepoints, 0, sizeof(ctx->tracepoints));
+    ctx->nbTracepoints = 0;
+    ctx->tracepointDataSize = 0;
+
+    memset(ctx->traceStateVariables, 0, sizeof(ctx->traceStateVariables));
+    ctx->nbTraceStateVariables = 0;
+
+    ctx->traceStatus = TRACE_STATUS_NOT_RUN;
+    ctx->traceStopTracepoint = 0;
+    ctx->traceFrameSelected = false;
+}
+
+GDB_DECLARE_QUERY_HANDLER(TraceInit)
+{
+    GDB_ClearTracepoints(ctx);
+    return GDB_ReplyOk(ctx);
+}
+
+static int GDB_DefineTracepoint(GDBContext *ctx, const char *data)
+{
+    // n:addr:ena:step:pass[:Xlen,cond]
+    u32 lst[2], stepPass[2];
+    const char *pos = GDB_ParseIntegerList(lst, data, 2, ':', ':', 16, false);
+    if(pos == NULL || *pos != ':' || (pos[1] != 'E' && pos[1] != 'D') || pos[2] != ':')
+        return GDB_ReplyErrno(ctx, EILSEQ);
+
+    bool enabled = pos[1] == 'E';
+    pos = GDB_ParseIntegerList(stepPass, pos + 3, 2, ':', ':', 16, false);
+    if(pos == NULL)
+        return GDB_ReplyErrno(ctx, EILSEQ);
+    else if(ctx->nbTracepoints == MAX_TRACEPOINT)
+        return GDB_ReplyErrno(ctx, ENOMEM);
+    else if(GDB_FindTracepoint(ctx, lst[0], lst[1]) != NULL)
+        return GDB_ReplyErrno(ctx, EINVAL);
+
+    Tracepoint *tp = &ctx->tracepoints[ctx->nbTracepoints];
+    memset(tp, 0, sizeof(Tracepoint));
+    tp->number = lst[0];
+    tp->address = lst[1];
+    tp->enabled = enabled;
+    tp->passCount = stepPass[1];
+    tp->dataOffset = ctx->tracepointDataSize;
+
+    while(*pos == ':')
+    {
+        u64 size;
+        pos++;
+
+        // Fast tracepoints ('F') aren't supported
+        if(*pos != 'X' || tp->conditionSize != 0)
+            return GDB_ReplyErrno(ctx, EILSEQ);
+
+        pos = GDB_ParseTraceHex(&size, pos + 1);
+        if(pos == NULL || *pos != ',' || size == 0 || size > GDB_BUF_LEN)
+            return GDB_ReplyErrno(ctx, EILSEQ);
+        else if(size > sizeof(ctx->tracepointData) - ctx->tracepointDataSize)
+            return GDB_ReplyErrno(ctx, ENOMEM);
+        else if(GDB_DecodeHex(ctx->tracepointData + tp->dataOffset, pos + 1, (u32)size) != size)
+            return GDB_ReplyErrno(ctx, EILSEQ);
+
+        tp->conditionSize = (u16)size;
+        pos += 1 + 2 * size;
+    }
+
+    if(*pos != 0)
+        return GDB_ReplyErrno(ctx, EILSEQ);
+
+    ctx->tracepointDataSize += tp->conditionSize;
+    ctx->nbTracepoints++;
+
+    if(stepPass[0] != 0)
+        GDB_SendDebugString(ctx, "Point de trace %lu : les actions \"while-stepping\" seront ignorees.\n", tp->number);
+
+    return GDB_ReplyOk(ctx);
+}
+
+static int GDB_AddTracepointActions(GDBContext *ctx, const char *data)
+{
+    // n:addr:actions, each of them being "R mask", "M basereg,offset,len", "X len,expr", or 'S' before while-stepping ones
+    u32 lst[2];
+    const char *pos = GDB_ParseIntegerList(lst, data, 2, ':', ':', 16, false);
+    if(pos == NULL || *pos != ':')
+        return GDB_ReplyErrno(ctx, EILSEQ);
+
+    // The actions are sent right after their tracepoint, whose data is thus at the end of the pool
+    Tracepoint *tp = GDB_FindTracepoint(ctx, lst[0], lst[1]);
+    if(tp == NULL || (u32)tp->dataOffset + tp->conditionSize + tp->actionsSize != ctx->tracepointDataSize)
+        return GDB_ReplyErrno(ctx, EINVAL);
+
+    u8 *out = ctx->tracepointData + ctx->tracepointDataSize;
+    u8 *end = ctx->tracepointData + sizeof(ctx->tracepointData);
+
+    for(pos++; *pos != 0 && *pos != 'S';)
+    {
+        if(*pos == 'R')
+        {
+            // The mask doesn't matter, the whole register block is collected
+            u64 mask;
+            pos = GDB_ParseTraceHex(&mask, pos + 1);
+            if(pos == NULL)
+                return GDB_ReplyErrno(ctx, EILSEQ);
+            else if(out == end)
+                return GDB_ReplyErrno(ctx, ENOMEM);
+
+            *out++ = 'R';
+        }
+        else if(*pos == 'M')
+        {
+            u64 baseReg, offset, size;
+            pos = GDB_ParseTraceHex(&baseReg, pos + 1);
+            if(pos != NULL && *pos == ',')
+                pos = GDB_ParseTraceHex(&offset, pos + 1);
+            if(pos != NULL && *pos == ',')
+                pos = GDB_ParseTraceHex(&size, pos + 1);
+            else
+                pos = NULL;
+
+            if(pos == NULL)
+                return GDB_ReplyErrno(ctx, EILSEQ);
+            else if(end - out < TRACE_ACTION_MEMORY_SIZE)
+                return GDB_ReplyErrno(ctx, ENOMEM);
+
+            // The base register is -1 for absolute addresses
+            s32 baseReg32 = (s32)baseReg;
+            u32 offset32 = (u32)offset, size32 = (u32)size;
+            out[0] = 'M';
+            memcpy(out + 1, &baseReg32, 4);
+            memcpy(out + 5, &offset32, 4);
+            memcpy(out + 9, &size32, 4);
+            out += TRACE_ACTION_MEMORY_SIZE;
+        }
+        else if(*pos == 'X')
+        {
+            u64 size;
+            pos = GDB_ParseTraceHex(&size, pos + 1);
+            if(pos == NULL || *pos != ',' || size == 0 || size > GDB_BUF_LEN)
+                return GDB_ReplyErrno(ctx, EILSEQ);
+            else if((u32)(end - out) < 3 + size)
+                return GDB_ReplyErrno(ctx, ENOMEM);
+
+            u16 size16 = (u16)size;
+            out[0] = 'X';
+            memcpy(out + 1, &size16, 2);
+            if(GDB_DecodeHex(out + 3, pos + 1, size16) != size16)
+                return GDB_ReplyErrno(ctx, EILSEQ);
+
+            out += 3 + size16;
+            pos += 1 + 2 * size16;
+        }
+        else
+            return GDB_ReplyErrno(ctx, EILSEQ);
+    }
+
+    u32 added = out - (ctx->tracepointData + ctx->tracepointDataSize);
+    tp->actionsSize += added;
+    ctx->tracepointDataSize += added;
+
+    return GDB_ReplyOk(ctx);
+}
+
+GDB_DECLARE_QUERY_HANDLER(TraceDefineTracepoint)
+{
+    char *data = ctx->commandData;
+    u32 len = strlen(data);
+
+    // A trailing '-' only means that more packets for this tracepoint follow
+    if(len != 0 && data[len - 1] == '-')
+        data[len - 1] = 0;
+
+    if(ctx->traceStatus == TRACE_STATUS_RUNNING)
+        return GDB_ReplyErrno(ctx, EBUSY);
+
+    return data[0] == '-' ? GDB_AddTracepointActions(ctx, data + 1) : GDB_DefineTracepoint(ctx, data);
+}
+
+GDB_DECLARE_QUERY_HANDLER(TraceDefineVariable)
+{
+    // n:value:builtin:name, only the first two matter
+    u32 number;
+    u64 value;
+    const char *pos = GDB_ParseIntegerList(&number, ctx->commandData, 1, ':', ':', 16, false);
+    if(pos == NULL || *pos != ':' || GDB_ParseIntegerList64(&value, pos + 1, 1, ':', ':', 16, false) == NULL)
+        return GDB_ReplyErrno(ctx, EILSEQ);
+
+    TraceStateVariable *var = GDB_FindTraceStateVariable(ctx, number);
+    if(var == NULL)
+    {
+        if(ctx->nbTraceStateVariables == MAX_TRACE_STATE_VARIABLE)
+            return GDB_ReplyErrno(ctx, ENOMEM);
+
+        var = &ctx->traceStateVariables[ctx->nbTraceStateVariables++];
+        var->number = number;
+    }
+
+    var->initialValue = var->value = (s64)value;
+    return GDB_ReplyOk(ctx);
+}
+
+GDB_DECLARE_QUERY_HANDLER(TraceReadOnlyRegions)
+{
+    // Memory that wasn't collected is never read from the process while looking at a frame anyway
+    return GDB_ReplyOk(ctx);
+}
+
+GDB_DECLARE_QUERY_HANDLER(TraceBufferOptions)
+{
+    u32 circular;
+    if(strncmp(ctx->commandData, "circular:", 9) != 0)
+        return GDB_ReplyEmpty(ctx);
+    else if(GDB_ParseHexIntegerList(&circular, ctx->commandData + 9, 1, 0) == NULL)
+        return GDB_ReplyErrno(ctx, EILSEQ);
+
+    ctx->circularTraceBuffer = circular != 0;
+    return GDB_ReplyOk(ctx);
+}
+
+// Returns 1 for Thumb, 0 for ARM, -1 if unknown: the tracepoint packets don't say which instruction set is used
+static int GDB_GetTracepointInstructionSet(GDBContext *ctx, u32 address)
+{
+    // ARM instructions are word-aligned
+    if((address & 3) != 0)
+        return 1;
+
+    // Breakpoint there, or the kind GDB gave for an earlier one
+    u32 size = GDB_GetBreakpointInstructionSize(ctx, address);
+    if(size != 0)
+        return size == 2;
+
+    // Thread stopped on that instruction
+    for(u32 i = 0; i < ctx->nbThreads; i++)
+    {
+        ThreadContext regs;
+        Result r = svcGetDebugThreadContext(&regs, ctx->debug, ctx->threadInfos[i].id, THREADCONTEXT_CONTROL_CPU_SPRS);
+        if(R_SUCCEEDED(r) && regs.cpu_registers.pc == address)
+            return (regs.cpu_registers.cpsr & 0x20) != 0;
+    }
+
+    return -1;
+}
+
+GDB_DECLARE_QUERY_HANDLER(TraceStart)
+{
+    if(traceBuffer.owner != NULL && traceBuffer.owner != ctx)
+    {
+        GDB_SendDebugString(ctx, "Le tampon de trace est deja utilise par une autre session.\n");
+        return GDB_ReplyErrno(ctx, EBUSY);
+    }
+
+    if(ctx->traceStatus == TRACE_STATUS_RUNNING)
+        GDB_StopTrace(ctx, TRACE_STATUS_STOPPED, 0);
+
+    GDB_ResetTraceBuffer(ctx);
+    ctx->traceFrameSelected = false;
+
+    for(u32 i = 0; i < ctx->nbTraceStateVariables; i++)
+        ctx->traceStateVariables[i].value = ctx->traceStateVariables[i].initialValue;
+
+    for(u32 i = 0; i < ctx->nbTracepoints; i++)
+    {
+        Tracepoint *tp = &ctx->tracepoints[i];
+        tp->hitCount = tp->traceFrameUsage = 0;
+        if(!tp->enabled)
+            continue;
+
+        // A 4-byte ARM svc on Thumb code would break two instructions, don't guess
+        int thumb = GDB_GetTracepointInstructionSet(ctx, tp->address);
+        if(thumb < 0)
+        {
+            GDB_StopTrace(ctx, TRACE_STATUS_NOT_RUN, 0);
+            GDB_ResetTraceBuffer(NULL);
+            GDB_SendDebugString(ctx, "Point de trace %lu : mode ARM ou Thumb inconnu a 0x%08lx, placez-y d'abord un point d'arret (break *0x%08lx) "
+                                "ou indiquez-le (monitor tracepointmode 0x%08lx thumb).\n", tp->number, tp->address, tp->address, tp->address);
+            return GDB_ReplyErrno(ctx, EINVAL);
+        }
+
+        int r = GDB_AddTracepointBreakpoint(ctx, tp->address, thumb != 0);
+        if(r != 0)
+        {
+            GDB_StopTrace(ctx, TRACE_STATUS_NOT_RUN, 0);
+            GDB_ResetTraceBuffer(NULL);
+            GDB_SendDebugString(ctx, "Impossible de placer le point de trace %lu a 0x%08lx (les branchements ne sont pas pris en charge).\n",
+                                tp->number, tp->address);
+            return GDB_ReplyErrno(ctx, -r);
+        }
+
+        tp->inserted = true;
+    }
+
+    ctx->traceStatus = TRACE_STATUS_RUNNING;
+    return GDB_ReplyOk(ctx);
+}
+
+GDB_DECLARE_QUERY_HANDLER(TraceStop)
+{
+    if(ctx->traceStatus == TRACE_STATUS_RUNNING)
+        GDB_StopTrace(ctx, TRACE_STATUS_STOPPED, 0);
+
+    return GDB_ReplyOk(ctx);
+}
+
+GDB_DECLARE_QUERY_HANDLER(TraceStatus)
+{
+    static const char errorMessage[] = "expression invalide";
+    char reason[64];
+    bool owner = traceBuffer.owner == ctx;
+    u32 n;
+
+    switch(ctx->traceStatus)
+    {
+        case TRACE_STATUS_STOPPED:
+            strcpy(reason, "tstop::0");
+            break;
+        case TRACE_STATUS_BUFFER_FULL:
+            strcpy(reason, "tfull:0");
+            break;
+        case TRACE_STATUS_PASS_COUNT:
+            sprintf(reason, "tpasscount:%lx", ctx->traceStopTracepoint);
+            break;
+        case TRACE_STATUS_ERROR:
+            n = sprintf(reason, "terror:");
+            GDB_EncodeHex(reason + n, errorMessage, sizeof(errorMessage) - 1);
+            sprintf(reason + n + 2 * (sizeof(errorMessage) - 1), ":%lx", ctx->traceStopTracepoint);
+            break;
+        default:
+            strcpy(reason, "tnotrun:0");
+            break;
+    }
+
+    return GDB_SendFormattedPacket(ctx, "T%d;%s;tframes:%lx;tcreated:%lx;tfree:%lx;tsize:%lx;circular:%d;disconn:0",
+                                   ctx->traceStatus == TRACE_STATUS_RUNNING ? 1 : 0, reason,
+                                   owner ? traceBuffer.nbFrames : 0, owner ? traceBuffer.nbFramesCreated : 0,
+                                   (u32)TRACE_BUFFER_SIZE - (owner ? GDB_GetTraceBufferUsedSize() : 0), (u32)TRACE_BUFFER_SIZE,
+                                   ctx->circularTraceBuffer ? 1 : 0);
+}
+
+GDB_DECLARE_QUERY_HANDLER(TracepointStatus)
+{
+    u32 lst[2];
+    if(GDB_ParseIntegerList(lst, ctx->commandData, 2, ':', 0, 16, false) == NULL)
+        return GDB_ReplyErrno(ctx, EILSEQ);
+
+    Tracepoint *tp = GDB_FindTracepoint(ctx, lst[0], lst[1]);
+    if(tp == NULL)
+        return GDB_ReplyErrno(ctx, EINVAL);
+
+    return GDB_SendFormattedPacket(ctx, "V%lx:%lx", tp->hitCount, tp->traceFrameUsage);
+}
+
+GDB_DECLARE_QUERY_HANDLER(TraceVariableValue)
+{
+    u32 number;
+    if(GDB_ParseHexIntegerList(&number, ctx->commandData, 1, 0) == NULL)
+        return GDB_ReplyErrno(ctx, EILSEQ);
+
+    TraceStateVariable *var = GDB_FindTraceStateVariable(ctx, number);
+    if(var == NULL)
+        return GDB_SendPacket(ctx, "U", 1);
+
+    return GDB_SendFormattedPacket(ctx, "V%llx", (u64)var->value);
+}
+
+GDB_DECLARE_QUERY_HANDLER(TraceFrame)
+{
+    const char *data = ctx->commandData;
+    u32 lst[2];
+    s32 tracepoint = -1;
+    bool outside = false;
+
+    if(strncmp(data, "pc:", 3) == 0)
+    {
+        if(GDB_ParseHexIntegerList(lst, data + 3, 1, 0) == NULL)
+            return GDB_ReplyErrno(ctx, EILSEQ);
+        lst[1] = lst[0];
+    }
+    else if(strncmp(data, "tdp:", 4) == 0)
+    {
+        if(GDB_ParseHexIntegerList(lst, data + 4, 1, 0) == NULL)
+            return GDB_ReplyErrno(ctx, EILSEQ);
+        tracepoint = (s32)lst[0];
+    }
+    else if(strncmp(data, "range:", 6) == 0 || strncmp(data, "outside:", 8) == 0)
+    {
+        outside = data[0] == 'o';
+        if(GDB_ParseIntegerList(lst, data + (outside ? 8 : 6), 2, ':', 0, 16, false) == NULL)
+            return GDB_ReplyErrno(ctx, EILSEQ);
+    }
+    else
+    {
+        // Select a frame by number, -1 to go back to the live process
+        u32 number;
+        if(GDB_ParseHexIntegerList(&number, data, 1, 0) == NULL)
+            return GDB_ReplyErrno(ctx, EILSEQ);
+
+        s32 offset = GDB_FindTraceFrame(ctx, number);
+        ctx->traceFrameSelected = offset >= 0;
+        ctx->selectedTraceFrame = number;
+        if(offset < 0)
+            return GDB_SendPacket(ctx, "F-1", 3);
+
+        u16 frameTracepoint;
+        memcpy(&frameTracepoint, traceBuffer.data + offset, 2);
+        return GDB_SendFormattedPacket(ctx, "F%lxT%x", number, frameTracepoint);
+    }
+
+    // Look for the next matching frame, after the current one
+    u32 first = traceBuffer.nbFramesCreated - traceBuffer.nbFrames;
+    u32 number = ctx->traceFrameSelected ? ctx->selectedTraceFrame + 1 : first;
+    number = number < first ? first : number;
+
+    s32 offset = GDB_FindTraceFrame(ctx, number);
+    for(; offset >= 0 && number < traceBuffer.nbFramesCreated; number++, offset = GDB_GetNextTraceFrame((u32)offset))
+    {
+        u16 frameTracepoint;
+        ThreadContext regs;
+        memcpy(&frameTracepoint, traceBuffer.data + offset, 2);
+
+        bool match;
+        if(tracepoint >= 0)
+            match = frameTracepoint == (u32)tracepoint;
+        else
+        {
+            GDB_ReadTraceFrameRegisters(ctx, (u32)offset, &regs);
+            u32 pc = regs.cpu_registers.pc;
+            match = (pc >= lst[0] && pc <= lst[1]) != outside;
+        }
+
+        if(match)
+        {
+            ctx->traceFrameSelected = true;
+            ctx->selectedTraceFrame = number;
+            return GDB_SendFormattedPacket(ctx, "F%lxT%x", number, frameTracepoint);
+        }
+    }
+
+    ctx->traceFrameSelected = false;
+    return GDB_SendPacket(ctx, "F-1", 3);
+}
+
+GDB_DECLARE_QUERY_HANDLER(TraceBuffer)
+{
+    u32 lst[2];
+    u8 buf[(GDB_BUF_LEN - 4) / 2];
+
+    if(GDB_ParseHexIntegerList(lst, ctx->commandData, 2, 0) == NULL)
+        return GDB_ReplyErrno(ctx, EILSEQ);
+
+    // Raw frames, in chronological order
+    u32 len = lst[1] < sizeof(buf) ? lst[1] : sizeof(buf);
+    u32 n = traceBuffer.owner == ctx ? GDB_ReadTraceBuffer(buf, lst[0], len) : 0;
+
+    return n == 0 ? GDB_SendPacket(ctx, "l", 1) : GDB_SendHexPacket(ctx, buf, n);
+}
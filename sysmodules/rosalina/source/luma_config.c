@@ -24,7 +24,10 @@
 *         reasonable ways as different from the original version.
 */
 
+#define _GNU_SOURCE // for strchrnul
+
 #include <3ds.h>
+#include <stddef.h>
 #include "memory.h"
 #include "fmt.h"
 #include "luma_config.h"
@@ -85,16 +88,179 @@ void LumaConfig_ConvertComboToString(char *out, u32 combo)
         out[-1] = 0;
 }
 
+// Every option written to config.ini, sorted by section and then by name. This mirrors
+// the table Arm9 parses the file with, so both sides must agree on names and values.
+
+typedef enum IniOptionType {
+    INI_OPTION_BOOL,        // Bit 'bit' of the field
+    INI_OPTION_MULTI_NAME,  // Multi-choice option 'bit', stored as an index into 'names'
+    INI_OPTION_MULTI_VALUE, // Multi-choice option 'bit', stored as an index into 'values'
+    INI_OPTION_DEC_INT,
+    INI_OPTION_FLOAT,
+    INI_OPTION_HEX_U64,
+    INI_OPTION_KEY_COMBO,
+} IniOptionType;
+
+typedef struct IniOption {
+    const char *section;
+    const char *name;
+    u8 type;
+    u8 size;
+    u8 bit;
+    u8 numChoices;
+    u16 offset;
+    bool isSigned;
+    const char *const *names;
+    const s8 *values;
+} IniOption;
+
+#define INI_FIELD(field) .size = sizeof(((CfgData *)NULL)->field), .offset = offsetof(CfgData, field)
+
+#define INI_BOOL(sec, key, field, b) \
+    { .section = sec, .name = key, .type = INI_OPTION_BOOL, INI_FIELD(field), .bit = b }
+#define INI_MULTI_NAME(sec, key, opt, choices) \
+    { .section = sec, .name = key, .type = INI_OPTION_MULTI_NAME, INI_FIELD(multiConfig), .bit = opt, \
+      .numChoices = sizeof(choices)/sizeof(choices[0]), .names = choices }
+#define INI_MULTI_VALUE(sec, key, opt, choices) \
+    { .section = sec, .name = key, .type = INI_OPTION_MULTI_VALUE, INI_FIELD(multiConfig), .bit = opt, \
+      .numChoices = sizeof(choices)/sizeof(choices[0]), .values = choices }
+#define INI_DEC_INT(sec, key, field, signed) \
+    { .section = sec, .name = key, .type = INI_OPTION_DEC_INT, INI_FIELD(field), .isSigned = signed }
+#define INI_FLOAT(sec, key, field) \
+    { .section = sec, .name = key, .type = INI_OPTION_FLOAT, INI_FIELD(field) }
+#define INI_HEX_U64(sec, key, field) \
+    { .section = sec, .name = key, .type = INI_OPTION_HEX_U64, INI_FIELD(field) }
+#define INI_KEY_COMBO(sec, key, field) \
+    { .section = sec, .name = key, .type = INI_OPTION_KEY_COMBO, INI_FIELD(field) }
+
+static const char *const splashPositionNames[] = { "off", "before payloads", "after payloads" };
+static const char *const newCpuNames[] = { "off", "clock", "l2", "clock+l2" };
+static const char *const autobootModeNames[] = { "off", "3ds", "dsi" };
+static const char *const forceAudioOutputNames[] = { "off", "headphones", "speakers" };
+
+static const s8 defaultEmuNandValues[] = { 1, 2, 3, 4 };
+static const s8 brightnessValues[] = { 4, 3, 2, 1 };
+static const s8 pinNumDigitsValues[] = { 0, 4, 6, 8 };
+
+static const IniOption iniOptions[] = {
+    INI_DEC_INT("autoboot", "autoboot_3ds_app_mem_type", autobootCtrAppmemtype, false),
+    INI_HEX_U64("autoboot", "autoboot_dsi_titleid", autobootTwlTitleId),
+
+    INI_MULTI_NAME("boot", "app_launch_new_3ds_cpu", NEWCPU, newCpuNames),
+    INI_BOOL("boot", "app_syscore_threads_on_core_2", config, REDIRECTAPPTHREADS),
+    INI_BOOL("boot", "autoboot_emunand", config, AUTOBOOTEMU),
+    INI_MULTI_NAME("boot", "autoboot_mode", AUTOBOOTMODE, autobootModeNames),
+    INI_MULTI_VALUE("boot", "brightness_level", BRIGHTNESS, brightnessValues),
+    INI_MULTI_VALUE("boot", "default_emunand_number", DEFAULTEMU, defaultEmuNandValues),
+    INI_BOOL("boot", "enable_external_firm_and_modules", config, LOADEXTFIRMSANDMODULES),
+    INI_BOOL("boot", "enable_game_patching", config, PATCHGAMES),
+    INI_MULTI_VALUE("boot", "pin_lock_num_digits", PIN, pinNumDigitsValues),
+    INI_BOOL("boot", "show_gba_boot_screen", config, SHOWGBABOOT),
+    INI_BOOL("boot", "show_system_settings_string", config, PATCHVERSTRING),
+    INI_DEC_INT("boot", "splash_duration_ms", splashDurationMsec, false),
+    INI_MULTI_NAME("boot", "splash_position", SPLASH, splashPositionNames),
+
+    INI_DEC_INT("meta", "config_version_major", formatVersionMajor, false),
+    INI_DEC_INT("meta", "config_version_minor", formatVersionMinor, false),
+
+    INI_BOOL("misc", "disable_arm11_exception_handlers", config, DISABLEARM11EXCHANDLERS),
+    INI_BOOL("misc", "enable_dsi_external_filter", config, ENABLEDSIEXTFILTER),
+    INI_BOOL("misc", "enable_safe_firm_rosalina", config, ENABLESAFEFIRMROSALINA),
+    INI_MULTI_NAME("misc", "force_audio_output", FORCEAUDIOOUTPUT, forceAudioOutputNames),
+    INI_BOOL("misc", "use_dev_unitinfo", config, PATCHUNITINFO),
+    INI_DEC_INT("misc", "volume_slider_override", volumeSliderOverride, true),
+
+    INI_HEX_U64("rosalina", "hbldr_3dsx_titleid", hbldr3dsxTitleId),
+    INI_DEC_INT("rosalina", "ntp_tz_offset_min", ntpTzOffetMinutes, true),
+    INI_BOOL("rosalina", "plugin_loader_enabled", pluginLoaderFlags, 0),
+    INI_KEY_COMBO("rosalina", "rosalina_menu_combo", rosalinaMenuCombo),
+
+    INI_FLOAT("screen_filters", "screen_filters_bot_brightness", bottomScreenFilter.brightness),
+    INI_DEC_INT("screen_filters", "screen_filters_bot_cct", bottomScreenFilter.cct, false),
+    INI_DEC_INT("screen_filters", "screen_filters_bot_color_curve_adj", bottomScreenFilter.colorCurveCorrection, false),
+    INI_FLOAT("screen_filters", "screen_filters_bot_contrast", bottomScreenFilter.contrast),
+    INI_FLOAT("screen_filters", "screen_filters_bot_gamma", bottomScreenFilter.gamma),
+    INI_BOOL("screen_filters", "screen_filters_bot_invert", bottomScreenFilter.invert, 0),
+    INI_FLOAT("screen_filters", "screen_filters_top_brightness", topScreenFilter.brightness),
+    INI_DEC_INT("screen_filters", "screen_filters_top_cct", topScreenFilter.cct, false),
+    INI_DEC_INT("screen_filters", "screen_filters_top_color_curve_adj", topScreenFilter.colorCurveCorrection, false),
+    INI_FLOAT("screen_filters", "screen_filters_top_contrast", topScreenFilter.contrast),
+    INI_FLOAT("screen_filters", "screen_filters_top_gamma", topScreenFilter.gamma),
+    INI_BOOL("screen_filters", "screen_filters_top_invert", topScreenFilter.invert, 0),
+};
+
+static const IniOption *LumaConfig_FindIniOption(const char *section, const char *name)
+{
+    size_t lo = 0, hi = sizeof(iniOptions)/sizeof(iniOptions[0]);
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(section, iniOptions[mid].section);
+        if (cmp == 0) {
+            cmp = strcmp(name, iniOptions[mid].name);
+        }
+
+        if (cmp == 0) {
+            return &iniOptions[mid];
+        } else if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    return NULL;
+}
+
+static u64 LumaConfig_GetIniOptionField(const CfgData *cfg, const IniOption *opt)
+{
+    u64 val = 0;
+    memcpy(&val, (const u8 *)cfg + opt->offset, opt->size);
+    return val;
+}
+
+static int LumaConfig_FormatIniOption(char *out, const CfgData *cfg, const IniOption *opt)
+{
+    u64 field = LumaConfig_GetIniOptionField(cfg, opt);
+
+    switch (opt->type) {
+        case INI_OPTION_BOOL:
+            return sprintf(out, "%d", (int)((field >> opt->bit) & 1));
+        case INI_OPTION_MULTI_NAME:
+        case INI_OPTION_MULTI_VALUE: {
+            u32 choice = (cfg->multiConfig >> (2 * opt->bit)) & 3;
+            choice = choice < opt->numChoices ? choice : 0;
+            if (opt->type == INI_OPTION_MULTI_NAME)
+                return sprintf(out, "%s", opt->names[choice]);
+            else
+                return sprintf(out, "%d", (int)opt->values[choice]);
+        }
+        case INI_OPTION_DEC_INT: {
+            // Sign-extend the field for options that can be negative
+            u32 shift = 64 - 8 * opt->size;
+            s64 n = opt->isSigned ? (s64)(field << shift) >> shift : (s64)field;
+            return sprintf(out, "%lld", n);
+        }
+        case INI_OPTION_FLOAT: {
+            float f;
+            memcpy(&f, (const u8 *)cfg + opt->offset, sizeof(float));
+            floatToString(out, f, 6, false);
+            return strlen(out);
+        }
+        case INI_OPTION_HEX_U64:
+            return sprintf(out, "%016llx", field);
+        case INI_OPTION_KEY_COMBO:
+            LumaConfig_ConvertComboToString(out, (u32)field);
+            return strlen(out);
+        default:
+            return 0;
+    }
+}
+
 static size_t LumaConfig_SaveLumaIniConfigToStr(char *out, const CfgData *cfg)
 {
     char lumaVerStr[64];
     char lumaRevSuffixStr[16];
-    char rosalinaMenuComboStr[128];
-
-    const char *splashPosStr;
-    const char *n3dsCpuStr;
-    const char *autobootModeStr;
-    const char *forceAudioOutputStr;
 
     s64 outInfo;
     svcGetSystemInfo(&outInfo, 0x10000, 0);
@@ -106,31 +272,6 @@ static size_t LumaConfig_SaveLumaIniConfigToStr(char *out, const CfgData *cfg)
     svcGetSystemInfo(&outInfo, 0x10000, 0x200);
     bool isRelease = (bool)outInfo;
 
-    switch (MULTICONFIG(SPLASH)) {
-        default: case 0: splashPosStr = "desactive"; break;
-        case 1: splashPosStr = "avant les payloads"; break;
-        case 2: splashPosStr = "apres les payloads"; break;
-    }
-
-    switch (MULTICONFIG(NEWCPU)) {
-        default: case 0: n3dsCpuStr = "desactive"; break;
-        case 1: n3dsCpuStr = "horloge"; break;
-        case 2: n3dsCpuStr = "l2"; break;
-        case 3: n3dsCpuStr = "horloge+l2"; break;
-    }
-
-    switch (MULTICONFIG(AUTOBOOTMODE)) {
-        default: case 0: autobootModeStr = "desactive"; break;
-        case 1: autobootModeStr = "3ds"; break;
-        case 2: autobootModeStr = "dsi"; break;
-    }
-
-    switch (MULTICONFIG(FORCEAUDIOOUTPUT)) {
-        default: case 0: forceAudioOutputStr = "desactive"; break;
-        case 1: forceAudioOutputStr = "ecouteurs"; break;
-        case 2: forceAudioOutputStr = "haut-parleurs"; break;
-    }
-
     if (GET_VERSION_REVISION(version) != 0) {
         sprintf(lumaVerStr, "Luma3DS v%d.%d.%d", (int)GET_VERSION_MAJOR(version), (int)GET_VERSION_MINOR(version), (int)GET_VERSION_REVISION(version));
     } else {
@@ -143,59 +284,56 @@ static size_t LumaConfig_SaveLumaIniConfigToStr(char *out, const CfgData *cfg)
         sprintf(lumaRevSuffixStr, "-%08lx", (u32)commitHash);
     }
 
-    LumaConfig_ConvertComboToString(rosalinaMenuComboStr, cfg->rosalinaMenuCombo);
-
-    static const int pinOptionToDigits[] = { 0, 4, 6, 8 };
-    int pinNumDigits = pinOptionToDigits[MULTICONFIG(PIN)];
-
-    char topScreenFilterGammaStr[32];
-    char topScreenFilterContrastStr[32];
-    char topScreenFilterBrightnessStr[32];
-    floatToString(topScreenFilterGammaStr, cfg->topScreenFilter.gamma, 6, false);
-    floatToString(topScreenFilterContrastStr, cfg->topScreenFilter.contrast, 6, false);
-    floatToString(topScreenFilterBrightnessStr, cfg->topScreenFilter.brightness, 6, false);
-
-    char bottomScreenFilterGammaStr[32];
-    char bottomScreenFilterContrastStr[32];
-    char bottomScreenFilterBrightnessStr[32];
-    floatToString(bottomScreenFilterGammaStr, cfg->bottomScreenFilter.gamma, 6, false);
-    floatToString(bottomScreenFilterContrastStr, cfg->bottomScreenFilter.contrast, 6, false);
-    floatToString(bottomScreenFilterBrightnessStr, cfg->bottomScreenFilter.brightness, 6, false);
-
-    int n = sprintf(
-        out, (const char *)config_template_ini,
-        lumaVerStr, lumaRevSuffixStr,
-
-        (int)cfg->formatVersionMajor, (int)cfg->formatVersionMinor,
-        (int)CONFIG(AUTOBOOTEMU), (int)CONFIG(LOADEXTFIRMSANDMODULES),
-        (int)CONFIG(PATCHGAMES), (int)CONFIG(REDIRECTAPPTHREADS),
-        (int)CONFIG(PATCHVERSTRING), (int)CONFIG(SHOWGBABOOT),
-
-        1 + (int)MULTICONFIG(DEFAULTEMU), 4 - (int)MULTICONFIG(BRIGHTNESS),
-        splashPosStr, (unsigned int)cfg->splashDurationMsec,
-        pinNumDigits, n3dsCpuStr,
-        autobootModeStr,
-
-        cfg->hbldr3dsxTitleId, rosalinaMenuComboStr, (int)(cfg->pluginLoaderFlags & 1),
-        (int)cfg->ntpTzOffetMinutes,
-
-        (int)cfg->topScreenFilter.cct, (int)cfg->bottomScreenFilter.cct,
-        (int)cfg->topScreenFilter.colorCurveCorrection, (int)cfg->bottomScreenFilter.colorCurveCorrection,
-        topScreenFilterGammaStr, bottomScreenFilterGammaStr,
-        topScreenFilterContrastStr, bottomScreenFilterContrastStr,
-        topScreenFilterBrightnessStr, bottomScreenFilterBrightnessStr,
-        (int)cfg->topScreenFilter.invert, (int)cfg->bottomScreenFilter.invert,
-
-        cfg->autobootTwlTitleId, (int)cfg->autobootCtrAppmemtype,
-
-        forceAudioOutputStr,
-        cfg->volumeSliderOverride,
+    // Copy the template line by line, replacing the value of each "key = ..." line
+    char section[32] = "";
+    char line[256];
+    char *pos = out;
+    const char *tpl = (const char *)config_template_ini;
+
+    while (*tpl != '\0') {
+        const char *eol = strchrnul(tpl, '\n');
+        size_t len = eol - tpl;
+        len = len < sizeof(line) - 1 ? len : sizeof(line) - 1;
+        memcpy(line, tpl, len);
+        line[len] = '\0';
+
+        char *eq = strchr(line, '=');
+        if (line[0] == '[') {
+            char *end = strchrnul(line + 1, ']');
+            size_t n = end - (line + 1);
+            n = n < sizeof(section) - 1 ? n : sizeof(section) - 1;
+            memcpy(section, line + 1, n);
+            section[n] = '\0';
+            pos += sprintf(pos, "%s", line);
+        } else if (line[0] != ';' && eq != NULL) {
+            char *nameEnd = eq;
+            while (nameEnd > line && nameEnd[-1] == ' ') {
+                nameEnd--;
+            }
+            *nameEnd = '\0';
+
+            const IniOption *opt = LumaConfig_FindIniOption(section, line);
+            if (opt == NULL) {
+                // Template and option table are out of sync
+                return 0;
+            }
+
+            pos += sprintf(pos, "%s = ", line);
+            pos += LumaConfig_FormatIniOption(pos, cfg, opt);
+        } else {
+            // Comments only contain the version placeholders and escaped '%'
+            pos += sprintf(pos, line, lumaVerStr, lumaRevSuffixStr);
+        }
 
-        (int)CONFIG(PATCHUNITINFO), (int)CONFIG(ENABLEDSIEXTFILTER),
-        (int)CONFIG(DISABLEARM11EXCHANDLERS), (int)CONFIG(ENABLESAFEFIRMROSALINA)
-    );
+        if (*eol == '\n') {
+            *pos++ = '\n';
+            eol++;
+        }
+        tpl = eol;
+    }
 
-    return n < 0 ? 0 : (size_t)n;
+    *pos = '\0';
+    return pos - out;
 }
 
 void LumaConfig_RequestSaveSettings(void) {
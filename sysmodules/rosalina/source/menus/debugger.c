@@ -30,6 +30,9 @@
 #include "minisoc.h"
 #include "fmt.h"
 #include "pmdbgext.h"
+#include "ifile.h"
+#include "svc_trace.h"
+#include "svc_trace_streaming.h"
 #include "gdb/server.h"
 #include "gdb/debug.h"
 #include "gdb/monitor.h"
@@ -42,6 +45,9 @@ Menu debuggerMenu = {
         { "Activer le debogueur",                        METHOD, .method = &DebuggerMenu_EnableDebugger  },
         { "Desactiver le debogueur",                       METHOD, .method = &DebuggerMenu_DisableDebugger },
         { "Forcer le debogage de l'application suivante a son lancement", METHOD, .method = &DebuggerMenu_DebugNextApplicationByForce },
+        { "Activer/desactiver le tracage des SVC",          METHOD, .method = &DebuggerMenu_ToggleSvcTracing },
+        { "Sauvegarder la trace des SVC",                   METHOD, .method = &DebuggerMenu_DumpSvcTrace },
+        { "Activer/desactiver la diffusion de la trace des SVC", METHOD, .method = &DebuggerMenu_ToggleSvcTraceStreaming },
         {},
     }
 };
@@ -236,6 +242,182 @@ void DebuggerMenu_DebugNextApplicationByForce(void)
     while(!(waitInput() & KEY_B) && !menuShouldExit);
 }
 
+static bool svcTracingEnabled = false;
+static SvcTraceRing svcTraceRingBuffer;
+
+void DebuggerMenu_ToggleSvcTracing(void)
+{
+    Result res = 0;
+    char buf[65];
+    u32 pid = 0xFFFFFFFF; // all processes
+
+    Draw_Lock();
+    Draw_ClearFramebuffer();
+    Draw_FlushFramebuffer();
+    Draw_Unlock();
+
+    if(!svcTracingEnabled)
+    {
+        u32 pressed;
+        do
+        {
+            Draw_Lock();
+            Draw_DrawString(10, 10, COLOR_TITLE, "Menu des options du debogueur");
+            Draw_DrawString(10, 30, COLOR_WHITE, "Processus a tracer :\n\n  A : tous les processus\n  Y : l'application en cours");
+            Draw_FlushFramebuffer();
+            Draw_Unlock();
+
+            pressed = waitInput();
+        }
+        while(!(pressed & (KEY_A | KEY_Y | KEY_B)) && !menuShouldExit);
+
+        if(!(pressed & (KEY_A | KEY_Y)))
+            return;
+
+        if(pressed & KEY_Y)
+        {
+            FS_ProgramInfo programInfo;
+            u32 launchFlags;
+            res = PMDBG_GetCurrentAppInfo(&programInfo, &pid, &launchFlags);
+        }
+    }
+
+    if(R_SUCCEEDED(res))
+        res = svcKernelSetState(0x10008, !svcTracingEnabled, pid);
+
+    if(R_SUCCEEDED(res))
+    {
+        svcTracingEnabled = !svcTracingEnabled;
+        if(!svcTracingEnabled)
+            sprintf(buf, "Tracage des SVC desactive.");
+        else if(pid == 0xFFFFFFFF)
+            sprintf(buf, "Tracage des SVC active pour tous les processus.");
+        else
+            sprintf(buf, "Tracage des SVC active pour le processus %lu.", pid);
+    }
+    else
+        sprintf(buf, "L'operation a echoue (0x%08lx).", (u32)res);
+
+    Draw_Lock();
+    Draw_ClearFramebuffer();
+    Draw_FlushFramebuffer();
+    Draw_Unlock();
+
+    do
+    {
+        Draw_Lock();
+        Draw_DrawString(10, 10, COLOR_TITLE, "Menu des options du debogueur");
+        Draw_DrawString(10, 30, COLOR_WHITE, buf);
+        Draw_FlushFramebuffer();
+        Draw_Unlock();
+    }
+    while(!(waitInput() & KEY_B) && !menuShouldExit);
+}
+
+// The file holds the committed entries of each core, oldest first, core after core
+void DebuggerMenu_DumpSvcTrace(void)
+{
+    IFile file;
+    u64 total;
+    s64 out;
+    Result res;
+    char buf[65];
+    u32 nbEntries = 0;
+
+    if(R_FAILED(svcGetSystemInfo(&out, 0x10000, 0x203))) svcBreak(USERBREAK_ASSERT);
+    FS_ArchiveID archiveId = (bool)out ? ARCHIVE_SDMC : ARCHIVE_NAND_RW;
+
+    res = IFile_Open(&file, archiveId, fsMakePath(PATH_EMPTY, ""), fsMakePath(PATH_ASCII, "/luma/svc_trace.bin"), FS_OPEN_CREATE | FS_OPEN_WRITE);
+    if(R_SUCCEEDED(res))
+    {
+        res = IFile_SetSize(&file, 0);
+        for(u32 core = 0; core < 4 && R_SUCCEEDED(res); core++)
+        {
+            // Fails with "out of range" past the last core
+            if(R_FAILED(svcKernelSetState(0x10009, core, &svcTraceRingBuffer)))
+                break;
+
+            u32 count = svcTraceCollectRing(&svcTraceRingBuffer, 0);
+            res = IFile_Write(&file, &total, svcTraceRingBuffer.entries, count * sizeof(SvcTraceEntry), 0);
+            nbEntries += count;
+        }
+        IFile_Close(&file);
+    }
+
+    if(R_FAILED(res))
+        sprintf(buf, "L'operation a echoue (0x%08lx).", (u32)res);
+    else
+        sprintf(buf, "%lu entrees sauvegardees dans /luma/svc_trace.bin.", nbEntries);
+
+    do
+    {
+        Draw_Lock();
+        Draw_DrawString(10, 10, COLOR_TITLE, "Menu des options du debogueur");
+        Draw_DrawString(10, 30, COLOR_WHITE, buf);
+        Draw_FlushFramebuffer();
+        Draw_Unlock();
+    }
+    while(!(waitInput() & KEY_B) && !menuShouldExit);
+}
+
+void DebuggerMenu_ToggleSvcTraceStreaming(void)
+{
+    Result res = 0;
+    char buf[65];
+    bool isSocURegistered;
+
+    if(svcTraceStreamingEnabled)
+    {
+        res = SvcTraceStreaming_Disable(5 * 1000 * 1000 * 1000LL);
+        if(res == 0)
+            sprintf(buf, "Diffusion de la trace des SVC arretee.");
+    }
+    else
+    {
+        res = srvIsServiceRegistered(&isSocURegistered, "soc:U");
+        if(R_SUCCEEDED(res) && !isSocURegistered)
+            res = -1;
+
+        if(R_SUCCEEDED(res))
+            res = svcCreateEvent(&svcTraceStreamingThreadStartedEvent, RESET_STICKY);
+        if(R_SUCCEEDED(res))
+        {
+            svcTraceStreamingCreateThread();
+            res = svcWaitSynchronization(svcTraceStreamingThreadStartedEvent, 10 * 1000 * 1000 * 1000LL);
+            if(res == 0)
+                res = (Result)svcTraceStreamingStartResult;
+
+            if(res != 0)
+            {
+                svcCloseHandle(svcTraceStreamingThreadStartedEvent);
+                svcTraceStreamingEnabled = false;
+            }
+            svcTraceStreamingStartResult = 0;
+        }
+
+        if(res == 0)
+            sprintf(buf, "Trace des SVC diffusee sur le port TCP %d.", SVC_TRACE_STREAMING_PORT);
+    }
+
+    if(res != 0)
+        sprintf(buf, "L'operation a echoue (0x%08lx).", (u32)res);
+
+    Draw_Lock();
+    Draw_ClearFramebuffer();
+    Draw_FlushFramebuffer();
+    Draw_Unlock();
+
+    do
+    {
+        Draw_Lock();
+        Draw_DrawString(10, 10, COLOR_TITLE, "Menu des options du debogueur");
+        Draw_DrawString(10, 30, COLOR_WHITE, buf);
+        Draw_FlushFramebuffer();
+        Draw_Unlock();
+    }
+    while(!(waitInput() & KEY_B) && !menuShouldExit);
+}
+
 void debuggerSocketThreadMain(void)
 {
     GDB_IncrementServerReferenceCount(&gdbServer);
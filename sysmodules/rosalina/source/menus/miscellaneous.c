@@ -38,6 +38,8 @@
 #include "pmdbgext.h"
 #include "plugin.h"
 #include "process_patches.h"
+#include "pxi_stats.h"
+#include "launch_timings.h"
 
 typedef struct DspFirmSegmentHeader {
     u32 offset;
@@ -73,6 +75,9 @@ Menu miscellaneousMenu = {
         { "Mettre a jour l'heure et la date via NTP", METHOD, .method = &MiscellaneousMenu_UpdateTimeDateNtp },
         { "Annuler le decalage horaire de l'utilisateur", METHOD, .method = &MiscellaneousMenu_NullifyUserTimeOffset },
         { "Dump le firmware DSP", METHOD, .method = &MiscellaneousMenu_DumpDspFirm },
+        { "Relire les fichiers de /luma/titles", METHOD, .method = &MiscellaneousMenu_ReloadTitleOverrides },
+        { "Durees du dernier lancement", METHOD, .method = &MiscellaneousMenu_ShowLastLaunchTimings },
+        { "Statistiques PXI", METHOD, .method = &MiscellaneousMenu_ShowPxiStats },
         {},
     }
 };
@@ -416,6 +421,152 @@ void MiscellaneousMenu_NullifyUserTimeOffset(void)
     while(!(waitInput() & KEY_B) && !menuShouldExit);
 }
 
+void MiscellaneousMenu_ReloadTitleOverrides(void)
+{
+    Handle loaderHandle;
+    Result res = srvGetServiceHandle(&loaderHandle, "Loader");
+
+    if(R_SUCCEEDED(res))
+    {
+        u32 *cmdbuf = getThreadCommandBuffer();
+        cmdbuf[0] = IPC_MakeHeader(0x103, 0, 0); // InvalidateTitleOverrides
+
+        if(R_SUCCEEDED(res = svcSendSyncRequest(loaderHandle)))
+            res = cmdbuf[1];
+
+        svcCloseHandle(loaderHandle);
+    }
+
+    Draw_Lock();
+    Draw_ClearFramebuffer();
+    Draw_FlushFramebuffer();
+    Draw_Unlock();
+
+    do
+    {
+        Draw_Lock();
+        Draw_DrawString(10, 10, COLOR_TITLE, "Menu d'options diverses");
+        if(R_SUCCEEDED(res))
+            Draw_DrawString(10, 30, COLOR_WHITE, "Operation reussie.\n\nLes fichiers de /luma/titles seront relus au\nprochain lancement de chaque titre.");
+        else
+            Draw_DrawFormattedString(10, 30, COLOR_WHITE, "L'operation (0x%08lx) a echoue.", res);
+        Draw_FlushFramebuffer();
+        Draw_Unlock();
+    }
+    while(!(waitInput() & KEY_B) && !menuShouldExit);
+}
+
+void MiscellaneousMenu_ShowLastLaunchTimings(void)
+{
+    LaunchTimings timings = { 0 };
+    IFileReadStats readStats;
+    Handle loaderHandle;
+    Result res = srvGetServiceHandle(&loaderHandle, "Loader");
+
+    if(R_SUCCEEDED(res))
+    {
+        u32 *cmdbuf = getThreadCommandBuffer();
+        cmdbuf[0] = IPC_MakeHeader(0x104, 0, 0); // GetLastLaunchTimings
+
+        if(R_SUCCEEDED(res = svcSendSyncRequest(loaderHandle)) && R_SUCCEEDED(res = cmdbuf[1]))
+            memcpy(&timings, &cmdbuf[2], sizeof(LaunchTimings));
+
+        svcCloseHandle(loaderHandle);
+    }
+
+    // Plugins are read by Rosalina, whose totals are since boot
+    IFile_GetReadStats(&readStats);
+
+    // Set by the Arm9 side, 0 when unknown
+    s64 out;
+    u32 firmLoadMsec = R_SUCCEEDED(svcGetSystemInfo(&out, 0x10000, 0x204)) ? (u32)out : 0;
+    u32 firmColdLoadMsec = R_SUCCEEDED(svcGetSystemInfo(&out, 0x10000, 0x205)) ? (u32)out : 0;
+    bool isFirmFromCache = R_SUCCEEDED(svcGetSystemInfo(&out, 0x10000, 0x206)) && out != 0;
+
+    Draw_Lock();
+    Draw_ClearFramebuffer();
+    Draw_FlushFramebuffer();
+    Draw_Unlock();
+
+    do
+    {
+        Draw_Lock();
+        Draw_DrawString(10, 10, COLOR_TITLE, "Menu d'options diverses");
+        u32 posY = Draw_DrawFormattedString(10, 30, COLOR_WHITE, "Chargement du FIRM :    %lu ms%s\n", firmLoadMsec, isFirmFromCache ? " (cache)" : "");
+        if(isFirmFromCache && firmColdLoadMsec != 0)
+            posY = Draw_DrawFormattedString(10, posY, COLOR_WHITE, "  sans le cache :       %lu ms\n", firmColdLoadMsec);
+        posY += SPACING_Y;
+
+        if(R_FAILED(res))
+            Draw_DrawFormattedString(10, posY, COLOR_WHITE, "L'operation (0x%08lx) a echoue.", res);
+        else if(timings.titleId == 0)
+            Draw_DrawString(10, posY, COLOR_WHITE, "Aucun titre n'a ete lance depuis le demarrage.");
+        else
+        {
+            posY = Draw_DrawFormattedString(10, posY, COLOR_WHITE, "Titre :                 %016llX\n", timings.titleId);
+            posY = Draw_DrawFormattedString(10, posY, COLOR_WHITE, "Taille du code :        %lu Kio\n\n", timings.codeSize >> 10);
+            posY = Draw_DrawFormattedString(10, posY, COLOR_WHITE, "Chargement du code :    %lu us%s\n", timings.loadCodeUsec, timings.fromCodeCache ? " (cache)" : "");
+            posY = Draw_DrawFormattedString(10, posY, COLOR_WHITE, "  dont patchs :         %lu us\n", timings.patchUsec);
+            posY = Draw_DrawFormattedString(10, posY, COLOR_WHITE, "Creation du processus : %lu us\n", timings.createProcessUsec);
+            posY = Draw_DrawFormattedString(10, posY, COLOR_WHITE, "Plugin :                %lu us\n\n", timings.pluginUsec);
+            posY = Draw_DrawFormattedString(10, posY, COLOR_WHITE, "Total :                 %lu us\n\n", timings.totalUsec);
+            posY = Draw_DrawFormattedString(10, posY, COLOR_WHITE, "Lectures du loader :    %lu (%lu requetes FS)\n", timings.readCalls, timings.fsReadCalls);
+            posY = Draw_DrawString(10, posY, COLOR_WHITE, "Lectures de Rosalina depuis le demarrage :\n");
+            Draw_DrawFormattedString(10, posY, COLOR_WHITE, "  %lu (%llu o), %lu requetes FS (%llu o)", readStats.calls, readStats.bytes, readStats.fsCalls, readStats.fsBytes);
+        }
+        Draw_FlushFramebuffer();
+        Draw_Unlock();
+    }
+    while(!(waitInput() & KEY_B) && !menuShouldExit);
+}
+
+void MiscellaneousMenu_ShowPxiStats(void)
+{
+    PXIStats stats = { 0 };
+    Handle pxiHandle;
+    Result res = srvGetServiceHandle(&pxiHandle, PXI_STATS_SERVICE_NAME);
+
+    if(R_SUCCEEDED(res))
+    {
+        u32 *cmdbuf = getThreadCommandBuffer();
+        cmdbuf[0] = IPC_MakeHeader(1, 0, 0); // GetStats
+
+        if(R_SUCCEEDED(res = svcSendSyncRequest(pxiHandle)) && R_SUCCEEDED(res = cmdbuf[1]))
+            memcpy(&stats, &cmdbuf[2], sizeof(PXIStats));
+
+        svcCloseHandle(pxiHandle);
+    }
+
+    // Ratios with one decimal
+    u32 commandsPerBatch = stats.nbSendBatches == 0 ? 0 : (u32)(10ULL * stats.nbCommandsSent / stats.nbSendBatches);
+    u32 repliesPerWakeup = stats.nbReceiverWakeups == 0 ? 0 : (u32)(10ULL * stats.nbRepliesReceived / stats.nbReceiverWakeups);
+    u32 stallUsec = (u32)(1000 * 1000 * stats.sendFIFOStallTicks / SYSCLOCK_ARM11);
+
+    Draw_Lock();
+    Draw_ClearFramebuffer();
+    Draw_FlushFramebuffer();
+    Draw_Unlock();
+
+    do
+    {
+        Draw_Lock();
+        Draw_DrawString(10, 10, COLOR_TITLE, "Menu d'options diverses");
+        if(R_FAILED(res))
+            Draw_DrawFormattedString(10, 30, COLOR_WHITE, "L'operation (0x%08lx) a echoue.", res);
+        else
+        {
+            u32 posY = Draw_DrawFormattedString(10, 30, COLOR_WHITE, "Commandes envoyees :     %lu\n", stats.nbCommandsSent);
+            posY = Draw_DrawFormattedString(10, posY, COLOR_WHITE, "  par envoi groupe :     %lu.%lu\n", commandsPerBatch / 10, commandsPerBatch % 10);
+            posY = Draw_DrawFormattedString(10, posY, COLOR_WHITE, "Reponses recues :        %lu\n", stats.nbRepliesReceived);
+            posY = Draw_DrawFormattedString(10, posY, COLOR_WHITE, "  par interruption :     %lu.%lu\n\n", repliesPerWakeup / 10, repliesPerWakeup % 10);
+            Draw_DrawFormattedString(10, posY, COLOR_WHITE, "Attente FIFO pleine :    %lu us", stallUsec);
+        }
+        Draw_FlushFramebuffer();
+        Draw_Unlock();
+    }
+    while(!(waitInput() & KEY_B) && !menuShouldExit);
+}
+
 static Result MiscellaneousMenu_DumpDspFirmCallback(Handle procHandle, u32 textSz, u32 roSz, u32 rwSz)
 {
     (void)procHandle;
@@ -11,6 +11,7 @@
 static FS_DirectoryEntry   g_entries[10];
 
 static char        g_path[256];
+static u8          g_pluginReadBuffer[0x1000];
 static const char *g_dirPath = "/luma/plugins/%016llX";
 static const char *g_defaultPath = "/luma/plugins/default.3gx";
 
@@ -185,6 +186,9 @@ bool     TryToLoadPlugin(Handle process, bool isHomebrew)
             return false;
     }
 
+    // The header, strings and targets are small scattered reads
+    IFile_SetReadBuffer(&plugin, g_pluginReadBuffer, sizeof(g_pluginReadBuffer));
+
     if (R_FAILED((res = IFile_GetSize(&plugin, &fileSize))))
         ctx->error.message = "Impossible d'obtenir la taille du fichier";
 
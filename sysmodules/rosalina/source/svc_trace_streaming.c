@@ -0,0 +1,215 @@
+/*
+*   This file is part of Luma3DS
+*   Copyright (C) 2016-2020 Aurora Wright, TuxSH
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+*       * Requiring preservation of specified reasonable legal notices or
+*         author attributions in that material or in the Appropriate Legal
+*         Notices displayed by works containing it.
+*       * Prohibiting misrepresentation of the origin of that material,
+*         or requiring that modified versions of such material be marked in
+*         reasonable ways as different from the original version.
+*/
+
+#include <3ds.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "minisoc.h"
+#include "svc_trace_streaming.h"
+#include "svc_trace.h"
+#include "menus.h"
+#include "sleep.h"
+#include "sock_util.h"
+
+// Streams the SVC trace rings to one TCP client at a time, as the same SvcTraceEntry records as /luma/svc_trace.bin.
+// Entries overwritten between two polls are lost: the client sees a gap in the sequence numbers of that core.
+
+bool svcTraceStreamingEnabled = false;
+Handle svcTraceStreamingThreadStartedEvent;
+
+int svcTraceStreamingStartResult;
+
+static MyThread svcTraceStreamingThread;
+static u8 CTR_ALIGN(8) svcTraceStreamingThreadStack[0x3000];
+static SvcTraceRing svcTraceStreamingRing;
+
+MyThread *svcTraceStreamingCreateThread(void)
+{
+    if(R_FAILED(MyThread_Create(&svcTraceStreamingThread, svcTraceStreamingThreadMain, svcTraceStreamingThreadStack, 0x3000, 0x30, CORE_SYSTEM)))
+        svcBreak(USERBREAK_PANIC);
+    return &svcTraceStreamingThread;
+}
+
+static bool sendAll(int sock, const void *data, u32 size)
+{
+    for(const u8 *pos = (const u8 *)data, *end = pos + size; pos < end;)
+    {
+        int n = socSend(sock, pos, end - pos, 0);
+        if(n <= 0)
+            return false;
+        pos += n;
+    }
+
+    return true;
+}
+
+// Sends what each core traced since the previous call
+static bool sendNewEntries(int client, u32 *lastSequences)
+{
+    for(u32 core = 0; core < 4; core++)
+    {
+        // Fails with "out of range" past the last core
+        if(R_FAILED(svcKernelSetState(0x10009, core, &svcTraceStreamingRing)))
+            break;
+
+        u32 count = svcTraceCollectRing(&svcTraceStreamingRing, lastSequences[core]);
+        if(count == 0)
+            continue;
+
+        if(!sendAll(client, svcTraceStreamingRing.entries, count * sizeof(SvcTraceEntry)))
+            return false;
+        lastSequences[core] = svcTraceStreamingRing.entries[count - 1].sequence;
+    }
+
+    return true;
+}
+
+void svcTraceStreamingThreadMain(void)
+{
+    Result res = 0;
+    svcTraceStreamingStartResult = 0;
+
+    res = miniSocInit();
+    if(R_FAILED(res))
+    {
+        // Socket services broken
+        svcTraceStreamingStartResult = res;
+
+        miniSocExit();
+        // Still signal the event
+        svcSignalEvent(svcTraceStreamingThreadStartedEvent);
+        return;
+    }
+
+    int sock = socSocket(AF_INET, SOCK_STREAM, 0);
+    u32 tries = 15;
+    while(sock == -1 && --tries > 0)
+    {
+        svcSleepThread(100 * 1000 * 1000LL);
+        sock = socSocket(AF_INET, SOCK_STREAM, 0);
+    }
+
+    if (sock < -10000 || tries == 0) {
+        // Socket services broken
+        svcTraceStreamingStartResult = -1;
+
+        miniSocExit();
+        // Still signal the event
+        svcSignalEvent(svcTraceStreamingThreadStartedEvent);
+        return;
+    }
+
+    struct sockaddr_in saddr;
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = htons(SVC_TRACE_STREAMING_PORT);
+    saddr.sin_addr.s_addr = socGethostid();
+    res = socBind(sock, (struct sockaddr*)&saddr, sizeof(struct sockaddr_in));
+    if(res == 0)
+        res = socListen(sock, 1);
+    if(res != 0)
+    {
+        socClose(sock);
+        miniSocExit();
+        svcTraceStreamingStartResult = res;
+
+        // Still signal the event
+        svcSignalEvent(svcTraceStreamingThreadStartedEvent);
+        return;
+    }
+
+    svcTraceStreamingEnabled = true;
+    svcSignalEvent(svcTraceStreamingThreadStartedEvent);
+
+    int client = -1;
+    u32 lastSequences[4];
+    while(svcTraceStreamingEnabled && !preTerminationRequested)
+    {
+        if (Sleep__Status())
+        {
+            while (!Wifi__IsConnected()
+                    && svcTraceStreamingEnabled && !preTerminationRequested)
+                svcSleepThread(1000000000ULL);
+        }
+
+        if(client == -1)
+        {
+            struct pollfd pfd;
+            pfd.fd = sock;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+
+            int pollres = socPoll(&pfd, 1, 100);
+            if(pollres > 0 && (pfd.revents & POLLIN))
+            {
+                socklen_t len = sizeof(struct sockaddr_in);
+                client = socAccept(sock, (struct sockaddr *)&saddr, &len);
+                if(client < 0)
+                    client = -1;
+
+                // Start with what the rings still hold
+                memset(lastSequences, 0, sizeof(lastSequences));
+            }
+            else if(pollres < -10000)
+                break;
+
+            continue;
+        }
+
+        if(!sendNewEntries(client, lastSequences))
+        {
+            socClose(client);
+            client = -1;
+            continue;
+        }
+
+        // A ring holds 256 entries: a busy core may overwrite some of them before the next poll
+        svcSleepThread(5 * 1000 * 1000LL);
+    }
+
+    svcTraceStreamingEnabled = false;
+    struct linger linger;
+    linger.l_onoff = 1;
+    linger.l_linger = 0;
+
+    if(client != -1)
+        socClose(client);
+    socSetsockopt(sock, SOL_SOCKET, SO_LINGER, &linger, sizeof(struct linger));
+    socClose(sock);
+
+    miniSocExit();
+}
+
+Result SvcTraceStreaming_Disable(s64 timeout)
+{
+    if(!svcTraceStreamingEnabled)
+        return 0;
+
+    svcTraceStreamingEnabled = false;
+    Result res = MyThread_Join(&svcTraceStreamingThread, timeout);
+    svcCloseHandle(svcTraceStreamingThreadStartedEvent);
+
+    return res;
+}
@@ -20,7 +20,7 @@ SessionDataList sessionDataWaitingForServiceOrPortRegisterList = {NULL, NULL}, s
 SessionDataList sessionDataWaitingPortReadyList = {NULL, NULL};
 
 static SessionData sessionDataPool[76];
-static ProcessData processDataPool[64];
+ProcessData processDataPool[64];
 
 static u8 CTR_ALIGN(4) serviceAccessListStaticBuffer[0x110];
 
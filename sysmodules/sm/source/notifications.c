@@ -10,6 +10,111 @@ This is part of 3ds_sm, which is licensed under the MIT license (see LICENSE for
 
 #include <stdatomic.h>
 
+// Subscription index: notification ID -> set of subscribed processes (as a bitmask of processDataPool indices).
+// Open-addressed with linear probing; entries whose set becomes empty are removed by backward shifting.
+// It has room for every process subscribing to 0x11 different IDs, so that Subscribe can't fail because of it.
+#define NOTIFICATION_INDEX_SIZE         0x800
+#define NOTIFICATION_INDEX_MAX_ENTRIES  (64 * 0x11)
+
+_Static_assert(NOTIFICATION_INDEX_MAX_ENTRIES <= 3 * NOTIFICATION_INDEX_SIZE / 4, "notification index too small");
+
+static u32 notificationIndexIds[NOTIFICATION_INDEX_SIZE] = { 0 };
+static u64 notificationIndexMasks[NOTIFICATION_INDEX_SIZE] = { 0 };
+static u32 nbNotificationIndexEntries = 0;
+
+static inline u64 getProcessMask(const ProcessData *processData)
+{
+    return 1ULL << (processData - processDataPool);
+}
+
+static inline u32 hashNotificationId(u32 notificationId)
+{
+    return (notificationId * 0x9E3779B1) >> (32 - 11);
+}
+
+static inline u32 getPendingNotificationFilterBit(u32 notificationId)
+{
+    return 1u << ((notificationId * 0x9E3779B1) >> (32 - 5));
+}
+
+static u32 findNotificationIndexSlot(u32 notificationId)
+{
+    u32 slot = hashNotificationId(notificationId);
+    while(notificationIndexMasks[slot] != 0 && notificationIndexIds[slot] != notificationId)
+        slot = (slot + 1) % NOTIFICATION_INDEX_SIZE;
+
+    return slot;
+}
+
+static inline u64 getNotificationSubscribers(u32 notificationId)
+{
+    return notificationIndexMasks[findNotificationIndexSlot(notificationId)];
+}
+
+// Subscribers in processDataInUseList order (most recently registered first), the order the list walk used to notify them in
+static u32 getOrderedNotificationSubscribers(ProcessData **subscribers, u32 notificationId)
+{
+    u32 nb = 0;
+    for(u64 mask = getNotificationSubscribers(notificationId); mask != 0; mask &= mask - 1)
+    {
+        ProcessData *node = &processDataPool[__builtin_ctzll(mask)];
+        u32 i;
+        for(i = nb++; i > 0 && subscribers[i - 1]->registrationIndex < node->registrationIndex; i--)
+            subscribers[i] = subscribers[i - 1];
+        subscribers[i] = node;
+    }
+
+    return nb;
+}
+
+static void addNotificationSubscriber(u32 notificationId, const ProcessData *processData)
+{
+    u32 slot = findNotificationIndexSlot(notificationId);
+    if(notificationIndexMasks[slot] == 0)
+    {
+        notificationIndexIds[slot] = notificationId;
+        ++nbNotificationIndexEntries;
+    }
+
+    notificationIndexMasks[slot] |= getProcessMask(processData);
+}
+
+static void removeNotificationSubscriber(u32 notificationId, const ProcessData *processData)
+{
+    u32 hole = findNotificationIndexSlot(notificationId);
+
+    if(notificationIndexMasks[hole] == 0)
+        return;
+
+    notificationIndexMasks[hole] &= ~getProcessMask(processData);
+    if(notificationIndexMasks[hole] != 0)
+        return;
+
+    --nbNotificationIndexEntries;
+    for(u32 i = (hole + 1) % NOTIFICATION_INDEX_SIZE; notificationIndexMasks[i] != 0; i = (i + 1) % NOTIFICATION_INDEX_SIZE)
+    {
+        u32 home = hashNotificationId(notificationIndexIds[i]);
+
+        // Move the entry into the hole if its home slot is not within (hole, i]
+        if(((i - home) % NOTIFICATION_INDEX_SIZE) >= ((i - hole) % NOTIFICATION_INDEX_SIZE))
+        {
+            notificationIndexIds[hole] = notificationIndexIds[i];
+            notificationIndexMasks[hole] = notificationIndexMasks[i];
+            notificationIndexMasks[i] = 0;
+            hole = i;
+        }
+    }
+}
+
+void removeProcessFromNotificationIndex(ProcessData *processData)
+{
+    for(u16 i = 0; i < processData->nbSubscribed; i++)
+        removeNotificationSubscriber(processData->subscribedNotifications[i], processData);
+
+    processData->nbSubscribed = 0;
+    processData->notificationEnabled = false;
+}
+
 static bool isNotificationInhibited(const ProcessData *processData, u32 notificationId)
 {
     (void)processData;
@@ -22,7 +127,8 @@ static bool isNotificationInhibited(const ProcessData *processData, u32 notifica
 
 static bool doPublishNotification(ProcessData *processData, u32 notificationId, u32 flags)
 {
-    if((flags & 1) && processData->nbPendingNotifications != 0) // only send if not already pending
+    // only send if not already pending
+    if((flags & 1) && (processData->pendingNotificationFilter & getPendingNotificationFilterBit(notificationId)) != 0)
     {
         for(u16 i = 0; i < processData->nbPendingNotifications; i++)
         {
@@ -37,6 +143,7 @@ static bool doPublishNotification(ProcessData *processData, u32 notificationId,
 
         processData->pendingNotifications[processData->pendingNotificationIndex] = notificationId;
         processData->pendingNotificationIndex = (processData->pendingNotificationIndex + 1) % 16;
+        processData->pendingNotificationFilter |= getPendingNotificationFilterBit(notificationId);
         ++processData->nbPendingNotifications;
         assertSuccess(svcReleaseSemaphore(&count, processData->notificationSemaphore, 1));
 
@@ -81,6 +188,7 @@ Result Subscribe(SessionData *sessionData, u32 notificationId)
 
     if(processData->nbSubscribed < 0x11)
     {
+        addNotificationSubscriber(notificationId, processData);
         processData->subscribedNotifications[processData->nbSubscribed++] = notificationId;
         return 0;
     }
@@ -102,6 +210,7 @@ Result Unsubscribe(SessionData *sessionData, u32 notificationId)
         return 0xD8806404;
     else
     {
+        removeNotificationSubscriber(notificationId, processData);
         processData->subscribedNotifications[i] = processData->subscribedNotifications[--processData->nbSubscribed];
         return 0;
     }
@@ -122,20 +231,27 @@ Result ReceiveNotification(SessionData *sessionData, u32 *notificationId)
         --processData->nbPendingNotifications;
         *notificationId = processData->pendingNotifications[processData->receivedNotificationIndex];
         processData->receivedNotificationIndex = (processData->receivedNotificationIndex + 1) % 16;
+
+        // Rebuild the dedup filter from the remaining pending notifications
+        processData->pendingNotificationFilter = 0;
+        for(u16 i = 0; i < processData->nbPendingNotifications; i++)
+        {
+            u32 id = processData->pendingNotifications[(processData->receivedNotificationIndex + i) % 16];
+            processData->pendingNotificationFilter |= getPendingNotificationFilterBit(id);
+        }
+
         return 0;
     }
 }
 
 Result PublishToSubscriber(u32 notificationId, u32 flags)
 {
-    for(ProcessData *node = processDataInUseList.first; node != NULL; node = node->next)
+    ProcessData *subscribers[64];
+    u32 nbSubscribers = getOrderedNotificationSubscribers(subscribers, notificationId);
+    for(u32 i = 0; i < nbSubscribers; i++)
     {
-        if(!node->notificationEnabled || isNotificationInhibited(node, notificationId))
-            continue;
-
-        u16 i;
-        for(i = 0; i < node->nbSubscribed && node->subscribedNotifications[i] != notificationId; i++);
-        if(i >= node->nbSubscribed)
+        ProcessData *node = subscribers[i];
+        if(isNotificationInhibited(node, notificationId))
             continue;
 
         if(!doPublishNotification(node, notificationId, flags))
@@ -148,14 +264,12 @@ Result PublishToSubscriber(u32 notificationId, u32 flags)
 Result PublishAndGetSubscriber(u32 *pidCount, u32 *pidList, u32 notificationId, u32 flags)
 {
     u32 nb = 0;
-    for(ProcessData *node = processDataInUseList.first; node != NULL; node = node->next)
+    ProcessData *subscribers[64];
+    u32 nbSubscribers = getOrderedNotificationSubscribers(subscribers, notificationId);
+    for(u32 i = 0; i < nbSubscribers; i++)
     {
-        if(!node->notificationEnabled || isNotificationInhibited(node, notificationId))
-            continue;
-
-        u16 i;
-        for(i = 0; i < node->nbSubscribed && node->subscribedNotifications[i] != notificationId; i++);
-        if(i >= node->nbSubscribed)
+        ProcessData *node = subscribers[i];
+        if(isNotificationInhibited(node, notificationId))
             continue;
 
         if(!doPublishNotification(node, notificationId, flags))
@@ -8,6 +8,7 @@ This is part of 3ds_sm, which is licensed under the MIT license (see LICENSE for
 #pragma once
 
 #include "common.h"
+#include "processes.h"
 
 Result EnableNotification(SessionData *sessionData, Handle *notificationSemaphore);
 Result Subscribe(SessionData *sessionData, u32 notificationId);
@@ -18,4 +19,6 @@ Result PublishAndGetSubscriber(u32 *pidCount, u32 *pidList, u32 notificationId,
 Result PublishToProcess(Handle process, u32 notificationId);
 Result PublishToAll(u32 notificationId);
 
+void removeProcessFromNotificationIndex(ProcessData *processData);
+
 Result AddToNdmuWorkaroundCount(s32 count);
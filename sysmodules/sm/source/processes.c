@@ -8,15 +8,29 @@ This is part of 3ds_sm, which is licensed under the MIT license (see LICENSE for
 #include "list.h"
 #include "processes.h"
 #include "services.h"
+#include "notifications.h"
 
 ProcessDataList processDataInUseList = { NULL, NULL }, freeProcessDataList = { NULL, NULL };
 
+// Direct-mapped pid -> process data table. PIDs are allocated sequentially, so collisions are rare;
+// on a collision we fall back to walking the list, and the slot caches the last process found.
+#define PROCESS_DATA_TABLE_SIZE 0x80
+static ProcessData *processDataTable[PROCESS_DATA_TABLE_SIZE] = { NULL };
+static u32 nextRegistrationIndex = 0;
+
 ProcessData *findProcessData(u32 pid)
 {
+    ProcessData **slot = &processDataTable[pid % PROCESS_DATA_TABLE_SIZE];
+    if(*slot != NULL && (*slot)->pid == pid)
+        return *slot;
+
     for(ProcessData *node = processDataInUseList.first; node != NULL; node = node->next)
     {
         if(node->pid == pid)
+        {
+            *slot = node;
             return node;
+        }
     }
 
     return NULL;
@@ -31,6 +45,8 @@ ProcessData *doRegisterProcess(u32 pid, char (*serviceAccessList)[8], u32 servic
 
     assertSuccess(svcCreateSemaphore(&processData->notificationSemaphore, 0, 0x10));
     processData->pid = pid;
+    processData->registrationIndex = nextRegistrationIndex++;
+    processDataTable[pid % PROCESS_DATA_TABLE_SIZE] = processData;
 
     return processData;
 }
@@ -56,6 +72,7 @@ Result UnregisterProcess(u32 pid)
         return 0xD8806404;
 
     svcCloseHandle(processData->notificationSemaphore);
+    removeProcessFromNotificationIndex(processData);
 
     // Unregister the services registered by the process
     u32 i = 0;
@@ -64,12 +81,15 @@ Result UnregisterProcess(u32 pid)
         if(servicesInfo[i].pid == pid)
         {
             svcCloseHandle(servicesInfo[i].clientPort);
-            servicesInfo[i] = servicesInfo[--nbServices];
+            removeServiceInfo(i);
         }
         else
             ++i;
     }
 
+    if(processDataTable[pid % PROCESS_DATA_TABLE_SIZE] == processData)
+        processDataTable[pid % PROCESS_DATA_TABLE_SIZE] = NULL;
+
     moveNode(processData, &freeProcessDataList, false);
     return 0;
 }
@@ -17,6 +17,7 @@ typedef struct ProcessData
     struct ProcessDataList *parent;
 
     u32 pid;
+    u32 registrationIndex; // increasing, processDataInUseList is in decreasing order
 
     Handle notificationSemaphore;
 
@@ -30,6 +31,7 @@ typedef struct ProcessData
 
     u16 nbPendingNotifications;
     u32 pendingNotifications[16];
+    u32 pendingNotificationFilter; // one bit per hash of each pending notification ID, for fast dedup
     u16 nbSubscribed;
     u32 subscribedNotifications[17];
 } ProcessData;
@@ -40,6 +42,7 @@ typedef struct ProcessDataList
 } ProcessDataList;
 
 extern ProcessDataList processDataInUseList, freeProcessDataList;
+extern ProcessData processDataPool[64];
 
 ProcessData *findProcessData(u32 pid);
 ProcessData *doRegisterProcess(u32 pid, char (*serviceAccessList)[8], u32 serviceAccessListSize);
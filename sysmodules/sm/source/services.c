@@ -13,6 +13,10 @@ This is part of 3ds_sm, which is licensed under the MIT license (see LICENSE for
 ServiceInfo servicesInfo[0xA0] = { 0 };
 u32 nbServices = 0; // including "ports" registered with getPort
 
+// Open-addressed (linear probing) index into servicesInfo, 1-based (0 = empty slot)
+#define SERVICE_HASH_TABLE_SIZE 0x100
+static u8 serviceHashTable[SERVICE_HASH_TABLE_SIZE] = { 0 };
+
 static Result checkServiceName(const char *name, s32 nameSize)
 {
     if(nameSize <= 0 || nameSize > 8)
@@ -28,12 +32,75 @@ static inline bool areServiceNamesEqual(const char *name, const char *name2, s32
     return strncmp(name, name2, nameSize) == 0 && (nameSize == 8 || name[nameSize] == 0);
 }
 
+static inline u64 makeServiceNameKey(const char *name, s32 nameSize)
+{
+    // Names are at most 8 chars and have been validated by checkServiceName, pack them zero-padded
+    u64 key = 0;
+    memcpy(&key, name, nameSize);
+    return key;
+}
+
+static inline u32 hashServiceNameKey(u64 key, bool isNamedPort)
+{
+    u32 h = (u32)key ^ ((u32)(key >> 32) * 0x9E3779B1);
+    h ^= h >> 15;
+    h *= 0x85EBCA77;
+    h ^= h >> 13;
+    return (h + (isNamedPort ? 1 : 0)) % SERVICE_HASH_TABLE_SIZE;
+}
+
+static u32 findServiceHashTableSlot(bool isNamedPort, u64 key)
+{
+    u32 slot = hashServiceNameKey(key, isNamedPort);
+    while(serviceHashTable[slot] != 0)
+    {
+        ServiceInfo *info = &servicesInfo[serviceHashTable[slot] - 1];
+        if(info->nameKey == key && info->isNamedPort == isNamedPort)
+            break;
+        slot = (slot + 1) % SERVICE_HASH_TABLE_SIZE;
+    }
+
+    return slot;
+}
+
+static void removeServiceFromHashTable(u32 slot)
+{
+    // Backward-shift deletion, so that no tombstones are needed
+    u32 hole = slot;
+    serviceHashTable[hole] = 0;
+    for(u32 i = (hole + 1) % SERVICE_HASH_TABLE_SIZE; serviceHashTable[i] != 0; i = (i + 1) % SERVICE_HASH_TABLE_SIZE)
+    {
+        ServiceInfo *info = &servicesInfo[serviceHashTable[i] - 1];
+        u32 home = hashServiceNameKey(info->nameKey, info->isNamedPort);
+
+        // Move the entry into the hole if its home slot is not within (hole, i]
+        if(((i - home) % SERVICE_HASH_TABLE_SIZE) >= ((i - hole) % SERVICE_HASH_TABLE_SIZE))
+        {
+            serviceHashTable[hole] = serviceHashTable[i];
+            serviceHashTable[i] = 0;
+            hole = i;
+        }
+    }
+}
+
 static s32 findServicePortByName(bool isNamedPort, const char *name, s32 nameSize)
 {
-    ServiceInfo *info;
-    for(info = servicesInfo; info < servicesInfo + nbServices && (info->isNamedPort != isNamedPort || !areServiceNamesEqual(info->name, name, nameSize)); info++);
+    u32 slot = findServiceHashTableSlot(isNamedPort, makeServiceNameKey(name, nameSize));
+    return serviceHashTable[slot] == 0 ? -1 : serviceHashTable[slot] - 1;
+}
+
+void removeServiceInfo(u32 serviceId)
+{
+    ServiceInfo *info = &servicesInfo[serviceId];
+    removeServiceFromHashTable(findServiceHashTableSlot(info->isNamedPort, info->nameKey));
 
-    return info >= servicesInfo + nbServices ? -1 : info - servicesInfo;
+    if(serviceId != --nbServices)
+    {
+        // Move the last entry into the freed space, and update its index
+        ServiceInfo *last = &servicesInfo[nbServices];
+        serviceHashTable[findServiceHashTableSlot(last->isNamedPort, last->nameKey)] = (u8)(serviceId + 1);
+        *info = *last;
+    }
 }
 
 static bool checkServiceAccess(SessionData *sessionData, const char *name, s32 nameSize)
@@ -72,10 +139,12 @@ static Result doRegisterServiceOrPort(u32 pid, Handle *serverPort, Handle client
 
     ServiceInfo *serviceInfo = &servicesInfo[nbServices++];
     strncpy(serviceInfo->name, name, 8);
+    serviceInfo->nameKey = makeServiceNameKey(name, nameSize);
 
     serviceInfo->pid = pid;
     serviceInfo->clientPort = portClient;
     serviceInfo->isNamedPort = isNamedPort;
+    serviceHashTable[findServiceHashTableSlot(isNamedPort, serviceInfo->nameKey)] = (u8)nbServices;
 
     SessionData *nextSessionData;
     s32 n = 0;
@@ -134,7 +203,7 @@ static Result UnregisterServiceOrPort(SessionData *sessionData, const char *name
     {
         svcCloseHandle(servicesInfo[serviceId].clientPort);
 
-        servicesInfo[serviceId] = servicesInfo[--nbServices];
+        removeServiceInfo(serviceId);
         return 0;
     }
 }
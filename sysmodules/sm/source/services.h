@@ -14,6 +14,7 @@ This is part of 3ds_sm, which is licensed under the MIT license (see LICENSE for
 typedef struct ServiceInfo
 {
     char name[8];
+    u64 nameKey;
     Handle clientPort;
     u32 pid;
     bool isNamedPort;
@@ -22,6 +23,8 @@ typedef struct ServiceInfo
 extern ServiceInfo servicesInfo[0xA0];
 extern u32 nbServices;
 
+void removeServiceInfo(u32 serviceId);
+
 Result doRegisterService(u32 pid, Handle *serverPort, const char *name, s32 nameSize, s32 maxSessions);
 Result RegisterService(SessionData *sessionData, Handle *serverPort, const char *name, s32 nameSize, s32 maxSessions);
 Result RegisterPort(SessionData *sessionData, Handle clientPort, const char *name, s32 nameSize);
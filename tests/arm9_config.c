@@ -0,0 +1,213 @@
+// arm9: config.ini option table, checked against config_template.ini and by save/parse round trips
+
+#define VERSION_MAJOR           13
+#define VERSION_MINOR           0
+#define VERSION_BUILD           0
+#define ISRELEASE               0
+#define COMMIT_HASH             0x12345678
+#define CONFIG_TITLE            "Luma3DS configuration"
+#define HBLDR_DEFAULT_3DSX_TID  0x000400000D921E00ULL
+#define INI_HANDLER_LINENO      1       // As in arm9/Makefile
+#define INI_STOP_ON_FIRST_ERROR 1
+
+// strchrnul is in newlib, glibc only has it as an extension
+#define _GNU_SOURCE
+
+#include "check.h"
+
+// s64 is long long on the console but long here, which only matters to -Wformat
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat"
+#include "../arm9/source/config.c"
+#pragma GCC diagnostic pop
+#include "../arm9/source/ini.c"
+
+unsigned char config_template_ini[0x4000];
+BootType bootType;
+bool isSdMode;
+
+// Only the menus and the MCU storage use these
+bool I2C_readRegBuf(I2cDevice devId, u8 regAddr, u8 *out, u32 size) { (void)devId; (void)regAddr; (void)out; (void)size; abort(); }
+bool I2C_writeReg(I2cDevice devId, u8 regAddr, u8 data) { (void)devId; (void)regAddr; (void)data; abort(); }
+bool I2C_writeRegBuf(I2cDevice devId, u8 regAddr, const u8 *data, u32 size) { (void)devId; (void)regAddr; (void)data; (void)size; abort(); }
+bool doLumaUpgradeProcess(void) { abort(); }
+void drawCharacter(bool isTopScreen, u32 posX, u32 posY, u32 color, char character) { (void)isTopScreen; (void)posX; (void)posY; (void)color; (void)character; abort(); }
+u32 drawString(bool isTopScreen, u32 posX, u32 posY, u32 color, const char *string) { (void)isTopScreen; (void)posX; (void)posY; (void)color; (void)string; abort(); }
+u32 drawFormattedString(bool isTopScreen, u32 posX, u32 posY, u32 color, const char *fmt, ...) { (void)isTopScreen; (void)posX; (void)posY; (void)color; (void)fmt; abort(); }
+bool fileDelete(const char *path) { (void)path; abort(); }
+u32 fileRead(void *dest, const char *path, u32 maxSize) { (void)dest; (void)path; (void)maxSize; abort(); }
+bool fileWrite(const void *buffer, const char *path, u32 size) { (void)buffer; (void)path; (void)size; abort(); }
+void initScreens(void) { abort(); }
+void loadHomebrewFirm(u32 pressed) { (void)pressed; abort(); }
+void locateEmuNand(FirmwareSource *nandType, u32 *emunandIndex, bool configureCtrNandParams) { (void)nandType; (void)emunandIndex; (void)configureCtrNandParams; abort(); }
+void newPin(bool allowSkipping, u32 pinMode) { (void)allowSkipping; (void)pinMode; abort(); }
+void updateBrightness(u32 brightnessIndex) { (void)brightnessIndex; abort(); }
+u32 waitInput(bool isMenu) { (void)isMenu; abort(); }
+
+#define NB_OPTIONS (sizeof(iniOptions) / sizeof(iniOptions[0]))
+
+static u32 optionHits[NB_OPTIONS];
+
+static int countingHandler(void *user, const char *section, const char *name, const char *value, int lineno)
+{
+    const IniOption *opt = findIniOption(section, name);
+    if(opt != NULL)
+        optionHits[opt - iniOptions]++;
+
+    return configIniHandler(user, section, name, value, lineno);
+}
+
+static s64 randomInRange(s64 minval, s64 maxval)
+{
+    u64 range = (u64)(maxval - minval) + 1;
+    u64 r = (u64)checkRand() << 32 | checkRand();
+
+    // Favor the bounds a bit
+    switch(checkRand() % 8)
+    {
+        case 0: return minval;
+        case 1: return maxval;
+        default: return range == 0 ? (s64)r : minval + (s64)(r % range);
+    }
+}
+
+static void randomizeOption(CfgData *cfg, const IniOption *opt)
+{
+    switch(opt->type)
+    {
+        case INI_OPTION_BOOL:
+            setIniOptionField(cfg, opt, (getIniOptionField(cfg, opt) & ~(1ull << opt->bit)) | (u64)(checkRand() & 1) << opt->bit);
+            break;
+        case INI_OPTION_MULTI_NAME:
+        case INI_OPTION_MULTI_VALUE:
+            cfg->multiConfig = (cfg->multiConfig & ~(3u << (2 * opt->bit))) | (checkRand() % opt->numChoices) << (2 * opt->bit);
+            break;
+        case INI_OPTION_DEC_INT:
+        case INI_OPTION_DEC_FLOAT:
+            setIniOptionField(cfg, opt, (u64)randomInRange(opt->minval, opt->maxval));
+            break;
+        case INI_OPTION_HEX_U64:
+            setIniOptionField(cfg, opt, (u64)checkRand() << 32 | checkRand());
+            break;
+        case INI_OPTION_KEY_COMBO:
+        {
+            u32 combo;
+            do
+            {
+                combo = checkRand() & checkRand();
+                for(u32 i = 0; i < 32; i++)
+                {
+                    if(strcmp(keyNames[i], "?") == 0)
+                        combo &= ~(1u << i);
+                }
+            } while(combo == 0);
+            setIniOptionField(cfg, opt, combo);
+            break;
+        }
+    }
+}
+
+static void checkOptionEqual(const CfgData *a, const CfgData *b, const IniOption *opt)
+{
+    switch(opt->type)
+    {
+        case INI_OPTION_BOOL:
+            CHECK(((getIniOptionField(a, opt) ^ getIniOptionField(b, opt)) >> opt->bit & 1) == 0);
+            break;
+        case INI_OPTION_MULTI_NAME:
+        case INI_OPTION_MULTI_VALUE:
+            CHECK(getIniOptionChoice(a, opt) == getIniOptionChoice(b, opt));
+            break;
+        default:
+            CHECK(getIniOptionField(a, opt) == getIniOptionField(b, opt));
+            break;
+    }
+}
+
+static bool parseConfig(CfgData *cfg, char *str)
+{
+    hasIniParseError = false;
+    memset(optionHits, 0, sizeof(optionHits));
+    return ini_parse_string(str, countingHandler, cfg) >= 0 && !hasIniParseError;
+}
+
+static bool parseOne(CfgData *cfg, const char *section, const char *name, const char *value)
+{
+    hasIniParseError = false;
+    return configIniHandler(cfg, section, name, value, 1) == 1 && !hasIniParseError;
+}
+
+int main(void)
+{
+    static char saved[sizeof(tmpIniBuffer)], resaved[sizeof(tmpIniBuffer)];
+
+    FILE *f = fopen("../arm9/data/config_template.ini", "rb");
+    CHECK(f != NULL);
+    size_t templateSize = fread(config_template_ini, 1, sizeof(config_template_ini) - 1, f);
+    CHECK(templateSize > 0 && feof(f));
+    fclose(f);
+
+    // findIniOption binary searches the table
+    for(u32 i = 1; i < NB_OPTIONS; i++)
+    {
+        int cmp = strcmp(iniOptions[i - 1].section, iniOptions[i].section);
+        CHECK(cmp < 0 || (cmp == 0 && strcmp(iniOptions[i - 1].name, iniOptions[i].name) < 0));
+    }
+    for(u32 i = 0; i < NB_OPTIONS; i++)
+    {
+        CHECK(findIniOption(iniOptions[i].section, iniOptions[i].name) == &iniOptions[i]);
+        CHECK(iniOptions[i].offset + iniOptions[i].size <= sizeof(CfgData));
+    }
+    CHECK(findIniOption("boot", "no_such_option") == NULL);
+    CHECK(findIniOption("no_such_section", "autoboot_emunand") == NULL);
+
+    // Random configurations: what is saved parses back to the same values, and saves the same way again
+    for(u32 round = 0; round < 2000; round++)
+    {
+        CfgData parsed;
+        memset(&configData, 0, sizeof(CfgData));
+        for(u32 i = 0; i < NB_OPTIONS; i++)
+            randomizeOption(&configData, &iniOptions[i]);
+
+        size_t n = saveLumaIniConfigToStr(saved);
+        CHECK(n != 0 && n < sizeof(saved) && strlen(saved) == n);
+
+        memset(&parsed, 0, sizeof(CfgData));
+        CHECK(parseConfig(&parsed, saved));
+
+        // The template must have every option, once
+        for(u32 i = 0; i < NB_OPTIONS; i++)
+        {
+            CHECK(optionHits[i] == 1);
+            checkOptionEqual(&configData, &parsed, &iniOptions[i]);
+        }
+
+        configData = parsed;
+        CHECK(saveLumaIniConfigToStr(resaved) == n && strcmp(saved, resaved) == 0);
+    }
+
+    // Values that must be refused
+    CfgData cfg;
+    memset(&cfg, 0, sizeof(CfgData));
+    CHECK(!parseOne(&cfg, "boot", "no_such_option", "1"));
+    CHECK(!parseOne(&cfg, "boot", "autoboot_emunand", "2"));
+    CHECK(!parseOne(&cfg, "boot", "brightness_level", "5"));
+    CHECK(!parseOne(&cfg, "boot", "splash_position", "sometimes"));
+    CHECK(!parseOne(&cfg, "misc", "volume_slider_override", "101"));
+    CHECK(!parseOne(&cfg, "misc", "volume_slider_override", "-2"));
+    CHECK(!parseOne(&cfg, "rosalina", "rosalina_menu_combo", "L+"));
+    CHECK(!parseOne(&cfg, "rosalina", "rosalina_menu_combo", "L+?"));
+    CHECK(!parseOne(&cfg, "rosalina", "hbldr_3dsx_titleid", "00040000g"));
+    CHECK(!parseOne(&cfg, "screen_filters", "screen_filters_top_brightness", "1.5"));
+    CHECK(!parseOne(&cfg, "screen_filters", "screen_filters_top_brightness", "-"));
+
+    // And a few that must be accepted, written the way a user or Rosalina would
+    CHECK(parseOne(&cfg, "boot", "splash_position", "Before Payloads") && ((cfg.multiConfig >> (2 * SPLASH)) & 3) == 1);
+    CHECK(parseOne(&cfg, "misc", "volume_slider_override", "-1") && cfg.volumeSliderOverride == -1);
+    CHECK(parseOne(&cfg, "rosalina", "rosalina_menu_combo", "l+start+select") && cfg.rosalinaMenuCombo == (1u << 9 | 1u << 3 | 1u << 2));
+    CHECK(parseOne(&cfg, "screen_filters", "screen_filters_top_brightness", "-0.25") && cfg.topScreenFilter.brightnessEnc == -25000000);
+    CHECK(parseOne(&cfg, "screen_filters", "screen_filters_top_gamma", "+.5") && cfg.topScreenFilter.gammaEnc == 50000000);
+    CHECK(parseOne(&cfg, "screen_filters", "screen_filters_top_contrast", "1.123456789") && cfg.topScreenFilter.contrastEnc == 112345678);
+
+    return 0;
+}
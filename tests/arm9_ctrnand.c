@@ -0,0 +1,334 @@
+// arm9: CTRNAND sector I/O, checked against encrypted NAND and EmuNAND image files.
+// The hardware backend's sector routing is kept, the AES engine is replaced by a software AES-128 CTR.
+
+#include <string.h>
+#include "check.h"
+
+#include "../arm9/source/crypto.c"
+
+#define SECTOR_SIZE     0x200
+#define IMAGE_SECTORS   0x400
+#define FAT_START       0x5CAE5     // o3DS CTRNAND partition, 0x0B95CA00 bytes in
+#define EMUNAND_OFFSET  0x10000
+
+u32 emuOffset = 0, emuHeader = 0;
+
+static FILE *nandImage, *sdImage;
+static u32 deviceReads, deviceWrites;
+
+// Image files hold the sectors from FAT_START (NAND) or FAT_START + EMUNAND_OFFSET (SD) on
+static int imageAccess(FILE *image, u32 firstSector, u32 sector, u32 count, u8 *out, const u8 *in)
+{
+    if(sector < firstSector || sector - firstSector + count > IMAGE_SECTORS)
+        return -1;
+
+    CHECK(fseek(image, (long)(sector - firstSector) * SECTOR_SIZE, SEEK_SET) == 0);
+    if(out != NULL)
+    {
+        deviceReads++;
+        CHECK(fread(out, SECTOR_SIZE, count, image) == count);
+    }
+    else
+    {
+        deviceWrites++;
+        CHECK(fwrite(in, SECTOR_SIZE, count, image) == count);
+    }
+
+    return 0;
+}
+
+int sdmmc_nand_readsectors(u32 sector_no, u32 numsectors, u8 *out) { return imageAccess(nandImage, FAT_START, sector_no, numsectors, out, NULL); }
+int sdmmc_nand_writesectors(u32 sector_no, u32 numsectors, const u8 *in) { return imageAccess(nandImage, FAT_START, sector_no, numsectors, NULL, in); }
+int sdmmc_sdcard_readsectors(u32 sector_no, u32 numsectors, u8 *out) { return imageAccess(sdImage, FAT_START + EMUNAND_OFFSET, sector_no, numsectors, out, NULL); }
+void sdmmc_get_cid(bool isNand, u32 *info) { (void)isNand; memset(info, 0, 16); }
+u32 decAtoi(const char *in, u32 digits) { (void)in; (void)digits; return 0; }
+void *alignedseqmemcpy(void *dst, const void *src, u32 len) { return memcpy(dst, src, len); }
+
+/* AES-128, encryption only (all CTR needs) */
+
+static u8 sbox[256];
+
+static u8 gfMul2(u8 x)
+{
+    return (u8)(x << 1) ^ ((x & 0x80) ? 0x1B : 0);
+}
+
+static void initSbox(void)
+{
+    // Walk the multiplicative group with generator 3 and its inverse, then apply the affine transform
+    u8 p = 1, q = 1;
+    do
+    {
+        p = p ^ gfMul2(p);
+        q ^= q << 1;
+        q ^= q << 2;
+        q ^= q << 4;
+        if(q & 0x80)
+            q ^= 0x09;
+
+        u8 x = q ^ (u8)((q << 1) | (q >> 7)) ^ (u8)((q << 2) | (q >> 6)) ^ (u8)((q << 3) | (q >> 5)) ^ (u8)((q << 4) | (q >> 4));
+        sbox[p] = x ^ 0x63;
+    } while(p != 1);
+
+    sbox[0] = 0x63;
+}
+
+static void aesExpandKey(u8 roundKeys[176], const u8 key[16])
+{
+    u8 rcon = 1;
+
+    memcpy(roundKeys, key, 16);
+    for(u32 i = 16; i < 176; i += 4)
+    {
+        u8 t[4];
+        memcpy(t, roundKeys + i - 4, 4);
+        if(i % 16 == 0)
+        {
+            u8 first = t[0];
+            t[0] = sbox[t[1]] ^ rcon;
+            t[1] = sbox[t[2]];
+            t[2] = sbox[t[3]];
+            t[3] = sbox[first];
+            rcon = gfMul2(rcon);
+        }
+
+        for(u32 j = 0; j < 4; j++)
+            roundKeys[i + j] = roundKeys[i - 16 + j] ^ t[j];
+    }
+}
+
+static void aesEncryptBlock(const u8 roundKeys[176], u8 block[16])
+{
+    for(u32 i = 0; i < 16; i++)
+        block[i] ^= roundKeys[i];
+
+    for(u32 round = 1; round <= 10; round++)
+    {
+        u8 s[16];
+
+        // SubBytes and ShiftRows
+        for(u32 col = 0; col < 4; col++)
+            for(u32 row = 0; row < 4; row++)
+                s[col * 4 + row] = sbox[block[((col + row) % 4) * 4 + row]];
+
+        // MixColumns, except in the last round
+        for(u32 col = 0; col < 4 && round != 10; col++)
+        {
+            u8 *c = s + col * 4;
+            u8 all = c[0] ^ c[1] ^ c[2] ^ c[3], first = c[0];
+            c[0] ^= all ^ gfMul2(c[0] ^ c[1]);
+            c[1] ^= all ^ gfMul2(c[1] ^ c[2]);
+            c[2] ^= all ^ gfMul2(c[2] ^ c[3]);
+            c[3] ^= all ^ gfMul2(c[3] ^ first);
+        }
+
+        for(u32 i = 0; i < 16; i++)
+            block[i] = s[i] ^ roundKeys[round * 16 + i];
+    }
+}
+
+static u8 nandRoundKeys[176];
+static u32 cryptCalls;
+
+// Big endian 128-bit counter, the reference the driver's aes_advctr is checked against
+static void counterAdd(u8 ctr[16], u32 val)
+{
+    u32 carry = val;
+    for(int i = 15; i >= 0 && carry != 0; i--)
+    {
+        carry += ctr[i];
+        ctr[i] = (u8)carry;
+        carry >>= 8;
+    }
+}
+
+static void softwareCtr(u8 *data, u32 size, u8 *ctr)
+{
+    for(u32 pos = 0; pos < size; pos += AES_BLOCK_SIZE)
+    {
+        u8 keystream[AES_BLOCK_SIZE];
+        memcpy(keystream, ctr, AES_BLOCK_SIZE);
+        aesEncryptBlock(nandRoundKeys, keystream);
+        for(u32 i = 0; i < AES_BLOCK_SIZE; i++)
+            data[pos + i] ^= keystream[i];
+        counterAdd(ctr, 1);
+    }
+}
+
+static void softwareCrypt(u8 *data, u32 size, u8 *ctr)
+{
+    cryptCalls++;
+    CHECK(size % AES_BLOCK_SIZE == 0);
+    softwareCtr(data, size, ctr);
+}
+
+static u8 writeBuffer[0x4000];
+
+static const CtrNandBackend softwareBackend = {
+    .readSectors = ctrNandReadSectors,
+    .writeSectors = sdmmc_nand_writesectors,
+    .crypt = softwareCrypt,
+    .writeBuffer = writeBuffer,
+    .writeBufferSize = sizeof(writeBuffer),
+};
+
+static void checkAes(void)
+{
+    // FIPS-197 appendix C.1
+    static const u8 key[16] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F };
+    static const u8 expected[16] = { 0x69, 0xC4, 0xE0, 0xD8, 0x6A, 0x7B, 0x04, 0x30, 0xD8, 0xCD, 0xB7, 0x80, 0x70, 0xB4, 0xC5, 0x5A };
+    u8 roundKeys[176], block[16];
+
+    for(u32 i = 0; i < 16; i++)
+        block[i] = (u8)(i * 0x11);
+
+    aesExpandKey(roundKeys, key);
+    aesEncryptBlock(roundKeys, block);
+    CHECK(memcmp(block, expected, sizeof(block)) == 0);
+}
+
+static void checkAdvanceCounter(void)
+{
+    for(u32 i = 0; i < 10000; i++)
+    {
+        __attribute__((aligned(4))) u8 ctr[AES_BLOCK_SIZE];
+        u8 expected[AES_BLOCK_SIZE];
+        for(u32 j = 0; j < sizeof(ctr); j++)
+            ctr[j] = (u8)checkRand();
+
+        // Bias towards carries across the 32-bit words
+        if(i % 2)
+            memset(ctr + 4 + checkRand() % 9, 0xFF, 4);
+
+        u32 val = i % 3 ? checkRand() : checkRand() % 0x100;
+        memcpy(expected, ctr, sizeof(ctr));
+        counterAdd(expected, val);
+        aes_advctr(ctr, val, AES_INPUT_BE | AES_INPUT_NORMAL);
+        CHECK(memcmp(ctr, expected, sizeof(ctr)) == 0);
+    }
+}
+
+// Counter of a CTRNAND partition sector, from the start of the NAND
+static void sectorCounter(u8 ctr[16], u32 sector)
+{
+    memcpy(ctr, nandCtr, sizeof(nandCtr));
+    counterAdd(ctr, (FAT_START + sector) * (SECTOR_SIZE / AES_BLOCK_SIZE));
+}
+
+// Plain sector contents, encrypted into the image file the way the console stores them
+static FILE *createImage(u8 *plain)
+{
+    static u8 sector[SECTOR_SIZE];
+    FILE *image = tmpfile();
+    CHECK(image != NULL);
+
+    for(u32 i = 0; i < IMAGE_SECTORS * SECTOR_SIZE; i++)
+        plain[i] = (u8)checkRand();
+
+    for(u32 i = 0; i < IMAGE_SECTORS; i++)
+    {
+        u8 ctr[16];
+        sectorCounter(ctr, i);
+        memcpy(sector, plain + i * SECTOR_SIZE, SECTOR_SIZE);
+        softwareCtr(sector, SECTOR_SIZE, ctr);
+        CHECK(fwrite(sector, SECTOR_SIZE, 1, image) == 1);
+    }
+
+    return image;
+}
+
+static void checkReads(const u8 *plain, u32 count)
+{
+    static u8 buf[IMAGE_SECTORS * SECTOR_SIZE];
+
+    for(u32 i = 0; i < count; i++)
+    {
+        u32 sector = checkRand() % IMAGE_SECTORS;
+        u32 sectorCount = 1 + checkRand() % (IMAGE_SECTORS - sector < 100 ? IMAGE_SECTORS - sector : 100);
+
+        CHECK(ctrNandRead(sector, sectorCount, buf) == 0);
+        CHECK(memcmp(buf, plain + sector * SECTOR_SIZE, sectorCount * SECTOR_SIZE) == 0);
+    }
+}
+
+static void checkNand(void)
+{
+    static u8 nandPlain[IMAGE_SECTORS * SECTOR_SIZE], sdPlain[IMAGE_SECTORS * SECTOR_SIZE], buf[IMAGE_SECTORS * SECTOR_SIZE];
+    static const u8 key[16] = { 0xDE, 0xAD, 0xBE, 0xEF, 0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF, 0xFE, 0xDC, 0xBA, 0x98 };
+
+    aesExpandKey(nandRoundKeys, key);
+    ctrNandBackend = &softwareBackend;
+    fatStart = FAT_START;
+
+    // The low word of the base counter is close to wrapping, sector offsets have to carry into the next one
+    for(u32 i = 0; i < sizeof(nandCtr); i++)
+        nandCtr[i] = (u8)checkRand();
+    memset(nandCtr + 12, 0xFF, 4);
+    nandCtr[15] = 0x00;
+
+    nandImage = createImage(nandPlain);
+    sdImage = createImage(sdPlain);
+
+    // SysNAND, then EmuNAND from the SD card: same partition layout, same counters
+    ctrNandLocation = FIRMWARE_SYSNAND;
+    checkReads(nandPlain, 500);
+
+    ctrNandLocation = FIRMWARE_EMUNAND;
+    emuOffset = EMUNAND_OFFSET;
+    checkReads(sdPlain, 500);
+
+    ctrNandLocation = FIRMWARE_SYSNAND;
+    emuOffset = 0;
+
+    // Writes are encrypted in the bounce buffer, chunk by chunk, and the caller's data is left as is
+    for(u32 i = 0; i < 200; i++)
+    {
+        u32 sector = checkRand() % IMAGE_SECTORS;
+        u32 maxCount = IMAGE_SECTORS - sector < 80 ? IMAGE_SECTORS - sector : 80;
+        u32 sectorCount = 1 + checkRand() % maxCount;
+        u32 chunkSectors = sizeof(writeBuffer) / SECTOR_SIZE;
+
+        for(u32 j = 0; j < sectorCount * SECTOR_SIZE; j++)
+            buf[j] = (u8)checkRand();
+        memcpy(nandPlain + sector * SECTOR_SIZE, buf, sectorCount * SECTOR_SIZE);
+
+        u32 writesBefore = deviceWrites;
+        CHECK(ctrNandWrite(sector, sectorCount, buf) == 0);
+        CHECK(deviceWrites - writesBefore == (sectorCount + chunkSectors - 1) / chunkSectors);
+        CHECK(memcmp(buf, nandPlain + sector * SECTOR_SIZE, sectorCount * SECTOR_SIZE) == 0);
+
+        if(i % 8 == 0)
+            checkReads(nandPlain, 4);
+    }
+
+    // And what is on the image is what the console would have written
+    for(u32 i = 0; i < IMAGE_SECTORS; i++)
+    {
+        u8 ctr[16];
+        sectorCounter(ctr, i);
+        CHECK(imageAccess(nandImage, FAT_START, FAT_START + i, 1, buf, NULL) == 0);
+        softwareCtr(buf, SECTOR_SIZE, ctr);
+        CHECK(memcmp(buf, nandPlain + i * SECTOR_SIZE, SECTOR_SIZE) == 0);
+    }
+
+    // A failed read is passed on and its buffer isn't run through the cipher
+    u32 cryptsBefore = cryptCalls;
+    CHECK(ctrNandRead(IMAGE_SECTORS - 1, 2, buf) != 0);
+    CHECK(cryptCalls == cryptsBefore);
+
+    // Nor is the key applied twice: one pass per read
+    CHECK(ctrNandRead(0, 64, buf) == 0);
+    CHECK(cryptCalls == cryptsBefore + 1);
+
+    fclose(nandImage);
+    fclose(sdImage);
+}
+
+int main(void)
+{
+    initSbox();
+    checkAes();
+    checkAdvanceCounter();
+    checkNand();
+    return 0;
+}
@@ -0,0 +1,360 @@
+// arm9: FatFs sector cache and fast seek reads, checked against the disk images they read from through a stand-in block driver
+
+#include "check.h"
+#include "fatimage.h"
+
+#include "../arm9/source/fatfs/sdmmc/sdmmc.h"
+
+// disk_write checks the SD write protect switch through the controller's registers
+static u16 sdmmcRegs[0x80];
+#undef SDMMC_BASE
+#define SDMMC_BASE ((uintptr_t)sdmmcRegs)
+
+#include "../arm9/source/fatfs/diskio.c"
+#include "../arm9/source/fatfs/ff.c"
+#include "../arm9/source/fatfs/ffunicode.c"
+
+#define DISK_SECTORS        FAT_IMAGE_MAX_SECTORS
+#define EMUNAND_A_OFFSET    0x10000
+#define EMUNAND_B_OFFSET    0x20000
+
+FirmwareSource ctrNandLocation = FIRMWARE_SYSNAND;
+u32 emuOffset = 0, emuHeader = 0;
+
+static u8 *sdDisk, *nandDisks[3];
+static u32 driverReads;
+
+static u8 *currentNandDisk(void)
+{
+    if(ctrNandLocation == FIRMWARE_SYSNAND)
+        return nandDisks[0];
+
+    return nandDisks[emuOffset == EMUNAND_A_OFFSET ? 1 : 2];
+}
+
+static int diskAccess(u8 *disk, u32 sector, u32 count, u8 *out, const u8 *in)
+{
+    if(sector + count > DISK_SECTORS)
+        return -1;
+
+    if(out != NULL)
+    {
+        driverReads++;
+        memcpy(out, disk + sector * FAT_IMAGE_SECTOR_SIZE, count * FAT_IMAGE_SECTOR_SIZE);
+    }
+    else if(in != NULL)
+        memcpy(disk + sector * FAT_IMAGE_SECTOR_SIZE, in, count * FAT_IMAGE_SECTOR_SIZE);
+
+    return 0;
+}
+
+u32 sdmmc_sdcard_init() { return 0; }
+int sdmmc_sdcard_readsectors(u32 sector_no, u32 numsectors, u8 *out) { return diskAccess(sdDisk, sector_no, numsectors, out, NULL); }
+int sdmmc_sdcard_writesectors(u32 sector_no, u32 numsectors, const u8 *in) { return diskAccess(sdDisk, sector_no, numsectors, NULL, in); }
+int ctrNandInit(void) { return 0; }
+int ctrNandRead(u32 sector, u32 sectorCount, u8 *outbuf) { return diskAccess(currentNandDisk(), sector, sectorCount, outbuf, NULL); }
+int ctrNandWrite(u32 sector, u32 sectorCount, const u8 *inbuf) { return diskAccess(currentNandDisk(), sector, sectorCount, NULL, inbuf); }
+
+bool I2C_readRegBuf(I2cDevice devId, u8 regAddr, u8 *out, u32 size)
+{
+    (void)devId;
+    (void)regAddr;
+    static const u8 time[8] = { 0x30, 0x15, 0x12, 1, 0x19, 0x10, 0x26, 0 };
+    memcpy(out, time, size);
+    return true;
+}
+
+static void fillRandom(u8 *buf, u32 size)
+{
+    for(u32 i = 0; i < size; i++)
+        buf[i] = (u8)checkRand();
+}
+
+static void selectNand(u32 i)
+{
+    ctrNandLocation = i == 0 ? FIRMWARE_SYSNAND : FIRMWARE_EMUNAND;
+    emuOffset = i == 1 ? EMUNAND_A_OFFSET : i == 2 ? EMUNAND_B_OFFSET : 0;
+}
+
+// Random reads and writes on raw disks, switching between SysNAND and EmuNANDs without remounting
+static void checkCoherency(void)
+{
+    static u8 buf[16 * FAT_IMAGE_SECTOR_SIZE];
+    u32 curNand = 0;
+    LBA_t lastSector[2] = { 0, 0 };
+
+    sdDisk = malloc(DISK_SECTORS * FAT_IMAGE_SECTOR_SIZE);
+    fillRandom(sdDisk, DISK_SECTORS * FAT_IMAGE_SECTOR_SIZE);
+    for(u32 i = 0; i < 3; i++)
+    {
+        nandDisks[i] = malloc(DISK_SECTORS * FAT_IMAGE_SECTOR_SIZE);
+        fillRandom(nandDisks[i], DISK_SECTORS * FAT_IMAGE_SECTOR_SIZE);
+    }
+
+    sdmmcRegs[REG_SDSTATUS0 / 2] = TMIO_STAT0_WRPROTECT;
+    CHECK(disk_initialize(SDCARD) == 0 && disk_initialize(CTRNAND) == 0);
+
+    for(u32 op = 0; op < 200000; op++)
+    {
+        u32 r = checkRand();
+        BYTE pdrv = r & 1;
+        u8 *disk = pdrv == SDCARD ? sdDisk : currentNandDisk();
+
+        // Stay within a few cache sets worth of sectors so that lines get reused and evicted
+        LBA_t sector = (r >> 8) % 96;
+        if(r & 2)
+            sector = lastSector[pdrv] + 1;
+
+        switch((r >> 4) % 16)
+        {
+            case 0:
+            case 1:
+            {
+                UINT count = 1 + (r >> 20) % 8;
+                fillRandom(buf, count * FAT_IMAGE_SECTOR_SIZE);
+                CHECK(disk_write(pdrv, buf, sector, count) == RES_OK);
+                CHECK(memcmp(disk + sector * FAT_IMAGE_SECTOR_SIZE, buf, count * FAT_IMAGE_SECTOR_SIZE) == 0);
+                break;
+            }
+            case 2:
+            {
+                UINT count = 2 + (r >> 20) % 14;
+                CHECK(disk_read(pdrv, buf, sector, count) == RES_OK);
+                CHECK(memcmp(disk + sector * FAT_IMAGE_SECTOR_SIZE, buf, count * FAT_IMAGE_SECTOR_SIZE) == 0);
+                lastSector[pdrv] = sector + count - 1;
+                break;
+            }
+            case 3:
+                curNand = (curNand + 1 + (r >> 20) % 2) % 3;
+                selectNand(curNand);
+                break;
+            case 4:
+                if((r >> 20) % 16 == 0)
+                    CHECK(disk_initialize(pdrv) == 0);
+                break;
+            default:
+                CHECK(disk_read(pdrv, buf, sector, 1) == RES_OK);
+                CHECK(memcmp(disk + sector * FAT_IMAGE_SECTOR_SIZE, buf, FAT_IMAGE_SECTOR_SIZE) == 0);
+                lastSector[pdrv] = sector;
+                break;
+        }
+    }
+
+    // The last line of the medium can't be read whole
+    CHECK(disk_read(SDCARD, buf, DISK_SECTORS - 1, 1) == RES_OK);
+    CHECK(memcmp(sdDisk + (DISK_SECTORS - 1) * FAT_IMAGE_SECTOR_SIZE, buf, FAT_IMAGE_SECTOR_SIZE) == 0);
+
+    sdmmcRegs[REG_SDSTATUS0 / 2] = 0;
+    CHECK(disk_write(SDCARD, buf, 0, 1) == RES_WRPRT);
+    sdmmcRegs[REG_SDSTATUS0 / 2] = TMIO_STAT0_WRPROTECT;
+
+    selectNand(0);
+}
+
+// Hits, misses and readahead for a lookup followed by a sequential read
+static void checkCounters(void)
+{
+    static u8 buf[4 * FAT_IMAGE_SECTOR_SIZE];
+    DISKCACHESTATS before, after;
+
+    CHECK(disk_initialize(SDCARD) == 0);
+    disk_get_cache_stats(&before);
+    u32 readsBefore = driverReads;
+
+    CHECK(disk_read(SDCARD, buf, 200, 1) == RES_OK);          // Metadata miss, line 200-203
+    CHECK(disk_read(SDCARD, buf, 200, 1) == RES_OK);          // Metadata hit
+    for(LBA_t sector = 201; sector < 216; sector++)           // Data: hits up to 203, then a miss at 204 prefetching 208
+        CHECK(disk_read(SDCARD, buf, sector, 1) == RES_OK);    // and another one at 212 prefetching 216
+    CHECK(disk_read(SDCARD, buf, 300, 4) == RES_OK);          // Bypass
+
+    disk_get_cache_stats(&after);
+    CHECK(after.misses[CACHE_CLASS_META] - before.misses[CACHE_CLASS_META] == 1);
+    CHECK(after.hits[CACHE_CLASS_META] - before.hits[CACHE_CLASS_META] == 1);
+    CHECK(after.misses[CACHE_CLASS_DATA] - before.misses[CACHE_CLASS_DATA] == 2);
+    CHECK(after.hits[CACHE_CLASS_DATA] - before.hits[CACHE_CLASS_DATA] == 13);
+    CHECK(after.readaheadLines - before.readaheadLines == 2);
+    CHECK(after.bypasses - before.bypasses == 1);
+    CHECK(driverReads - readsBefore == 6);
+}
+
+static void checkFileContents(const char *path, const u8 *expected, u32 size)
+{
+    static u8 buf[4096];
+    FIL file;
+    UINT read;
+
+    CHECK(f_open(&file, path, FA_READ) == FR_OK);
+    CHECK(f_size(&file) == size);
+
+    for(u32 pos = 0; pos < size; pos += read)
+    {
+        UINT chunk = 1 + checkRand() % sizeof(buf);
+        CHECK(f_read(&file, buf, chunk, &read) == FR_OK);
+        CHECK(read == (chunk < size - pos ? chunk : size - pos));
+        CHECK(memcmp(buf, expected + pos, read) == 0);
+    }
+
+    for(u32 i = 0; i < 200; i++)
+    {
+        u32 pos = checkRand() % size;
+        UINT chunk = 1 + checkRand() % sizeof(buf);
+        CHECK(f_lseek(&file, pos) == FR_OK);
+        CHECK(f_read(&file, buf, chunk, &read) == FR_OK);
+        CHECK(read == (chunk < size - pos ? chunk : size - pos));
+        CHECK(memcmp(buf, expected + pos, read) == 0);
+    }
+
+    CHECK(f_close(&file) == FR_OK);
+}
+
+// Whole FAT volumes, as Luma3DS uses them
+static void checkVolumes(void)
+{
+    static u8 small[700], big[300 * 1024], nandFile[40 * 1024], newFile[50 * 1024];
+    static FATFS sdFs, nandFs;
+    FatImage sdImage, nandImage;
+    DISKCACHESTATS before, after;
+
+    fillRandom(small, sizeof(small));
+    fillRandom(big, sizeof(big));
+    fillRandom(nandFile, sizeof(nandFile));
+    fillRandom(newFile, sizeof(newFile));
+
+    fatImageInit(&sdImage, 1);
+    u32 lumaDir = fatImageAddDir(&sdImage, 0, "LUMA       ");
+    fatImageAddFile(&sdImage, lumaDir, "SMALL   BIN", small, sizeof(small), 0);
+    fatImageAddFile(&sdImage, lumaDir, "BIG     BIN", big, sizeof(big), 7);
+    fatImageInit(&nandImage, 1);
+    fatImageAddFile(&nandImage, 0, "DATA    BIN", nandFile, sizeof(nandFile), 3);
+
+    free(sdDisk);
+    free(nandDisks[0]);
+    sdDisk = sdImage.data;
+    nandDisks[0] = nandImage.data;
+
+    CHECK(f_mount(&sdFs, "sdmc:", 1) == FR_OK);
+    CHECK(f_mount(&nandFs, "nand:", 1) == FR_OK);
+    disk_get_cache_stats(&before);
+
+    checkFileContents("sdmc:/luma/small.bin", small, sizeof(small));
+    checkFileContents("sdmc:/luma/big.bin", big, sizeof(big));
+    checkFileContents("nand:/data.bin", nandFile, sizeof(nandFile));
+
+    disk_get_cache_stats(&after);
+    CHECK(after.hits[CACHE_CLASS_META] > before.hits[CACHE_CLASS_META]);
+    CHECK(after.hits[CACHE_CLASS_DATA] > before.hits[CACHE_CLASS_DATA]);
+    CHECK(after.readaheadLines > before.readaheadLines);
+
+    // Writes go through to the medium, and the cache doesn't hand back stale FAT or directory sectors
+    FIL file;
+    UINT written;
+    CHECK(f_open(&file, "nand:/new.bin", FA_WRITE | FA_CREATE_NEW) == FR_OK);
+    for(u32 pos = 0; pos < sizeof(newFile); pos += written)
+    {
+        UINT chunk = 1 + checkRand() % 3000;
+        CHECK(f_write(&file, newFile + pos, chunk < sizeof(newFile) - pos ? chunk : sizeof(newFile) - pos, &written) == FR_OK);
+    }
+    CHECK(f_close(&file) == FR_OK);
+
+    CHECK(f_mount(&nandFs, "nand:", 1) == FR_OK);
+    checkFileContents("nand:/new.bin", newFile, sizeof(newFile));
+    checkFileContents("nand:/data.bin", nandFile, sizeof(nandFile));
+
+    CHECK(f_unmount("sdmc:") == FR_OK);
+    CHECK(f_unmount("nand:") == FR_OK);
+}
+
+// Reads of fragmented files with a cluster link map, the way fileRead sets it up for large files.
+// Clusters are several sectors long, so that reads can also start and stop within them.
+static void checkFastSeek(void)
+{
+    static u8 content[600 * 1024], buf[sizeof(content)];
+    static const u32 fragmentEvery[] = { 0, 50, 7, 3, 1 };
+    static FATFS fs;
+    FatImage image;
+
+    fillRandom(content, sizeof(content));
+    fatImageInit(&image, 4);
+    for(u32 i = 0; i < sizeof(fragmentEvery) / sizeof(fragmentEvery[0]); i++)
+    {
+        char name[12];
+        sprintf(name, "FRAG%u   BIN", i);
+        fatImageAddFile(&image, 0, name, content, sizeof(content), fragmentEvery[i]);
+    }
+
+    free(sdDisk);
+    sdDisk = image.data;
+    CHECK(f_mount(&fs, "sdmc:", 1) == FR_OK);
+
+    for(u32 i = 0; i < sizeof(fragmentEvery) / sizeof(fragmentEvery[0]); i++)
+    {
+        char path[20];
+        u32 nbClusters = sizeof(content) / image.clusterSize;
+        u32 nbFragments = fragmentEvery[i] == 0 ? 1 : (nbClusters + fragmentEvery[i] - 1) / fragmentEvery[i];
+        DWORD linkMap[0x80];
+        FIL file;
+        UINT read;
+
+        sprintf(path, "sdmc:/frag%u.bin", i);
+
+        // Without a link map first, for comparison
+        CHECK(f_open(&file, path, FA_READ) == FR_OK);
+        u32 readsBefore = driverReads;
+        CHECK(f_read(&file, buf, sizeof(buf), &read) == FR_OK && read == sizeof(buf));
+        CHECK(memcmp(buf, content, sizeof(buf)) == 0);
+        u32 chainReads = driverReads - readsBefore;
+        CHECK(f_close(&file) == FR_OK);
+
+        CHECK(f_open(&file, path, FA_READ) == FR_OK);
+        linkMap[0] = sizeof(linkMap) / sizeof(linkMap[0]);
+        file.cltbl = linkMap;
+        FRESULT res = f_lseek(&file, CREATE_LINKMAP);
+
+        // One (length, start) pair per fragment, plus the terminator
+        if(2 * nbFragments + 1 > sizeof(linkMap) / sizeof(linkMap[0]))
+        {
+            CHECK(res == FR_NOT_ENOUGH_CORE);
+            CHECK(f_close(&file) == FR_OK);
+            continue;
+        }
+        CHECK(res == FR_OK);
+
+        readsBefore = driverReads;
+        CHECK(f_read(&file, buf, sizeof(buf), &read) == FR_OK && read == sizeof(buf));
+        CHECK(memcmp(buf, content, sizeof(buf)) == 0);
+        u32 linkMapReads = driverReads - readsBefore;
+
+        // Each fragment is one read, a cut at the 16-bit block count limit aside
+        CHECK(linkMapReads == nbFragments);
+        printf("fast seek: %u fragments, %u driver reads with a link map, %u without\n", nbFragments, linkMapReads, chainReads);
+
+        // Reads that start and end within fragments, then small reads crossing fragment boundaries
+        for(u32 j = 0; j < 300; j++)
+        {
+            u32 pos = checkRand() % sizeof(content);
+            u32 len = j < 150 ? checkRand() % (sizeof(content) - pos + 1) : checkRand() % 2048;
+            CHECK(f_lseek(&file, pos) == FR_OK);
+            CHECK(f_read(&file, buf, len, &read) == FR_OK);
+            CHECK(read == (len < sizeof(content) - pos ? len : sizeof(content) - pos));
+            CHECK(memcmp(buf, content + pos, read) == 0);
+
+            // The current cluster must follow the reads, so that the next sequential one is right too
+            CHECK(f_read(&file, buf, 1000, &read) == FR_OK);
+            CHECK(memcmp(buf, content + pos + (len < sizeof(content) - pos ? len : sizeof(content) - pos), read) == 0);
+        }
+
+        CHECK(f_close(&file) == FR_OK);
+    }
+
+    CHECK(f_unmount("sdmc:") == FR_OK);
+}
+
+int main(void)
+{
+    checkCoherency();
+    checkCounters();
+    checkVolumes();
+    checkFastSeek();
+
+    return 0;
+}
@@ -0,0 +1,481 @@
+// arm9: FIRM section hashing while the image is read, and the cache of images already checked.
+// The SHA engine is replaced by a software SHA-256, the cache file lives in memory.
+
+#include <string.h>
+#include <time.h>
+#include "check.h"
+
+#include "../arm9/source/firmcheck.c"
+
+/* SHA-256 */
+
+typedef struct Sha256
+{
+    u32 state[8];
+    u8 block[64];
+    u64 length;
+} Sha256;
+
+static const u32 sha256K[64] = {
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2,
+};
+
+static u32 ror32(u32 x, u32 n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+static void sha256Block(Sha256 *ctx, const u8 *block)
+{
+    u32 w[64], s[8];
+
+    for(u32 i = 0; i < 16; i++)
+        w[i] = (u32)block[4 * i] << 24 | (u32)block[4 * i + 1] << 16 | (u32)block[4 * i + 2] << 8 | block[4 * i + 3];
+    for(u32 i = 16; i < 64; i++)
+        w[i] = w[i - 16] + (ror32(w[i - 15], 7) ^ ror32(w[i - 15], 18) ^ (w[i - 15] >> 3)) +
+               w[i - 7] + (ror32(w[i - 2], 17) ^ ror32(w[i - 2], 19) ^ (w[i - 2] >> 10));
+
+    memcpy(s, ctx->state, sizeof(s));
+    for(u32 i = 0; i < 64; i++)
+    {
+        u32 t1 = s[7] + (ror32(s[4], 6) ^ ror32(s[4], 11) ^ ror32(s[4], 25)) + ((s[4] & s[5]) ^ (~s[4] & s[6])) + sha256K[i] + w[i],
+            t2 = (ror32(s[0], 2) ^ ror32(s[0], 13) ^ ror32(s[0], 22)) + ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+        memmove(s + 1, s, 7 * sizeof(u32));
+        s[4] += t1;
+        s[0] = t1 + t2;
+    }
+
+    for(u32 i = 0; i < 8; i++)
+        ctx->state[i] += s[i];
+}
+
+static void sha256Init(Sha256 *ctx)
+{
+    static const u32 iv[8] = { 0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19 };
+    memcpy(ctx->state, iv, sizeof(iv));
+    ctx->length = 0;
+}
+
+static void sha256Update(Sha256 *ctx, const u8 *data, size_t size)
+{
+    for(size_t i = 0; i < size; i++)
+    {
+        ctx->block[ctx->length++ % 64] = data[i];
+        if(ctx->length % 64 == 0)
+            sha256Block(ctx, ctx->block);
+    }
+}
+
+static void sha256Final(Sha256 *ctx, u8 *out)
+{
+    u64 bits = ctx->length * 8;
+    u8 pad = 0x80;
+
+    sha256Update(ctx, &pad, 1);
+    pad = 0;
+    while(ctx->length % 64 != 56)
+        sha256Update(ctx, &pad, 1);
+    for(int i = 7; i >= 0; i--)
+    {
+        u8 b = (u8)(bits >> (8 * i));
+        sha256Update(ctx, &b, 1);
+    }
+
+    for(u32 i = 0; i < 8; i++)
+    {
+        out[4 * i] = (u8)(ctx->state[i] >> 24);
+        out[4 * i + 1] = (u8)(ctx->state[i] >> 16);
+        out[4 * i + 2] = (u8)(ctx->state[i] >> 8);
+        out[4 * i + 3] = (u8)ctx->state[i];
+    }
+}
+
+/* The SHA engine, in software. Like the hardware, it holds a single hash in progress */
+
+static Sha256 engine;
+static bool isEngineStarted, isEngineTailFed;
+static const u8 *imageBase;
+static u32 imageAvailable;          // Bytes of the image read so far, the hasher mustn't look past them
+static u64 hashedBytes;
+
+void sha_start(u32 mode)
+{
+    CHECK(mode == SHA_256_MODE);
+    sha256Init(&engine);
+    isEngineStarted = true;
+    isEngineTailFed = false;
+}
+
+void sha_update(const void *src, u32 size)
+{
+    const u8 *src8 = (const u8 *)src;
+
+    CHECK(isEngineStarted && !isEngineTailFed);
+    if(imageBase != NULL && src8 >= imageBase && src8 < imageBase + 0x8000000)
+        CHECK((u32)(src8 - imageBase) + size <= imageAvailable);
+
+    if(size % 0x40 != 0) isEngineTailFed = true;
+    hashedBytes += size;
+    sha256Update(&engine, src8, size);
+}
+
+void sha_finish(void *res, u32 mode)
+{
+    CHECK(isEngineStarted && mode == SHA_256_MODE);
+    sha256Final(&engine, res);
+    isEngineStarted = false;
+}
+
+void sha(void *res, const void *src, u32 size, u32 mode)
+{
+    sha_start(mode);
+    sha_update(src, size);
+    sha_finish(res, mode);
+}
+
+/* The cache file */
+
+static u8 cacheFile[sizeof(FirmCheckCache)];
+static u32 cacheFileSize, cacheFileWrites;
+
+u32 fileRead(void *dest, const char *path, u32 maxSize)
+{
+    CHECK(strcmp(path, FIRM_CHECK_CACHE_PATH) == 0);
+    if(cacheFileSize > maxSize)
+        return 0;
+    memcpy(dest, cacheFile, cacheFileSize);
+    return cacheFileSize;
+}
+
+bool fileWrite(const void *buffer, const char *path, u32 size)
+{
+    CHECK(strcmp(path, FIRM_CHECK_CACHE_PATH) == 0 && size == sizeof(cacheFile));
+    memcpy(cacheFile, buffer, size);
+    cacheFileSize = size;
+    cacheFileWrites++;
+    return true;
+}
+
+// Next boot: the cache is read from the file again
+static void reboot(void)
+{
+    isFirmCheckCacheLoaded = false;
+    memset(&firmCheckCache, 0xA5, sizeof(firmCheckCache));
+}
+
+/* FIRM images */
+
+#define MAX_IMAGE_SIZE  0x100000
+
+static __attribute__((aligned(8))) u8 image[MAX_IMAGE_SIZE];
+
+static void hashSection(FirmSection *section)
+{
+    Sha256 ctx;
+    sha256Init(&ctx);
+    sha256Update(&ctx, image + section->offset, section->size);
+    sha256Final(&ctx, section->hash);
+}
+
+// Random sections, back to back in file order, the first one at 0x200. Returns the image size
+static u32 buildImage(u32 sectionNum, bool isShuffled)
+{
+    Firm *firm = (Firm *)image;
+    u32 offset = 0x200, order[4] = { 0, 1, 2, 3 };
+
+    memset(image, 0, 0x200);
+    memcpy(firm->magic, "FIRM", 4);
+
+    if(isShuffled)
+        for(u32 i = 3; i > 0; i--)
+        {
+            u32 j = checkRand() % (i + 1), tmp = order[i];
+            order[i] = order[j];
+            order[j] = tmp;
+        }
+
+    for(u32 i = 0; i < sectionNum; i++)
+    {
+        FirmSection *section = &firm->section[order[i]];
+        section->offset = offset;
+        section->size = 0x200 * (1 + checkRand() % 0x100);
+        for(u32 j = 0; j < section->size; j++)
+            image[offset + j] = (u8)checkRand();
+        hashSection(section);
+        offset += section->size;
+    }
+
+    return offset;
+}
+
+// The image comes in as fileReadStreamed would hand it over. Returns the hasher's verdict
+static bool readImage(u32 size, u32 fileStamp, u32 chunkSize)
+{
+    static __attribute__((aligned(8))) u8 dest[MAX_IMAGE_SIZE];
+    FirmHasher hasher = { .fileStamp = fileStamp };
+
+    imageBase = dest;
+    for(imageAvailable = 0; imageAvailable < size;)
+    {
+        u32 chunk = chunkSize ? chunkSize : 1 + checkRand() % 0x4000;
+        if(chunk > size - imageAvailable)
+            chunk = size - imageAvailable;
+
+        memcpy(dest + imageAvailable, image + imageAvailable, chunk);
+        imageAvailable += chunk;
+        firmHasherOnRead(&hasher, dest, imageAvailable, size);
+    }
+
+    CHECK(hasher.isStarted);
+    bool ret = firmHasherFinish(&hasher);
+    imageBase = NULL;
+
+    return ret;
+}
+
+static void checkSha256(void)
+{
+    static const struct
+    {
+        const char *message;
+        u8 digest[32];
+    } vectors[] = {
+        { "", { 0xE3, 0xB0, 0xC4, 0x42, 0x98, 0xFC, 0x1C, 0x14, 0x9A, 0xFB, 0xF4, 0xC8, 0x99, 0x6F, 0xB9, 0x24,
+                0x27, 0xAE, 0x41, 0xE4, 0x64, 0x9B, 0x93, 0x4C, 0xA4, 0x95, 0x99, 0x1B, 0x78, 0x52, 0xB8, 0x55 } },
+        { "abc", { 0xBA, 0x78, 0x16, 0xBF, 0x8F, 0x01, 0xCF, 0xEA, 0x41, 0x41, 0x40, 0xDE, 0x5D, 0xAE, 0x22, 0x23,
+                   0xB0, 0x03, 0x61, 0xA3, 0x96, 0x17, 0x7A, 0x9C, 0xB4, 0x10, 0xFF, 0x61, 0xF2, 0x00, 0x15, 0xAD } },
+        { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+          { 0x24, 0x8D, 0x6A, 0x61, 0xD2, 0x06, 0x38, 0xB8, 0xE5, 0xC0, 0x26, 0x93, 0x0C, 0x3E, 0x60, 0x39,
+            0xA3, 0x3C, 0xE4, 0x59, 0x64, 0xFF, 0x21, 0x67, 0xF6, 0xEC, 0xED, 0xD4, 0x19, 0xDB, 0x06, 0xC1 } },
+    };
+
+    for(u32 i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++)
+    {
+        u8 digest[32];
+        sha(digest, vectors[i].message, strlen(vectors[i].message), SHA_256_MODE);
+        CHECK(memcmp(digest, vectors[i].digest, sizeof(digest)) == 0);
+    }
+}
+
+// Every section is hashed once, in file order, whatever the sizes of the pieces read
+static void checkStreaming(void)
+{
+    for(u32 i = 0; i < 300; i++)
+    {
+        u32 size = buildImage(1 + i % 4, i % 2), sectionBytes = size - 0x200;
+        u32 chunkSizes[] = { 0, 0x200, 0x20000, size, 0x41 };
+
+        hashedBytes = 0;
+        CHECK(readImage(size, 0, chunkSizes[i % 5]));
+        CHECK(hashedBytes == 0x200 + sectionBytes);
+
+        // One flipped bit anywhere in a section fails it
+        u32 pos = 0x200 + checkRand() % sectionBytes;
+        u8 bit = (u8)(1 << (checkRand() % 8));
+        image[pos] ^= bit;
+        CHECK(!readImage(size, 0, chunkSizes[(i + 1) % 5]));
+        image[pos] ^= bit;
+    }
+
+    // A truncated file fails, even though its header says otherwise
+    u32 size = buildImage(3, false);
+    CHECK(!readImage(size - 0x200, 0, 0));
+}
+
+// Overlapping sections are still streamed, sections past the end of the file or unaligned ones are hashed in one go at the end
+static void checkUnusualLayouts(void)
+{
+    Firm *firm = (Firm *)image;
+
+    u32 size = buildImage(2, false);
+    firm->section[2] = firm->section[0];
+    firm->section[2].offset += 0x200;
+    firm->section[2].size -= 0x200;
+    hashSection(&firm->section[2]);
+
+    FirmHasher hasher;
+    firmHasherStart(&hasher, firm, size, 0);
+    CHECK(hasher.isStreamable);
+    hashedBytes = 0;
+    CHECK(readImage(size, 0, 0));
+    CHECK(hashedBytes == size + firm->section[2].size);
+
+    size = buildImage(1, false);
+    firm->section[0].size -= 0x20;
+    hashSection(&firm->section[0]);
+    firmHasherStart(&hasher, firm, size, 0);
+    CHECK(!hasher.isStreamable);
+    CHECK(readImage(size, 0, 0x1000));
+
+    size = buildImage(2, false);
+    firm->section[1].offset = size;
+    firmHasherStart(&hasher, firm, size, 0);
+    CHECK(!hasher.isStreamable);
+    CHECK(!firmHasherFinish(&hasher));
+
+    firm->section[1].offset = 0xFFFFFE00;
+    firmHasherStart(&hasher, firm, size, 0);
+    CHECK(!firmHasherFinish(&hasher));
+}
+
+static void checkCache(void)
+{
+    cacheFileSize = 0;
+    reboot();
+
+    u32 size = buildImage(4, false);
+
+    // First boot hashes and records, the next ones skip the sections
+    u32 writes = cacheFileWrites;
+    hashedBytes = 0;
+    CHECK(readImage(size, 0x1234, 0));
+    CHECK(hashedBytes == size && cacheFileWrites == writes + 1);
+
+    for(u32 i = 0; i < 3; i++)
+    {
+        reboot();
+        hashedBytes = 0;
+        CHECK(readImage(size, 0x1234, 0));
+        CHECK(hashedBytes == 0x200 && cacheFileWrites == writes + 1);
+    }
+
+    // No stamp: always hashed, never recorded
+    hashedBytes = 0;
+    CHECK(readImage(size, 0, 0));
+    CHECK(hashedBytes == size && cacheFileWrites == writes + 1);
+
+    // Another stamp for the same contents: the file changed on the card, hashed again
+    hashedBytes = 0;
+    CHECK(readImage(size, 0x5678, 0));
+    CHECK(hashedBytes == size);
+
+    // A section changed along with its hash in the header: another key, hashed again
+    image[0x200] ^= 1;
+    hashSection(&((Firm *)image)->section[0]);
+    hashedBytes = 0;
+    CHECK(readImage(size, 0x1234, 0));
+    CHECK(hashedBytes == size);
+
+    // A section changed behind the header's back, in a file with a new stamp, is caught
+    image[0x200] ^= 1;
+    CHECK(!readImage(size, 0x9ABC, 0));
+
+    // Nor is a failed check remembered
+    CHECK(!readImage(size, 0x9ABC, 0));
+    image[0x200] ^= 1;
+
+    // Damaged cache files are dropped
+    for(u32 i = 0; i < 3; i++)
+    {
+        if(i == 0) cacheFileSize = 7;
+        else if(i == 1) ((FirmCheckCache *)cacheFile)->magic ^= 1;
+        else ((FirmCheckCache *)cacheFile)->entryNum = FIRM_CHECK_CACHE_ENTRIES + 1;
+
+        reboot();
+        hashedBytes = 0;
+        CHECK(readImage(size, 0x1111 + i, 0));
+        CHECK(hashedBytes == size);
+        CHECK(cacheFileSize == sizeof(cacheFile) && ((FirmCheckCache *)cacheFile)->entryNum == 1);
+    }
+}
+
+// Least recently used images go first, and the file is left alone while the same image keeps booting
+static void checkCacheEviction(void)
+{
+    static u8 images[FIRM_CHECK_CACHE_ENTRIES + 1][MAX_IMAGE_SIZE];
+    u32 sizes[FIRM_CHECK_CACHE_ENTRIES + 1];
+
+    cacheFileSize = 0;
+    reboot();
+
+    for(u32 i = 0; i <= FIRM_CHECK_CACHE_ENTRIES; i++)
+    {
+        sizes[i] = buildImage(1, false);
+        memcpy(images[i], image, sizes[i]);
+    }
+
+    for(u32 i = 0; i < FIRM_CHECK_CACHE_ENTRIES; i++)
+    {
+        memcpy(image, images[i], sizes[i]);
+        CHECK(readImage(sizes[i], 0x100 + i, 0));
+    }
+
+    // Use the first one again, then bring in a new one: the second one is evicted
+    memcpy(image, images[0], sizes[0]);
+    hashedBytes = 0;
+    CHECK(readImage(sizes[0], 0x100, 0));
+    CHECK(hashedBytes == 0x200);
+
+    u32 writes = cacheFileWrites;
+    reboot();
+    CHECK(readImage(sizes[0], 0x100, 0));
+    CHECK(cacheFileWrites == writes);
+
+    memcpy(image, images[FIRM_CHECK_CACHE_ENTRIES], sizes[FIRM_CHECK_CACHE_ENTRIES]);
+    CHECK(readImage(sizes[FIRM_CHECK_CACHE_ENTRIES], 0x100 + FIRM_CHECK_CACHE_ENTRIES, 0));
+
+    reboot();
+    for(u32 i = FIRM_CHECK_CACHE_ENTRIES; i > 1; i--)
+    {
+        u32 j = i == FIRM_CHECK_CACHE_ENTRIES ? 0 : i;
+        memcpy(image, images[j], sizes[j]);
+        hashedBytes = 0;
+        CHECK(readImage(sizes[j], 0x100 + j, 0));
+        CHECK(hashedBytes == 0x200);
+    }
+
+    memcpy(image, images[1], sizes[1]);
+    hashedBytes = 0;
+    CHECK(readImage(sizes[1], 0x101, 0));
+    CHECK(hashedBytes == sizes[1]);
+}
+
+static double secondsSince(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void benchmark(void)
+{
+    struct timespec start;
+    u32 size = 0;
+
+    // A payload-sized image
+    while(size < 0x40000)
+        size = buildImage(4, false);
+
+    cacheFileSize = 0;
+    reboot();
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CHECK(readImage(size, 0x1234, 0x20000));
+    double cold = secondsSince(&start);
+
+    reboot();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CHECK(readImage(size, 0x1234, 0x20000));
+    double cached = secondsSince(&start);
+
+    printf("firmcheck: %lu KB image, %.1f us hashing its sections, %.1f us with the image cached (host, %s)\n",
+           (unsigned long)size / 1024, cold * 1e6, cached * 1e6, CHECK_BUILD_FLAGS);
+}
+
+int main(void)
+{
+    checkSha256();
+    checkStreaming();
+    checkUnusualLayouts();
+    checkCache();
+    checkCacheEviction();
+    benchmark();
+    return 0;
+}
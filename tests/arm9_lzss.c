@@ -0,0 +1,306 @@
+// arm9: backwards LZSS decompressor, checked bit-exact against the routine it replaced.
+// The streams come from the encoder below, laid out in place the way KIP code is.
+
+#include <time.h>
+#include "check.h"
+
+#include "../arm9/source/lzss.c"
+
+// The previous decompressor (decompiler output), as the reference.
+// The two negated offsets are cast to int, they relied on 32-bit pointer wraparound.
+static int lzssDecompressReference(u8 *end)
+{
+    unsigned int v1; // r1@2
+    u8 *v2; // r2@2
+    u8 *v3; // r3@2
+    u8 *v4; // r1@2
+    char v5; // r5@4
+    char v6; // t1@4
+    signed int v7; // r6@4
+    int v9; // t1@7
+    u8 *v11; // r3@8
+    int v12; // r12@8
+    int v13; // t1@8
+    int v14; // t1@8
+    unsigned int v15; // r7@8
+    int v16; // r12@8
+    int ret;
+
+    ret = 0;
+    if ( end )
+    {
+        v1 = *((u32 *)end - 2);
+        v2 = &end[*((u32 *)end - 1)];
+        v3 = &end[-(int)(v1 >> 24)];
+        v4 = &end[-(int)(v1 & 0xFFFFFF)];
+        while ( v3 > v4 )
+        {
+            v6 = *(v3-- - 1);
+            v5 = v6;
+            v7 = 8;
+            while ( 1 )
+            {
+                if ( (v7-- < 1) )
+                    break;
+                if ( v5 & 0x80 )
+                {
+                    v13 = *(v3 - 1);
+                    v11 = v3 - 1;
+                    v12 = v13;
+                    v14 = *(v11 - 1);
+                    v3 = v11 - 1;
+                    v15 = ((v14 | (v12 << 8)) & 0xFFFF0FFF) + 2;
+                    v16 = v12 + 32;
+                    do
+                    {
+                        ret = v2[v15];
+                        *(v2-- - 1) = ret;
+                        v16 -= 16;
+                    }
+                    while ( !(v16 < 0) );
+                }
+                else
+                {
+                    v9 = *(v3-- - 1);
+                    ret = v9;
+                    *(v2-- - 1) = v9;
+                }
+                v5 *= 2;
+                if ( v3 <= v4 )
+                    return ret;
+            }
+        }
+    }
+    return ret;
+}
+
+
+#define MIN_LEN     3
+#define MAX_LEN     18
+#define MIN_DISP    3
+#define MAX_DISP    (0xFFF + 3)
+
+static u8 stream[(1 << 21) * 9 / 8 + 16];
+static u32 itemEnd[1 << 21], itemCovered[1 << 21];
+
+// Forward LZSS over the reversed data, so that the stream decodes from the end of the input backwards.
+// For each item, records how many stream bytes and input bytes have been used once it's done.
+static u32 encodeReversed(const u8 *data, u32 size)
+{
+    static s32 head[0x10000], prev[1 << 21];
+    u32 pos = 0, n = 0, nbItems = 0;
+
+    memset(head, 0xFF, sizeof(head));
+    CHECK(size <= sizeof(prev) / sizeof(prev[0]));
+
+    #define REV(i) data[size - 1 - (i)]
+    #define HASH(i) ((REV(i) << 8 ^ REV((i) + 1) << 4 ^ REV((i) + 2)) & 0xFFFF)
+
+    while(pos < size)
+    {
+        u32 flagsPos = n++;
+        stream[flagsPos] = 0;
+
+        for(u32 item = 0; item < 8 && pos < size; item++)
+        {
+            u32 bestLen = 0, bestDisp = 0;
+
+            if(pos + MIN_LEN <= size)
+            {
+                u32 chain = 0;
+                for(s32 cand = head[HASH(pos)]; cand != -1 && pos - cand <= MAX_DISP && chain < 256; cand = prev[cand], chain++)
+                {
+                    u32 disp = pos - cand, len = 0;
+                    if(disp < MIN_DISP)
+                        continue;
+                    while(len < MAX_LEN && pos + len < size && REV(cand + len) == REV(pos + len))
+                        len++;
+                    if(len > bestLen)
+                    {
+                        bestLen = len;
+                        bestDisp = disp;
+                    }
+                }
+            }
+
+            u32 step = bestLen >= MIN_LEN ? bestLen : 1;
+            if(bestLen >= MIN_LEN)
+            {
+                stream[flagsPos] |= 0x80 >> item;
+                stream[n++] = (u8)((bestLen - MIN_LEN) << 4 | (bestDisp - MIN_DISP) >> 8);
+                stream[n++] = (u8)(bestDisp - MIN_DISP);
+            }
+            else
+                stream[n++] = REV(pos);
+
+            for(u32 i = 0; i < step; i++, pos++)
+            {
+                if(pos + MIN_LEN <= size)
+                {
+                    prev[pos] = head[HASH(pos)];
+                    head[HASH(pos)] = pos;
+                }
+            }
+
+            itemEnd[nbItems] = n;
+            itemCovered[nbItems++] = pos;
+        }
+    }
+
+    #undef HASH
+    #undef REV
+
+    return nbItems;
+}
+
+// Builds the in-place layout: raw prefix, reversed stream, padding up to a word boundary, footer.
+// Only the end of the data is compressed, as far as it can be without the output overwriting
+// compressed bytes that haven't been read yet. With tightest, that limit is used as is, otherwise
+// a shorter compressed part is picked at random. Returns 0 when the data can't be laid out in place.
+static u32 buildBlob(u8 *blob, const u8 *data, u32 size, bool tightest)
+{
+    u32 nbItems = encodeReversed(data, size);
+    u32 nbValid = 0, cut = 0;
+    s32 maxDistance = INT32_MIN;
+
+    // When cutting after item k, the output starts covered - bytes ahead of the input. After item j,
+    // it's still (covered(k) - bytes(k)) - (covered(j) - bytes(j)) ahead, which must not be negative
+    for(u32 k = 0; k < nbItems; k++)
+    {
+        s32 distance = (s32)(itemCovered[k] - itemEnd[k]);
+        if(distance < maxDistance)
+            continue;
+
+        maxDistance = distance;
+        s32 padding = (4 - (size - itemCovered[k] + itemEnd[k]) % 4) % 4;
+        if(distance >= 8 + padding)
+        {
+            nbValid++;
+            if(tightest || checkRand() % nbValid == 0)
+                cut = k + 1;
+        }
+    }
+
+    if(cut == 0)
+        return 0;
+
+    u32 streamSize = itemEnd[cut - 1];
+    u32 prefix = size - itemCovered[cut - 1];
+    u32 padding = (4 - (prefix + streamSize) % 4) % 4;
+    u32 headerSize = 8 + padding;
+    u32 blobSize = prefix + streamSize + headerSize;
+
+    memcpy(blob, data, prefix);
+    for(u32 i = 0; i < streamSize; i++)
+        blob[prefix + i] = stream[streamSize - 1 - i];
+    memset(blob + prefix + streamSize, 0xFF, padding);
+
+    u32 footer[2] = { headerSize << 24 | (streamSize + headerSize), size - blobSize };
+    memcpy(blob + blobSize - 8, footer, 8);
+    return blobSize;
+}
+
+// Code-like data: literals, short repeats, long runs, with a tunable mix
+static void generate(u8 *data, u32 size, u32 literalPercent)
+{
+    u32 pos = 0;
+
+    while(pos < size)
+    {
+        u32 r = checkRand();
+        if(r % 100 < literalPercent || pos < 16)
+        {
+            // Sometimes long enough for whole groups of literals
+            u32 len = r % 5 == 0 ? 1 + (r >> 24) % 24 : 1;
+            for(u32 i = 0; i < len && pos < size; i++)
+                data[pos++] = (u8)checkRand();
+        }
+        else if(r % 7 == 0)
+        {
+            u32 len = 1 + (r >> 8) % 64;
+            for(u32 i = 0; i < len && pos < size; i++)
+                data[pos++] = (u8)(r >> 16);
+        }
+        else
+        {
+            u32 disp = 1 + (r >> 8) % (pos < 5000 ? pos : 5000);
+            u32 len = 1 + (r >> 20) % 40;
+            for(u32 i = 0; i < len && pos < size; i++, pos++)
+                data[pos] = data[pos - disp];
+        }
+    }
+}
+
+static bool checkStream(const u8 *data, u32 size)
+{
+    u8 *ref = malloc(size), *blob = malloc(size);
+    u32 blobSize = buildBlob(blob, data, size, checkRand() % 2 == 0);
+
+    if(blobSize != 0)
+    {
+        memcpy(ref, blob, blobSize);
+        lzssDecompressReference(ref + blobSize);
+        lzss_decompress(blob + blobSize);
+
+        CHECK(memcmp(ref, data, size) == 0);
+        CHECK(memcmp(blob, data, size) == 0);
+    }
+
+    free(ref);
+    free(blob);
+    return blobSize != 0;
+}
+
+// Best of 20 runs, the others are mostly scheduling noise. Only the decompression itself is timed.
+static double benchmark(int (*refFunc)(u8 *), void (*func)(u8 *), const u8 *blob, u32 blobSize, u8 *buf, u32 size)
+{
+    double best = 0.0;
+
+    for(u32 run = 0; run < 20; run++)
+    {
+        struct timespec t1, t2;
+        memcpy(buf, blob, blobSize);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        if(refFunc != NULL)
+            refFunc(buf + blobSize);
+        else
+            func(buf + blobSize);
+        clock_gettime(CLOCK_MONOTONIC, &t2);
+
+        double seconds = (t2.tv_sec - t1.tv_sec) + (t2.tv_nsec - t1.tv_nsec) / 1e9;
+        if(size / seconds > best)
+            best = size / seconds;
+    }
+
+    return best / (1024 * 1024);
+}
+
+int main(void)
+{
+    static u8 data[sizeof(itemEnd) / sizeof(itemEnd[0])];
+    u32 nbChecked = 0;
+
+    for(u32 i = 0; i < 3000; i++)
+    {
+        u32 size = 16 + checkRand() % (i < 2500 ? 2048 : 65536);
+        generate(data, size, checkRand() % 60);
+        if(checkStream(data, size))
+            nbChecked++;
+    }
+    CHECK(nbChecked > 2500);
+
+    // A stream the size of a large KIP, also used for the throughput figures
+    u32 size = sizeof(data);
+    u8 *blob = malloc(size), *buf = malloc(size);
+    generate(data, size, 20);
+    u32 blobSize = buildBlob(blob, data, size, true);
+    CHECK(blobSize != 0 && checkStream(data, size));
+
+    double refSpeed = benchmark(lzssDecompressReference, NULL, blob, blobSize, buf, size);
+    double speed = benchmark(NULL, lzss_decompress, blob, blobSize, buf, size);
+    printf("lzss: %u -> %u bytes, previous %.1f MB/s, current %.1f MB/s (host, %s)\n", blobSize, size, refSpeed, speed, CHECK_BUILD_FLAGS);
+
+    free(blob);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,499 @@
+// arm9: FIRM patch functions, run over synthetic FIRM sections and compared against golden images.
+// The sections are random filler with the code each patch looks for planted at known offsets; the
+// golden images are the same sections with the expected edits written by hand from the instruction
+// encodings. Given files on the command line, it runs the section patches over real decrypted
+// section images instead, and compares the result to an optional golden image:
+//   build/arm9_patches <section.bin> [golden.bin]
+
+#define VERSION_MAJOR   13
+#define VERSION_MINOR   0
+#define VERSION_BUILD   0
+#define ISRELEASE       0
+#define COMMIT_HASH     0x12345678
+
+#include <time.h>
+
+#include "check.h"
+
+#include "../arm9/source/types.h"
+
+static u8 unitInfo;
+#undef CFG_UNITINFO
+#define CFG_UNITINFO unitInfo
+
+// The patches handle addresses as u32. The sections are allocated so that they don't cross a 4GB
+// boundary, which keeps the differences between two truncated pointers right
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpointer-to-int-cast"
+#pragma GCC diagnostic ignored "-Wint-to-pointer-cast"
+#include "../arm9/source/patches.c"
+#pragma GCC diagnostic pop
+#include "../arm9/source/memory.c"
+
+u16 launchedPath[80+1];
+u32 firmProtoVersion;
+CfgData configData;
+u32 arm9ExceptionHandlerSvcBreakAddress;
+bool isSdMode;
+
+const u8 rebootPatch[0x80] = { 0xDE, 0xAD, 0xBE, 0xEF };
+const u32 rebootPatchSize = sizeof(rebootPatch);
+u32 rebootPatchFopenPtr;
+u16 rebootPatchFileName[80+1];
+
+// Only reached through the patches that this check doesn't run (K11 extension, DSi filter)
+void error(const char *fmt, ...) { (void)fmt; abort(); }
+u32 fileRead(void *dest, const char *path, u32 maxSize) { (void)dest; (void)path; (void)maxSize; abort(); }
+
+#define SECTION_SIZE        0x80000
+#define PROCESS9_ADDRESS    0x08028000
+#define KERNEL9_ADDRESS     0x08006000
+#define FIRM_VERSION        0x50
+
+typedef struct Patch
+{
+    const char *name;
+    u32 (*run)(u8 *pos, u32 size);
+    bool fixedAddresses;    // Needs the section's load address, which a file doesn't give
+} Patch;
+
+static u32 firmVersion = FIRM_VERSION;
+
+static u32 runTitleInstallMinVersionChecks(u8 *pos, u32 size) { return patchTitleInstallMinVersionChecks(pos, size, firmVersion); }
+static u32 runP9AMTicketWrapperZeroKeyIV(u8 *pos, u32 size) { return patchP9AMTicketWrapperZeroKeyIV(pos, size, firmVersion); }
+static u32 runTwlFlashcartChecks(u8 *pos, u32 size) { return patchTwlFlashcartChecks(pos, size, firmVersion); }
+static u32 runFirmlaunches(u8 *pos, u32 size) { return patchFirmlaunches(pos, size, PROCESS9_ADDRESS); }
+static u32 runSvcBreak9(u8 *pos, u32 size) { return patchSvcBreak9(pos, size, KERNEL9_ADDRESS); }
+static u32 runK11ModuleLoadingLgy(u8 *pos, u32 size) { return patchK11ModuleLoadingLgy(0x140000, pos, size); }
+static u32 runLgyK11(u8 *pos, u32 size) { return patchLgyK11(pos, size / 2, pos + size / 2, size / 2); }
+
+#define PATCH(fn)       { #fn, fn, false }
+#define PATCH_RUN(fn)   { "patch" #fn, run##fn, false }
+
+static const Patch patches[] = {
+    PATCH(patchSignatureChecks),
+    PATCH(patchOldSignatureChecks),
+    { "patchFirmlaunches", runFirmlaunches, true },
+    PATCH(patchFirmWrites),
+    PATCH(patchOldFirmWrites),
+    PATCH_RUN(TitleInstallMinVersionChecks),
+    PATCH(patchZeroKeyNcchEncryptionCheck),
+    PATCH(patchNandNcchEncryptionCheck),
+    PATCH(patchCheckForDevCommonKey),
+    PATCH(patchKernel9Panic),
+    { "patchSvcBreak9", runSvcBreak9, true },
+    PATCH(patchP9AccessChecks),
+    PATCH(patchUnitInfoValueSet),
+    PATCH_RUN(P9AMTicketWrapperZeroKeyIV),
+    PATCH(patchLgySignatureChecks),
+    PATCH(patchTwlInvalidSignatureChecks),
+    PATCH(patchTwlNintendoLogoChecks),
+    PATCH(patchTwlWhitelistChecks),
+    PATCH_RUN(TwlFlashcartChecks),
+    PATCH(patchTwlShaHashChecks),
+    PATCH(patchAgbBootSplash),
+    { "patchK11ModuleLoadingLgy", runK11ModuleLoadingLgy, false },
+    { "patchLgyK11", runLgyK11, false },
+    PATCH(patchProtoNandSignatureCheck),
+};
+
+#define NB_PATCHES (sizeof(patches) / sizeof(patches[0]))
+
+static const Patch *findPatch(const char *name)
+{
+    for(u32 i = 0; i < NB_PATCHES; i++)
+    {
+        if(strcmp(patches[i].name, name) == 0)
+            return &patches[i];
+    }
+
+    abort();
+}
+
+static u64 nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static u8 *allocSection(u32 size)
+{
+    // 1MB alignment: a 4GB boundary is also a 1MB boundary
+    void *section;
+    CHECK(posix_memalign(&section, 0x100000, size) == 0);
+    return section;
+}
+
+static u8 filler[SECTION_SIZE];
+
+typedef struct Image
+{
+    const char *name;
+    u8 *section, *golden;
+} Image;
+
+static void imageInit(Image *img, const char *name)
+{
+    img->name = name;
+    img->section = allocSection(SECTION_SIZE);
+    img->golden = allocSection(SECTION_SIZE);
+    memcpy(img->section, filler, SECTION_SIZE);
+    memcpy(img->golden, filler, SECTION_SIZE);
+}
+
+// What the patch looks for, in both the section and the golden image
+static void plant(Image *img, u32 offset, const void *data, u32 size)
+{
+    memcpy(img->section + offset, data, size);
+    memcpy(img->golden + offset, data, size);
+}
+
+static void plant32(Image *img, u32 offset, u32 val)
+{
+    plant(img, offset, &val, 4);
+}
+
+// What the patch must have written
+static void expect(Image *img, u32 offset, const void *data, u32 size)
+{
+    memcpy(img->golden + offset, data, size);
+}
+
+static void expect32(Image *img, u32 offset, u32 val)
+{
+    expect(img, offset, &val, 4);
+}
+
+static u32 nbHits;
+static u64 totalNs, slowestNs;
+static const char *slowestName;
+
+static void runPatches(Image *img, const char *const *names, u32 nbNames)
+{
+    for(u32 i = 0; i < nbNames; i++)
+    {
+        const Patch *patch = findPatch(names[i]);
+        u64 start = nowNs();
+        u32 ret = patch->run(img->section, SECTION_SIZE);
+        u64 ns = nowNs() - start;
+
+        if(ret != 0)
+        {
+            fprintf(stderr, "%s: %s missed (%u)\n", img->name, patch->name, ret);
+            CHECK(ret == 0);
+        }
+        nbHits++;
+        totalNs += ns;
+        if(ns > slowestNs)
+        {
+            slowestNs = ns;
+            slowestName = patch->name;
+        }
+    }
+
+    for(u32 i = 0; i < SECTION_SIZE; i++)
+    {
+        if(img->section[i] != img->golden[i])
+        {
+            fprintf(stderr, "%s: differs from the golden image at 0x%x\n", img->name, i);
+            CHECK(false);
+        }
+    }
+
+    free(img->section);
+    free(img->golden);
+}
+
+#define RUN_PATCHES(img, ...) do\
+{\
+    static const char *const names[] = { __VA_ARGS__ };\
+    runPatches(img, names, sizeof(names) / sizeof(names[0]));\
+} while(0)
+
+static void checkNativeProcess9(void)
+{
+    Image img;
+    imageInit(&img, "NATIVE_FIRM Process9");
+
+    // Signature checks, the function is found by its push {r4-r7, lr}; sub sp, ...
+    plant(&img, 0x1000, "\xC0\x1C\x76\xE7", 4);
+    expect(&img, 0x1000, "\x00\x20", 2);                        // movs r0, #0
+    plant(&img, 0x2001, "\xB5\x22\x4D\x0C", 4);
+    expect(&img, 0x2000, "\x00\x20\x70\x47", 4);                // movs r0, #0; bx lr
+
+    // FIRM writes, the check is before the "exe:" string
+    plant(&img, 0x3000, "exe:", 4);
+    plant(&img, 0x3000 - 0x80, "\x00\x28\x01\xDA", 4);
+    expect(&img, 0x3000 - 0x80, "\x00\x20\xC0\x46", 4);         // movs r0, #0; nop
+
+    plant(&img, 0x4000, "\xFF\x00\x00\x02\x01\x02\x03\x04\x05\x06\x07\x08", 12);
+    expect(&img, 0x4001, "\0\0\0\0\0\0\0\0", 8);                // First title ID in the list
+
+    plant(&img, 0x5001, "\x28\x2A\xD0\x08", 4);
+    expect(&img, 0x5000, "\x01\x20", 2);                        // movs r0, #1
+    plant(&img, 0x5100, "\x07\xD1\x28\x7A", 4);
+    expect(&img, 0x50FE, "\x01\x20", 2);                        // movs r0, #1
+    plant(&img, 0x5200, "\x03\x7C\x28\x00", 4);
+    expect(&img, 0x5200, "\x01\x23", 2);                        // movs r3, #1
+    plant(&img, 0x5303, "\x00\x08\x49\x68", 4);
+    expect(&img, 0x5300, "\x01\x20\x70\x47", 4);                // movs r0, #1; bx lr
+
+    // The ticket wrapper's bl is turned into a blx to __rt_memclr, 0x1006 bytes before it
+    plant(&img, 0x6000, "\x00\x20\xA0\xE3\x04\x00\x51\xE3\x07\x00\x00\x3A", 12);
+    plant(&img, 0x7000, "\x20\x21\xA6\xA8", 4);
+    expect(&img, 0x7004, "\xFE\xF7\xFC\xEF", 4);                // blx 0x6000
+
+    // Firmlaunch: the code at the pattern - 0x13 starts with a bl to fOpen, 0x400 bytes before it
+    plant(&img, 0x8013, "\xE2\x20\x20\x90", 4);
+    plant32(&img, 0x8000, 0xEBFFFF00);
+    expect(&img, 0x8000, rebootPatch, sizeof(rebootPatch));
+
+    RUN_PATCHES(&img, "patchSignatureChecks", "patchFirmWrites", "patchTitleInstallMinVersionChecks",
+                "patchZeroKeyNcchEncryptionCheck", "patchNandNcchEncryptionCheck", "patchCheckForDevCommonKey",
+                "patchP9AccessChecks", "patchP9AMTicketWrapperZeroKeyIV", "patchFirmlaunches");
+
+    // bl target, with the Thumb bit set
+    CHECK(rebootPatchFopenPtr == PROCESS9_ADDRESS + 0x8000 + 8 - 0x400 + 1);
+    CHECK(memcmp(rebootPatchFileName, launchedPath, sizeof(launchedPath)) == 0);
+}
+
+static void checkNativeKernel9(void)
+{
+    Image img;
+    imageInit(&img, "NATIVE_FIRM Kernel9");
+
+    plant(&img, 0x1034, "\x00\x20\x92\x15", 4);
+    expect32(&img, 0x1000, 0xE12FFF7E);                         // bkpt 0xFFFE
+
+    // The SVC table follows the handler; svcBreak is entry 0x3C
+    plant(&img, 0x2000, "\x00\xE0\x4F\xE1", 4);
+    plant32(&img, 0x2004, 0xE92D5000);
+    plant32(&img, 0x2008, 0);
+    for(u32 i = 1; i < 0x80; i++)
+        plant32(&img, 0x2008 + 4 * i, KERNEL9_ADDRESS + 0x100 * i);
+    expect32(&img, 0x3C00, 0xE1A0800D);                         // mov r8, sp
+    expect32(&img, 0x3C04, 0xE12FFF7F);                         // bkpt 0xFFFF
+
+    plant(&img, 0x4000, "\x01\x10\xA0\x13", 4);
+    expect(&img, 0x4000, "\x01\x10\xA0\xE3", 4);                // mov r1, #1, on a retail unit
+
+    RUN_PATCHES(&img, "patchKernel9Panic", "patchSvcBreak9", "patchUnitInfoValueSet");
+
+    CHECK(arm9ExceptionHandlerSvcBreakAddress == KERNEL9_ADDRESS + 0x3C00);
+}
+
+static void checkOldProcess9(void)
+{
+    Image img;
+    imageInit(&img, "1.x-2.x NATIVE_FIRM Process9");
+
+    plant(&img, 0x1000, "\xC0\x1C\xBD\xE7", 4);
+    expect(&img, 0x1000, "\x00\x20", 2);                        // movs r0, #0
+    plant(&img, 0x2001, "\xB5\x23\x4E\x0C", 4);
+    expect(&img, 0x2000, "\x00\x20\x70\x47", 4);                // movs r0, #0; bx lr
+    plant(&img, 0x3000, "\x04\x1E\x1D\xDB", 4);
+    expect(&img, 0x3000, "\x00\x24\x1D\xE0", 4);                // movs r4, #0; b
+
+    RUN_PATCHES(&img, "patchOldSignatureChecks", "patchOldFirmWrites");
+}
+
+static void checkTwlProcess9(void)
+{
+    Image img;
+    imageInit(&img, "TWL_FIRM Process9");
+
+    plant(&img, 0x1001, "\x47\xC1\x17\x49", 4);
+    expect(&img, 0x1002, "\x00\x20\x4E\xB0\x70\xBD", 6);        // movs r0, #0; add sp, #0x138; pop {r4-r6, pc}
+    plant(&img, 0x2001, "\x20\xF6\xE7\x7F", 4);
+    expect(&img, 0x2000, "\x01\x20", 2);                        // movs r0, #1
+    plant(&img, 0x3000, "\xC0\x30\x06\xF0", 4);
+    expect(&img, 0x3002, "\x00\x20\x00\x00", 4);                // movs r0, #0; nop
+    plant(&img, 0x4000, "\x22\x00\x20\x30", 4);
+    expect(&img, 0x4004, "\x00\x20\x00\x00", 4);                // movs r0, #0; nop
+    plant(&img, 0x5001, "\x25\x20\x00\x0E", 4);
+    expect(&img, 0x5004, "\x01\x20\x00\x00", 4);                // movs r0, #1; nop, three times
+    expect(&img, 0x5010, "\x01\x20\x00\x00", 4);
+    expect(&img, 0x501C, "\x01\x20\x00\x00", 4);
+    plant(&img, 0x6000, "\x10\xB5\x14\x22", 4);
+    expect(&img, 0x6000, "\x01\x20\x70\x47", 4);                // movs r0, #1; bx lr
+
+    RUN_PATCHES(&img, "patchLgySignatureChecks", "patchTwlInvalidSignatureChecks", "patchTwlNintendoLogoChecks",
+                "patchTwlWhitelistChecks", "patchTwlFlashcartChecks", "patchTwlShaHashChecks");
+
+    // Older TWL_FIRMs only have two flashcart checks
+    imageInit(&img, "old TWL_FIRM Process9");
+    plant(&img, 0x1000, "\x06\xF0\xA0\xFD", 4);
+    expect(&img, 0x1000, "\x01\x20\x00\x00", 4);
+    expect(&img, 0x100C, "\x01\x20\x00\x00", 4);
+
+    firmVersion = 0xFFFFFFFF;
+    RUN_PATCHES(&img, "patchTwlFlashcartChecks", "patchTitleInstallMinVersionChecks", "patchP9AMTicketWrapperZeroKeyIV");
+    firmVersion = FIRM_VERSION;
+}
+
+static void checkLegacyFirm(void)
+{
+    Image img;
+    imageInit(&img, "AGB_FIRM Process9");
+
+    plant(&img, 0x1001, "\x47\xC1\x17\x49", 4);
+    expect(&img, 0x1002, "\x00\x20\x4E\xB0\x70\xBD", 6);
+    plant(&img, 0x2000, "\x00\x00\x01\xEF", 4);
+    expect(&img, 0x2000, "\x00\x00\x26\xEF", 4);                // svc 0x26 instead of 0x01
+
+    RUN_PATCHES(&img, "patchLgySignatureChecks", "patchAgbBootSplash");
+
+    // TwlBg/AgbBg copy, the section size is both an immediate and a literal further down
+    imageInit(&img, "legacy K11 module loading");
+    plant(&img, 0x1002, "\xC9\x06\x00\x06", 4);
+    plant32(&img, 0x1010, 0x128000);
+    expect32(&img, 0x1010, 0x140000);
+    plant32(&img, 0x1054, 0x128000);
+    expect32(&img, 0x1054, 0x140000);
+
+    RUN_PATCHES(&img, "patchK11ModuleLoadingLgy");
+
+    // Legacy K11, section 1 in the first half and section 2 in the second one
+    imageInit(&img, "legacy K11");
+    plant32(&img, 0x1000, 0xE0100000);
+    plant32(&img, 0x1004, 0x00000E36);
+    expect32(&img, 0x1004, 0x00000C36);                         // APX=0, AP=3, XN=0
+    plant32(&img, SECTION_SIZE / 2 + 0x1000, 0x0100021F);
+    expect32(&img, SECTION_SIZE / 2 + 0x1004, 0xFFFF0F00);
+    expect32(&img, SECTION_SIZE / 2 + 0x1008, 0xFFFF0F04);
+    plant(&img, SECTION_SIZE / 2 + 0x2000, "\x1F\xDB\x15\x49", 4);
+    expect(&img, SECTION_SIZE / 2 + 0x2000, "\x1A\xE0", 2);    // b +0x38
+
+    RUN_PATCHES(&img, "patchLgyK11");
+}
+
+static void checkProtoProcess9(void)
+{
+    Image img;
+    imageInit(&img, "prototype NATIVE_FIRM Process9");
+
+    plant(&img, 0x1000, "\x08\x31\x9F\xE5", 4);
+    expect(&img, 0x1020, "\x02", 1);
+
+    firmProtoVersion = 243;
+    RUN_PATCHES(&img, "patchProtoNandSignatureCheck");
+    firmProtoVersion = 0;
+}
+
+// Nothing to find: every patch must report it and leave the section alone
+static void checkMisses(void)
+{
+    u8 *section = allocSection(SECTION_SIZE);
+
+    firmProtoVersion = 243;
+    for(u32 i = 0; i < NB_PATCHES; i++)
+    {
+        memcpy(section, filler, SECTION_SIZE);
+        CHECK(patches[i].run(section, SECTION_SIZE) != 0);
+        CHECK(memcmp(section, filler, SECTION_SIZE) == 0);
+    }
+    firmProtoVersion = 0;
+
+    free(section);
+}
+
+// The patches that scan by hand instead of with memsearch must not read past the section
+static void checkSectionEnds(void)
+{
+    u8 *section = allocSection(SECTION_SIZE);
+
+    // A first halfword that matches in the last halfword of the section
+    memcpy(section, filler, SECTION_SIZE);
+    memcpy(section + SECTION_SIZE - 2, "\xC9\x06", 2);
+    CHECK(patchK11ModuleLoadingLgy(0x140000, section, SECTION_SIZE) != 0);
+
+    // Section 1 found, nothing in section 2
+    memcpy(section, filler, SECTION_SIZE);
+    memcpy(section + 0x1000, "\x00\x00\x10\xE0", 4);
+    CHECK(patchLgyK11(section, SECTION_SIZE / 2, section + SECTION_SIZE / 2, SECTION_SIZE / 2) != 0);
+
+    free(section);
+}
+
+static u8 *readFile(const char *path, u32 *size)
+{
+    FILE *f = fopen(path, "rb");
+    CHECK(f != NULL);
+    fseek(f, 0, SEEK_END);
+    *size = (u32)ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    u8 *data = allocSection(*size);
+    CHECK(fread(data, 1, *size, f) == *size);
+    fclose(f);
+
+    return data;
+}
+
+static int patchFile(const char *path, const char *goldenPath)
+{
+    u32 size;
+    u8 *section = readFile(path, &size);
+    u64 total = 0;
+
+    for(u32 i = 0; i < NB_PATCHES; i++)
+    {
+        if(patches[i].fixedAddresses)
+            continue;
+
+        u64 start = nowNs();
+        u32 ret = patches[i].run(section, size);
+        u64 ns = nowNs() - start;
+        total += ns;
+        printf("%-36s %-4s %8.1f us\n", patches[i].name, ret == 0 ? "hit" : "miss", ns / 1000.0);
+    }
+    printf("total %.1f us\n", total / 1000.0);
+
+    int ret = 0;
+    if(goldenPath != NULL)
+    {
+        u32 goldenSize;
+        u8 *golden = readFile(goldenPath, &goldenSize);
+        CHECK(goldenSize == size);
+        for(u32 i = 0; i < size && ret == 0; i++)
+        {
+            if(section[i] != golden[i])
+            {
+                printf("differs from %s at 0x%x\n", goldenPath, i);
+                ret = 1;
+            }
+        }
+        free(golden);
+    }
+
+    free(section);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    static const char path[] = "sdmc:/luma/payloads/firm.firm";
+    for(u32 i = 0; i < sizeof(path); i++)
+        launchedPath[i] = path[i];
+
+    if(argc > 1)
+        return patchFile(argv[1], argc > 2 ? argv[2] : NULL);
+
+    for(u32 i = 0; i < SECTION_SIZE; i++)
+        filler[i] = (u8)checkRand();
+
+    checkMisses();
+    checkSectionEnds();
+    checkNativeProcess9();
+    checkNativeKernel9();
+    checkOldProcess9();
+    checkTwlProcess9();
+    checkLegacyFirm();
+    checkProtoProcess9();
+
+    printf("patches: %u hits, %.1f us in total, slowest %s (%.1f us) (host, %s)\n",
+           nbHits, totalNs / 1000.0, slowestName, slowestNs / 1000.0, CHECK_BUILD_FLAGS);
+
+    return 0;
+}
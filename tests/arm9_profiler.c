@@ -0,0 +1,177 @@
+// arm9: boot timeline profiler, checked by simulating many boots and aggregating the log they leave
+
+#define BUILD_FOR_BOOT_PROFILING
+
+#include "check.h"
+
+#include "../arm9/source/profiler.c"
+
+static u64 ticks;
+static char logFile[PROFILE_LOG_MAX_SIZE];
+static u32 logSize, nbRestarts;
+
+void startChrono(void) {}
+u64 chronoTicks(void) { return ticks; }
+u32 getFileSize(const char *path) { CHECK(strcmp(path, PROFILE_LOG_PATH) == 0); return logSize; }
+bool fileDelete(const char *path) { CHECK(strcmp(path, PROFILE_LOG_PATH) == 0); logSize = 0; nbRestarts++; return true; }
+void disk_get_cache_stats(DISKCACHESTATS *stats) { memset(stats, 0, sizeof(DISKCACHESTATS)); stats->hits[1] = 42; }
+
+bool fileWriteAt(const void *buffer, const char *path, u32 offset, u32 size)
+{
+    CHECK(strcmp(path, PROFILE_LOG_PATH) == 0);
+    CHECK(offset == logSize && offset + size <= sizeof(logFile));
+    memcpy(logFile + offset, buffer, size);
+    logSize += size;
+    return true;
+}
+
+static u32 fakePatch(u32 a, u32 b)
+{
+    ticks += TICKS_PER_SEC / 1000;
+    return a + b;
+}
+
+static const char *phaseNames[] = { "init", "mount", "config", "firm load" };
+
+// Durations vary from boot to boot, their average over the boots is known
+static u64 phaseTicks(u32 boot, u32 phase)
+{
+    return TICKS_PER_SEC / 1000 * (1 + phase) + (boot % 2 == 0 ? 6700 : -6700);
+}
+
+static void simulateBoot(u32 boot)
+{
+    entryCount = 0;
+    currentPhase = NULL;
+    ticks = 0;
+
+    for(u32 i = 0; i < sizeof(phaseNames) / sizeof(phaseNames[0]); i++)
+    {
+        PROFILE_PHASE(phaseNames[i]);
+        if(i == 3)
+        {
+            CHECK(PROFILE_PATCH(fakePatch, 0, 0) == 0);
+            CHECK(PROFILE_PATCH(fakePatch, 0, boot % 3) == boot % 3);
+            ticks += phaseTicks(boot, i) - 2 * TICKS_PER_SEC / 1000;
+        }
+        else
+            ticks += phaseTicks(boot, i);
+    }
+
+    PROFILE_WRITE(NATIVE_FIRM, FIRMWARE_EMUNAND);
+}
+
+// What a host-side reader of boot_profile.log does: sum each phase's duration over all the records
+static u32 aggregate(u64 *phaseTotals, u32 *patchFailures)
+{
+    char *line = logFile, *logEnd = logFile + logSize;
+    u32 nbBoots = 0, nbLines = 0, recordTotal = 0, recordFailures = 0;
+
+    memset(phaseTotals, 0, sizeof(phaseNames) / sizeof(phaseNames[0]) * sizeof(u64));
+    *patchFailures = 0;
+
+    while(line < logEnd)
+    {
+        char *eol = memchr(line, '\n', logEnd - line);
+        CHECK(eol != NULL);
+        *eol = 0;
+        nbLines++;
+
+        u32 a, b, c, d;
+        char name[41];
+        if(strncmp(line, "phase ", 6) == 0)
+        {
+            // Names can contain spaces, the numbers are the last two fields
+            char *last = strrchr(line, ' '), *prev;
+            *last = 0;
+            prev = strrchr(line, ' ');
+            *last = ' ';
+            CHECK(sscanf(prev, " %u %u", &a, &b) == 2);
+            memcpy(name, line + 6, prev - line - 6);
+            name[prev - line - 6] = 0;
+
+            u32 i;
+            for(i = 0; i < sizeof(phaseNames) / sizeof(phaseNames[0]) && strcmp(name, phaseNames[i]) != 0; i++);
+            CHECK(i < sizeof(phaseNames) / sizeof(phaseNames[0]));
+            phaseTotals[i] += b;
+            recordTotal += b;
+        }
+        else if(sscanf(line, "patch %40s %u %u %u", name, &a, &b, &c) == 4)
+        {
+            CHECK(strcmp(name, "fakePatch") == 0 && b == TICKS_PER_SEC / 1000 * 1000000 / TICKS_PER_SEC);
+            if(c != 0)
+            {
+                (*patchFailures)++;
+                recordFailures++;
+            }
+        }
+        else if(sscanf(line, "boot %u %u", &a, &b) == 2)
+        {
+            CHECK(a == NATIVE_FIRM && b == FIRMWARE_EMUNAND);
+            nbBoots++;
+            recordTotal = 0;
+            recordFailures = 0;
+        }
+        else if(sscanf(line, "cache %u %u %u %u %u %u", &a, &b, &c, &d, &a, &a) == 6)
+            CHECK(c == 42);
+        else if(sscanf(line, "end %u %u", &a, &b) == 2)
+        {
+            // Each duration is rounded down on its own
+            CHECK(a >= recordTotal && a - recordTotal < sizeof(phaseNames) / sizeof(phaseNames[0]));
+            CHECK(b == recordFailures);
+        }
+        else
+            CHECK(false);
+
+        *eol = '\n';
+        line = eol + 1;
+    }
+
+    CHECK(nbLines == nbBoots * 9);
+    return nbBoots;
+}
+
+int main(void)
+{
+    u32 nbBoots = 0, nbRestartsSeen = 0, expectedFailures = 0;
+    u64 expectedTotals[sizeof(phaseNames) / sizeof(phaseNames[0])] = { 0 };
+
+    for(u32 boot = 0; boot < 1000; boot++)
+    {
+        u32 restartsBefore = nbRestarts;
+        simulateBoot(boot);
+
+        if(nbRestarts != restartsBefore)
+        {
+            nbRestartsSeen++;
+            nbBoots = 0;
+            memset(expectedTotals, 0, sizeof(expectedTotals));
+            expectedFailures = 0;
+        }
+        nbBoots++;
+        if(boot % 3 != 0)
+            expectedFailures++;
+        for(u32 i = 0; i < sizeof(phaseNames) / sizeof(phaseNames[0]); i++)
+            expectedTotals[i] += phaseTicks(boot, i) * 1000000 / TICKS_PER_SEC;
+
+        u64 phaseTotals[sizeof(phaseNames) / sizeof(phaseNames[0])];
+        u32 patchFailures;
+        CHECK(aggregate(phaseTotals, &patchFailures) == nbBoots);
+        CHECK(logSize <= PROFILE_LOG_MAX_SIZE);
+        CHECK(memcmp(phaseTotals, expectedTotals, sizeof(expectedTotals)) == 0);
+        CHECK(patchFailures == expectedFailures);
+    }
+    CHECK(nbRestartsSeen > 0);
+
+    // Too many entries: the extra ones are dropped, with long names cut short
+    entryCount = 0;
+    currentPhase = NULL;
+    for(u32 i = 0; i < 3 * PROFILE_MAX_ENTRIES; i++)
+        profilePatch("a patch function with a name much longer than forty characters", 0, 0xFFFFFFFF);
+    CHECK(entryCount == PROFILE_MAX_ENTRIES);
+    logSize = 0;
+    profileWrite(0xFFFFFFFF, 0xFFFFFFFF);
+    CHECK(logSize <= 160 + PROFILE_MAX_ENTRIES * 96);
+
+    return 0;
+}
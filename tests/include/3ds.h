@@ -0,0 +1,49 @@
+#pragma once
+
+// Host stand-in for <3ds.h>: only what the checked sources need. The checks define the functions they call.
+
+#include <3ds/types.h>
+#include <3ds/os.h>
+#include <3ds/exheader.h>
+#include <3ds/services/fs.h>
+
+typedef enum
+{
+    USERBREAK_PANIC = 0,
+    USERBREAK_ASSERT = 1,
+} UserBreakType;
+
+typedef struct
+{
+    u8 name[8];
+    u16 unk1;
+    u16 unk2;
+    u32 unk3;
+    u32 text_addr;
+    u32 text_size;
+    u32 ro_addr;
+    u32 ro_size;
+    u32 rw_addr;
+    u32 rw_size;
+    u32 text_size_total;
+    u32 ro_size_total;
+    u32 rw_size_total;
+    u32 unk4;
+    u64 program_id;
+} CodeSetHeader;
+
+#define RUNFLAG_APTCHAINLOAD    BIT(2)
+
+u32 osGetKernelVersion(void);
+
+Result svcCreatePort(Handle *portServer, Handle *portClient, const char *name, s32 maxSessions);
+Result svcCreateSessionToPort(Handle *clientSession, Handle clientPort);
+Result svcCreateSemaphore(Handle *semaphore, s32 initialCount, s32 maxCount);
+Result svcReleaseSemaphore(s32 *count, Handle semaphore, s32 releaseCount);
+Result svcGetProcessId(u32 *out, Handle handle);
+Result svcCloseHandle(Handle handle);
+void svcBreak(UserBreakType breakReason);
+u64 svcGetSystemTick(void);
+Result svcGetSystemInfo(s64 *out, u32 type, s32 param);
+Result svcCreateCodeSet(Handle *out, const CodeSetHeader *info, u32 codePtr, u32 roPtr, u32 dataPtr);
+Result svcKernelSetState(u32 type, ...);
@@ -0,0 +1,57 @@
+#pragma once
+
+// Host stand-in for the libctru extended header: same size, only the code set info and the title ID are named
+
+#include <3ds/types.h>
+
+typedef struct
+{
+    u32 address;
+    u32 num_pages;
+    u32 size;
+} ExHeader_CodeSectionInfo;
+
+typedef struct
+{
+    u8 reserved[5];
+    u8 compress_exefs_code : 1;
+    u8 is_sd_application : 1;
+    u8 reserved2 : 6;
+    u16 remaster_version;
+} ExHeader_SystemInfoFlags;
+
+typedef struct
+{
+    char title[8];
+    ExHeader_SystemInfoFlags flags;
+    ExHeader_CodeSectionInfo text;
+    u32 stack_size;
+    ExHeader_CodeSectionInfo rodata;
+    u32 reserved;
+    ExHeader_CodeSectionInfo data;
+    u32 bss_size;
+} ExHeader_CodeSetInfo;
+
+typedef struct
+{
+    struct
+    {
+        ExHeader_CodeSetInfo codeset_info;
+        u8 rest[0x200 - sizeof(ExHeader_CodeSetInfo)];
+    } sci;
+    struct
+    {
+        struct
+        {
+            u64 title_id;
+            u8 rest[0x170 - 8];
+        } local_caps;
+        u8 rest[0x200 - 0x170];
+    } aci;
+} ExHeader_Info;
+
+typedef struct
+{
+    ExHeader_Info info;
+    u8 access_descriptor[0x400];
+} ExHeader;
@@ -0,0 +1,5 @@
+#pragma once
+
+#include <3ds/types.h>
+
+#define SYSCLOCK_ARM11  268111856ULL
@@ -0,0 +1,3 @@
+#pragma once
+
+// Host stand-in, nothing the checked sources use
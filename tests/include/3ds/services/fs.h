@@ -0,0 +1,91 @@
+#pragma once
+
+// Host stand-in for the libctru FS service, as the loader uses it
+
+#include <3ds/types.h>
+
+typedef u64 FS_Archive;
+
+typedef enum
+{
+    PATH_INVALID = 0,
+    PATH_EMPTY = 1,
+    PATH_BINARY = 2,
+    PATH_ASCII = 3,
+    PATH_UTF16 = 4,
+} FS_PathType;
+
+typedef struct
+{
+    FS_PathType type;
+    u32 size;
+    const void *data;
+} FS_Path;
+
+typedef enum
+{
+    ARCHIVE_SDMC = 0x00000009,
+    ARCHIVE_NAND_RW = 0x1234567D,
+} FS_ArchiveID;
+
+typedef enum
+{
+    ARCHIVE_ACTION_GET_TIMESTAMP = 0x789D,
+} FS_ArchiveAction;
+
+enum
+{
+    FS_OPEN_READ = BIT(0),
+    FS_OPEN_WRITE = BIT(1),
+    FS_OPEN_CREATE = BIT(2),
+};
+
+enum
+{
+    FS_WRITE_FLUSH = BIT(0),
+};
+
+enum
+{
+    FS_ATTRIBUTE_DIRECTORY = BIT(0),
+};
+
+typedef struct
+{
+    u16 name[0x106];
+    char shortName[0x0A];
+    char shortExt[0x04];
+    u8 valid;
+    u8 reserved;
+    u32 attributes;
+    u64 fileSize;
+} FS_DirectoryEntry;
+
+typedef enum
+{
+    MEDIATYPE_NAND = 0,
+    MEDIATYPE_SD = 1,
+    MEDIATYPE_GAME_CARD = 2,
+} FS_MediaType;
+
+typedef struct
+{
+    u64 programId;
+    FS_MediaType mediaType : 8;
+    u8 padding[7];
+} FS_ProgramInfo;
+
+FS_Path fsMakePath(FS_PathType type, const void *path);
+Result FSUSER_OpenArchive(FS_Archive *archive, u32 id, FS_Path path);
+Result FSUSER_CloseArchive(FS_Archive archive);
+Result FSUSER_ControlArchive(FS_Archive archive, FS_ArchiveAction action, void *input, u32 inputSize, void *output, u32 outputSize);
+Result FSUSER_OpenDirectory(Handle *out, FS_Archive archive, FS_Path path);
+Result FSDIR_Read(Handle handle, u32 *entriesRead, u32 entryCount, FS_DirectoryEntry *entries);
+Result FSDIR_Close(Handle handle);
+Result FSUSER_OpenFileDirectly(Handle *out, FS_ArchiveID archiveId, FS_Path archivePath, FS_Path filePath, u32 openFlags, u32 attributes);
+Result FSUSER_OpenFile(Handle *out, FS_Archive archive, FS_Path path, u32 openFlags, u32 attributes);
+Result FSFILE_Read(Handle handle, u32 *bytesRead, u64 offset, void *buffer, u32 size);
+Result FSFILE_Write(Handle handle, u32 *bytesWritten, u64 offset, const void *buffer, u32 size, u32 flags);
+Result FSFILE_GetSize(Handle handle, u64 *size);
+Result FSFILE_SetSize(Handle handle, u64 size);
+Result FSFILE_Close(Handle handle);
@@ -0,0 +1,5 @@
+#pragma once
+
+// Host stand-in for the libctru PM service headers, only their types are used
+
+#include <3ds/services/fs.h>
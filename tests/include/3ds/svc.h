@@ -0,0 +1,66 @@
+#pragma once
+
+// Host stand-in for the libctru debug SVC types, as Rosalina's GDB stub uses them
+
+#include <3ds/types.h>
+
+typedef struct
+{
+    u32 r[13];
+    u32 sp;
+    u32 lr;
+    u32 pc;
+    u32 cpsr;
+} CpuRegisters;
+
+typedef struct
+{
+    union
+    {
+        struct { double d[16]; };
+        float s[32];
+    };
+    u32 fpscr;
+    u32 fpexc;
+} FpuRegisters;
+
+typedef struct
+{
+    CpuRegisters cpu_registers;
+    FpuRegisters fpu_registers;
+} ThreadContext;
+
+typedef enum
+{
+    THREADCONTEXT_CONTROL_CPU_GPRS = BIT(0),
+    THREADCONTEXT_CONTROL_CPU_SPRS = BIT(1),
+    THREADCONTEXT_CONTROL_FPU_GPRS = BIT(2),
+    THREADCONTEXT_CONTROL_FPU_SPRS = BIT(3),
+
+    THREADCONTEXT_CONTROL_CPU_REGS = BIT(0) | BIT(1),
+    THREADCONTEXT_CONTROL_FPU_REGS = BIT(2) | BIT(3),
+    THREADCONTEXT_CONTROL_ALL = BIT(0) | BIT(1) | BIT(2) | BIT(3),
+} ThreadContextControlFlags;
+
+typedef enum
+{
+    DBG_INHIBIT_USER_CPU_EXCEPTION_HANDLERS = BIT(0),
+    DBG_SIGNAL_FAULT_EXCEPTION_EVENTS = BIT(1),
+    DBG_SIGNAL_SCHEDULE_EVENTS = BIT(2),
+    DBG_SIGNAL_SYSCALL_EVENTS = BIT(3),
+    DBG_SIGNAL_MAP_EVENTS = BIT(4),
+} DebugFlags;
+
+// Only its size matters to the checks
+typedef struct
+{
+    u32 type;
+    u32 thread_id;
+    u32 flags;
+    u8 remnants[4];
+    u8 data[0x20];
+} DebugEventInfo;
+
+Result svcGetDebugThreadContext(ThreadContext *context, Handle debug, u32 threadId, ThreadContextControlFlags controlFlags);
+Result svcReadProcessMemory(void *buffer, Handle debug, u32 addr, u32 size);
+Result svcWriteProcessMemory(Handle debug, const void *buffer, u32 addr, u32 size);
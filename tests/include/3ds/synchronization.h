@@ -0,0 +1,12 @@
+#pragma once
+
+// Host stand-in for the libctru locks, the checks are single-threaded
+
+#include <3ds/types.h>
+
+typedef struct
+{
+    s32 lock;
+    u32 thread_tag;
+    u32 counter;
+} RecursiveLock;
@@ -0,0 +1,32 @@
+#pragma once
+
+// Host stand-in for the libctru types the sysmodules use
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+
+typedef volatile u8 vu8;
+typedef volatile u16 vu16;
+typedef volatile u32 vu32;
+typedef volatile u64 vu64;
+
+typedef u32 Handle;
+typedef s32 Result;
+
+#define BIT(n)          (1U << (n))
+#define CTR_ALIGN(m)    __attribute__((aligned(m)))
+#define R_SUCCEEDED(res)    ((res) >= 0)
+#define R_FAILED(res)       ((res) < 0)
+
+#define GET_VERSION_MAJOR(version)      ((version) >> 24)
+#define GET_VERSION_MINOR(version)      (((version) >> 16) & 0xFF)
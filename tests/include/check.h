@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Compiler and flags of this build (see the Makefile), printed next to the benchmark figures
+#ifndef CHECK_BUILD_FLAGS
+#define CHECK_BUILD_FLAGS "unknown flags"
+#endif
+
+#define CHECK(cond) do\
+{\
+    if(!(cond))\
+    {\
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);\
+        exit(1);\
+    }\
+} while(0)
+
+// Small deterministic PRNG, so that failures can be reproduced
+static inline unsigned int checkRand(void)
+{
+    static unsigned int state = 0x12345678;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+// Stand-in for the header that the build generates from config_template.ini.
+// The checks that need the template load the file into this buffer at run time.
+extern unsigned char config_template_ini[0x4000];
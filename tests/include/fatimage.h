@@ -0,0 +1,145 @@
+#pragma once
+
+// Builds small FAT16 volumes in memory, for the checks that go through FatFs.
+// Files are laid out cluster by cluster, optionally fragmented.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FAT_IMAGE_SECTOR_SIZE       512
+#define FAT_IMAGE_CLUSTERS          8192    // More than 4085, so that FatFs sees FAT16
+#define FAT_IMAGE_FAT_SECTORS       ((FAT_IMAGE_CLUSTERS + 2) * 2 / FAT_IMAGE_SECTOR_SIZE + 1)
+#define FAT_IMAGE_ROOT_ENTRIES      512
+#define FAT_IMAGE_ROOT_SECTOR       (1 + 2 * FAT_IMAGE_FAT_SECTORS)
+#define FAT_IMAGE_DATA_SECTOR       (FAT_IMAGE_ROOT_SECTOR + FAT_IMAGE_ROOT_ENTRIES * 32 / FAT_IMAGE_SECTOR_SIZE)
+#define FAT_IMAGE_MAX_CLUSTER_SIZE  4       // In sectors
+#define FAT_IMAGE_MAX_SECTORS       (FAT_IMAGE_DATA_SECTOR + FAT_IMAGE_CLUSTERS * FAT_IMAGE_MAX_CLUSTER_SIZE)
+
+typedef struct FatImage
+{
+    uint8_t *data;              // FAT_IMAGE_MAX_SECTORS long whatever the cluster size
+    uint32_t clusterSize;       // In bytes
+    uint32_t nextCluster;
+} FatImage;
+
+static inline void fatImageSetWord(uint8_t *p, uint16_t val)
+{
+    p[0] = (uint8_t)val;
+    p[1] = (uint8_t)(val >> 8);
+}
+
+static inline uint8_t *fatImageCluster(FatImage *img, uint32_t cluster)
+{
+    return img->data + FAT_IMAGE_DATA_SECTOR * FAT_IMAGE_SECTOR_SIZE + (cluster - 2) * img->clusterSize;
+}
+
+static inline void fatImageSetFatEntry(FatImage *img, uint32_t cluster, uint16_t val)
+{
+    for(uint32_t i = 0; i < 2; i++)
+        fatImageSetWord(img->data + (1 + i * FAT_IMAGE_FAT_SECTORS) * FAT_IMAGE_SECTOR_SIZE + cluster * 2, val);
+}
+
+static inline void fatImageInit(FatImage *img, uint32_t sectorsPerCluster)
+{
+    img->data = calloc(FAT_IMAGE_MAX_SECTORS, FAT_IMAGE_SECTOR_SIZE);
+    img->clusterSize = sectorsPerCluster * FAT_IMAGE_SECTOR_SIZE;
+    img->nextCluster = 2;
+
+    uint8_t *bs = img->data;
+    memcpy(bs, "\xEB\x3C\x90" "MSDOS5.0", 11);
+    fatImageSetWord(bs + 11, FAT_IMAGE_SECTOR_SIZE);
+    bs[13] = (uint8_t)sectorsPerCluster;
+    fatImageSetWord(bs + 14, 1);                        // Reserved sectors
+    bs[16] = 2;                                         // FATs
+    fatImageSetWord(bs + 17, FAT_IMAGE_ROOT_ENTRIES);
+    fatImageSetWord(bs + 19, FAT_IMAGE_DATA_SECTOR + FAT_IMAGE_CLUSTERS * sectorsPerCluster);
+    bs[21] = 0xF8;
+    fatImageSetWord(bs + 22, FAT_IMAGE_FAT_SECTORS);
+    bs[38] = 0x29;
+    memcpy(bs + 43, "NO NAME    FAT16   ", 19);
+    fatImageSetWord(bs + 510, 0xAA55);
+
+    fatImageSetFatEntry(img, 0, 0xFFF8);
+    fatImageSetFatEntry(img, 1, 0xFFFF);
+}
+
+// Allocates a cluster chain, leaving a free cluster after every "fragmentEvery" clusters (0: contiguous)
+static inline uint32_t fatImageAllocChain(FatImage *img, uint32_t nbClusters, uint32_t fragmentEvery)
+{
+    uint32_t first = 0, prev = 0;
+
+    for(uint32_t i = 0; i < nbClusters; i++)
+    {
+        if(fragmentEvery != 0 && i != 0 && i % fragmentEvery == 0)
+            img->nextCluster++;
+
+        uint32_t cluster = img->nextCluster++;
+        if(prev != 0)
+            fatImageSetFatEntry(img, prev, (uint16_t)cluster);
+        else
+            first = cluster;
+        prev = cluster;
+    }
+
+    if(prev != 0)
+        fatImageSetFatEntry(img, prev, 0xFFFF);
+
+    return first;
+}
+
+static inline uint32_t fatImageNextInChain(FatImage *img, uint32_t cluster)
+{
+    const uint8_t *p = img->data + FAT_IMAGE_SECTOR_SIZE + cluster * 2;
+    return p[0] | (p[1] << 8);
+}
+
+// name83 is the 11-character directory entry name, e.g. "DATA    BIN". dirCluster 0 is the root directory
+static inline void fatImageAddEntry(FatImage *img, uint32_t dirCluster, const char *name83, uint8_t attr, uint32_t cluster, uint32_t size)
+{
+    uint8_t *dir = dirCluster == 0 ? img->data + FAT_IMAGE_ROOT_SECTOR * FAT_IMAGE_SECTOR_SIZE : fatImageCluster(img, dirCluster);
+    uint32_t nbEntries = dirCluster == 0 ? FAT_IMAGE_ROOT_ENTRIES : img->clusterSize / 32;
+
+    for(uint32_t i = 0; i < nbEntries; i++)
+    {
+        uint8_t *entry = dir + 32 * i;
+        if(entry[0] != 0)
+            continue;
+
+        memcpy(entry, name83, 11);
+        entry[11] = attr;
+        fatImageSetWord(entry + 22, 0x6000);            // 12:00:00
+        fatImageSetWord(entry + 24, 0x5021);            // 2020-01-01
+        fatImageSetWord(entry + 26, (uint16_t)cluster);
+        fatImageSetWord(entry + 28, (uint16_t)size);
+        fatImageSetWord(entry + 30, (uint16_t)(size >> 16));
+        return;
+    }
+
+    abort();
+}
+
+static inline uint32_t fatImageAddDir(FatImage *img, uint32_t parentCluster, const char *name83)
+{
+    uint32_t cluster = fatImageAllocChain(img, 1, 0);
+
+    fatImageAddEntry(img, parentCluster, name83, 0x10, cluster, 0);
+    fatImageAddEntry(img, cluster, ".          ", 0x10, cluster, 0);
+    fatImageAddEntry(img, cluster, "..         ", 0x10, parentCluster, 0);
+
+    return cluster;
+}
+
+static inline uint32_t fatImageAddFile(FatImage *img, uint32_t dirCluster, const char *name83, const uint8_t *content, uint32_t size, uint32_t fragmentEvery)
+{
+    uint32_t nbClusters = (size + img->clusterSize - 1) / img->clusterSize;
+    uint32_t first = fatImageAllocChain(img, nbClusters, fragmentEvery);
+
+    uint32_t cluster = first;
+    for(uint32_t off = 0; off < size; off += img->clusterSize, cluster = fatImageNextInChain(img, cluster))
+        memcpy(fatImageCluster(img, cluster), content + off, size - off < img->clusterSize ? size - off : img->clusterSize);
+
+    fatImageAddEntry(img, dirCluster, name83, 0x20, first, size);
+
+    return first;
+}
@@ -0,0 +1,350 @@
+// k11 SVC trace: ring collection (common/svc_trace.h) and the host decoder for the trace files and streams.
+// Without arguments, checks both against rings filled the way k11_extension/source/trace.c fills them.
+// With arguments, decodes captures and prints the SVC and IPC command latency histograms:
+//   build/k11_svc_trace svc_trace.bin         (the file saved from Rosalina's debugger menu)
+//   nc <console ip> 4960 > stream.bin          (the network stream, same format)
+
+#include <string.h>
+#include "check.h"
+
+#include "../common/svc_trace.h"
+
+// Log2 buckets, in cycles: bucket N holds durations in [2^N, 2^(N+1))
+typedef struct LatencyHistogram
+{
+    uint32_t count, unknown;
+    uint64_t total;
+    uint32_t min, max;
+    uint32_t buckets[32];
+} LatencyHistogram;
+
+#define MAX_IPC_COMMANDS    256
+
+typedef struct SvcTraceReport
+{
+    uint32_t nbEntries, nbLost;
+    uint32_t lastSequences[4];
+    LatencyHistogram svcs[256];
+    uint32_t nbIpcCommands;
+    uint16_t ipcCommandIds[MAX_IPC_COMMANDS];
+    LatencyHistogram ipcCommands[MAX_IPC_COMMANDS]; // SendSyncRequest returns, by command ID of the reply header
+} SvcTraceReport;
+
+static void addLatency(LatencyHistogram *histogram, uint32_t duration)
+{
+    if(duration == 0)
+    {
+        histogram->unknown++;
+        return;
+    }
+
+    histogram->min = histogram->count == 0 || duration < histogram->min ? duration : histogram->min;
+    histogram->max = duration > histogram->max ? duration : histogram->max;
+    histogram->count++;
+    histogram->total += duration;
+    histogram->buckets[31 - __builtin_clz(duration)]++;
+}
+
+static LatencyHistogram *getIpcCommandHistogram(SvcTraceReport *report, uint16_t commandId)
+{
+    for(uint32_t i = 0; i < report->nbIpcCommands; i++)
+    {
+        if(report->ipcCommandIds[i] == commandId)
+            return &report->ipcCommands[i];
+    }
+
+    if(report->nbIpcCommands == MAX_IPC_COMMANDS)
+        return NULL;
+
+    report->ipcCommandIds[report->nbIpcCommands] = commandId;
+    return &report->ipcCommands[report->nbIpcCommands++];
+}
+
+// Entries of different cores may be interleaved (stream), entries of a given core are in sequence order
+static void decodeEntries(SvcTraceReport *report, const SvcTraceEntry *entries, uint32_t count)
+{
+    for(uint32_t i = 0; i < count; i++)
+    {
+        const SvcTraceEntry *entry = &entries[i];
+        uint32_t coreId = entry->flags >> SVC_TRACE_CORE_SHIFT;
+        if(!svcTraceEntryIsCommitted(entry))
+            continue;
+
+        // The rings only hold the last SVC_TRACE_RING_SIZE entries of each core
+        if(report->lastSequences[coreId] != 0 && (int32_t)(entry->sequence - report->lastSequences[coreId]) > 1)
+            report->nbLost += entry->sequence - report->lastSequences[coreId] - 1;
+        report->lastSequences[coreId] = entry->sequence;
+        report->nbEntries++;
+
+        if(!(entry->flags & SVC_TRACE_FLAG_RETURN))
+            continue;
+
+        addLatency(&report->svcs[entry->svcId], entry->duration);
+        if(entry->svcId == 0x32)
+        {
+            LatencyHistogram *histogram = getIpcCommandHistogram(report, entry->ipcHeader >> 16);
+            if(histogram != NULL)
+                addLatency(histogram, entry->duration);
+        }
+    }
+}
+
+static void printHistogram(const char *name, const LatencyHistogram *histogram)
+{
+    printf("%s: %u calls", name, histogram->count + histogram->unknown);
+    if(histogram->unknown != 0)
+        printf(" (%u returned on another core)", histogram->unknown);
+    if(histogram->count == 0)
+    {
+        printf("\n");
+        return;
+    }
+
+    printf(", cycles min %u avg %llu max %u\n", histogram->min, (unsigned long long)(histogram->total / histogram->count), histogram->max);
+    for(uint32_t i = 0; i < 32; i++)
+    {
+        if(histogram->buckets[i] == 0)
+            continue;
+
+        uint32_t width = (uint32_t)((uint64_t)histogram->buckets[i] * 50 / histogram->count);
+        printf("  >= %10u: %8u %.*s\n", 1u << i, histogram->buckets[i], (int)(width != 0 ? width : 1),
+               "**************************************************");
+    }
+}
+
+static void printReport(const SvcTraceReport *report)
+{
+    char name[32];
+
+    printf("%u entries, %u lost (ring overwritten before it was read)\n", report->nbEntries, report->nbLost);
+    for(uint32_t i = 0; i < 256; i++)
+    {
+        if(report->svcs[i].count + report->svcs[i].unknown == 0)
+            continue;
+
+        sprintf(name, "svc 0x%02X", i);
+        printHistogram(name, &report->svcs[i]);
+    }
+
+    for(uint32_t i = 0; i < report->nbIpcCommands; i++)
+    {
+        sprintf(name, "IPC command 0x%04X", report->ipcCommandIds[i]);
+        printHistogram(name, &report->ipcCommands[i]);
+    }
+}
+
+static int decodeFiles(int argc, char **argv)
+{
+    static SvcTraceReport report;
+    SvcTraceEntry entries[256];
+
+    for(int i = 1; i < argc; i++)
+    {
+        FILE *f = fopen(argv[i], "rb");
+        if(f == NULL)
+        {
+            perror(argv[i]);
+            return 1;
+        }
+
+        size_t count;
+        while((count = fread(entries, sizeof(SvcTraceEntry), 256, f)) != 0)
+            decodeEntries(&report, entries, count);
+        fclose(f);
+    }
+
+    printReport(&report);
+    return 0;
+}
+
+// Same protocol as traceSvc: the commit word is cleared, the fields then the sequence are written, then the commit word
+static SvcTraceEntry *beginEntry(SvcTraceRing *ring, uint32_t coreId, uint32_t svcId, bool isReturn, uint32_t duration)
+{
+    uint32_t sequence = ring->lastSequence + 1 != 0 ? ring->lastSequence + 1 : 1;
+    SvcTraceEntry *entry = &ring->entries[(sequence - 1) % SVC_TRACE_RING_SIZE];
+
+    entry->commit = 0;
+    entry->timestamp = sequence * 100;
+    entry->duration = duration;
+    entry->thread = 0xFFF20000 + 0xB0 * (sequence % 7);
+    entry->ipcHeader = svcId == 0x32 ? (0x0800u + (duration & 3)) << 16 : 0;
+    entry->pid = 0x20;
+    entry->svcId = svcId;
+    entry->flags = (isReturn ? SVC_TRACE_FLAG_RETURN : 0) | (coreId << SVC_TRACE_CORE_SHIFT);
+    entry->reserved = 0;
+    entry->sequence = sequence;
+    return entry;
+}
+
+static void commitEntry(SvcTraceRing *ring, SvcTraceEntry *entry)
+{
+    entry->commit = entry->sequence;
+    ring->lastSequence = entry->sequence;
+}
+
+static void traceEntry(SvcTraceRing *ring, uint32_t coreId, uint32_t svcId, bool isReturn, uint32_t duration)
+{
+    commitEntry(ring, beginEntry(ring, coreId, svcId, isReturn, duration));
+}
+
+static void checkCollectedInOrder(const SvcTraceRing *ring, uint32_t count, uint32_t first)
+{
+    for(uint32_t i = 0; i < count; i++)
+    {
+        CHECK(ring->entries[i].sequence == first + i);
+        CHECK(svcTraceEntryIsCommitted(&ring->entries[i]));
+        CHECK(ring->entries[i].timestamp == (first + i) * 100);
+    }
+}
+
+static void checkCollect(void)
+{
+    static SvcTraceRing ring, copy;
+
+    // Empty ring, partially filled ring
+    memset(&ring, 0, sizeof(ring));
+    copy = ring;
+    CHECK(svcTraceCollectRing(&copy, 0) == 0);
+
+    for(uint32_t i = 0; i < 100; i++)
+        traceEntry(&ring, 1, 0x0A, i & 1, 0);
+    copy = ring;
+    CHECK(svcTraceCollectRing(&copy, 0) == 100);
+    checkCollectedInOrder(&copy, 100, 1);
+
+    // Wrapped ring, at every rotation: only the last SVC_TRACE_RING_SIZE entries are left, oldest first
+    for(uint32_t i = 0; i < 3 * SVC_TRACE_RING_SIZE; i++)
+    {
+        traceEntry(&ring, 1, 0x0A, i & 1, 0);
+        copy = ring;
+        uint32_t count = svcTraceCollectRing(&copy, 0);
+        CHECK(count == (ring.lastSequence < SVC_TRACE_RING_SIZE ? ring.lastSequence : SVC_TRACE_RING_SIZE));
+        checkCollectedInOrder(&copy, count, ring.lastSequence - count + 1);
+    }
+
+    // Only what is newer than the last entry read (what the streaming thread sends)
+    uint32_t last = ring.lastSequence;
+    for(uint32_t i = 0; i < 37; i++)
+        traceEntry(&ring, 1, 0x0A, false, 0);
+    copy = ring;
+    CHECK(svcTraceCollectRing(&copy, last) == 37);
+    checkCollectedInOrder(&copy, 37, last + 1);
+    copy = ring;
+    CHECK(svcTraceCollectRing(&copy, ring.lastSequence) == 0);
+
+    // Entry being written: neither its cleared commit word nor the new fields with the old commit word pass
+    SvcTraceEntry *entry = beginEntry(&ring, 1, 0x0A, false, 0);
+    copy = ring;
+    CHECK(svcTraceCollectRing(&copy, 0) == SVC_TRACE_RING_SIZE - 1);
+    checkCollectedInOrder(&copy, SVC_TRACE_RING_SIZE - 1, ring.lastSequence - SVC_TRACE_RING_SIZE + 2);
+
+    uint32_t commit = entry->sequence;
+    entry->commit = commit - SVC_TRACE_RING_SIZE; // torn copy: commit word of the entry that was there before
+    copy = ring;
+    CHECK(svcTraceCollectRing(&copy, 0) == SVC_TRACE_RING_SIZE - 1);
+    entry->commit = commit;
+    commitEntry(&ring, entry);
+    copy = ring;
+    CHECK(svcTraceCollectRing(&copy, 0) == SVC_TRACE_RING_SIZE);
+    checkCollectedInOrder(&copy, SVC_TRACE_RING_SIZE, ring.lastSequence - SVC_TRACE_RING_SIZE + 1);
+
+    // The kernel kept writing while the ring was copied: the slots copied last are a lap ahead of the first ones
+    copy = ring;
+    for(uint32_t i = 0; i < 40; i++)
+        traceEntry(&ring, 1, 0x0A, false, 0);
+    uint32_t start = (copy.lastSequence) % SVC_TRACE_RING_SIZE; // slot of the oldest entry
+    for(uint32_t i = 0; i < 10; i++)
+        copy.entries[(start + 30 + i) % SVC_TRACE_RING_SIZE] = ring.entries[(start + 30 + i) % SVC_TRACE_RING_SIZE];
+    uint32_t count = svcTraceCollectRing(&copy, 0);
+    CHECK(count == SVC_TRACE_RING_SIZE);
+    for(uint32_t i = 1; i < count; i++)
+        CHECK(copy.entries[i].sequence > copy.entries[i - 1].sequence);
+}
+
+static void checkDecoder(void)
+{
+    static SvcTraceRing rings[2], copy;
+    static SvcTraceReport report;
+    uint32_t lastSequences[2] = { 0 };
+
+    memset(rings, 0, sizeof(rings));
+    memset(&report, 0, sizeof(report));
+
+    // Streamed the way Rosalina does it: whatever each core wrote since the previous poll
+    uint32_t nbReturns = 0, nbUnknown = 0, nbIpcReturns = 0, nbWritten = 0;
+    for(uint32_t poll = 0; poll < 50; poll++)
+    {
+        for(uint32_t core = 0; core < 2; core++)
+        {
+            // Core 1 is busier than its ring between polls 20 and 30
+            uint32_t n = core == 1 && poll >= 20 && poll < 30 ? 300 : 40 + checkRand() % 100;
+            for(uint32_t i = 0; i < n; i++)
+            {
+                bool isReturn = i & 1;
+                uint32_t svcId = i % 6 == 1 ? 0x32 : 0x0A;
+                uint32_t duration = !isReturn || checkRand() % 10 == 0 ? 0 : 1 + checkRand() % 100000;
+                traceEntry(&rings[core], core, svcId, isReturn, duration);
+                nbWritten++;
+
+                if(!(core == 1 && poll >= 20 && poll < 30))
+                {
+                    nbReturns += isReturn;
+                    nbUnknown += isReturn && duration == 0;
+                    nbIpcReturns += isReturn && svcId == 0x32;
+                }
+            }
+
+            copy = rings[core];
+            uint32_t count = svcTraceCollectRing(&copy, lastSequences[core]);
+            if(count != 0)
+                lastSequences[core] = copy.entries[count - 1].sequence;
+            decodeEntries(&report, copy.entries, count);
+        }
+    }
+
+    CHECK(report.nbLost == 10 * (300 - SVC_TRACE_RING_SIZE));
+    CHECK(report.nbEntries + report.nbLost == nbWritten);
+
+    // Everything but the overloaded polls is accounted for exactly
+    uint32_t nbDecodedReturns = 0, nbDecodedUnknown = 0, nbDecodedIpc = 0;
+    for(uint32_t i = 0; i < 256; i++)
+    {
+        nbDecodedReturns += report.svcs[i].count + report.svcs[i].unknown;
+        nbDecodedUnknown += report.svcs[i].unknown;
+
+        uint32_t inBuckets = 0;
+        for(uint32_t j = 0; j < 32; j++)
+            inBuckets += report.svcs[i].buckets[j];
+        CHECK(inBuckets == report.svcs[i].count);
+    }
+    for(uint32_t i = 0; i < report.nbIpcCommands; i++)
+    {
+        nbDecodedIpc += report.ipcCommands[i].count + report.ipcCommands[i].unknown;
+        CHECK((report.ipcCommandIds[i] & ~3) == 0x0800);
+    }
+    CHECK(nbDecodedReturns >= nbReturns && nbDecodedReturns <= nbReturns + 10 * SVC_TRACE_RING_SIZE / 2);
+    CHECK(nbDecodedUnknown >= nbUnknown);
+    CHECK(nbDecodedIpc >= nbIpcReturns);
+    CHECK(report.svcs[0x32].count + report.svcs[0x32].unknown == nbDecodedIpc);
+
+    // Bucket boundaries
+    LatencyHistogram histogram = { 0 };
+    addLatency(&histogram, 1);
+    addLatency(&histogram, 1023);
+    addLatency(&histogram, 1024);
+    addLatency(&histogram, 0xFFFFFFFF);
+    addLatency(&histogram, 0);
+    CHECK(histogram.count == 4 && histogram.unknown == 1);
+    CHECK(histogram.buckets[0] == 1 && histogram.buckets[9] == 1 && histogram.buckets[10] == 1 && histogram.buckets[31] == 1);
+    CHECK(histogram.min == 1 && histogram.max == 0xFFFFFFFF);
+}
+
+int main(int argc, char **argv)
+{
+    if(argc > 1)
+        return decodeFiles(argc, argv);
+
+    checkCollect();
+    checkDecoder();
+    return 0;
+}
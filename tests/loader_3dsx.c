@@ -0,0 +1,321 @@
+// loader: 3DSX loading and relocation, compared with a straightforward relocator over random images
+
+#include "check.h"
+
+// The codeset is created from the segment addresses, which are 32-bit on the console
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpointer-to-int-cast"
+#include "../sysmodules/loader/source/3dsx.c"
+#pragma GCC diagnostic pop
+
+#define BASE_ADDR       0x00100000
+#define MAX_SEG_PAGES   6
+#define MAX_FILE_SIZE   0x100000
+
+static u8 fileData[MAX_FILE_SIZE];
+static u32 fileSize, nbReads;
+
+static struct
+{
+    u32 calls;
+    CodeSetHeader csh;
+    u32 codePtr, roPtr, dataPtr;
+} codeset;
+
+u32 IFile_Read2(IFile *file, void *buffer, u32 size, u32 offset)
+{
+    (void)file;
+    nbReads++;
+    if(offset > fileSize) return 0;
+    if(size > fileSize - offset) size = fileSize - offset;
+    memcpy(buffer, fileData + offset, size);
+    return size;
+}
+
+Result svcGetSystemInfo(s64 *out, u32 type, s32 param)
+{
+    CHECK(type == 0x10001 && param == 0);
+    *out = 0;
+    return 0;
+}
+
+Result svcCreateCodeSet(Handle *out, const CodeSetHeader *info, u32 codePtr, u32 roPtr, u32 dataPtr)
+{
+    codeset.calls++;
+    codeset.csh = *info;
+    codeset.codePtr = codePtr;
+    codeset.roPtr = roPtr;
+    codeset.dataPtr = dataPtr;
+    *out = 0xC0DE;
+    return 0;
+}
+
+typedef struct Image
+{
+    _3DSX_Header hdr;
+    u32 nRelocTables;
+    u32 counts[3][4];
+    u32 segSizes[3];
+    u32 headerExtra;
+    u32 relocsOffset, totalRelocs;
+} Image;
+
+// Returns the offset of a 32-bit word of the loaded image (before relocation) in the file, or ~0 for BSS
+static u32 fileOffsetOfWord(const Image *img, u32 seg, u32 wordOffset)
+{
+    u32 loadSizes[3] = { img->hdr.codeSegSize, img->hdr.rodataSegSize, img->hdr.dataSegSize - img->hdr.bssSize };
+    u32 offset = img->hdr.headerSize + 3 * img->hdr.relocHdrSize;
+
+    for(u32 i = 0; i < seg; i++) offset += loadSizes[i];
+
+    return wordOffset + 4 <= loadSizes[seg] ? offset + wordOffset : ~0u;
+}
+
+static u16 randomRelocField(void)
+{
+    switch(checkRand() % 8)
+    {
+        case 0: return 0;
+        case 1: return checkRand() % 0x800;
+        case 2: return 0xFFFF;
+        default: return checkRand() % 24;
+    }
+}
+
+static u32 randomSegSize(void)
+{
+    u32 pages = checkRand() % (MAX_SEG_PAGES + 1);
+
+    switch(checkRand() % 4)
+    {
+        case 0: return pages * 0x1000;  // Whole pages, read together with the next segment
+        case 1: return pages * 0x1000 + 4 * (checkRand() % 0x400);
+        default: return pages == 0 ? 0 : pages * 0x1000 - 4 * (checkRand() % 0x400);
+    }
+}
+
+// Builds a random 3DSX file. Words that absolute relocations patch are given a valid subtype unless badSubtype
+static void buildImage(Image *img, bool badSubtype)
+{
+    memset(img, 0, sizeof(Image));
+
+    img->hdr.magic = _3DSX_MAGIC;
+    img->headerExtra = checkRand() % 2 ? 0 : 4 * (checkRand() % 4);
+    img->hdr.headerSize = sizeof(_3DSX_Header) + img->headerExtra;
+    img->nRelocTables = 2 + checkRand() % 3;
+    img->hdr.relocHdrSize = 4 * img->nRelocTables;
+    img->hdr.codeSegSize = randomSegSize();
+    img->hdr.rodataSegSize = randomSegSize();
+    img->hdr.dataSegSize = randomSegSize();
+    img->hdr.bssSize = checkRand() % 2 ? 0 : 4 * (checkRand() % (img->hdr.dataSegSize / 4 + 1));
+
+    for(u32 i = 0; i < 3; i++)
+    {
+        u32 size = i == 0 ? img->hdr.codeSegSize : i == 1 ? img->hdr.rodataSegSize : img->hdr.dataSegSize;
+        img->segSizes[i] = (size + 0xFFF) & ~0xFFF;
+
+        for(u32 j = 0; j < img->nRelocTables; j++)
+        {
+            switch(checkRand() % 6)
+            {
+                case 0: img->counts[i][j] = 0; break;
+                case 1: img->counts[i][j] = 4000 + checkRand() % 6000; break; // Spans several read chunks
+                default: img->counts[i][j] = checkRand() % 300; break;
+            }
+            img->totalRelocs += img->counts[i][j];
+        }
+    }
+
+    u32 offset = 0;
+    memcpy(fileData, &img->hdr, sizeof(_3DSX_Header));
+    offset += sizeof(_3DSX_Header);
+    for(u32 i = 0; i < img->headerExtra; i++) fileData[offset++] = (u8)checkRand();
+
+    for(u32 i = 0; i < 3; i++)
+    {
+        memcpy(fileData + offset, img->counts[i], img->hdr.relocHdrSize);
+        offset += img->hdr.relocHdrSize;
+    }
+
+    u32 loadSize = img->hdr.codeSegSize + img->hdr.rodataSegSize + img->hdr.dataSegSize - img->hdr.bssSize;
+    u32 imageSize = img->segSizes[0] + img->segSizes[1] + img->segSizes[2];
+    for(u32 i = 0; i < loadSize; i += 4)
+    {
+        // Target offsets inside the image, with relative subtypes 0 and 1
+        u32 word = checkRand() % (imageSize + 1) | (checkRand() % 4 == 0 ? 1u << 28 : 0);
+        memcpy(fileData + offset + i, &word, 4);
+    }
+    if(checkRand() % 4 == 0 && img->hdr.codeSegSize >= 8)
+    {
+        u32 magic = _PRM_MAGIC;
+        memcpy(fileData + offset + 4, &magic, 4);
+    }
+    offset += loadSize;
+
+    img->relocsOffset = offset;
+    CHECK(offset + 4 * img->totalRelocs <= MAX_FILE_SIZE);
+
+    _3DSX_Reloc *relocs = (_3DSX_Reloc *)(fileData + offset);
+    for(u32 i = 0, n = 0; i < 3; i++)
+    {
+        for(u32 j = 0; j < img->nRelocTables; j++)
+        {
+            u32 pos = 0;
+            for(u32 k = 0; k < img->counts[i][j]; k++, n++)
+            {
+                relocs[n].skip = randomRelocField();
+                relocs[n].patch = randomRelocField();
+
+                // Absolute relocations only support subtype 0
+                if(j != 0) continue;
+
+                pos += relocs[n].skip;
+                for(u32 m = 0; m < relocs[n].patch && pos < img->segSizes[i] / 4; m++, pos++)
+                {
+                    u32 wordOffset = fileOffsetOfWord(img, i, 4 * pos);
+                    if(wordOffset != ~0u) fileData[wordOffset + 3] &= 0x0F;
+                }
+            }
+        }
+    }
+    offset += 4 * img->totalRelocs;
+    fileSize = offset;
+
+    u32 segmentsOffset = img->hdr.headerSize + 3 * img->hdr.relocHdrSize;
+    if(badSubtype && img->relocsOffset > segmentsOffset)
+    {
+        u32 i = checkRand() % (img->relocsOffset - segmentsOffset) & ~3u;
+        fileData[segmentsOffset + i + 3] |= 0x20 + (checkRand() % 14 << 4);
+    }
+}
+
+static u32 translateAddr(const Image *img, u32 off)
+{
+    if(off < img->segSizes[0]) return BASE_ADDR + off;
+    if(off < img->segSizes[0] + img->segSizes[1]) return BASE_ADDR + img->segSizes[0] + (off - img->segSizes[0]);
+    return BASE_ADDR + img->segSizes[0] + img->segSizes[1] + (off - img->segSizes[0] - img->segSizes[1]);
+}
+
+// The relocator as the 3DSX format describes it, one table and one word at a time
+static bool referenceLoad(const Image *img, u32 *pages)
+{
+    const _3DSX_Header *hdr = &img->hdr;
+    u8 *segPtrs[3] = { (u8 *)pages, (u8 *)pages + img->segSizes[0], (u8 *)pages + img->segSizes[0] + img->segSizes[1] };
+    u32 *extraPage = (u32 *)(segPtrs[2] + img->segSizes[2]);
+    u32 offset = hdr->headerSize + 3 * hdr->relocHdrSize;
+
+    if(fileSize < img->relocsOffset + 4 * img->totalRelocs) return false;
+
+    memcpy(extraPage, fileData + hdr->headerSize, 3 * hdr->relocHdrSize);
+    memcpy(segPtrs[0], fileData + offset, hdr->codeSegSize);
+    offset += hdr->codeSegSize;
+    memcpy(segPtrs[1], fileData + offset, hdr->rodataSegSize);
+    offset += hdr->rodataSegSize;
+    memcpy(segPtrs[2], fileData + offset, hdr->dataSegSize - hdr->bssSize);
+    offset += hdr->dataSegSize - hdr->bssSize;
+
+    const _3DSX_Reloc *reloc = (const _3DSX_Reloc *)(fileData + offset);
+    for(u32 i = 0; i < 3; i++)
+    {
+        for(u32 j = 0; j < img->nRelocTables; j++)
+        {
+            u32 *pos = (u32 *)segPtrs[i], *endPos = pos + img->segSizes[i] / 4;
+
+            for(u32 k = 0; k < img->counts[i][j]; k++, reloc++)
+            {
+                if(j >= 2 || pos >= endPos) continue;
+
+                pos += reloc->skip;
+                for(u32 m = 0; m < reloc->patch && pos < endPos; m++, pos++)
+                {
+                    u32 inAddr = BASE_ADDR + 4 * (pos - pages), subType = *pos >> 28, addr = translateAddr(img, *pos & 0x0FFFFFFF);
+
+                    if(j == 0 && subType == 0) *pos = addr;
+                    else if(j == 1 && subType == 0) *pos = addr - inAddr;
+                    else if(j == 1 && subType == 1) *pos = (addr - inAddr) & 0x7FFFFFFF;
+                    else return false;
+                }
+            }
+        }
+    }
+
+    PrmStruct *pst = (PrmStruct *)&pages[1];
+    if(pst->magic == _PRM_MAGIC)
+    {
+        u32 extraPageAddr = BASE_ADDR + img->segSizes[0] + img->segSizes[1] + img->segSizes[2];
+        memset(extraPage, 0, 0x1000);
+        memcpy(extraPage, ldrArgvBuf, sizeof(ldrArgvBuf));
+        pst->pSrvOverride = extraPageAddr + 0xFFC;
+        pst->pArgList = extraPageAddr;
+        pst->runFlags |= RUNFLAG_APTCHAINLOAD;
+        pst->heapSize = 48 * 1024 * 1024;
+        pst->linearHeapSize = 64 * 1024 * 1024;
+    }
+
+    return true;
+}
+
+static u32 countSegmentReads(const Image *img)
+{
+    // A segment that ends on a page boundary is read together with the next one
+    return 1 + (img->hdr.codeSegSize != img->segSizes[0]) + (img->hdr.rodataSegSize != img->segSizes[1]);
+}
+
+int main(void)
+{
+    static u32 pages[(3 * (MAX_SEG_PAGES + 1) + 1) * 0x400], expected[(3 * (MAX_SEG_PAGES + 1) + 1) * 0x400];
+    u32 nbLoaded = 0, nbRefused = 0, nbPrm = 0;
+
+    for(u32 i = 0; i < ARGVBUF_SIZE / 4; i++) ldrArgvBuf[i] = checkRand();
+
+    for(u32 round = 0; round < 3000; round++)
+    {
+        Image img;
+        u32 totalSize;
+        bool badSubtype = round % 16 == 1;
+
+        buildImage(&img, badSubtype);
+
+        // Sometimes cut the file short
+        if(round % 16 == 2) fileSize = img.hdr.headerSize + checkRand() % (fileSize - img.hdr.headerSize);
+
+        CHECK(Ldr_Get3dsxSize(&totalSize, NULL));
+        CHECK(totalSize == img.segSizes[0] + img.segSizes[1] + img.segSizes[2] + 0x1000 && totalSize <= sizeof(pages));
+
+        // Both start from the same garbage, which relocations can hit past the end of a segment
+        for(u32 i = 0; i < totalSize / 4; i++) pages[i] = expected[i] = checkRand() & 0x0FFFFFFF;
+
+        bool ok = referenceLoad(&img, expected);
+        u32 codesetCalls = codeset.calls;
+
+        nbReads = 0;
+        Handle hCodeset = Ldr_CodesetFrom3dsx("3dsx_app", pages, BASE_ADDR, NULL, 0x000400000D921E00ULL);
+        CHECK((hCodeset != 0) == ok);
+
+        if(!ok)
+        {
+            nbRefused++;
+            CHECK(codeset.calls == codesetCalls);
+            continue;
+        }
+
+        nbLoaded++;
+        nbPrm += expected[1] == _PRM_MAGIC;
+        CHECK(memcmp(pages, expected, totalSize) == 0);
+
+        // Header, relocation headers, segments, then the relocation tables in chunks
+        CHECK(nbReads == 2 + countSegmentReads(&img) + (img.totalRelocs + MAXRELOCS - 1) / MAXRELOCS);
+
+        CHECK(codeset.calls == codesetCalls + 1 && hCodeset == 0xC0DE);
+        CHECK(memcmp(codeset.csh.name, "3dsx_app", 8) == 0 && codeset.csh.program_id == 0x000400000D921E00ULL);
+        CHECK(codeset.csh.text_addr == BASE_ADDR && codeset.csh.text_size == img.segSizes[0] >> 12);
+        CHECK(codeset.csh.ro_addr == BASE_ADDR + img.segSizes[0] && codeset.csh.ro_size == img.segSizes[1] >> 12);
+        CHECK(codeset.csh.rw_addr == BASE_ADDR + img.segSizes[0] + img.segSizes[1] && codeset.csh.rw_size == (img.segSizes[2] >> 12) + 1);
+        CHECK(codeset.codePtr == (u32)(uintptr_t)pages && codeset.roPtr == (u32)(uintptr_t)((u8 *)pages + img.segSizes[0]));
+    }
+
+    // Enough of each kind for the comparison to mean something
+    CHECK(nbLoaded > 1500 && nbRefused > 150 && nbPrm > 200);
+
+    return 0;
+}
@@ -0,0 +1,458 @@
+// loader: code cache, hit only when nothing that goes into the final code image changed
+
+#define VERSION_MAJOR   13
+#define VERSION_MINOR   0
+#define VERSION_BUILD   0
+#define COMMIT_HASH     0x12345678
+
+#include "check.h"
+
+#include "../sysmodules/loader/source/codecache.c"
+#include "../sysmodules/loader/source/strings.c"
+
+#define TITLE_ID        0x0004000000055D00ULL
+#define CACHE_PATH      "/luma/codecache/0004000000055D00.bin"
+#define TITLE_DIR       "/luma/titles/0004000000055D00/"
+#define CODE_SIZE       0x40000
+#define MAX_FILES       8
+#define TICKS_PER_LAUNCH (5 * SYSCLOCK_ARM11 / 1000)
+
+u32 config, multiConfig, bootConfig;
+bool isN3DS, isSdMode, nextGamePatchDisabled, isLumaWithKext;
+LayeredFsLayout layeredFsLayout;
+
+typedef struct FakeFile
+{
+    char path[64];
+    u8 *data;
+    u64 size, mtime;
+} FakeFile;
+
+static FakeFile files[MAX_FILES];
+static bool hasCodeCacheDir;
+static u32 nbOpenFiles, nbOpenArchives, titleOverrides, failingWrite, nbWrites;
+static u64 systemTick;
+
+static struct
+{
+    u32 calls;
+    LayeredFsLayout layout;
+    bool result;
+} patchCached = { .result = true };
+
+static FakeFile *findFile(const char *path)
+{
+    for(u32 i = 0; i < MAX_FILES; i++)
+    {
+        if(files[i].data != NULL && strcmp(files[i].path, path) == 0)
+            return &files[i];
+    }
+
+    return NULL;
+}
+
+static FakeFile *createFile(const char *path, u64 size)
+{
+    for(u32 i = 0; i < MAX_FILES; i++)
+    {
+        if(files[i].data == NULL)
+        {
+            CHECK(strlen(path) < sizeof(files[i].path));
+            strcpy(files[i].path, path);
+            files[i].data = calloc(1, size + 1);
+            files[i].size = size;
+            files[i].mtime = 1;
+            return &files[i];
+        }
+    }
+
+    CHECK(false);
+    return NULL;
+}
+
+static void deleteFile(const char *path)
+{
+    FakeFile *f = findFile(path);
+    if(f == NULL) return;
+
+    free(f->data);
+    memset(f, 0, sizeof(FakeFile));
+}
+
+static void resizeFile(FakeFile *f, u64 size)
+{
+    f->data = realloc(f->data, size + 1);
+    if(size > f->size) memset(f->data + f->size, 0, size - f->size);
+    f->size = size;
+}
+
+FS_Path fsMakePath(FS_PathType type, const void *path)
+{
+    return (FS_Path){ type, type == PATH_ASCII ? strlen(path) + 1 : 0, path };
+}
+
+Result FSUSER_OpenArchive(FS_Archive *archive, u32 id, FS_Path path)
+{
+    CHECK(id == (isSdMode ? ARCHIVE_SDMC : ARCHIVE_NAND_RW) && path.type == PATH_EMPTY);
+
+    *archive = 0xA5;
+    nbOpenArchives++;
+    return 0;
+}
+
+Result FSUSER_CloseArchive(FS_Archive archive)
+{
+    CHECK(archive == 0xA5 && nbOpenArchives == 1);
+    nbOpenArchives--;
+    return 0;
+}
+
+Result FSUSER_ControlArchive(FS_Archive archive, FS_ArchiveAction action, void *input, u32 inputSize, void *output, u32 outputSize)
+{
+    const u16 *path16 = input;
+    char path[64];
+    u32 i;
+
+    CHECK(archive == 0xA5 && action == ARCHIVE_ACTION_GET_TIMESTAMP && outputSize == sizeof(u64));
+    for(i = 0; path16[i] != 0; i++)
+    {
+        CHECK(i < sizeof(path) - 1 && path16[i] < 0x80);
+        path[i] = (char)path16[i];
+    }
+    path[i] = 0;
+    CHECK(inputSize == (i + 1) * sizeof(u16));
+
+    FakeFile *f = findFile(path);
+    if(f == NULL) return -1;
+
+    memcpy(output, &f->mtime, sizeof(u64));
+    return 0;
+}
+
+Result FSUSER_OpenDirectory(Handle *out, FS_Archive archive, FS_Path path)
+{
+    CHECK(archive == 0xA5 && path.type == PATH_ASCII && strcmp(path.data, "/luma/codecache") == 0);
+    if(!hasCodeCacheDir) return -1;
+
+    *out = 0xD1;
+    return 0;
+}
+
+Result FSDIR_Close(Handle handle)
+{
+    CHECK(handle == 0xD1);
+    return 0;
+}
+
+static Result openFakeFile(IFile *file, const char *path, u32 flags)
+{
+    FakeFile *f = findFile(path);
+
+    if(f == NULL)
+    {
+        if(!(flags & FS_OPEN_CREATE)) return -1;
+        f = createFile(path, 0);
+    }
+
+    memset(file, 0, sizeof(IFile));
+    file->handle = (Handle)(f - files) + 1;
+    nbOpenFiles++;
+    return 0;
+}
+
+static FakeFile *getFakeFile(IFile *file)
+{
+    CHECK(file->handle >= 1 && file->handle <= MAX_FILES && files[file->handle - 1].data != NULL);
+    return &files[file->handle - 1];
+}
+
+Result IFile_Open(IFile *file, FS_ArchiveID archiveId, FS_Path archivePath, FS_Path filePath, u32 flags)
+{
+    CHECK(archiveId == (isSdMode ? ARCHIVE_SDMC : ARCHIVE_NAND_RW) && archivePath.type == PATH_EMPTY && filePath.type == PATH_ASCII);
+    CHECK(strcmp(filePath.data, CACHE_PATH) == 0);
+    return openFakeFile(file, filePath.data, flags);
+}
+
+Result IFile_OpenFromArchive(IFile *file, FS_Archive archive, FS_Path filePath, u32 flags)
+{
+    CHECK(archive == 0xA5 && filePath.type == PATH_ASCII && flags == FS_OPEN_READ);
+    return openFakeFile(file, filePath.data, flags);
+}
+
+Result IFile_Close(IFile *file)
+{
+    getFakeFile(file);
+    CHECK(nbOpenFiles != 0);
+    nbOpenFiles--;
+    file->handle = 0;
+    return 0;
+}
+
+Result IFile_GetSize(IFile *file, u64 *size)
+{
+    *size = getFakeFile(file)->size;
+    return 0;
+}
+
+Result IFile_SetSize(IFile *file, u64 size)
+{
+    resizeFile(getFakeFile(file), size);
+    return 0;
+}
+
+Result IFile_Read(IFile *file, u64 *total, void *buffer, u32 len)
+{
+    FakeFile *f = getFakeFile(file);
+    u64 n = file->pos >= f->size ? 0 : f->size - file->pos;
+
+    if(n > len) n = len;
+    memcpy(buffer, f->data + file->pos, n);
+    file->pos += n;
+    *total = n;
+    return 0;
+}
+
+// failingWrite: 1-based index of the next write that fails, as if the console lost power
+Result IFile_Write(IFile *file, u64 *total, const void *buffer, u32 len, u32 flags)
+{
+    FakeFile *f = getFakeFile(file);
+    (void)flags;
+
+    nbWrites++;
+    if(failingWrite != 0 && --failingWrite == 0) return -1;
+
+    if(file->pos + len > f->size) resizeFile(f, file->pos + len);
+    memcpy(f->data + file->pos, buffer, len);
+    file->pos += len;
+    *total = len;
+    return 0;
+}
+
+u32 getTitleOverrides(u64 progId)
+{
+    CHECK(progId == TITLE_ID);
+    return titleOverrides;
+}
+
+bool patchCachedCode(u64 progId, u8 *code, u32 size, const LayeredFsLayout *layout)
+{
+    (void)code;
+    CHECK(progId == TITLE_ID && size == CODE_SIZE);
+    patchCached.calls++;
+    patchCached.layout = *layout;
+    return patchCached.result;
+}
+
+u64 svcGetSystemTick(void)
+{
+    return systemTick;
+}
+
+static ExHeader_Info exhi;
+static u8 image[CODE_SIZE], code[CODE_SIZE];
+
+static void randomize(void *buf, size_t size)
+{
+    for(size_t i = 0; i < size; i++)
+        ((u8 *)buf)[i] = (u8)checkRand();
+}
+
+// What the loader does: load from the cache, or patch the code and store it. Returns whether it was a hit
+static bool launch(u32 size)
+{
+    u32 callsBefore = patchCached.calls;
+    bool hit;
+
+    memset(code, 0, sizeof(code));
+    systemTick += TICKS_PER_LAUNCH;
+
+    hit = codeCacheLoad(&exhi, code, size, systemTick - TICKS_PER_LAUNCH);
+    if(!hit)
+    {
+        memcpy(code, image, size);
+        codeCacheStore(code, size, systemTick - TICKS_PER_LAUNCH);
+    }
+
+    CHECK(memcmp(code, image, size) == 0);
+    CHECK(patchCached.calls == callsBefore + (hit ? 1 : 0) || !patchCached.result);
+    CHECK(nbOpenFiles == 0 && nbOpenArchives == 0);
+    return hit;
+}
+
+static CodeCacheHeader *cachedHeader(void)
+{
+    FakeFile *f = findFile(CACHE_PATH);
+    CHECK(f != NULL && f->size >= sizeof(CodeCacheHeader));
+    return (CodeCacheHeader *)f->data;
+}
+
+// The launch after a change must miss and store the new image, the one after it must hit
+static void checkInvalidates(void)
+{
+    randomize(image, sizeof(image));
+    CHECK(!launch(CODE_SIZE));
+    CHECK(launch(CODE_SIZE));
+}
+
+static void toggleTitleFile(const char *name, u32 override)
+{
+    char path[64];
+    sprintf(path, TITLE_DIR "%s", name);
+
+    if(findFile(path) != NULL) deleteFile(path);
+    else createFile(path, checkRand() % 0x1000);
+
+    titleOverrides ^= override;
+}
+
+static void touchTitleFile(const char *name, u32 override, bool resize)
+{
+    char path[64];
+    sprintf(path, TITLE_DIR "%s", name);
+
+    FakeFile *f = findFile(path);
+    if(f == NULL)
+    {
+        f = createFile(path, 0x100);
+        titleOverrides |= override;
+    }
+
+    if(resize) resizeFile(f, f->size + 1 + checkRand() % 0x100);
+    else f->mtime++;
+}
+
+static void changeKeyInput(u32 which)
+{
+    switch(which)
+    {
+        case 0: config ^= 1u << (checkRand() % 32); break;
+        case 1: multiConfig ^= 1u << (checkRand() % 32); break;
+        case 2: bootConfig ^= 1u << (checkRand() % 32); break;
+        case 3: isN3DS = !isN3DS; break;
+        case 4: isLumaWithKext = !isLumaWithKext; break;
+        case 5:
+        {
+            // Anything but the title ID, which names the file
+            u32 offset;
+            do
+                offset = checkRand() % sizeof(exhi);
+            while(offset >= offsetof(ExHeader_Info, aci.local_caps.title_id) && offset < offsetof(ExHeader_Info, aci.local_caps.title_id) + 8);
+            ((u8 *)&exhi)[offset] ^= 1u << (checkRand() % 8);
+            break;
+        }
+        case 6: titleOverrides ^= TITLE_OVERRIDE_ROMFS; break;
+        case 7: touchTitleFile("code.bin", TITLE_OVERRIDE_CODE_BIN, false); break;
+        case 8: touchTitleFile("code.bin", TITLE_OVERRIDE_CODE_BIN, true); break;
+        case 9: touchTitleFile("code.ips", TITLE_OVERRIDE_CODE_IPS, false); break;
+        case 10: toggleTitleFile("code.ips", TITLE_OVERRIDE_CODE_IPS); break;
+        case 11: toggleTitleFile("code.bps", TITLE_OVERRIDE_CODE_BPS); break;
+        case 12: touchTitleFile("code.bps", TITLE_OVERRIDE_CODE_BPS, true); break;
+        default: CHECK(false);
+    }
+}
+
+int main(void)
+{
+    randomize(&exhi, sizeof(exhi));
+    exhi.aci.local_caps.title_id = TITLE_ID;
+    randomize(image, sizeof(image));
+
+    // Opt-in: nothing is cached without /luma/codecache
+    CHECK(!launch(CODE_SIZE) && !launch(CODE_SIZE));
+    CHECK(findFile(CACHE_PATH) == NULL);
+
+    hasCodeCacheDir = true;
+    layeredFsLayout = (LayeredFsLayout){ 0x1000, 0x2000, 0x800 };
+    CHECK(!launch(CODE_SIZE));
+    CHECK(findFile(CACHE_PATH)->size == sizeof(CodeCacheHeader) + CODE_SIZE);
+    CHECK(cachedHeader()->coldLaunchMsec == 5 && cachedHeader()->warmLaunchMsec == 0);
+
+    memset(&layeredFsLayout, 0, sizeof(layeredFsLayout));
+    CHECK(launch(CODE_SIZE) && launch(CODE_SIZE));
+    CHECK(memcmp(&patchCached.layout, &(LayeredFsLayout){ 0x1000, 0x2000, 0x800 }, sizeof(LayeredFsLayout)) == 0);
+    CHECK(cachedHeader()->warmLaunchMsec == 5);
+
+    // Only the first hit records its time, the next ones don't write
+    u32 writes = nbWrites;
+    CHECK(launch(CODE_SIZE) && launch(CODE_SIZE) && nbWrites == writes);
+
+    // The patch files are stamped even when the folder listing doesn't have them
+    createFile(TITLE_DIR "code.bps", 0x10);
+    checkInvalidates();
+    deleteFile(TITLE_DIR "code.bps");
+    checkInvalidates();
+
+    // The key has the build identity, a cache written by another Luma3DS build is stale
+    CHECK(cachedHeader()->key.lumaCommitHash == COMMIT_HASH && cachedHeader()->key.lumaVersionMajor == VERSION_MAJOR);
+    cachedHeader()->key.lumaCommitHash ^= 1;
+    checkInvalidates();
+    cachedHeader()->key.lumaVersionBuild++;
+    checkInvalidates();
+
+    // Every key input, then random ones
+    for(u32 which = 0; which <= 12; which++)
+    {
+        changeKeyInput(which);
+        checkInvalidates();
+    }
+    for(u32 round = 0; round < 300; round++)
+    {
+        changeKeyInput(checkRand() % 13);
+        checkInvalidates();
+
+        // What isn't part of the key doesn't
+        nextGamePatchDisabled = (checkRand() & 1) != 0;
+        CHECK(launch(CODE_SIZE));
+    }
+
+    // An empty patch file the archive has no timestamp for is still a change
+    deleteFile(TITLE_DIR "code.ips");
+    titleOverrides &= ~TITLE_OVERRIDE_CODE_IPS;
+    launch(CODE_SIZE);
+    CHECK(launch(CODE_SIZE));
+    createFile(TITLE_DIR "code.ips", 0)->mtime = 0;
+    titleOverrides |= TITLE_OVERRIDE_CODE_IPS;
+    checkInvalidates();
+
+    // The code size
+    CHECK(!launch(CODE_SIZE - 0x1000));
+    CHECK(!launch(CODE_SIZE));
+    CHECK(launch(CODE_SIZE));
+
+    // Damaged files
+    cachedHeader()->magic[0] = 0;
+    checkInvalidates();
+    cachedHeader()->formatVersion++;
+    checkInvalidates();
+    resizeFile(findFile(CACHE_PATH), sizeof(CodeCacheHeader) + CODE_SIZE / 2);
+    checkInvalidates();
+    resizeFile(findFile(CACHE_PATH), sizeof(CodeCacheHeader) / 2);
+    checkInvalidates();
+    cachedHeader()->layeredFs = (LayeredFsLayout){ 0x1000, CODE_SIZE - 0x400, 0x800 };
+    checkInvalidates();
+
+    // A cached image patchCachedCode refuses
+    u32 calls = patchCached.calls;
+    patchCached.result = false;
+    CHECK(!launch(CODE_SIZE) && !launch(CODE_SIZE));
+    CHECK(patchCached.calls == calls + 2);
+    patchCached.result = true;
+    CHECK(launch(CODE_SIZE));
+
+    // Stores interrupted at each write must not leave a file that hits
+    for(u32 write = 1; write <= 3; write++)
+    {
+        changeKeyInput(checkRand() % 13);
+        randomize(image, sizeof(image));
+        failingWrite = write;
+        CHECK(!launch(CODE_SIZE));
+        failingWrite = 0;
+        CHECK(!launch(CODE_SIZE));
+        CHECK(launch(CODE_SIZE));
+    }
+
+    for(u32 i = 0; i < MAX_FILES; i++)
+        free(files[i].data);
+
+    return 0;
+}
@@ -0,0 +1,1098 @@
+// loader: a title launch from /luma/titles overrides the way loadCode does it (exheader.bin, code.bin, then
+// patchCode with code.ips, locale.txt and LayeredFS), over a stub FS that serves a host directory as the SD card.
+// The check writes a few titles to a temporary directory and compares the code it gets with the edits each
+// override should make. Given a copy of an SD card, it replays the launch of every /luma/titles folder that has
+// an exheader.bin and a code.bin, or of the given title IDs, and reports each stage the way the launch timings
+// screen does, with the size of the code image and the peak memory use of the run:
+//   build/loader_launch <SD card root> [title ID]...
+// code.bps is left out: the BPS patcher is C++, it is stubbed to leave the code as is.
+
+// nftw is an XSI extension
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "check.h"
+
+// ifile.h has the console's
+#undef PATH_MAX
+
+// The payload offsets and the branches are worked out with casts between u32 and pointers, the low 32 bits are what matters
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpointer-to-int-cast"
+#pragma GCC diagnostic ignored "-Wint-to-pointer-cast"
+#include "../sysmodules/loader/source/patcher.c"
+#pragma GCC diagnostic pop
+#include "../sysmodules/loader/source/ifile.c"
+#include "../sysmodules/loader/source/layeredfs.c"
+#include "../sysmodules/loader/source/memory.c"
+#include "../sysmodules/loader/source/strings.c"
+#include "../common/launch_timings.h"
+
+#define MAX_HANDLES     16
+#define REPLAY_RUNS     5
+#define FS_NOT_FOUND    ((Result)0xC8804478)
+
+// romfsredir.s with its code replaced by filler, only where its variables are matters here
+__asm__(
+    ".pushsection .data\n"
+    ".balign 4\n"
+    ".global romfsRedirPatch\n"
+    "romfsRedirPatch:\n"
+    "    .long 0xEA000004\n"
+    ".global romfsRedirPatchSubstituted1\n"
+    "romfsRedirPatchSubstituted1: .long 0xdead0000\n"
+    ".global romfsRedirPatchHook1\n"
+    "romfsRedirPatchHook1: .long 0xdead0001\n"
+    "    .long 0xEA000016\n"
+    ".global romfsRedirPatchSubstituted2\n"
+    "romfsRedirPatchSubstituted2: .long 0xdead0002\n"
+    ".global romfsRedirPatchHook2\n"
+    "romfsRedirPatchHook2: .long 0xdead0003\n"
+    "    .fill 116, 4, 0xE1A00000\n"
+    ".global romfsRedirPatchArchiveName\n"
+    "romfsRedirPatchArchiveName: .ascii \"lf:\\0\"\n"
+    ".global romfsRedirPatchFsMountArchive\n"
+    "romfsRedirPatchFsMountArchive: .long 0xdead0005\n"
+    ".global romfsRedirPatchFsRegisterArchive\n"
+    "romfsRedirPatchFsRegisterArchive: .long 0xdead0006\n"
+    ".global romfsRedirPatchArchiveId\n"
+    "romfsRedirPatchArchiveId: .long 0xdead0007\n"
+    ".global romfsRedirPatchRomFsMount\n"
+    "romfsRedirPatchRomFsMount: .ascii \"rom:\"\n"
+    ".global romfsRedirPatchUpdateRomFsMount\n"
+    "romfsRedirPatchUpdateRomFsMount: .long 0xdead0008\n"
+    ".global romfsRedirPatchCustomPath\n"
+    "romfsRedirPatchCustomPath: .long 0xdead0004\n"
+    ".global romfsRedirPatchManifest\n"
+    "romfsRedirPatchManifest: .long 0xdead0009\n"
+    ".global romfsRedirPatchManifestMask\n"
+    "romfsRedirPatchManifestMask: .long 0\n"
+    "_romfsRedirPatchEnd:\n"
+    ".global romfsRedirPatchSize\n"
+    "romfsRedirPatchSize: .long _romfsRedirPatchEnd - romfsRedirPatch\n"
+    ".popsection\n"
+);
+
+u32 config, multiConfig, bootConfig;
+bool isN3DS, isSdMode, nextGamePatchDisabled, isLumaWithKext;
+
+static char sdRoot[256];
+
+static struct
+{
+    FILE *file;
+    DIR *dir;
+    bool isTitleDir;
+    char path[1024];
+} handles[MAX_HANDLES];
+static u32 nbOpenHandles, nbOpenArchives, titleDirReads, fileReads;
+static bool hasNoTimestamps;
+
+static u64 systemTick;
+static jmp_buf *breakTarget;
+static u8 *launchCode;
+static u32 kernelStateType, kernelState;
+static u64 kernelStateTitleId;
+
+bool patcherApplyCodeBpsPatch(u64 progId, u8 *code, u32 size)
+{
+    (void)progId; (void)code; (void)size;
+    return true;
+}
+
+u64 svcGetSystemTick(void)
+{
+    return systemTick;
+}
+
+void svcBreak(UserBreakType breakReason)
+{
+    if(breakTarget == NULL)
+    {
+        fprintf(stderr, "svcBreak(%d)\n", breakReason);
+        abort();
+    }
+
+    longjmp(*breakTarget, 1);
+}
+
+Result svcKernelSetState(u32 type, ...)
+{
+    va_list args;
+    va_start(args, type);
+    kernelStateType = type;
+    kernelState = va_arg(args, u32);
+    kernelStateTitleId = va_arg(args, u64);
+    va_end(args);
+    return 0;
+}
+
+static u64 nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// The console paths are ASCII or UTF-16, the host ones UTF-8 under the SD card root
+
+static char *putUtf8(char *p, u32 c)
+{
+    if(c < 0x80) *p++ = (char)c;
+    else if(c < 0x800)
+    {
+        *p++ = (char)(0xC0 | c >> 6);
+        *p++ = (char)(0x80 | (c & 0x3F));
+    }
+    else if(c < 0x10000)
+    {
+        *p++ = (char)(0xE0 | c >> 12);
+        *p++ = (char)(0x80 | (c >> 6 & 0x3F));
+        *p++ = (char)(0x80 | (c & 0x3F));
+    }
+    else
+    {
+        *p++ = (char)(0xF0 | c >> 18);
+        *p++ = (char)(0x80 | (c >> 12 & 0x3F));
+        *p++ = (char)(0x80 | (c >> 6 & 0x3F));
+        *p++ = (char)(0x80 | (c & 0x3F));
+    }
+
+    return p;
+}
+
+static void toHostPath(char *out, FS_Path path)
+{
+    char *p = out + sprintf(out, "%s", sdRoot);
+
+    if(path.type == PATH_ASCII)
+    {
+        CHECK(strlen(path.data) < 512);
+        strcpy(p, path.data);
+        return;
+    }
+
+    CHECK(path.type == PATH_UTF16);
+    for(const u16 *s = path.data; *s != 0; s++)
+    {
+        u32 c = *s;
+        if(c - 0xD800 < 0x400 && s[1] - 0xDC00u < 0x400)
+        {
+            c = 0x10000 + ((c - 0xD800) << 10) + (s[1] - 0xDC00);
+            s++;
+        }
+        CHECK(p - out < 1024 - 5);
+        p = putUtf8(p, c);
+    }
+    *p = 0;
+}
+
+// Returns the number of UTF-16 units written, 0 if the name doesn't fit
+static u32 toUtf16(u16 *out, u32 maxLength, const char *name)
+{
+    const u8 *s = (const u8 *)name;
+    u32 length = 0;
+
+    while(*s != 0)
+    {
+        u32 c = *s++;
+        if(c >= 0xF0) { c &= 0x07; c = c << 6 | (*s++ & 0x3F); c = c << 6 | (*s++ & 0x3F); c = c << 6 | (*s++ & 0x3F); }
+        else if(c >= 0xE0) { c &= 0x0F; c = c << 6 | (*s++ & 0x3F); c = c << 6 | (*s++ & 0x3F); }
+        else if(c >= 0xC0) { c &= 0x1F; c = c << 6 | (*s++ & 0x3F); }
+
+        if(length + 3 > maxLength) return 0;
+        if(c >= 0x10000)
+        {
+            out[length++] = (u16)(0xD800 + ((c - 0x10000) >> 10));
+            out[length++] = (u16)(0xDC00 + ((c - 0x10000) & 0x3FF));
+        }
+        else out[length++] = (u16)c;
+    }
+
+    out[length] = 0;
+    return length;
+}
+
+static Handle newHandle(FILE *file, DIR *dir, const char *path)
+{
+    for(u32 i = 0; i < MAX_HANDLES; i++)
+    {
+        if(handles[i].file == NULL && handles[i].dir == NULL)
+        {
+            handles[i].file = file;
+            handles[i].dir = dir;
+            handles[i].isTitleDir = dir != NULL && strstr(path + strlen(sdRoot), "/romfs") == NULL;
+            strcpy(handles[i].path, path);
+            nbOpenHandles++;
+            return 0x100 + i;
+        }
+    }
+
+    abort();
+}
+
+static FILE *getFile(Handle handle)
+{
+    CHECK(handle - 0x100 < MAX_HANDLES && handles[handle - 0x100].file != NULL);
+    return handles[handle - 0x100].file;
+}
+
+FS_Path fsMakePath(FS_PathType type, const void *path)
+{
+    u32 size = 0;
+
+    if(type == PATH_ASCII) size = strlen(path) + 1;
+    else if(type == PATH_UTF16)
+    {
+        const u16 *p;
+        for(p = path; *p != 0; p++);
+        size = (p - (const u16 *)path + 1) * 2;
+    }
+
+    return (FS_Path){ type, size, path };
+}
+
+Result FSUSER_OpenArchive(FS_Archive *archive, u32 id, FS_Path path)
+{
+    CHECK((id == ARCHIVE_SDMC || id == ARCHIVE_NAND_RW) && path.type == PATH_EMPTY);
+    *archive = id;
+    nbOpenArchives++;
+    return 0;
+}
+
+Result FSUSER_CloseArchive(FS_Archive archive)
+{
+    CHECK((archive == ARCHIVE_SDMC || archive == ARCHIVE_NAND_RW) && nbOpenArchives != 0);
+    nbOpenArchives--;
+    return 0;
+}
+
+Result FSUSER_ControlArchive(FS_Archive archive, FS_ArchiveAction action, void *input, u32 inputSize, void *output, u32 outputSize)
+{
+    char path[1024];
+    struct stat st;
+
+    CHECK(archive == ARCHIVE_SDMC || archive == ARCHIVE_NAND_RW);
+    CHECK(action == ARCHIVE_ACTION_GET_TIMESTAMP && outputSize == sizeof(u64));
+    toHostPath(path, (FS_Path){ PATH_UTF16, inputSize, input });
+    if(hasNoTimestamps) return -1;
+    if(stat(path, &st) != 0) return FS_NOT_FOUND;
+
+    *(u64 *)output = (u64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    return 0;
+}
+
+Result FSUSER_OpenDirectory(Handle *out, FS_Archive archive, FS_Path path)
+{
+    char hostPath[1024];
+
+    CHECK(archive == ARCHIVE_SDMC || archive == ARCHIVE_NAND_RW);
+    toHostPath(hostPath, path);
+    DIR *dir = opendir(hostPath);
+    if(dir == NULL) return FS_NOT_FOUND;
+
+    *out = newHandle(NULL, dir, hostPath);
+    return 0;
+}
+
+Result FSDIR_Read(Handle handle, u32 *entriesRead, u32 entryCount, FS_DirectoryEntry *entries)
+{
+    CHECK(handle - 0x100 < MAX_HANDLES && handles[handle - 0x100].dir != NULL);
+
+    u32 n = 0;
+    struct dirent *de;
+
+    if(handles[handle - 0x100].isTitleDir) titleDirReads++;
+
+    while(n < entryCount && (de = readdir(handles[handle - 0x100].dir)) != NULL)
+    {
+        char path[2048];
+        struct stat st;
+        FS_DirectoryEntry *entry = &entries[n];
+
+        if(strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+
+        memset(entry, 0, sizeof(FS_DirectoryEntry));
+        snprintf(path, sizeof(path), "%s/%s", handles[handle - 0x100].path, de->d_name);
+        if(stat(path, &st) != 0 || toUtf16(entry->name, sizeof(entry->name) / sizeof(u16) - 1, de->d_name) == 0) continue;
+
+        entry->attributes = S_ISDIR(st.st_mode) ? FS_ATTRIBUTE_DIRECTORY : 0;
+        entry->fileSize = S_ISDIR(st.st_mode) ? 0 : (u64)st.st_size;
+        n++;
+    }
+
+    *entriesRead = n;
+    return 0;
+}
+
+Result FSDIR_Close(Handle handle)
+{
+    CHECK(handle - 0x100 < MAX_HANDLES && handles[handle - 0x100].dir != NULL);
+    closedir(handles[handle - 0x100].dir);
+    handles[handle - 0x100].dir = NULL;
+    nbOpenHandles--;
+    return 0;
+}
+
+static Result openFile(Handle *out, FS_Path path, u32 openFlags)
+{
+    char hostPath[1024];
+    struct stat st;
+
+    // A launch only reads
+    CHECK(openFlags == FS_OPEN_READ);
+    toHostPath(hostPath, path);
+    if(stat(hostPath, &st) != 0 || !S_ISREG(st.st_mode)) return FS_NOT_FOUND;
+
+    FILE *f = fopen(hostPath, "rb");
+    if(f == NULL) return FS_NOT_FOUND;
+
+    *out = newHandle(f, NULL, hostPath);
+    return 0;
+}
+
+Result FSUSER_OpenFileDirectly(Handle *out, FS_ArchiveID archiveId, FS_Path archivePath, FS_Path filePath, u32 openFlags, u32 attributes)
+{
+    CHECK((archiveId == ARCHIVE_SDMC || archiveId == ARCHIVE_NAND_RW) && archivePath.type == PATH_EMPTY && attributes == 0);
+    return openFile(out, filePath, openFlags);
+}
+
+Result FSUSER_OpenFile(Handle *out, FS_Archive archive, FS_Path path, u32 openFlags, u32 attributes)
+{
+    CHECK((archive == ARCHIVE_SDMC || archive == ARCHIVE_NAND_RW) && attributes == 0);
+    return openFile(out, path, openFlags);
+}
+
+Result FSFILE_Read(Handle handle, u32 *bytesRead, u64 offset, void *buffer, u32 size)
+{
+    FILE *f = getFile(handle);
+
+    fileReads++;
+    CHECK(fseeko(f, (off_t)offset, SEEK_SET) == 0);
+    *bytesRead = (u32)fread(buffer, 1, size, f);
+    return ferror(f) ? -1 : 0;
+}
+
+Result FSFILE_GetSize(Handle handle, u64 *size)
+{
+    struct stat st;
+
+    CHECK(fstat(fileno(getFile(handle)), &st) == 0);
+    *size = (u64)st.st_size;
+    return 0;
+}
+
+Result FSFILE_Write(Handle handle, u32 *bytesWritten, u64 offset, const void *buffer, u32 size, u32 flags)
+{
+    (void)handle; (void)bytesWritten; (void)offset; (void)buffer; (void)size; (void)flags;
+    abort();
+}
+
+Result FSFILE_SetSize(Handle handle, u64 size)
+{
+    (void)handle; (void)size;
+    abort();
+}
+
+Result FSFILE_Close(Handle handle)
+{
+    fclose(getFile(handle));
+    handles[handle - 0x100].file = NULL;
+    nbOpenHandles--;
+    return 0;
+}
+
+// What LoadProcessImpl and loadCode do for a title with a code.bin override, timed the same way.
+// Returns the code image, NULL if the exheader.bin or the code.bin is missing
+static u8 *launchTitle(u64 titleId, ExHeader_Info *exhi, LaunchTimings *timings)
+{
+    IFileReadStats startReadStats, readStats;
+
+    // A new launch, getTitleOverrides looks at the folder again
+    systemTick += TITLE_OVERRIDES_RECHECK_TICKS;
+
+    memset(timings, 0, sizeof(LaunchTimings));
+    timings->titleId = titleId;
+    IFile_GetReadStats(&startReadStats);
+    u64 startNs = nowNs();
+
+    if(!loadTitleExheaderInfo(titleId, exhi)) return NULL;
+
+    const ExHeader_CodeSetInfo *csi = &exhi->sci.codeset_info;
+    u32 size = ((csi->text.size + 4095) & ~4095) + ((csi->rodata.size + 4095) & ~4095) + ((csi->data.size + 4095) & ~4095);
+    u8 *code = launchCode = aligned_alloc(0x1000, size);
+    CHECK(code != NULL);
+    memset(code, 0, size);
+    timings->codeSize = size;
+
+    u64 loadNs = nowNs();
+    if(!loadTitleCodeSection(titleId, code, size))
+    {
+        free(code);
+        return NULL;
+    }
+
+    u64 patchNs = nowNs();
+    patchCode(titleId, csi->flags.remaster_version, code, size, csi->text.size, csi->rodata.size, csi->data.size, csi->rodata.address, csi->data.address);
+
+    u64 endNs = nowNs();
+    timings->patchUsec = (u32)((endNs - patchNs) / 1000);
+    timings->loadCodeUsec = (u32)((endNs - loadNs) / 1000);
+    timings->totalUsec = (u32)((endNs - startNs) / 1000);
+
+    IFile_GetReadStats(&readStats);
+    timings->readCalls = readStats.calls - startReadStats.calls;
+    timings->fsReadCalls = readStats.fsCalls - startReadStats.fsCalls;
+
+    CHECK(nbOpenHandles == 0 && nbOpenArchives == 0);
+    return code;
+}
+
+static void writeFile(const char *path, const void *data, u32 size)
+{
+    char hostPath[1024];
+    sprintf(hostPath, "%s%s", sdRoot, path);
+
+    // Create the folders on the way
+    for(char *p = hostPath + strlen(sdRoot) + 1; (p = strchr(p, '/')) != NULL; p++)
+    {
+        *p = 0;
+        CHECK(mkdir(hostPath, 0755) == 0 || errno == EEXIST);
+        *p = '/';
+    }
+
+    FILE *f = fopen(hostPath, "wb");
+    CHECK(f != NULL && fwrite(data, 1, size, f) == size);
+    fclose(f);
+}
+
+static int removeEntry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    (void)st; (void)flag; (void)ftw;
+    return remove(path);
+}
+
+static void writeExheader(u64 titleId, u32 textSize, u32 roSize, u32 dataSize)
+{
+    static ExHeader_Info exhi;
+    char path[] = "/luma/titles/0000000000000000/exheader.bin";
+    progIdToStr(path + 28, titleId);
+
+    memset(&exhi, 0, sizeof(exhi));
+    ExHeader_CodeSetInfo *csi = &exhi.sci.codeset_info;
+    csi->text = (ExHeader_CodeSectionInfo){ 0x100000, (textSize + 4095) >> 12, textSize };
+    csi->rodata = (ExHeader_CodeSectionInfo){ 0x100000 + ((textSize + 4095) & ~4095), (roSize + 4095) >> 12, roSize };
+    csi->data = (ExHeader_CodeSectionInfo){ csi->rodata.address + ((roSize + 4095) & ~4095), (dataSize + 4095) >> 12, dataSize };
+    csi->bss_size = 0x1000;
+    exhi.aci.local_caps.title_id = titleId;
+    writeFile(path, &exhi, sizeof(exhi));
+}
+
+// Random records over [from, to), applied to ref as they are written
+static u32 makeIps(u8 *ips, u8 *ref, u32 from, u32 to, u32 nbRecords)
+{
+    u32 n = 0;
+
+    memcpy(ips, "PATCH", 5);
+    n += 5;
+
+    for(u32 i = 0; i < nbRecords; i++)
+    {
+        bool isRle = checkRand() % 8 == 0;
+        u32 size = isRle ? 1 + checkRand() % 32 : 1 + checkRand() % 8,
+            offset = from + checkRand() % (to - from - size);
+
+        ips[n++] = (u8)(offset >> 16);
+        ips[n++] = (u8)(offset >> 8);
+        ips[n++] = (u8)offset;
+
+        if(isRle)
+        {
+            u8 value = (u8)checkRand();
+            ips[n++] = 0;
+            ips[n++] = 0;
+            ips[n++] = (u8)(size >> 8);
+            ips[n++] = (u8)size;
+            ips[n++] = value;
+            memset(ref + offset, value, size);
+        }
+        else
+        {
+            ips[n++] = (u8)(size >> 8);
+            ips[n++] = (u8)size;
+            for(u32 j = 0; j < size; j++)
+                ips[n++] = ref[offset + j] = (u8)checkRand();
+        }
+    }
+
+    memcpy(ips + n, "EOF", 3);
+    return n + 3;
+}
+
+// ARM B, written out rather than with MAKE_BRANCH
+static u32 armBranch(u32 src, u32 dst)
+{
+    return 0xEA000000 | ((((dst - src) >> 2) - 2) & 0xFFFFFF);
+}
+
+static u32 payloadWord(const u8 *payload, const void *symbol)
+{
+    return *(const u32 *)(payload + ((const u8 *)symbol - romfsRedirPatch));
+}
+
+// What a code cache hit does with the image patchCode gave: the manifest and its mask are rebuilt
+// where the layout says, a layout that doesn't match the payload leaves the image as is
+static void checkCachedCode(u64 titleId, const u8 *code, u32 codeSize)
+{
+    static u8 image[0x9000], ref[0x9000];
+    const LayeredFsLayout good = layeredFsLayout;
+    u32 maskOffset = good.payloadOffset + ((const u8 *)&romfsRedirPatchManifestMask - romfsRedirPatch);
+
+    CHECK(codeSize <= sizeof(image));
+    memcpy(ref, code, codeSize);
+    memset(ref + good.manifestOffset, 0, good.manifestSize);
+    *(u32 *)(ref + maskOffset) = 0;
+
+    const LayeredFsLayout bad[] = {
+        { good.payloadOffset + 4, good.manifestOffset, good.manifestSize },
+        { good.payloadOffset + 2, good.manifestOffset, good.manifestSize },
+        { good.payloadOffset, good.manifestOffset + 4, good.manifestSize },
+        { good.payloadOffset, good.manifestOffset, good.manifestSize + 1 },
+        { codeSize - romfsRedirPatchSize + 4, good.manifestOffset, good.manifestSize },
+        { codeSize + 4, good.manifestOffset, good.manifestSize },
+        { 0xFFFFFFFC, good.manifestOffset, good.manifestSize },
+    };
+    for(u32 i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+    {
+        memcpy(image, ref, codeSize);
+        nextGamePatchDisabled = true;
+        CHECK(!patchCachedCode(titleId, image, codeSize, &bad[i]));
+        CHECK(memcmp(image, ref, codeSize) == 0 && nextGamePatchDisabled);
+    }
+
+    // A payload or a manifest past the end of the image, with the payload pointing at the manifest
+    u32 pointerOffset = (const u8 *)&romfsRedirPatchManifest - romfsRedirPatch;
+    const LayeredFsLayout outside[] = {
+        { codeSize - romfsRedirPatchSize + 4, good.manifestOffset, good.manifestSize },
+        { good.payloadOffset, codeSize - 0x400, good.manifestSize },
+        { good.payloadOffset, 0xFFFFF000, 0x2000 },
+    };
+    for(u32 i = 0; i < sizeof(outside) / sizeof(outside[0]); i++)
+    {
+        memcpy(image, ref, codeSize);
+        *(u32 *)(image + outside[i].payloadOffset + pointerOffset) = 0x100000 + outside[i].manifestOffset;
+        CHECK(!patchCachedCode(titleId, image, codeSize, &outside[i]));
+    }
+
+    memcpy(image, ref, codeSize);
+    nextGamePatchDisabled = true;
+    kernelStateType = 0;
+    CHECK(patchCachedCode(titleId, image, codeSize, &good));
+    CHECK(memcmp(image, code, codeSize) == 0 && !nextGamePatchDisabled);
+    CHECK(kernelStateType == 0x10001 && kernelStateTitleId == titleId);
+
+    // Without LayeredFS only the locale is set again
+    memcpy(image, ref, codeSize);
+    CHECK(patchCachedCode(titleId, image, codeSize, &(LayeredFsLayout){ 0 }));
+    CHECK(memcmp(image, ref, codeSize) == 0);
+}
+
+// An application with code.ips, locale.txt and a romfs folder. Its .text has the four functions
+// LayeredFS hooks and enough padding for the payload, its .rodata doesn't have room for the path
+static void checkLayeredFsTitle(void)
+{
+    static const u64 titleId = 0x0004000000123400;
+    static const u32 textSize = 0x5100, roSize = 0x1FE0, dataSize = 0xF00, codeSize = 0x9000;
+    static const char *romfsFiles[] = { "/a.bin", "/Sub/B.txt", "/sub2/deep/c" };
+    static u8 image[0x9000], ref[0x9000], ips[0x4000];
+    static ExHeader_Info exhi;
+    char path[64];
+
+    for(u32 i = 0x500; i < textSize; i++) image[i] = (u8)checkRand();
+    for(u32 i = 0x6000; i < 0x6000 + roSize; i++) image[i] = (u8)checkRand() | 0x80;
+    for(u32 i = 0x8000; i < 0x8000 + dataSize; i++) image[i] = (u8)checkRand();
+    memcpy(image + 0x6100, "\0patch:", 8);
+
+    static const struct { u32 offset, words[16]; } functions[] = {
+        { 0x100, { 0xE92D4070, 0xE5970010, 0xE1CD20D8, 0xE58D0000 } },     // fsMountArchive
+        { 0x200, { 0xE92D4FF0, 0xE3500008, 0xE1810401, 0xE1820FC3 } },     // fsRegisterArchive
+        { 0x300, { 0xE92D41F0, 0xE351003A, 0x1AFFFFFC, [14] = 0xE590C000 } }, // fsTryOpenFile, the rest below
+        { 0x400, { 0xE92D40F8, 0x08030204 } },                             // fsOpenFileDirectly
+    };
+    for(u32 i = 0; i < sizeof(functions) / sizeof(functions[0]); i++)
+        memcpy(image + functions[i].offset, functions[i].words, sizeof(functions[i].words));
+    *(u32 *)(image + 0x304 + 0xF * 4) = 0xE12FFF3C;
+
+    memcpy(ref, image, codeSize);
+    u32 ipsSize = makeIps(ips, ref, 0x1000, textSize, 1200);
+
+    sprintf(path, "/luma/titles/%016llX/code.bin", (unsigned long long)titleId);
+    writeFile(path, image, 0x8000 + dataSize);
+    sprintf(path, "/luma/titles/%016llX/code.ips", (unsigned long long)titleId);
+    writeFile(path, ips, ipsSize);
+    sprintf(path, "/luma/titles/%016llX/locale.txt", (unsigned long long)titleId);
+    writeFile(path, "USA EN", 6);
+    for(u32 i = 0; i < sizeof(romfsFiles) / sizeof(romfsFiles[0]); i++)
+    {
+        sprintf(path, "/luma/titles/%016llX/romfs%s", (unsigned long long)titleId, romfsFiles[i]);
+        writeFile(path, romfsFiles[i], 1);
+    }
+    writeExheader(titleId, textSize, roSize, dataSize);
+
+    LaunchTimings timings;
+    u8 *code = launchTitle(titleId, &exhi, &timings);
+    CHECK(code != NULL && timings.codeSize == codeSize);
+
+    // locale.txt
+    CHECK(kernelStateType == 0x10001 && kernelState == (1 << 8 | 1 << 4 | 3) && kernelStateTitleId == titleId);
+
+    // Where the payload, its manifest and the path went
+    u32 payloadOffset = textSize,
+        manifestOffset = (payloadOffset + romfsRedirPatchSize + 3) & ~3,
+        manifestSize = 0x800,
+        pathOffset = 0x8000 + dataSize;
+    CHECK(manifestOffset + manifestSize <= 0x6000 && manifestOffset + 2 * manifestSize > 0x6000);
+    CHECK(layeredFsLayout.payloadOffset == payloadOffset && layeredFsLayout.manifestOffset == manifestOffset && layeredFsLayout.manifestSize == manifestSize);
+
+    const u8 *payload = code + payloadOffset;
+    CHECK(memcmp(payload, romfsRedirPatch, romfsRedirPatchSize) == 0);
+    CHECK(payloadWord(payload, &romfsRedirPatchSubstituted1) == 0xE92D40F8);
+    CHECK(payloadWord(payload, &romfsRedirPatchHook1) == armBranch(payloadOffset + 8, 0x404));
+    CHECK(payloadWord(payload, &romfsRedirPatchSubstituted2) == 0xE92D41F0);
+    CHECK(payloadWord(payload, &romfsRedirPatchHook2) == armBranch(payloadOffset + 20, 0x304));
+    CHECK(payloadWord(payload, &romfsRedirPatchFsMountArchive) == 0x100100);
+    CHECK(payloadWord(payload, &romfsRedirPatchFsRegisterArchive) == 0x100200);
+    CHECK(payloadWord(payload, &romfsRedirPatchArchiveId) == ARCHIVE_SDMC);
+    CHECK(memcmp(payload + ((const u8 *)&romfsRedirPatchUpdateRomFsMount - romfsRedirPatch), "patc", 4) == 0);
+    CHECK(payloadWord(payload, &romfsRedirPatchCustomPath) == 0x108000 + dataSize);
+    CHECK(payloadWord(payload, &romfsRedirPatchManifest) == 0x100000 + manifestOffset);
+    CHECK(payloadWord(payload, &romfsRedirPatchManifestMask) == manifestSize * 8 - 1);
+
+    // Every romfs file is in the manifest
+    const u32 *manifest = (const u32 *)(code + manifestOffset);
+    for(u32 i = 0; i < sizeof(romfsFiles) / sizeof(romfsFiles[0]); i++)
+    {
+        u16 path16[32];
+        CHECK(toUtf16(path16, 31, romfsFiles[i]) != 0);
+
+        u32 hash = hashLayeredFsPath(path16),
+            bit1 = hash & (manifestSize * 8 - 1),
+            bit2 = ((hash >> 16) | (hash << 16)) & (manifestSize * 8 - 1);
+        CHECK((manifest[bit1 >> 5] >> (bit1 & 31) & 1) && (manifest[bit2 >> 5] >> (bit2 & 31) & 1));
+    }
+
+    // Everything else is code.bin with code.ips applied, and the two hooks and the path
+    sprintf(path, "lf:/luma/titles/%016llX/romfs", (unsigned long long)titleId);
+    memcpy(ref + pathOffset, path, strlen(path) + 1);
+    *(u32 *)(ref + 0x400) = armBranch(0x400, payloadOffset);
+    *(u32 *)(ref + 0x300) = armBranch(0x300, payloadOffset + 12);
+    memcpy(ref + payloadOffset, payload, manifestOffset + manifestSize - payloadOffset);
+    CHECK(memcmp(code, ref, codeSize) == 0);
+
+    // The readahead buffer takes the IPS records in a few requests
+    CHECK(timings.readCalls > 2000 && timings.fsReadCalls * 20 < timings.readCalls);
+
+    // A second launch gets the same code, listing the title folder once: one batch and the read that ends it
+    u32 dirReads = titleDirReads;
+    u8 *again = launchTitle(titleId, &exhi, &timings);
+    CHECK(again != NULL && memcmp(again, code, codeSize) == 0 && titleDirReads == dirReads + 2);
+
+    checkCachedCode(titleId, code, codeSize);
+
+    printf("launch: LayeredFS title, code.ips of %u records: patchCode %u us, %u reads -> %u FS reads (host, %s)\n",
+           1200, timings.patchUsec, timings.readCalls, timings.fsReadCalls, CHECK_BUILD_FLAGS);
+
+    free(again);
+    free(code);
+}
+
+// A sysmodule patched from /luma/sysmodules, found under its Old 3DS title ID
+static void checkSysmoduleTitle(void)
+{
+    static const u64 titleId = 0x0004013020009902;
+    static const u32 textSize = 0x3000, roSize = 0x1000, dataSize = 0x800, codeSize = 0x5000;
+    static u8 image[0x5000], ref[0x5000], ips[0x2000];
+    static ExHeader_Info exhi;
+    char path[64];
+
+    for(u32 i = 0; i < 0x4000 + dataSize; i++) image[i] = (u8)checkRand();
+    memcpy(ref, image, codeSize);
+    u32 ipsSize = makeIps(ips, ref, 0, codeSize, 300);
+
+    sprintf(path, "/luma/titles/%016llX/code.bin", (unsigned long long)titleId);
+    writeFile(path, image, 0x4000 + dataSize);
+    writeFile("/luma/sysmodules/0004013000009902.ips", ips, ipsSize);
+    writeExheader(titleId, textSize, roSize, dataSize);
+
+    LaunchTimings timings;
+    u8 *code = launchTitle(titleId, &exhi, &timings);
+    CHECK(code != NULL && memcmp(code, ref, codeSize) == 0);
+    CHECK(layeredFsLayout.payloadOffset == 0 && layeredFsLayout.manifestSize == 0);
+    free(code);
+
+    // Without "load external FIRMs and modules", only the code.bin is taken
+    config &= ~BIT(LOADEXTFIRMSANDMODULES);
+    code = launchTitle(titleId, &exhi, &timings);
+    CHECK(code != NULL && memcmp(code, image, codeSize) == 0);
+    config |= BIT(LOADEXTFIRMSANDMODULES);
+    free(code);
+}
+
+// An application with only a code.bin: patchCode leaves it as is
+static void checkPlainTitle(void)
+{
+    static const u64 titleId = 0x0004000000567800;
+    static u8 image[0x3000];
+    static ExHeader_Info exhi;
+    char path[64];
+
+    for(u32 i = 0; i < sizeof(image); i++) image[i] = (u8)checkRand();
+    sprintf(path, "/luma/titles/%016llX/code.bin", (unsigned long long)titleId);
+    writeFile(path, image, sizeof(image));
+    writeExheader(titleId, 0x1000, 0x1000, 0x1000);
+
+    LaunchTimings timings;
+    u8 *code = launchTitle(titleId, &exhi, &timings);
+    CHECK(code != NULL && memcmp(code, image, sizeof(image)) == 0);
+    CHECK(layeredFsLayout.payloadOffset == 0 && timings.readCalls == 2);
+    free(code);
+
+    // A code.ips added since is taken on the next launch, whatever the folder's timestamp says
+    static u8 ref[0x3000], ips[0x400];
+    memcpy(ref, image, sizeof(image));
+    u32 ipsSize = makeIps(ips, ref, 0, sizeof(ref), 40);
+    sprintf(path, "/luma/titles/%016llX/code.ips", (unsigned long long)titleId);
+    writeFile(path, ips, ipsSize);
+    code = launchTitle(titleId, &exhi, &timings);
+    CHECK(code != NULL && memcmp(code, ref, sizeof(ref)) == 0);
+    free(code);
+
+    // No folder at all
+    CHECK(launchTitle(0x0004000000999900, &exhi, &timings) == NULL);
+}
+
+// A /luma/sysmodules .cxi: exheader filled with the marker, the ExeFS at exeFsOffset with .code at codeIndex (none if negative).
+// Returns the size of the file
+static u32 writeCxi(u64 titleId, u32 unitShift, u32 exeFsOffset, s32 codeIndex, u32 codeSize, u8 marker, u8 *code)
+{
+    static u8 cxi[0x8000];
+    char path[64];
+    u32 size = exeFsOffset + sizeof(ExeFsHeader) + codeSize;
+
+    CHECK(size <= sizeof(cxi) && exeFsOffset % (1u << unitShift) == 0);
+    memset(cxi, 0, size);
+
+    Ncch *ncch = (Ncch *)cxi;
+    memcpy(ncch->magic, "NCCH", 4);
+    ncch->exHeaderSize = sizeof(ExHeader_Info);
+    ncch->flags[6] = (u8)(unitShift - 9);
+    ncch->exeFsOffset = exeFsOffset >> unitShift;
+    ncch->exeFsSize = (sizeof(ExeFsHeader) + codeSize + (1u << unitShift) - 1) >> unitShift;
+
+    ExHeader_Info *exhi = (ExHeader_Info *)(cxi + sizeof(Ncch));
+    memset(exhi, marker, sizeof(ExHeader_Info));
+    exhi->aci.local_caps.title_id = titleId;
+
+    ExeFsHeader *exeFs = (ExeFsHeader *)(cxi + exeFsOffset);
+    memcpy(exeFs->fileHeaders[0].name, "icon", 4);
+    exeFs->fileHeaders[0].size = 0x10;
+    if(codeIndex >= 0)
+    {
+        memcpy(exeFs->fileHeaders[codeIndex].name, ".code", 5);
+        exeFs->fileHeaders[codeIndex].offset = 0x10;
+        exeFs->fileHeaders[codeIndex].size = codeSize - 0x10;
+    }
+
+    for(u32 i = 0; i < codeSize; i++) cxi[exeFsOffset + sizeof(ExeFsHeader) + i] = (u8)checkRand();
+    if(code != NULL) memcpy(code, cxi + exeFsOffset + sizeof(ExeFsHeader) + 0x10, codeSize - 0x10);
+
+    sprintf(path, "/luma/sysmodules/%016llX.cxi", (unsigned long long)(titleId & ~0xF0000000ull));
+    writeFile(path, cxi, size);
+    return size;
+}
+
+// The host clock is coarse, each edit in place is given a timestamp of its own
+static void setCxiTimestamp(u64 titleId, time_t seconds)
+{
+    char path[1024];
+    sprintf(path, "%s/luma/sysmodules/%016llX.cxi", sdRoot, (unsigned long long)(titleId & ~0xF0000000ull));
+
+    struct timespec times[2] = { { seconds, 0 }, { seconds, 0 } };
+    CHECK(utimensat(AT_FDCWD, path, times, 0) == 0);
+}
+
+// Opens the .cxi the way RegisterProgram does and gets its headers, with the number of file reads that took
+static const SysmoduleCxiHeaders *readCxiHeaders(u64 titleId, IFile *file, u32 *reads)
+{
+    CHECK(R_SUCCEEDED(openSysmoduleCxi(file, titleId)));
+
+    u32 readsBefore = fileReads;
+    const SysmoduleCxiHeaders *headers = readSysmoduleCxiHeaders(file, titleId);
+    *reads = fileReads - readsBefore;
+    return headers;
+}
+
+static void checkCxiHeaders(u64 titleId, u32 unitShift, u32 exeFsOffset, u32 expectedReads)
+{
+    static u8 code[0x2000], out[0x2000];
+    const u32 codeSize = 0x1800;
+    IFile file;
+    u32 reads;
+
+    writeCxi(titleId, unitShift, exeFsOffset, 3, codeSize, 0x5A, code);
+    setCxiTimestamp(titleId, 1000);
+
+    const SysmoduleCxiHeaders *headers = readCxiHeaders(titleId, &file, &reads);
+    CHECK(headers != NULL && reads == expectedReads);
+    CHECK(memcmp(headers->ncch.magic, "NCCH", 4) == 0 && headers->exeFsOffset == exeFsOffset);
+    CHECK(headers->exheaderInfo.aci.local_caps.title_id == titleId && headers->exheaderInfo.sci.codeset_info.stack_size == 0x5A5A5A5A);
+    CHECK(strcmp(headers->codeHeader.name, ".code") == 0 && headers->codeHeader.offset == 0x10 && headers->codeHeader.size == codeSize - 0x10);
+
+    u32 size;
+    CHECK(readSysmoduleCxiCode(out, &size, sizeof(out), &file, headers) && size == codeSize - 0x10 && memcmp(out, code, size) == 0);
+    CHECK(!readSysmoduleCxiCode(out, &size, codeSize - 0x11, &file, headers));
+    IFile_Close(&file);
+}
+
+// readSysmoduleCxiHeaders: the NCCH header, the exheader and the ExeFS header in one read when they are back to back,
+// a second one for the ExeFS header otherwise. The parsed headers are kept for the last few .cxi launched
+static void checkSysmoduleCxi(void)
+{
+    static const u64 titleIds[] = { 0x0004013000001502, 0x0004013000001602, 0x0004013000001702, 0x0004013000001802, 0x0004013000001902 };
+    IFile file;
+    u32 reads;
+
+    checkCxiHeaders(0x0004013000001002, 9, 0xA00, 1);
+    checkCxiHeaders(0x0004013000001102, 9, 0x2000, 2);
+    checkCxiHeaders(0x0004013000001202, 10, 0xC00, 2);
+
+    // The N3DS title ID gets the same file, and the headers parsed for it
+    const SysmoduleCxiHeaders *headers = readCxiHeaders(0x0004013020001002, &file, &reads);
+    CHECK(headers != NULL && reads == 0 && headers->exheaderInfo.aci.local_caps.title_id == 0x0004013000001002);
+    IFile_Close(&file);
+
+    // An edit in place, same size but another timestamp
+    writeCxi(0x0004013000001002, 9, 0xA00, 3, 0x1800, 0x33, NULL);
+    setCxiTimestamp(0x0004013000001002, 1002);
+    headers = readCxiHeaders(0x0004013000001002, &file, &reads);
+    CHECK(headers != NULL && reads == 1 && headers->exheaderInfo.sci.codeset_info.stack_size == 0x33333333);
+    IFile_Close(&file);
+
+    // Without timestamps nothing is taken from the cache
+    hasNoTimestamps = true;
+    for(u32 i = 0; i < 2; i++)
+    {
+        headers = readCxiHeaders(0x0004013000001002, &file, &reads);
+        CHECK(headers != NULL && reads == 1);
+        IFile_Close(&file);
+    }
+    hasNoTimestamps = false;
+
+    // No .code, no ExeFS: the headers, but no code to load
+    u8 out[0x100];
+    u32 size;
+    writeCxi(0x0004013000001302, 9, 0xA00, -1, 0x100, 0, NULL);
+    headers = readCxiHeaders(0x0004013000001302, &file, &reads);
+    CHECK(headers != NULL && headers->codeHeader.name[0] == 0 && !readSysmoduleCxiCode(out, &size, sizeof(out), &file, headers));
+    IFile_Close(&file);
+
+    // Truncated files and a short exheader are refused, and the refusal isn't cached
+    static const u32 truncatedSizes[] = { 0x100, sizeof(Ncch) + sizeof(ExHeader_Info) - 1 };
+    char path[1024];
+    sprintf(path, "%s/luma/sysmodules/0004013000001402.cxi", sdRoot);
+    for(u32 i = 0; i < sizeof(truncatedSizes) / sizeof(truncatedSizes[0]); i++)
+    {
+        writeCxi(0x0004013000001402, 9, 0xA00, 3, 0x100, 0, NULL);
+        CHECK(truncate(path, truncatedSizes[i]) == 0);
+        CHECK(readCxiHeaders(0x0004013000001402, &file, &reads) == NULL);
+        IFile_Close(&file);
+    }
+
+    for(u32 exHeaderSize = 0x200; exHeaderSize <= 0x400; exHeaderSize += 0x200)
+    {
+        writeCxi(0x0004013000001402, 9, 0xA00, 3, 0x100, 0, NULL);
+        FILE *f = fopen(path, "r+b");
+        CHECK(f != NULL && fseek(f, offsetof(Ncch, exHeaderSize), SEEK_SET) == 0 && fwrite(&exHeaderSize, 4, 1, f) == 1);
+        fclose(f);
+        setCxiTimestamp(0x0004013000001402, 2000);
+
+        headers = readCxiHeaders(0x0004013000001402, &file, &reads);
+        CHECK((headers != NULL) == (exHeaderSize == 0x400) && reads == 1);
+        IFile_Close(&file);
+    }
+
+    // Least recently used first: the fifth .cxi replaces the one not launched for the longest
+    for(u32 i = 0; i < 4; i++)
+    {
+        writeCxi(titleIds[i], 9, 0xA00, 3, 0x100, (u8)i, NULL);
+        CHECK(readCxiHeaders(titleIds[i], &file, &reads) != NULL && reads == 1);
+        IFile_Close(&file);
+    }
+
+    CHECK(readCxiHeaders(titleIds[0], &file, &reads) != NULL && reads == 0);
+    IFile_Close(&file);
+    writeCxi(titleIds[4], 9, 0xA00, 3, 0x100, 4, NULL);
+    CHECK(readCxiHeaders(titleIds[4], &file, &reads) != NULL && reads == 1);
+    IFile_Close(&file);
+
+    static const u32 expectedReads[] = { 0, 1, 0, 0, 0 };
+    for(u32 i = 0; i < 5; i++)
+    {
+        if(i == 1) continue;
+        headers = readCxiHeaders(titleIds[i], &file, &reads);
+        CHECK(headers != NULL && reads == expectedReads[i] && headers->exheaderInfo.sci.codeset_info.stack_size == 0x01010101u * i);
+        IFile_Close(&file);
+    }
+    headers = readCxiHeaders(titleIds[1], &file, &reads);
+    CHECK(headers != NULL && reads == 1);
+    IFile_Close(&file);
+
+    CHECK(nbOpenHandles == 0 && nbOpenArchives == 0);
+}
+
+static bool parseTitleId(u64 *out, const char *s)
+{
+    char *end;
+
+    if(strlen(s) != 16) return false;
+    *out = strtoull(s, &end, 16);
+    return *end == 0;
+}
+
+// Returns false if patchCode gave up, where the console would stop the loader
+static bool tryLaunchTitle(u64 titleId, ExHeader_Info *exhi, LaunchTimings *timings, u8 **code)
+{
+    jmp_buf target;
+
+    breakTarget = &target;
+    if(setjmp(target) != 0)
+    {
+        breakTarget = NULL;
+        for(u32 i = 0; i < MAX_HANDLES; i++)
+        {
+            if(handles[i].file != NULL) fclose(handles[i].file);
+            if(handles[i].dir != NULL) closedir(handles[i].dir);
+        }
+        memset(handles, 0, sizeof(handles));
+        nbOpenHandles = nbOpenArchives = 0;
+        free(launchCode);
+        launchCode = NULL;
+        return false;
+    }
+
+    *code = launchTitle(titleId, exhi, timings);
+    breakTarget = NULL;
+    return true;
+}
+
+static void replayTitle(u64 titleId)
+{
+    static ExHeader_Info exhi;
+    LaunchTimings best, timings;
+    bool ok = true;
+
+    for(u32 run = 0; run < REPLAY_RUNS && ok; run++)
+    {
+        u8 *code = NULL;
+
+        ok = tryLaunchTitle(titleId, &exhi, &timings, &code);
+        if(ok && code == NULL)
+        {
+            printf("%016llX: no exheader.bin or code.bin\n", (unsigned long long)titleId);
+            return;
+        }
+
+        if(run == 0 || timings.totalUsec < best.totalUsec) best = timings;
+        free(code);
+    }
+
+    if(!ok)
+        printf("%016llX: %5u KiB  svcBreak in patchCode\n", (unsigned long long)titleId, timings.codeSize >> 10);
+    else
+        printf("%016llX: %5u KiB  total %7u us  code %7u us  patches %7u us  %5u reads -> %4u FS reads\n",
+               (unsigned long long)titleId, best.codeSize >> 10, best.totalUsec, best.loadCodeUsec, best.patchUsec,
+               best.readCalls, best.fsReadCalls);
+}
+
+static int replay(const char *root, int nbTitleIds, char **titleIds)
+{
+    u64 titleId;
+
+    CHECK(strlen(root) < sizeof(sdRoot));
+    strcpy(sdRoot, root);
+
+    printf("best of %u launches, with the overrides folder already listed\n", REPLAY_RUNS);
+
+    if(nbTitleIds > 0)
+    {
+        for(int i = 0; i < nbTitleIds; i++)
+        {
+            if(!parseTitleId(&titleId, titleIds[i]))
+            {
+                fprintf(stderr, "%s: not a title ID\n", titleIds[i]);
+                return 1;
+            }
+            replayTitle(titleId);
+        }
+    }
+    else
+    {
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/luma/titles", root);
+        DIR *dir = opendir(path);
+        if(dir == NULL)
+        {
+            fprintf(stderr, "%s: no luma/titles folder\n", root);
+            return 1;
+        }
+
+        struct dirent *de;
+        while((de = readdir(dir)) != NULL)
+        {
+            char exheaderPath[2048], codePath[2048];
+            snprintf(exheaderPath, sizeof(exheaderPath), "%s/%s/exheader.bin", path, de->d_name);
+            snprintf(codePath, sizeof(codePath), "%s/%s/code.bin", path, de->d_name);
+            if(parseTitleId(&titleId, de->d_name) && access(exheaderPath, R_OK) == 0 && access(codePath, R_OK) == 0)
+                replayTitle(titleId);
+        }
+        closedir(dir);
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("peak memory use %ld KiB (host, %s)\n", usage.ru_maxrss, CHECK_BUILD_FLAGS);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    config = BIT(PATCHGAMES) | BIT(LOADEXTFIRMSANDMODULES);
+    isSdMode = true;
+    isLumaWithKext = true;
+
+    if(argc > 1)
+        return replay(argv[1], argc - 2, argv + 2);
+
+    char tempDir[] = "/tmp/loader_launch.XXXXXX";
+    CHECK(mkdtemp(tempDir) != NULL);
+    strcpy(sdRoot, tempDir);
+
+    checkPlainTitle();
+    checkSysmoduleTitle();
+    checkLayeredFsTitle();
+    checkSysmoduleCxi();
+
+    CHECK(nftw(tempDir, removeEntry, 16, FTW_DEPTH | FTW_PHYS) == 0);
+    return 0;
+}
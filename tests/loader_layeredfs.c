@@ -0,0 +1,460 @@
+// loader: LayeredFS manifest, built over random folder trees and looked up the way romfsredir.s does
+
+#include <strings.h>
+
+#include "check.h"
+
+#include "../sysmodules/loader/source/layeredfs.c"
+
+#define ROOT            "/luma/titles/0004000000012300/romfs"
+#define ARCHIVE_ID      0x12345678
+#define MAX_NODES       8192
+#define MAX_HANDLES     32
+
+typedef struct Node
+{
+    char name[64];
+    bool isDir;
+    u32 parent, firstChild, nextSibling;    // 0: none, node 0 is the root
+} Node;
+
+static Node nodes[MAX_NODES];
+static u32 nbNodes;
+
+static struct
+{
+    bool isOpen;
+    u32 next;
+} handles[MAX_HANDLES];
+static u32 nbOpenHandles, nbOpenArchives, nbReads;
+static u32 failReadAt;      // Fails that FSDIR_Read call (counting from 1), 0: never
+static bool failArchive;
+
+FS_Path fsMakePath(FS_PathType type, const void *path)
+{
+    return (FS_Path){ type, 0, path };
+}
+
+Result FSUSER_OpenArchive(FS_Archive *archive, u32 id, FS_Path path)
+{
+    CHECK(id == ARCHIVE_ID && path.type == PATH_EMPTY);
+    if(failArchive) return -1;
+
+    *archive = 0xA5;
+    nbOpenArchives++;
+    return 0;
+}
+
+Result FSUSER_CloseArchive(FS_Archive archive)
+{
+    CHECK(archive == 0xA5 && nbOpenArchives == 1);
+    nbOpenArchives--;
+    return 0;
+}
+
+static bool nameEquals(const u16 *a, u32 length, const char *b)
+{
+    for(u32 i = 0; i < length; i++)
+    {
+        if(b[i] == 0 || a[i] != (u8)b[i]) return false;
+    }
+
+    return b[length] == 0;
+}
+
+Result FSUSER_OpenDirectory(Handle *out, FS_Archive archive, FS_Path path)
+{
+    CHECK(archive == 0xA5 && path.type == PATH_UTF16);
+
+    const u16 *p = path.data;
+    for(u32 i = 0; i < sizeof(ROOT) - 1; i++, p++)
+        CHECK(*p == ROOT[i]);
+
+    // Walk the rest of the path from the root
+    u32 dir = 0;
+    while(*p != 0)
+    {
+        CHECK(*p == '/');
+        p++;
+
+        u32 length;
+        for(length = 0; p[length] != 0 && p[length] != '/'; length++);
+
+        u32 child;
+        for(child = nodes[dir].firstChild; child != 0 && !nameEquals(p, length, nodes[child].name); child = nodes[child].nextSibling);
+        if(child == 0 || !nodes[child].isDir) return -2;
+
+        dir = child;
+        p += length;
+    }
+
+    for(u32 i = 1; i < MAX_HANDLES; i++)
+    {
+        if(!handles[i].isOpen)
+        {
+            handles[i].isOpen = true;
+            handles[i].next = nodes[dir].firstChild;
+            nbOpenHandles++;
+            *out = i;
+            return 0;
+        }
+    }
+
+    CHECK(false);
+    return -1;
+}
+
+Result FSDIR_Read(Handle handle, u32 *entriesRead, u32 entryCount, FS_DirectoryEntry *entries)
+{
+    CHECK(handle < MAX_HANDLES && handles[handle].isOpen && entryCount >= 1);
+
+    if(++nbReads == failReadAt)
+    {
+        *entriesRead = 0xCCCCCCCC;
+        return 0xC8804478;
+    }
+
+    memset(entries, 0xCC, entryCount * sizeof(FS_DirectoryEntry));
+
+    u32 n;
+    for(n = 0; n < entryCount && handles[handle].next != 0; n++)
+    {
+        u32 node = handles[handle].next;
+        u32 i;
+
+        // Names are stored as UTF-8, only the two byte sequences the checks use are decoded
+        const u8 *name = (const u8 *)nodes[node].name;
+        for(i = 0; *name != 0; i++)
+        {
+            if(*name < 0x80)
+                entries[n].name[i] = *name++;
+            else
+            {
+                entries[n].name[i] = (u16)((name[0] & 0x1F) << 6 | (name[1] & 0x3F));
+                name += 2;
+            }
+        }
+        entries[n].name[i] = 0;
+        entries[n].attributes = nodes[node].isDir ? FS_ATTRIBUTE_DIRECTORY : 0;
+
+        handles[handle].next = nodes[node].nextSibling;
+    }
+
+    *entriesRead = n;
+    return 0;
+}
+
+Result FSDIR_Close(Handle handle)
+{
+    CHECK(handle < MAX_HANDLES && handles[handle].isOpen);
+    handles[handle].isOpen = false;
+    nbOpenHandles--;
+    return 0;
+}
+
+static u32 addNode(u32 parent, const char *name, bool isDir)
+{
+    CHECK(nbNodes < MAX_NODES && strlen(name) < sizeof(nodes[0].name));
+
+    Node *node = &nodes[nbNodes];
+    strcpy(node->name, name);
+    node->isDir = isDir;
+    node->parent = parent;
+    node->firstChild = 0;
+    node->nextSibling = nodes[parent].firstChild;
+    nodes[parent].firstChild = nbNodes;
+
+    return nbNodes++;
+}
+
+static void resetTree(void)
+{
+    memset(nodes, 0, sizeof(nodes));
+    nbNodes = 1;
+}
+
+static void randomName(char *name, u32 maxLength)
+{
+    static const char chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_.- ";
+    u32 length = 1 + checkRand() % maxLength;
+
+    for(u32 i = 0; i < length; i++)
+        name[i] = chars[checkRand() % (sizeof(chars) - 1)];
+    name[length] = 0;
+}
+
+// Names are unique in a folder, whatever their case, as on a FAT volume
+static void randomChildName(u32 dir, char *name, u32 maxLength)
+{
+    u32 child;
+    do
+    {
+        randomName(name, maxLength);
+        for(child = nodes[dir].firstChild; child != 0 && strcasecmp(nodes[child].name, name) != 0; child = nodes[child].nextSibling);
+    }
+    while(child != 0);
+}
+
+static void randomTree(u32 nbFiles, u32 maxDepth)
+{
+    resetTree();
+
+    for(u32 i = 0; i < nbFiles; i++)
+    {
+        // Go down a few existing or new folders, then add the file
+        u32 dir = 0;
+        for(u32 depth = checkRand() % (maxDepth + 1); depth > 0; depth--)
+        {
+            u32 child;
+            for(child = nodes[dir].firstChild; child != 0 && !nodes[child].isDir; child = nodes[child].nextSibling);
+
+            if(child != 0 && checkRand() % 2 == 0)
+                dir = child;
+            else
+            {
+                char name[16];
+                randomChildName(dir, name, 12);
+                dir = addNode(dir, name, true);
+            }
+        }
+
+        char name[32];
+        randomChildName(dir, name, 24);
+        addNode(dir, name, false);
+    }
+}
+
+// Path of a node relative to the root, starting with a slash
+static u32 nodePath(u32 node, char *out)
+{
+    if(node == 0)
+    {
+        out[0] = 0;
+        return 0;
+    }
+
+    u32 length = nodePath(nodes[node].parent, out);
+    out[length] = '/';
+    strcpy(out + length + 1, nodes[node].name);
+
+    return length + 1 + strlen(nodes[node].name);
+}
+
+// checkManifest in romfsredir.s, on what a game passes to iFileOpen
+static bool lookUp(const u32 *manifest, u32 mask, const u16 *gamePath)
+{
+    if(mask == 0) return true;
+
+    const u16 *p = gamePath;
+    while(*p++ != ':');
+    if(p[1] == '/') p++;
+
+    u32 hash = 0x811C9DC5;
+    for(; *p != 0; p++)
+    {
+        u32 c = *p;
+        if(c - 0x41 <= 25) c += 0x20;
+        hash = (hash ^ c) * 0x01000193;
+    }
+
+    u32 bit1 = hash & mask,
+        bit2 = ((hash >> 16) | (hash << 16)) & mask;
+
+    return (manifest[bit1 >> 5] >> (bit1 & 31) & 1) && (manifest[bit2 >> 5] >> (bit2 & 31) & 1);
+}
+
+// "rom:" + path, the way a game would write it: any case, sometimes with a doubled slash
+static void gamePath(u16 *out, const char *path, bool changeCase)
+{
+    u32 n = 0;
+    for(const char *s = "rom:"; *s != 0; s++)
+        out[n++] = *s;
+    if(checkRand() % 4 == 0)
+        out[n++] = '/';
+
+    for(; *path != 0; path++)
+    {
+        char c = *path;
+        if(changeCase && checkRand() % 2 == 0)
+            c = (c >= 'a' && c <= 'z') ? c - 0x20 : (c >= 'A' && c <= 'Z') ? c + 0x20 : c;
+        out[n++] = (u8)c;
+    }
+    out[n] = 0;
+}
+
+static u32 build(u32 *manifest, u32 manifestSize)
+{
+    u32 mask = buildLayeredFsManifest(ARCHIVE_ID, ROOT, manifest, manifestSize);
+
+    // Every folder is closed, whatever happened
+    CHECK(nbOpenHandles == 0 && nbOpenArchives == 0);
+    return mask;
+}
+
+static void checkTrees(void)
+{
+    static u32 manifest[LAYEREDFS_MANIFEST_MAX_SIZE / 4 + 1];
+    static const u32 nbFiles[] = { 1, 10, 100, 400, 1000 };
+
+    for(u32 manifestSize = LAYEREDFS_MANIFEST_MIN_SIZE; manifestSize <= LAYEREDFS_MANIFEST_MAX_SIZE; manifestSize <<= 1)
+    {
+        for(u32 t = 0; t < sizeof(nbFiles) / sizeof(nbFiles[0]); t++)
+        {
+            randomTree(nbFiles[t], 4);
+
+            // The word after the manifest must stay untouched
+            manifest[manifestSize / 4] = 0xDEADBEEF;
+            u32 mask = build(manifest, manifestSize);
+            CHECK(mask == manifestSize * 8 - 1);
+            CHECK(manifest[manifestSize / 4] == 0xDEADBEEF);
+
+            // No false negatives
+            u32 nbBitsSet = 0;
+            for(u32 i = 0; i < manifestSize / 4; i++)
+                nbBitsSet += __builtin_popcount(manifest[i]);
+            CHECK(nbBitsSet > 0 && nbBitsSet <= 2 * nbFiles[t]);
+
+            for(u32 node = 1; node < nbNodes; node++)
+            {
+                if(nodes[node].isDir) continue;
+
+                char path[1024];
+                u16 path16[1024];
+                nodePath(node, path);
+                gamePath(path16, path, true);
+                CHECK(lookUp(manifest, mask, path16));
+            }
+
+            // False positives at about the rate two bits out of the ones set give
+            double fill = (double)nbBitsSet / (manifestSize * 8);
+            u32 nbProbes = 20000, nbFalsePositives = 0;
+            for(u32 i = 0; i < nbProbes; i++)
+            {
+                char path[64] = "/not_there/";
+                u16 path16[128];
+                randomName(path + strlen(path), 40);
+                gamePath(path16, path, false);
+                nbFalsePositives += lookUp(manifest, mask, path16);
+            }
+            CHECK(nbFalsePositives <= nbProbes * fill * fill * 1.5 + 50);
+        }
+    }
+}
+
+static void checkLimits(void)
+{
+    static u32 manifest[LAYEREDFS_MANIFEST_MAX_SIZE / 4];
+    char name[2] = "a";
+
+    // As deep as allowed, then one folder too deep: the manifest is given up on
+    resetTree();
+    u32 dir = 0;
+    for(u32 i = 0; i < LAYEREDFS_MANIFEST_MAX_DEPTH; i++)
+        dir = addNode(dir, name, true);
+    addNode(dir, "file", false);
+    CHECK(build(manifest, sizeof(manifest)) != 0);
+    dir = addNode(dir, name, true);
+    addNode(dir, "file", false);
+    CHECK(build(manifest, sizeof(manifest)) == 0);
+
+    // A path that doesn't fit
+    resetTree();
+    char longName[64];
+    memset(longName, 'x', sizeof(longName) - 1);
+    longName[sizeof(longName) - 1] = 0;
+    dir = 0;
+    for(u32 i = 0; i < 6; i++)
+        dir = addNode(dir, longName, true);
+    addNode(dir, "file", false);
+    CHECK(build(manifest, sizeof(manifest)) != 0);
+    for(u32 i = 0; i < 3; i++)
+        dir = addNode(dir, longName, true);
+    addNode(dir, "file", false);
+    CHECK(build(manifest, sizeof(manifest)) == 0);
+
+    // An empty folder has an empty manifest, nothing goes to the SD card
+    resetTree();
+    u16 path16[64];
+    gamePath(path16, "/file.bin", false);
+    u32 mask = build(manifest, sizeof(manifest));
+    CHECK(mask != 0 && !lookUp(manifest, mask, path16));
+
+    // No folder at all
+    failArchive = true;
+    CHECK(build(manifest, sizeof(manifest)) == 0);
+    failArchive = false;
+
+    // A failed read anywhere gives up on the manifest, rather than leaving out what's after it
+    randomTree(200, 3);
+    nbReads = 0;
+    CHECK(build(manifest, sizeof(manifest)) != 0);
+    u32 nbGoodReads = nbReads;
+    for(failReadAt = 1; failReadAt <= nbGoodReads; failReadAt++)
+    {
+        nbReads = 0;
+        CHECK(build(manifest, sizeof(manifest)) == 0);
+    }
+    failReadAt = 0;
+
+    // Names with letters outside ASCII: FAT would match them in another case, the hash wouldn't
+    resetTree();
+    addNode(0, "music", true);
+    addNode(nbNodes - 1, "caf\xc3\xa9.bcstm", false);
+    CHECK(build(manifest, sizeof(manifest)) == 0);
+    resetTree();
+    addNode(0, "\xc3\x89t\xc3\xa9", true);
+    CHECK(build(manifest, sizeof(manifest)) == 0);
+
+    // Wide trees: every folder found waits its turn, too many of them and the manifest is given up on
+    resetTree();
+    for(u32 i = 0; i < 64; i++)
+    {
+        char dirName[16];
+        sprintf(dirName, "dir%u", i);
+        dir = addNode(0, dirName, true);
+        addNode(dir, "file", false);
+    }
+    CHECK(build(manifest, sizeof(manifest)) != 0);
+    for(u32 i = 0; i < 2 * LAYEREDFS_MANIFEST_PENDING_SIZE / 8; i++)
+    {
+        char dirName[16];
+        sprintf(dirName, "more%u", i);
+        addNode(0, dirName, true);
+    }
+    CHECK(build(manifest, sizeof(manifest)) == 0);
+}
+
+// Folders are listed a batch of entries at a time
+static void checkBatching(void)
+{
+    static u32 manifest[LAYEREDFS_MANIFEST_MAX_SIZE / 4];
+
+    randomTree(1000, 4);
+
+    u32 nbDirs = 1;
+    for(u32 node = 1; node < nbNodes; node++)
+        nbDirs += nodes[node].isDir;
+
+    nbReads = 0;
+    CHECK(build(manifest, sizeof(manifest)) != 0);
+
+    // One read per batch, plus the one that finds the end of each folder
+    CHECK(nbReads <= (nbNodes - 1) / LAYEREDFS_MANIFEST_BATCH_SIZE + 2 * nbDirs);
+    printf("layeredfs: %u files in %u folders, %u directory reads\n", nbNodes - nbDirs, nbDirs, nbReads);
+}
+
+int main(void)
+{
+    // FNV-1a, with ASCII letters folded to lowercase
+    static const u16 empty[] = { 0 }, a[] = { 'a', 0 }, upperA[] = { 'A', 0 }, at[] = { '@', 0 }, grave[] = { '`', 0 };
+    CHECK(hashLayeredFsPath(empty) == 0x811C9DC5);
+    CHECK(hashLayeredFsPath(a) == 0xE40C292C);
+    CHECK(hashLayeredFsPath(upperA) == 0xE40C292C);
+    CHECK(hashLayeredFsPath(at) != hashLayeredFsPath(grave));
+
+    checkTrees();
+    checkLimits();
+    checkBatching();
+
+    return 0;
+}
@@ -0,0 +1,507 @@
+// rosalina: GDB agent expression interpreter. Random expression trees are compiled to bytecode and
+// compared with the same trees evaluated directly; then the stack opcodes, the error cases and the
+// trace opcodes. The opcode numbers are written out from the GDB manual, not taken from agent_expr.c.
+
+#include <stdarg.h>
+#include <string.h>
+
+#include "check.h"
+
+#include "../sysmodules/rosalina/source/gdb/agent_expr.c"
+
+enum
+{
+    OP_ADD = 0x02, OP_SUB, OP_MUL, OP_DIV_SIGNED, OP_DIV_UNSIGNED, OP_REM_SIGNED, OP_REM_UNSIGNED,
+    OP_LSH, OP_RSH_SIGNED, OP_RSH_UNSIGNED, OP_TRACE, OP_TRACE_QUICK, OP_LOG_NOT, OP_BIT_AND, OP_BIT_OR,
+    OP_BIT_XOR, OP_BIT_NOT, OP_EQUAL, OP_LESS_SIGNED, OP_LESS_UNSIGNED, OP_EXT, OP_REF8, OP_REF16,
+    OP_REF32, OP_REF64,
+    OP_REF_FLOAT = 0x1B,
+    OP_IF_GOTO = 0x20, OP_GOTO, OP_CONST8, OP_CONST16, OP_CONST32, OP_CONST64, OP_REG, OP_END, OP_DUP,
+    OP_POP, OP_ZERO_EXT, OP_SWAP, OP_GETV, OP_SETV, OP_TRACEV, OP_TRACENZ, OP_TRACE16,
+    OP_PICK = 0x32, OP_ROT, OP_PRINTF,
+};
+
+#define MEM_BASE    0x08000000u
+#define MEM_SIZE    0x2000u     // two pages, nothing mapped around them
+#define MAX_DEPTH   7
+#define MAX_CODE    0x10000   // goto targets are 16-bit
+
+static u64 regs[16];
+static u8 memory[MEM_SIZE];
+
+static struct
+{
+    u32 addr, size;
+} collected[16];
+static u32 nbCollected, collectedVariables[16], nbCollectedVariables;
+static s64 variables[4];
+
+static int readRegister(void *userData, u32 regNum, u64 *out)
+{
+    (void)userData;
+    if(regNum >= 16)
+        return -EINVAL;
+
+    *out = regs[regNum];
+    return 0;
+}
+
+static int readMemory(void *userData, void *out, u32 addr, u32 size)
+{
+    (void)userData;
+    if(addr < MEM_BASE || addr - MEM_BASE > MEM_SIZE || size > MEM_SIZE - (addr - MEM_BASE))
+        return -EFAULT;
+
+    memcpy(out, memory + (addr - MEM_BASE), size);
+    return 0;
+}
+
+static int collectMemory(void *userData, u32 addr, u32 size)
+{
+    (void)userData;
+    CHECK(nbCollected < 16);
+    collected[nbCollected].addr = addr;
+    collected[nbCollected++].size = size;
+    return 0;
+}
+
+static int collectTraceStateVariable(void *userData, u32 id)
+{
+    (void)userData;
+    if(id >= 4)
+        return -EINVAL;
+
+    CHECK(nbCollectedVariables < 16);
+    collectedVariables[nbCollectedVariables++] = id;
+    return 0;
+}
+
+static int getTraceStateVariable(void *userData, u32 id, s64 *out)
+{
+    (void)userData;
+    if(id >= 4)
+        return -EINVAL;
+
+    *out = variables[id];
+    return 0;
+}
+
+static int setTraceStateVariable(void *userData, u32 id, s64 value)
+{
+    (void)userData;
+    if(id >= 4)
+        return -EINVAL;
+
+    variables[id] = value;
+    return 0;
+}
+
+static const AgentExprEnvironment conditionEnv = { NULL, readRegister, readMemory, NULL, NULL, NULL, NULL };
+static const AgentExprEnvironment traceEnv = {
+    NULL, readRegister, readMemory, collectMemory, collectTraceStateVariable, getTraceStateVariable, setTraceStateVariable
+};
+
+// Bytecode being built
+
+static u8 code[MAX_CODE];
+static u32 codeSize;
+
+static void emit(u32 n, ...)
+{
+    va_list args;
+    va_start(args, n);
+    for(u32 i = 0; i < n; i++)
+    {
+        CHECK(codeSize < MAX_CODE);
+        code[codeSize++] = (u8)va_arg(args, int);
+    }
+    va_end(args);
+}
+
+// Big-endian immediate
+static void emitImm(u64 v, u32 size)
+{
+    for(u32 i = size; i > 0; i--)
+        emit(1, (int)(u8)(v >> (8 * (i - 1))));
+}
+
+static void emitConst(u64 v)
+{
+    if(v <= 0xFF) { emit(1, OP_CONST8); emitImm(v, 1); }
+    else if(v <= 0xFFFF) { emit(1, OP_CONST16); emitImm(v, 2); }
+    else if(v <= 0xFFFFFFFF) { emit(1, OP_CONST32); emitImm(v, 4); }
+    else { emit(1, OP_CONST64); emitImm(v, 8); }
+}
+
+static int evaluate(s64 *result, const AgentExprEnvironment *env)
+{
+    return GDB_EvaluateAgentExpression(result, env, code, codeSize);
+}
+
+static int run(s64 *result, const AgentExprEnvironment *env, u32 n, ...)
+{
+    va_list args;
+    va_start(args, n);
+    codeSize = 0;
+    for(u32 i = 0; i < n; i++)
+        code[codeSize++] = (u8)va_arg(args, int);
+    va_end(args);
+    return evaluate(result, env);
+}
+
+// Random expressions: each one is compiled and evaluated at the same time, with the value or the
+// error the interpreter must stop with. Both operands are evaluated before the operator, so the
+// first error met in postfix order is the one expected.
+
+typedef struct Value
+{
+    int err;
+    s64 v;
+} Value;
+
+static u64 randomU64(void)
+{
+    u64 v = (u64)checkRand() << 32 | checkRand();
+
+    // Small values and edge cases make the comparisons and the shifts interesting
+    switch(checkRand() % 8)
+    {
+        case 0: return v & 0xFF;
+        case 1: return v & 63;
+        case 2: return 0;
+        case 3: return (u64)INT64_MIN;
+        case 4: return (u64)-1;
+        default: return v;
+    }
+}
+
+static Value leaf(void)
+{
+    switch(checkRand() % 3)
+    {
+        case 0:
+        {
+            u64 v = randomU64();
+            emitConst(v);
+            return (Value){ 0, (s64)v };
+        }
+        case 1:
+        {
+            u32 n = checkRand() % 16;
+            emit(1, OP_REG);
+            emitImm(n, 2);
+            return (Value){ 0, (s64)regs[n] };
+        }
+        default:
+        {
+            // Little-endian load, sometimes out of the mapped memory
+            u32 sizeLog2 = checkRand() % 4, size = 1 << sizeLog2;
+            u32 addr = checkRand() % 16 == 0 ? MEM_BASE + MEM_SIZE - size + 1 + checkRand() % 4 : MEM_BASE + checkRand() % (MEM_SIZE - size + 1);
+            u64 v = 0;
+            emitConst(addr);
+            emit(1, OP_REF8 + sizeLog2);
+            if(addr + size > MEM_BASE + MEM_SIZE)
+                return (Value){ -EFAULT, 0 };
+            for(u32 i = size; i > 0; i--)
+                v = v << 8 | memory[addr - MEM_BASE + i - 1];
+            return (Value){ 0, (s64)v };
+        }
+    }
+}
+
+static Value expr(u32 depth);
+
+static Value binary(u32 depth)
+{
+    static const u8 ops[] = {
+        OP_ADD, OP_SUB, OP_MUL, OP_DIV_SIGNED, OP_DIV_UNSIGNED, OP_REM_SIGNED, OP_REM_UNSIGNED, OP_LSH,
+        OP_RSH_SIGNED, OP_RSH_UNSIGNED, OP_BIT_AND, OP_BIT_OR, OP_BIT_XOR, OP_EQUAL, OP_LESS_SIGNED, OP_LESS_UNSIGNED,
+    };
+    Value a = expr(depth + 1), b = expr(depth + 1);
+    u8 op = ops[checkRand() % sizeof(ops)];
+    emit(1, op);
+
+    if(a.err != 0) return a;
+    if(b.err != 0) return b;
+
+    u64 ua = (u64)a.v, ub = (u64)b.v;
+    switch(op)
+    {
+        case OP_ADD: return (Value){ 0, (s64)(ua + ub) };
+        case OP_SUB: return (Value){ 0, (s64)(ua - ub) };
+        case OP_MUL: return (Value){ 0, (s64)(ua * ub) };
+        case OP_DIV_SIGNED:
+            if(b.v == 0) return (Value){ -EDOM, 0 };
+            return (Value){ 0, a.v == INT64_MIN && b.v == -1 ? INT64_MIN : a.v / b.v };
+        case OP_REM_SIGNED:
+            if(b.v == 0) return (Value){ -EDOM, 0 };
+            return (Value){ 0, b.v == -1 ? 0 : a.v % b.v };
+        case OP_DIV_UNSIGNED: return ub == 0 ? (Value){ -EDOM, 0 } : (Value){ 0, (s64)(ua / ub) };
+        case OP_REM_UNSIGNED: return ub == 0 ? (Value){ -EDOM, 0 } : (Value){ 0, (s64)(ua % ub) };
+        case OP_LSH: return (Value){ 0, ub >= 64 ? 0 : (s64)(ua << ub) };
+        case OP_RSH_UNSIGNED: return (Value){ 0, ub >= 64 ? 0 : (s64)(ua >> ub) };
+        case OP_RSH_SIGNED:
+            if(ub >= 64) return (Value){ 0, a.v < 0 ? -1 : 0 };
+            return (Value){ 0, a.v < 0 ? (s64)~(~ua >> ub) : (s64)(ua >> ub) };
+        case OP_BIT_AND: return (Value){ 0, a.v & b.v };
+        case OP_BIT_OR: return (Value){ 0, a.v | b.v };
+        case OP_BIT_XOR: return (Value){ 0, a.v ^ b.v };
+        case OP_EQUAL: return (Value){ 0, a.v == b.v };
+        case OP_LESS_SIGNED: return (Value){ 0, a.v < b.v };
+        default: return (Value){ 0, ua < ub };
+    }
+}
+
+static Value unary(u32 depth)
+{
+    Value a = expr(depth + 1);
+
+    switch(checkRand() % 4)
+    {
+        case 0:
+            emit(1, OP_LOG_NOT);
+            return a.err != 0 ? a : (Value){ 0, a.v == 0 };
+        case 1:
+            emit(1, OP_BIT_NOT);
+            return a.err != 0 ? a : (Value){ 0, ~a.v };
+        default:
+        {
+            // ext/zero_ext, widths 1..64
+            bool sign = checkRand() & 1;
+            u32 n = 1 + checkRand() % 64;
+            emit(2, sign ? OP_EXT : OP_ZERO_EXT, (int)n);
+            if(a.err != 0 || n == 64)
+                return a;
+
+            u64 v = (u64)a.v & ((1ull << n) - 1);
+            if(sign && (v >> (n - 1)) != 0)
+                v |= ~0ull << n;
+            return (Value){ 0, (s64)v };
+        }
+    }
+}
+
+// cond ? x : y, as "cond if_goto L1 y goto L2 L1: x L2:". Only the branch taken is evaluated
+static Value conditional(u32 depth)
+{
+    Value cond = expr(depth + 1);
+    emit(1, OP_IF_GOTO);
+    u32 toThen = codeSize;
+    emitImm(0, 2);
+
+    Value y = expr(depth + 1);
+    emit(1, OP_GOTO);
+    u32 toEnd = codeSize;
+    emitImm(0, 2);
+
+    code[toThen] = (u8)(codeSize >> 8);
+    code[toThen + 1] = (u8)codeSize;
+    Value x = expr(depth + 1);
+    code[toEnd] = (u8)(codeSize >> 8);
+    code[toEnd + 1] = (u8)codeSize;
+
+    if(cond.err != 0) return cond;
+    return cond.v != 0 ? x : y;
+}
+
+// The stack opcodes, each in a small pattern with a known result
+static Value shuffle(u32 depth)
+{
+    Value a = expr(depth + 1), b = expr(depth + 1);
+    u64 ua = (u64)a.v, ub = (u64)b.v;
+
+    switch(checkRand() % 4)
+    {
+        case 0:     // a b swap sub => b - a
+            emit(2, OP_SWAP, OP_SUB);
+            ua = ub - ua;
+            break;
+        case 1:     // a b dup mul add => a + b * b
+            emit(3, OP_DUP, OP_MUL, OP_ADD);
+            ua += ub * ub;
+            break;
+        case 2:     // a b pick 1 mul add => a + b * a
+            emit(4, OP_PICK, 1, OP_MUL, OP_ADD);
+            ua += ub * ua;
+            break;
+        default:    // a b pop => a
+            emit(1, OP_POP);
+            break;
+    }
+
+    if(a.err != 0) return a;
+    if(b.err != 0) return b;
+    return (Value){ 0, (s64)ua };
+}
+
+static Value expr(u32 depth)
+{
+    if(depth >= MAX_DEPTH || checkRand() % 4 == 0)
+        return leaf();
+
+    switch(checkRand() % 8)
+    {
+        case 0: return unary(depth);
+        case 1: return conditional(depth);
+        case 2: return shuffle(depth);
+        default: return binary(depth);
+    }
+}
+
+static void checkRandomExpressions(void)
+{
+    for(u32 round = 0; round < 20000; round++)
+    {
+        for(u32 i = 0; i < 16; i++)
+            regs[i] = randomU64();
+
+        codeSize = 0;
+        Value expected = expr(0);
+        emit(1, OP_END);
+
+        s64 result = 0x5A5A;
+        int r = evaluate(&result, &conditionEnv);
+        CHECK(r == expected.err);
+        CHECK(r != 0 || result == expected.v);
+    }
+}
+
+static void checkStackOpcodes(void)
+{
+    s64 result;
+
+    // a b c rot => c a b, checked through subtractions: c - (a - b)
+    CHECK(run(&result, &conditionEnv, 10, OP_CONST8, 10, OP_CONST8, 3, OP_CONST8, 100, OP_ROT, OP_SUB, OP_SUB, OP_END) == 0 && result == 100 - (10 - 3));
+    // pick 0 is dup
+    CHECK(run(&result, &conditionEnv, 6, OP_CONST8, 7, OP_PICK, 0, OP_MUL, OP_END) == 0 && result == 49);
+    // pick deeper than the stack
+    CHECK(run(&result, &conditionEnv, 6, OP_CONST8, 7, OP_PICK, 1, OP_ADD, OP_END) == -EINVAL);
+    // The constants are zero-extended, ext gives them a sign
+    CHECK(run(&result, &conditionEnv, 5, OP_CONST8, 0xFF, OP_EXT, 8, OP_END) == 0 && result == -1);
+    CHECK(run(&result, &conditionEnv, 3, OP_CONST8, 0xFF, OP_END) == 0 && result == 0xFF);
+    CHECK(run(&result, &conditionEnv, 6, OP_CONST32, 0x80, 0, 0, 0, OP_END) == 0 && result == 0x80000000);
+}
+
+static void checkErrors(void)
+{
+    s64 result;
+
+    // Running out of code: empty, no "end", an operand cut short, a jump past the end
+    CHECK(run(&result, &conditionEnv, 0) == -EINVAL);
+    CHECK(run(&result, &conditionEnv, 2, OP_CONST8, 1) == -EINVAL);
+    CHECK(run(&result, &conditionEnv, 4, OP_CONST32, 1, 2, 3) == -EINVAL);
+    CHECK(run(&result, &conditionEnv, 4, OP_GOTO, 0, 9, OP_END) == -EINVAL);
+
+    // Opcodes that aren't implemented or don't exist
+    CHECK(run(&result, &conditionEnv, 2, 0x00, OP_END) == -ENOSYS);
+    CHECK(run(&result, &conditionEnv, 2, 0x01, OP_END) == -ENOSYS);
+    CHECK(run(&result, &conditionEnv, 4, OP_CONST8, 0, OP_REF_FLOAT, OP_END) == -ENOSYS);
+    CHECK(run(&result, &conditionEnv, 2, 0x31, OP_END) == -ENOSYS);
+    CHECK(run(&result, &conditionEnv, 2, OP_PRINTF, OP_END) == -ENOSYS);
+    CHECK(run(&result, &conditionEnv, 2, 0x35, OP_END) == -ENOSYS);
+    CHECK(run(&result, &conditionEnv, 2, 0xFF, OP_END) == -ENOSYS);
+
+    // Stack underflow and overflow
+    CHECK(run(&result, &conditionEnv, 1, OP_END) == -EINVAL);
+    CHECK(run(&result, &conditionEnv, 2, OP_POP, OP_END) == -EINVAL);
+    CHECK(run(&result, &conditionEnv, 4, OP_CONST8, 1, OP_ADD, OP_END) == -EINVAL);
+    CHECK(run(&result, &conditionEnv, 3, OP_CONST8, 1, OP_ROT) == -EINVAL);
+    codeSize = 0;
+    for(u32 i = 0; i < AGENT_EXPR_STACK_SIZE; i++)
+        emit(2, OP_CONST8, (int)i);
+    emit(1, OP_END);
+    CHECK(evaluate(&result, &conditionEnv) == 0 && result == AGENT_EXPR_STACK_SIZE - 1);
+    codeSize--;
+    emit(2, OP_DUP, OP_END);
+    CHECK(evaluate(&result, &conditionEnv) == -ENOMEM);
+
+    // Endless loops are cut
+    CHECK(run(&result, &conditionEnv, 3, OP_GOTO, 0, 0) == -ELOOP);
+
+    // ext 0, register and memory errors
+    CHECK(run(&result, &conditionEnv, 5, OP_CONST8, 1, OP_EXT, 0, OP_END) == -EINVAL);
+    CHECK(run(&result, &conditionEnv, 4, OP_REG, 0, 16, OP_END) == -EINVAL);
+    CHECK(run(&result, &conditionEnv, 4, OP_CONST8, 0, OP_REF8, OP_END) == -EFAULT);
+
+    // Conditions have no trace buffer
+    CHECK(run(&result, &conditionEnv, 5, OP_CONST8, 0, OP_TRACE_QUICK, 4, OP_END) == -ENOSYS);
+    CHECK(run(&result, &conditionEnv, 4, OP_GETV, 0, 1, OP_END) == -ENOSYS);
+}
+
+static void emitTraceNz(u32 addr, u32 maxSize)
+{
+    codeSize = 0;
+    emitConst(addr);
+    emitConst(maxSize);
+    emit(4, OP_TRACENZ, OP_CONST8, 1, OP_END);
+}
+
+static void checkTraceOpcodes(void)
+{
+    s64 result;
+
+    // trace pops the address and the size, trace_quick and trace16 keep the address
+    nbCollected = 0;
+    codeSize = 0;
+    emitConst(MEM_BASE + 0x10);
+    emitConst(0x20);
+    emit(4, OP_TRACE, OP_CONST8, 7, OP_END);
+    CHECK(evaluate(&result, &traceEnv) == 0 && result == 7);
+    CHECK(nbCollected == 1 && collected[0].addr == MEM_BASE + 0x10 && collected[0].size == 0x20);
+
+    nbCollected = 0;
+    codeSize = 0;
+    emitConst(MEM_BASE + 0x40);
+    emit(6, OP_TRACE_QUICK, 12, OP_TRACE16, 0x12, 0x34, OP_END);
+    CHECK(evaluate(&result, &traceEnv) == 0 && result == MEM_BASE + 0x40);
+    CHECK(nbCollected == 2 && collected[0].size == 12 && collected[1].addr == MEM_BASE + 0x40 && collected[1].size == 0x1234);
+
+    // tracenz: up to and including the NUL, at most the given size
+    memset(memory, 'x', sizeof(memory));
+    memory[0x105] = 0;
+    nbCollected = 0;
+    emitTraceNz(MEM_BASE + 0x100, 64);
+    CHECK(evaluate(&result, &traceEnv) == 0 && nbCollected == 1 && collected[0].addr == MEM_BASE + 0x100 && collected[0].size == 6);
+    nbCollected = 0;
+    emitTraceNz(MEM_BASE + 0x100, 3);
+    CHECK(evaluate(&result, &traceEnv) == 0 && nbCollected == 1 && collected[0].size == 3);
+
+    // A string longer than a read chunk
+    memory[0x105] = 'x';
+    memory[0x100 + 70] = 0;
+    nbCollected = 0;
+    emitTraceNz(MEM_BASE + 0x100, 200);
+    CHECK(evaluate(&result, &traceEnv) == 0 && nbCollected == 1 && collected[0].size == 71);
+
+    // One that ends just before the unmapped page that follows
+    memory[MEM_SIZE - 1] = 0;
+    nbCollected = 0;
+    emitTraceNz(MEM_BASE + MEM_SIZE - 10, 64);
+    CHECK(evaluate(&result, &traceEnv) == 0 && nbCollected == 1 && collected[0].size == 10);
+
+    // One that runs into it
+    memory[MEM_SIZE - 1] = 'x';
+    nbCollected = 0;
+    emitTraceNz(MEM_BASE + MEM_SIZE - 10, 64);
+    CHECK(evaluate(&result, &traceEnv) == -EFAULT && nbCollected == 0);
+
+    // Trace state variables: setv keeps its operand, getv and tracev
+    memset(variables, 0, sizeof(variables));
+    nbCollectedVariables = 0;
+    CHECK(run(&result, &traceEnv, 13, OP_CONST8, 42, OP_SETV, 0, 2, OP_GETV, 0, 2, OP_ADD, OP_TRACEV, 0, 2, OP_END) == 0);
+    CHECK(result == 84 && variables[2] == 42 && nbCollectedVariables == 1 && collectedVariables[0] == 2);
+    CHECK(run(&result, &traceEnv, 4, OP_GETV, 0, 9, OP_END) == -EINVAL);
+}
+
+int main(void)
+{
+    for(u32 i = 0; i < MEM_SIZE; i++)
+        memory[i] = (u8)checkRand();
+
+    checkRandomExpressions();
+    checkStackOpcodes();
+    checkErrors();
+    checkTraceOpcodes();
+
+    return 0;
+}
@@ -0,0 +1,493 @@
+// rosalina: the GDB trace buffer. Frames of random sizes are appended to the circular buffer and compared with a
+// list of the frames it should still hold: what qTBuffer reads across the wrap, and where each frame number is
+// found after the oldest ones were dropped. Then the frames collected at a tracepoint hit, and QTStart on Thumb
+// code and on svcs. The packets and the target process are stubbed, the frames are checked in the buffer itself.
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+
+#include "../sysmodules/rosalina/source/gdb/agent_expr.c"
+#include "../sysmodules/rosalina/source/gdb/breakpoints.c"
+#include "../sysmodules/rosalina/source/gdb/tracepoints.c"
+
+#define MEM_BASE    0x00100000u
+#define MEM_SIZE    0x1000u
+#define MAX_FRAMES  2000
+
+static GDBContext gdbContext;
+static u8 memory[MEM_SIZE];
+static ThreadContext threadContext;
+
+static int lastErrno;
+static char lastPacket[GDB_BUF_LEN + 1];
+static const char *lastDebugString;
+
+// The replies only need to be told apart
+
+int GDB_SendPacket(GDBContext *ctx, const char *packetData, u32 len)
+{
+    (void)ctx;
+    CHECK(len < sizeof(lastPacket));
+    memcpy(lastPacket, packetData, len);
+    lastPacket[len] = 0;
+    lastErrno = 0;
+    return 0;
+}
+
+int GDB_SendHexPacket(GDBContext *ctx, const void *packetData, u32 len)
+{
+    CHECK(2 * len < sizeof(lastPacket));
+    for(u32 i = 0; i < len; i++)
+        sprintf(lastPacket + 2 * i, "%02x", ((const u8 *)packetData)[i]);
+    return GDB_SendPacket(ctx, lastPacket, 2 * len);
+}
+
+int GDB_SendFormattedPacket(GDBContext *ctx, const char *packetDataFmt, ...)
+{
+    return GDB_SendPacket(ctx, packetDataFmt, strlen(packetDataFmt));
+}
+
+int GDB_SendDebugString(GDBContext *ctx, const char *fmt, ...)
+{
+    (void)ctx;
+    lastDebugString = fmt;
+    return 0;
+}
+
+int GDB_ReplyErrno(GDBContext *ctx, int no)
+{
+    GDB_SendPacket(ctx, "E", 1);
+    lastErrno = no;
+    return 0;
+}
+
+int GDB_ReplyOk(GDBContext *ctx)
+{
+    return GDB_SendPacket(ctx, "OK", 2);
+}
+
+int GDB_ReplyEmpty(GDBContext *ctx)
+{
+    return GDB_SendPacket(ctx, "", 0);
+}
+
+// The packet parsers aren't needed, the checks fill the context in directly
+
+const char *GDB_ParseIntegerList(u32 *dst, const char *src, u32 nb, char sep, char lastSep, u32 base, bool allowPrefix)
+{
+    (void)dst; (void)src; (void)nb; (void)sep; (void)lastSep; (void)base; (void)allowPrefix;
+    abort();
+}
+
+const char *GDB_ParseHexIntegerList(u32 *dst, const char *src, u32 nb, char lastSep)
+{
+    (void)dst; (void)src; (void)nb; (void)lastSep;
+    abort();
+}
+
+const char *GDB_ParseIntegerList64(u64 *dst, const char *src, u32 nb, char sep, char lastSep, u32 base, bool allowPrefix)
+{
+    (void)dst; (void)src; (void)nb; (void)sep; (void)lastSep; (void)base; (void)allowPrefix;
+    abort();
+}
+
+u32 GDB_DecodeHex(void *dst, const char *src, u32 len)
+{
+    (void)dst; (void)src; (void)len;
+    abort();
+}
+
+void GDB_EncodeHex(char *dst, const void *src, u32 len)
+{
+    (void)dst; (void)src; (void)len;
+    abort();
+}
+
+// The target: one page of memory at MEM_BASE, and one thread
+
+Result svcReadProcessMemory(void *buffer, Handle debug, u32 addr, u32 size)
+{
+    (void)debug;
+    if(addr < MEM_BASE || addr - MEM_BASE > MEM_SIZE || size > MEM_SIZE - (addr - MEM_BASE))
+        return -1;
+
+    memcpy(buffer, memory + (addr - MEM_BASE), size);
+    return 0;
+}
+
+Result svcWriteProcessMemory(Handle debug, const void *buffer, u32 addr, u32 size)
+{
+    (void)debug;
+    if(addr < MEM_BASE || addr - MEM_BASE > MEM_SIZE || size > MEM_SIZE - (addr - MEM_BASE))
+        return -1;
+
+    memcpy(memory + (addr - MEM_BASE), buffer, size);
+    return 0;
+}
+
+Result svcGetDebugThreadContext(ThreadContext *context, Handle debug, u32 threadId, ThreadContextControlFlags controlFlags)
+{
+    (void)debug; (void)controlFlags;
+    CHECK(threadId == 1);
+    *context = threadContext;
+    return 0;
+}
+
+u32 GDB_ReadTargetMemory(void *out, GDBContext *ctx, u32 addr, u32 len)
+{
+    return R_SUCCEEDED(svcReadProcessMemory(out, ctx->debug, addr, len)) ? len : 0;
+}
+
+int GDB_ReadThreadContextRegister(u64 *out, const ThreadContext *regs, u32 gdbNum)
+{
+    if(gdbNum < 16)
+        *out = (&regs->cpu_registers.r[0])[gdbNum];
+    else if(gdbNum == 25)
+        *out = regs->cpu_registers.cpsr;
+    else
+        return -EINVAL;
+
+    return 0;
+}
+
+// What the trace buffer should hold: the frames from firstKept to nbFrames - 1, each kept as it was written
+static struct
+{
+    u8 data[TRACE_FRAME_MAX_SIZE];
+    u32 size;
+    u16 tracepoint;
+    bool hasRegisters;
+    u32 pc, memoryAddress, memorySize;
+} frames[MAX_FRAMES];
+static u32 nbFrames, firstKept;
+
+// A frame of one 'M' block, with an 'R' block before it one time out of three
+static void makeFrame(u32 i, u32 maxSize)
+{
+    u8 *p = frames[i].data + TRACE_FRAME_HEADER_SIZE;
+    u32 fixedSize = TRACE_FRAME_HEADER_SIZE + 11;
+
+    frames[i].tracepoint = (u16)(1 + checkRand() % 4);
+    frames[i].hasRegisters = checkRand() % 3 == 0;
+    if(frames[i].hasRegisters)
+    {
+        ThreadContext regs = { 0 };
+        for(u32 r = 0; r < 13; r++) regs.cpu_registers.r[r] = checkRand();
+        regs.cpu_registers.pc = frames[i].pc = MEM_BASE + 4 * (checkRand() % (MEM_SIZE / 4));
+        *p++ = 'R';
+        memcpy(p, &regs, sizeof(ThreadContext));
+        p += sizeof(ThreadContext);
+        fixedSize += 1 + sizeof(ThreadContext);
+    }
+
+    u16 len = (u16)(checkRand() % (maxSize - fixedSize + 1));
+    u64 addr = frames[i].memoryAddress = MEM_BASE + checkRand() % 0x10000;
+    frames[i].memorySize = len;
+    *p++ = 'M';
+    memcpy(p, &addr, 8);
+    memcpy(p + 8, &len, 2);
+    p += 10;
+    for(u32 j = 0; j < len; j++) *p++ = (u8)checkRand();
+
+    u32 dataSize = p - frames[i].data - TRACE_FRAME_HEADER_SIZE;
+    frames[i].size = TRACE_FRAME_HEADER_SIZE + dataSize;
+    memcpy(frames[i].data, &frames[i].tracepoint, 2);
+    memcpy(frames[i].data + 2, &dataSize, 4);
+}
+
+// What GDB_CollectTraceFrames does with a frame once it is built
+static bool appendFrame(u32 i, bool circular)
+{
+    u8 *frame = GDB_ReserveTraceFrame(frames[i].size, circular);
+    if(frame == NULL)
+        return false;
+
+    memcpy(frame, frames[i].data, frames[i].size);
+    traceBuffer.nbFrames++;
+    traceBuffer.nbFramesCreated++;
+    return true;
+}
+
+// The kept frames back to back, in chronological order, as qTBuffer hands them out
+static u32 expectedTraceData(u8 *out)
+{
+    u32 size = 0;
+    for(u32 i = firstKept; i < nbFrames; i++)
+    {
+        memcpy(out + size, frames[i].data, frames[i].size);
+        size += frames[i].size;
+    }
+
+    return size;
+}
+
+static void checkTraceBuffer(void)
+{
+    static u8 expected[TRACE_BUFFER_SIZE + TRACE_FRAME_MAX_SIZE], data[TRACE_BUFFER_SIZE + 0x10];
+    u32 size = expectedTraceData(expected);
+
+    CHECK(traceBuffer.nbFrames == nbFrames - firstKept && traceBuffer.nbFramesCreated == nbFrames);
+    CHECK(size <= TRACE_BUFFER_SIZE && GDB_GetTraceBufferUsedSize() == size);
+
+    // All of it, then a few random slices, some of them across the wrap
+    memset(data, 0xCC, sizeof(data));
+    CHECK(GDB_ReadTraceBuffer(data, 0, sizeof(data)) == size && memcmp(data, expected, size) == 0);
+    CHECK(GDB_ReadTraceBuffer(data, size, 0x10) == 0 && GDB_ReadTraceBuffer(data, size + 1 + checkRand() % 0x100, 0x10) == 0);
+    for(u32 i = 0; i < 8 && size != 0; i++)
+    {
+        u32 offset = checkRand() % size, len = 1 + checkRand() % 0x800;
+        u32 n = len < size - offset ? len : size - offset;
+        CHECK(GDB_ReadTraceBuffer(data, offset, len) == n && memcmp(data, expected + offset, n) == 0);
+    }
+
+    // Every frame number: the dropped ones are gone, the kept ones are where they should be
+    for(u32 i = 0; i < nbFrames + 2; i++)
+    {
+        s32 offset = GDB_FindTraceFrame(&gdbContext, i);
+        if(i < firstKept || i >= nbFrames)
+            CHECK(offset < 0);
+        else
+            CHECK(offset >= 0 && (u32)offset + frames[i].size <= TRACE_BUFFER_SIZE &&
+                  memcmp(traceBuffer.data + offset, frames[i].data, frames[i].size) == 0);
+    }
+}
+
+// Selects the frame the way QTFrame does, and reads it back the way 'g' and 'm' do
+static void checkFrameSelection(u32 i)
+{
+    ThreadContext regs;
+
+    gdbContext.traceFrameSelected = true;
+    gdbContext.selectedTraceFrame = i;
+
+    int r = GDB_GetTraceFrameRegisters(&gdbContext, &regs);
+    if(i < firstKept)
+    {
+        CHECK(r == -ENOENT);
+        CHECK(GDB_SendTraceFrameMemory(&gdbContext, frames[i].memoryAddress, 1) == 0 && lastErrno == ENOENT);
+        return;
+    }
+
+    // Without an 'R' block, the pc is the tracepoint's address
+    CHECK(r == (frames[i].hasRegisters ? 1 : 0));
+    CHECK(regs.cpu_registers.pc == (frames[i].hasRegisters ? frames[i].pc : MEM_BASE + 0x10 * frames[i].tracepoint));
+
+    if(frames[i].memorySize != 0)
+    {
+        u32 offset = checkRand() % frames[i].memorySize;
+        const u8 *block = frames[i].data + frames[i].size - frames[i].memorySize;
+        char hex[2 * TRACE_FRAME_MAX_SIZE + 1];
+        u32 n = frames[i].memorySize - offset;
+        n = n < (GDB_BUF_LEN - 4) / 2 ? n : (GDB_BUF_LEN - 4) / 2;
+
+        for(u32 j = 0; j < n; j++)
+            sprintf(hex + 2 * j, "%02x", block[offset + j]);
+        CHECK(GDB_SendTraceFrameMemory(&gdbContext, frames[i].memoryAddress + offset, 0x10000) == 0 && strcmp(lastPacket, hex) == 0);
+    }
+
+    CHECK(GDB_SendTraceFrameMemory(&gdbContext, frames[i].memoryAddress + frames[i].memorySize, 1) == 0 && lastErrno == EFAULT);
+    gdbContext.traceFrameSelected = false;
+}
+
+static void resetTrace(void)
+{
+    GDB_ResetTraceBuffer(&gdbContext);
+    nbFrames = firstKept = 0;
+}
+
+// Circular: the oldest frames are dropped to make room, never more than that
+static void checkCircularBuffer(void)
+{
+    u32 nbWraps = 0;
+
+    resetTrace();
+    for(u32 i = 0; i < MAX_FRAMES; i++)
+    {
+        // Mostly small frames, some of the largest size
+        u32 maxSize = checkRand() % 8 == 0 ? TRACE_FRAME_MAX_SIZE : 0x100 + checkRand() % 0x200;
+        bool wasWrapped = traceBuffer.wrapped;
+
+        makeFrame(nbFrames, maxSize);
+        CHECK(appendFrame(nbFrames, true));
+        nbFrames++;
+
+        firstKept = nbFrames - traceBuffer.nbFrames;
+        nbWraps += !wasWrapped && traceBuffer.wrapped;
+        checkTraceBuffer();
+
+        // The room left can't fit the oldest frame dropped, or it would have been kept
+        if(firstKept != 0)
+            CHECK(GDB_GetTraceBufferUsedSize() + frames[firstKept - 1].size > TRACE_BUFFER_SIZE - TRACE_FRAME_MAX_SIZE);
+
+        if(i % 97 == 0)
+        {
+            for(u32 j = 0; j < 4; j++)
+                checkFrameSelection(nbFrames - 1 - checkRand() % (nbFrames < 40 ? nbFrames : 40));
+            if(firstKept != 0)
+                checkFrameSelection(checkRand() % firstKept);
+        }
+    }
+
+    CHECK(nbWraps > 10 && firstKept > MAX_FRAMES / 2);
+}
+
+// Not circular: the frame that doesn't fit is refused, nothing is dropped
+static void checkFullBuffer(void)
+{
+    resetTrace();
+    while(true)
+    {
+        makeFrame(nbFrames, TRACE_FRAME_MAX_SIZE);
+        if(!appendFrame(nbFrames, false))
+            break;
+        nbFrames++;
+    }
+
+    CHECK(GDB_GetTraceBufferUsedSize() + frames[nbFrames].size > TRACE_BUFFER_SIZE && !traceBuffer.wrapped);
+    checkTraceBuffer();
+}
+
+static void addTracepoint(u32 number, u32 address, const u8 *actions, u32 actionsSize)
+{
+    Tracepoint *tp = &gdbContext.tracepoints[gdbContext.nbTracepoints++];
+    memset(tp, 0, sizeof(Tracepoint));
+    tp->number = number;
+    tp->address = address;
+    tp->enabled = true;
+    tp->dataOffset = gdbContext.tracepointDataSize;
+    tp->actionsSize = actionsSize;
+    if(actionsSize != 0)
+        memcpy(gdbContext.tracepointData + gdbContext.tracepointDataSize, actions, actionsSize);
+    gdbContext.tracepointDataSize += actionsSize;
+}
+
+// A running trace: each hit is a frame with the registers and the memory the actions ask for, stepped over
+static void checkCollectedFrames(void)
+{
+    static const u32 movR0R1 = 0xE1A00001;
+    u8 actions[1 + TRACE_ACTION_MEMORY_SIZE] = { 'R', 'M' };
+    s32 baseReg = 0;
+    u32 offset = 0x10, size = 0x1F0;
+    memcpy(actions + 2, &baseReg, 4);
+    memcpy(actions + 6, &offset, 4);
+    memcpy(actions + 10, &size, 4);
+
+    GDB_ClearTracepoints(&gdbContext);
+    addTracepoint(7, MEM_BASE + 0x800, actions, sizeof(actions));
+    memcpy(memory + 0x800, &movR0R1, 4);
+    GDB_RememberBreakpointKind(&gdbContext, MEM_BASE + 0x800, 4);
+    gdbContext.circularTraceBuffer = true;
+
+    CHECK(GDB_HandleQueryTraceStart(&gdbContext) == 0 && strcmp(lastPacket, "OK") == 0);
+    CHECK(gdbContext.traceStatus == TRACE_STATUS_RUNNING && *(u32 *)(memory + 0x800) == BREAKPOINT_INSTRUCTION_ARM);
+
+    // Same size for all of them: as many frames are kept as fit once the buffer has wrapped
+    u32 frameSize = TRACE_FRAME_HEADER_SIZE + 1 + sizeof(ThreadContext) + 11 + size;
+    u32 nbHits = 3 * TRACE_BUFFER_SIZE / frameSize;
+    for(u32 i = 0; i < nbHits; i++)
+    {
+        // The breakpoint hit, then the one right after it that ends the step-over
+        for(u32 j = 0; j < 0x500; j++) memory[j] = (u8)(i + j);
+        threadContext.cpu_registers.r[0] = MEM_BASE + (i % 4) * 0x100;
+        threadContext.cpu_registers.pc = MEM_BASE + 0x800;
+        CHECK(GDB_HandleBreakpointHit(&gdbContext, 1));
+        CHECK(*(u32 *)(memory + 0x800) == movR0R1 && *(u32 *)(memory + 0x804) == BREAKPOINT_INSTRUCTION_ARM);
+        threadContext.cpu_registers.pc = MEM_BASE + 0x804;
+        CHECK(GDB_HandleBreakpointHit(&gdbContext, 1));
+        CHECK(*(u32 *)(memory + 0x800) == BREAKPOINT_INSTRUCTION_ARM && *(u32 *)(memory + 0x804) == 0);
+    }
+
+    Tracepoint *tp = &gdbContext.tracepoints[0];
+    CHECK(tp->hitCount == nbHits && tp->traceFrameUsage == nbHits * frameSize);
+    CHECK(traceBuffer.nbFramesCreated == nbHits && traceBuffer.nbFrames == TRACE_BUFFER_SIZE / frameSize);
+    CHECK(GDB_GetTraceBufferUsedSize() == traceBuffer.nbFrames * frameSize);
+
+    // Each kept frame has the registers and the memory of its own hit
+    for(u32 i = nbHits - traceBuffer.nbFrames; i < nbHits; i++)
+    {
+        u32 addr = MEM_BASE + (i % 4) * 0x100 + offset, n = (GDB_BUF_LEN - 4) / 2 < size ? (GDB_BUF_LEN - 4) / 2 : size;
+        char hex[2 * 0x1F0 + 1];
+        ThreadContext regs;
+
+        gdbContext.traceFrameSelected = true;
+        gdbContext.selectedTraceFrame = i;
+        CHECK(GDB_GetTraceFrameRegisters(&gdbContext, &regs) == 1 && regs.cpu_registers.r[0] == addr - offset);
+
+        for(u32 j = 0; j < n; j++)
+            sprintf(hex + 2 * j, "%02x", (u8)(i + (addr - MEM_BASE) + j));
+        CHECK(GDB_SendTraceFrameMemory(&gdbContext, addr, size) == 0 && strcmp(lastPacket, hex) == 0);
+    }
+
+    gdbContext.traceFrameSelected = false;
+    CHECK(GDB_HandleQueryTraceStop(&gdbContext) == 0 && *(u32 *)(memory + 0x800) == movR0R1 && gdbContext.nbBreakpoints == 0);
+}
+
+// QTStart: the packets don't say whether an address is Thumb code. An odd address, a breakpoint set there before
+// or "monitor tracepointmode" tell it. svcs can't be stepped over, so they can't have a tracepoint
+static void checkTraceStart(void)
+{
+    static const u16 thumbMov = 0x4608, thumbSvc = 0xDF01;
+    static const u32 armSvc = 0xEF000001;
+
+    GDB_ClearTracepoints(&gdbContext);
+    memset(memory, 0, sizeof(memory));
+    memcpy(memory + 0x100, &thumbMov, 2);
+    memcpy(memory + 0x102, &thumbMov, 2);
+    addTracepoint(1, MEM_BASE + 0x100, NULL, 0);
+
+    lastDebugString = NULL;
+    CHECK(GDB_HandleQueryTraceStart(&gdbContext) == 0 && lastErrno == EINVAL && gdbContext.traceStatus == TRACE_STATUS_NOT_RUN);
+    CHECK(lastDebugString != NULL && strstr(lastDebugString, "monitor tracepointmode") != NULL);
+    CHECK(memcmp(memory + 0x100, &thumbMov, 2) == 0 && gdbContext.nbBreakpoints == 0);
+
+    // Only halfword-aligned, that one can't be ARM code
+    GDB_RememberBreakpointKind(&gdbContext, MEM_BASE + 0x100, 2);
+    addTracepoint(2, MEM_BASE + 0x102, NULL, 0);
+    CHECK(GDB_HandleQueryTraceStart(&gdbContext) == 0 && strcmp(lastPacket, "OK") == 0 && gdbContext.traceStatus == TRACE_STATUS_RUNNING);
+    CHECK(*(u16 *)(memory + 0x100) == BREAKPOINT_INSTRUCTION_THUMB && *(u16 *)(memory + 0x102) == BREAKPOINT_INSTRUCTION_THUMB);
+    GDB_HandleQueryTraceStop(&gdbContext);
+    CHECK(memcmp(memory + 0x100, &thumbMov, 2) == 0 && memcmp(memory + 0x102, &thumbMov, 2) == 0);
+
+    // A breakpoint GDB set there, even removed since
+    GDB_ClearTracepoints(&gdbContext);
+    addTracepoint(2, MEM_BASE + 0x104, NULL, 0);
+    memcpy(memory + 0x104, &thumbMov, 2);
+    CHECK(GDB_AddBreakpoint(&gdbContext, MEM_BASE + 0x104, true, false, NULL, 0) == 0);
+    CHECK(GDB_RemoveBreakpoint(&gdbContext, MEM_BASE + 0x104) == 0);
+    CHECK(GDB_HandleQueryTraceStart(&gdbContext) == 0 && gdbContext.traceStatus == TRACE_STATUS_RUNNING);
+    GDB_HandleQueryTraceStop(&gdbContext);
+
+    // svcs, Thumb and ARM
+    GDB_ClearTracepoints(&gdbContext);
+    memcpy(memory + 0x200, &thumbSvc, 2);
+    addTracepoint(3, MEM_BASE + 0x201, NULL, 0);
+    CHECK(GDB_HandleQueryTraceStart(&gdbContext) == 0 && lastErrno == EINVAL && gdbContext.nbBreakpoints == 0);
+    CHECK(memcmp(memory + 0x200, &thumbSvc, 2) == 0);
+
+    GDB_ClearTracepoints(&gdbContext);
+    memcpy(memory + 0x300, &armSvc, 4);
+    GDB_RememberBreakpointKind(&gdbContext, MEM_BASE + 0x300, 4);
+    addTracepoint(4, MEM_BASE + 0x300, NULL, 0);
+    CHECK(GDB_HandleQueryTraceStart(&gdbContext) == 0 && lastErrno == EINVAL && gdbContext.nbBreakpoints == 0);
+    CHECK(memcmp(memory + 0x300, &armSvc, 4) == 0);
+}
+
+int main(void)
+{
+    gdbContext.debug = 0x1234;
+
+    // Tracepoints 1 to 4 for the frames without an 'R' block
+    for(u32 i = 1; i <= 4; i++)
+        addTracepoint(i, MEM_BASE + 0x10 * i, NULL, 0);
+
+    checkCircularBuffer();
+    checkFullBuffer();
+    checkCollectedFrames();
+    checkTraceStart();
+
+    return 0;
+}
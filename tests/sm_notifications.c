@@ -0,0 +1,295 @@
+// sm: notification subscriber index and pending dedup filter, checked against a brute-force model.
+// Then a fan-out benchmark against the process list walk that the index replaced, counting semaphore releases.
+
+#include <time.h>
+
+#include "check.h"
+
+#include "../sysmodules/sm/source/list.c"
+#include "../sysmodules/sm/source/notifications.c"
+#include "../sysmodules/sm/source/processes.c"
+
+ServiceInfo servicesInfo[0xA0];
+u32 nbServices;
+ProcessData processDataPool[64];
+u32 nbSection0Modules;
+
+static Handle nextHandle = 1;
+static u64 nbSemaphoreReleases;
+
+u32 osGetKernelVersion(void) { return 0x02340000; }
+Result svcCreateSemaphore(Handle *semaphore, s32 initialCount, s32 maxCount) { (void)initialCount; (void)maxCount; *semaphore = nextHandle++; return 0; }
+Result svcReleaseSemaphore(s32 *count, Handle semaphore, s32 releaseCount) { (void)semaphore; (void)releaseCount; *count = 0; nbSemaphoreReleases++; return 0; }
+Result svcGetProcessId(u32 *out, Handle handle) { *out = handle; return 0; }
+Result svcCloseHandle(Handle handle) { (void)handle; return 0; }
+void removeServiceInfo(u32 serviceId) { (void)serviceId; }
+
+#define NB_PROCESSES    40
+#define NB_IDS          24
+
+// Model: subscriptions and pending queues per process, and the order the processes were registered in
+static bool modelSubscribed[NB_PROCESSES][NB_IDS];
+static u32 modelPending[NB_PROCESSES][16];
+static u32 modelNbPending[NB_PROCESSES];
+static u32 modelRegistrationOrder[NB_PROCESSES];
+
+static u32 notificationIdOf(u32 i)
+{
+    // Spread over the hash table, with some IDs that are close to each other
+    return i < NB_IDS / 2 ? 0x100 + i : 0x1000 * i + 7;
+}
+
+static bool modelPublish(u32 pid, u32 id, u32 flags)
+{
+    if(flags & 1)
+    {
+        for(u32 i = 0; i < modelNbPending[pid]; i++)
+        {
+            if(modelPending[pid][i] == id)
+                return true;
+        }
+    }
+
+    if(modelNbPending[pid] == 16)
+        return (flags & 2) != 0;
+
+    modelPending[pid][modelNbPending[pid]++] = id;
+    return true;
+}
+
+// PublishToSubscriber as it was before the index: walk every process and scan its subscriptions
+static Result listWalkPublishToSubscriber(u32 notificationId, u32 flags)
+{
+    for(ProcessData *node = processDataInUseList.first; node != NULL; node = node->next)
+    {
+        if(!node->notificationEnabled || isNotificationInhibited(node, notificationId))
+            continue;
+
+        u16 i;
+        for(i = 0; i < node->nbSubscribed && node->subscribedNotifications[i] != notificationId; i++);
+        if(i >= node->nbSubscribed)
+            continue;
+
+        if(!doPublishNotification(node, notificationId, flags))
+            return 0xD8606408;
+    }
+
+    return 0;
+}
+
+static u64 nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void unregisterAll(void)
+{
+    while(processDataInUseList.first != NULL)
+        CHECK(UnregisterProcess(processDataInUseList.first->pid) == 0);
+}
+
+static void registerProcess(u32 pid)
+{
+    Handle semaphore;
+    CHECK(RegisterProcess(pid, NULL, 0) == 0);
+    CHECK(EnableNotification(&(SessionData){ .pid = pid }, &semaphore) == 0);
+}
+
+static void checkFullIndex(void)
+{
+    // Every process subscribed to as many different IDs as it can: the index must take all of them
+    unregisterAll();
+    for(u32 pid = 0; pid < 64; pid++)
+    {
+        registerProcess(pid);
+        for(u32 i = 0; i < 0x11; i++)
+            CHECK(Subscribe(&(SessionData){ .pid = pid }, 0x10000 + 0x11 * pid + i) == 0);
+        CHECK(Subscribe(&(SessionData){ .pid = pid }, 0x20000) == (Result)0xD9006405);
+    }
+
+    CHECK(nbNotificationIndexEntries == 64 * 0x11);
+    for(u32 pid = 0; pid < 64; pid++)
+        CHECK(getNotificationSubscribers(0x10000 + 0x11 * pid) == 1ULL << (findProcessData(pid) - processDataPool));
+}
+
+// Each ID is published to its subscribers, whose queues are then emptied
+#define FANOUT_PROCESSES    40
+#define FANOUT_IDS          32
+#define FANOUT_ROUNDS       20000
+
+static ProcessData *fanOutSubscribers[FANOUT_IDS][FANOUT_PROCESSES];
+static u32 nbFanOutSubscribers[FANOUT_IDS];
+
+static double benchmarkFanOut(Result (*publish)(u32, u32), u64 *nbReleases)
+{
+    double best = 1e300;
+    for(u32 run = 0; run < 10; run++)
+    {
+        nbSemaphoreReleases = 0;
+        u64 start = nowNs();
+        for(u32 round = 0; round < FANOUT_ROUNDS; round++)
+        {
+            u32 idIndex = round % FANOUT_IDS;
+            CHECK(publish(0x100 + idIndex, 1) == 0);
+            for(u32 i = 0; i < nbFanOutSubscribers[idIndex]; i++)
+            {
+                ProcessData *node = fanOutSubscribers[idIndex][i];
+                node->receivedNotificationIndex = node->pendingNotificationIndex;
+                node->nbPendingNotifications = 0;
+                node->pendingNotificationFilter = 0;
+            }
+        }
+
+        double ns = (double)(nowNs() - start) / FANOUT_ROUNDS;
+        best = ns < best ? ns : best;
+        *nbReleases = nbSemaphoreReleases;
+    }
+
+    return best;
+}
+
+static void benchmark(void)
+{
+    // Each process subscribes to 6 IDs at random, so about 7 subscribers per ID
+    unregisterAll();
+    for(u32 pid = 0; pid < FANOUT_PROCESSES; pid++)
+    {
+        registerProcess(pid);
+        for(u32 i = 0; i < 6; i++)
+        {
+            u32 idIndex = checkRand() % FANOUT_IDS;
+            if(Subscribe(&(SessionData){ .pid = pid }, 0x100 + idIndex) == 0)
+                fanOutSubscribers[idIndex][nbFanOutSubscribers[idIndex]++] = findProcessData(pid);
+        }
+    }
+
+    // Emptying the subscribers' queues is timed too, the same way for both
+    u64 indexedReleases, walkReleases;
+    double indexed = benchmarkFanOut(PublishToSubscriber, &indexedReleases);
+    double walk = benchmarkFanOut(listWalkPublishToSubscriber, &walkReleases);
+    CHECK(indexedReleases == walkReleases);
+
+    printf("notifications: %u processes, %.1f semaphore releases per publish, %.0f ns per publish indexed, %.0f ns walking the list (host, %s)\n",
+           FANOUT_PROCESSES, (double)indexedReleases / FANOUT_ROUNDS, indexed, walk, CHECK_BUILD_FLAGS);
+}
+
+int main(void)
+{
+    buildList(&freeProcessDataList, processDataPool, 64, sizeof(ProcessData));
+
+    // Registered in a random order, which is not the pool order either once slots are reused
+    for(u32 i = 0; i < NB_PROCESSES; i++)
+        modelRegistrationOrder[i] = i;
+    for(u32 i = NB_PROCESSES - 1; i > 0; i--)
+    {
+        u32 j = checkRand() % (i + 1), tmp = modelRegistrationOrder[i];
+        modelRegistrationOrder[i] = modelRegistrationOrder[j];
+        modelRegistrationOrder[j] = tmp;
+    }
+
+    for(u32 i = 0; i < NB_PROCESSES; i++)
+        registerProcess(NB_PROCESSES + i);
+    for(u32 i = 0; i < NB_PROCESSES; i++)
+        CHECK(UnregisterProcess(NB_PROCESSES + modelRegistrationOrder[(i * 7) % NB_PROCESSES]) == 0);
+    for(u32 i = 0; i < NB_PROCESSES; i++)
+        registerProcess(modelRegistrationOrder[i]);
+
+    for(u32 round = 0; round < 20000; round++)
+    {
+        u32 pid = checkRand() % NB_PROCESSES;
+        u32 idIndex = checkRand() % NB_IDS, id = notificationIdOf(idIndex);
+        SessionData session = { .pid = pid };
+        u32 flags = checkRand() % 3;
+
+        switch(checkRand() % 5)
+        {
+            case 0:
+            {
+                u32 nbSubscribed = 0;
+                for(u32 i = 0; i < NB_IDS; i++)
+                    nbSubscribed += modelSubscribed[pid][i];
+
+                Result res = Subscribe(&session, id);
+                if(modelSubscribed[pid][idIndex])
+                    CHECK(res == (Result)0xD9006403);
+                else if(nbSubscribed == 0x11)
+                    CHECK(res == (Result)0xD9006405);
+                else
+                {
+                    CHECK(res == 0);
+                    modelSubscribed[pid][idIndex] = true;
+                }
+                break;
+            }
+            case 1:
+                CHECK(Unsubscribe(&session, id) == (modelSubscribed[pid][idIndex] ? 0 : (Result)0xD8806404));
+                modelSubscribed[pid][idIndex] = false;
+                break;
+            case 2:
+            {
+                // Processes are notified in the order of the process list, the most recently registered first
+                u32 pidCount = 0, pidList[60], nbExpected = 0, expectedPids[60];
+                Result res = PublishAndGetSubscriber(&pidCount, pidList, id, flags), expectedRes = 0;
+
+                for(u32 i = NB_PROCESSES; i > 0; i--)
+                {
+                    u32 p = modelRegistrationOrder[i - 1];
+                    if(!modelSubscribed[p][idIndex])
+                        continue;
+                    else if(!modelPublish(p, id, flags))
+                    {
+                        expectedRes = 0xD8606408;
+                        break;
+                    }
+
+                    expectedPids[nbExpected++] = p;
+                }
+
+                CHECK(res == expectedRes);
+                if(res == 0)
+                    CHECK(pidCount == nbExpected && memcmp(pidList, expectedPids, 4 * nbExpected) == 0);
+                break;
+            }
+            case 3:
+            {
+                u32 received;
+                Result res = ReceiveNotification(&session, &received);
+                if(modelNbPending[pid] == 0)
+                    CHECK(res == (Result)0xD8806404);
+                else
+                {
+                    CHECK(res == 0 && received == modelPending[pid][0]);
+                    memmove(modelPending[pid], modelPending[pid] + 1, --modelNbPending[pid] * 4);
+                }
+                break;
+            }
+            case 4:
+                // Drain everything so that the queues don't stay full
+                for(u32 r; ReceiveNotification(&session, &r) == 0;);
+                modelNbPending[pid] = 0;
+                break;
+        }
+
+        CHECK(findProcessData(pid)->nbPendingNotifications == modelNbPending[pid]);
+    }
+
+    // Unregistering a process removes it from the index
+    for(u32 i = 0; i < NB_IDS; i++)
+        Subscribe(&(SessionData){ .pid = 3 }, notificationIdOf(i));
+
+    u64 mask = 1ULL << (findProcessData(3) - processDataPool);
+    CHECK(UnregisterProcess(3) == 0);
+    for(u32 i = 0; i < NB_IDS; i++)
+        CHECK((getNotificationSubscribers(notificationIdOf(i)) & mask) == 0);
+
+    u32 nbEntries = 0;
+    for(u32 i = 0; i < NOTIFICATION_INDEX_SIZE; i++)
+        nbEntries += notificationIndexMasks[i] != 0;
+    CHECK(nbEntries == nbNotificationIndexEntries);
+
+    checkFullIndex();
+    benchmark();
+    return 0;
+}
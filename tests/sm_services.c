@@ -0,0 +1,230 @@
+// sm: service name hash table and pid -> process data table, checked against linear scans.
+// Then the lookup throughput of both, with a table filled the way it is after boot.
+
+#include <time.h>
+
+#include "check.h"
+
+#include "../sysmodules/sm/source/list.c"
+#include "../sysmodules/sm/source/services.c"
+#include "../sysmodules/sm/source/processes.c"
+
+SessionDataList sessionDataInUseList, freeSessionDataList;
+SessionDataList sessionDataWaitingForServiceOrPortRegisterList, sessionDataToWakeUpAfterServiceOrPortRegisterList;
+SessionDataList sessionDataWaitingPortReadyList;
+Handle resumeGetServiceHandleOrPortRegisteredSemaphore;
+ProcessData processDataPool[64];
+u32 nbSection0Modules;
+
+static Handle nextHandle = 1;
+
+u32 osGetKernelVersion(void) { return 0x02340000; }
+Result svcCreatePort(Handle *portServer, Handle *portClient, const char *name, s32 maxSessions) { (void)name; (void)maxSessions; *portServer = nextHandle++; *portClient = nextHandle++; return 0; }
+Result svcCreateSessionToPort(Handle *clientSession, Handle clientPort) { *clientSession = clientPort | 0x80000000; return 0; }
+Result svcCreateSemaphore(Handle *semaphore, s32 initialCount, s32 maxCount) { (void)initialCount; (void)maxCount; *semaphore = nextHandle++; return 0; }
+Result svcReleaseSemaphore(s32 *count, Handle semaphore, s32 releaseCount) { (void)semaphore; (void)releaseCount; *count = 0; return 0; }
+Result svcCloseHandle(Handle handle) { (void)handle; return 0; }
+void removeProcessFromNotificationIndex(ProcessData *processData) { (void)processData; }
+
+static s32 linearFind(bool isNamedPort, const char *name, s32 nameSize)
+{
+    for(u32 i = 0; i < nbServices; i++)
+    {
+        if(servicesInfo[i].isNamedPort == isNamedPort && areServiceNamesEqual(servicesInfo[i].name, name, nameSize))
+            return i;
+    }
+
+    return -1;
+}
+
+static ProcessData *linearFindProcessData(u32 pid)
+{
+    for(ProcessData *node = processDataInUseList.first; node != NULL; node = node->next)
+    {
+        if(node->pid == pid)
+            return node;
+    }
+
+    return NULL;
+}
+
+static u64 nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void randomName(char *name, s32 *nameSize)
+{
+    static const char chars[] = "abcdefghijklmnopqrstuvwxyz:_0123456789";
+
+    // Few distinct lengths and characters, so that names share prefixes
+    *nameSize = 1 + checkRand() % 8;
+    memset(name, 0, 8);
+    for(s32 i = 0; i < *nameSize; i++)
+        name[i] = chars[checkRand() % 6];
+}
+
+static void checkAllServices(void)
+{
+    u32 nbIndexed = 0;
+    for(u32 i = 0; i < SERVICE_HASH_TABLE_SIZE; i++)
+        nbIndexed += serviceHashTable[i] != 0;
+
+    CHECK(nbIndexed == nbServices);
+    for(u32 i = 0; i < nbServices; i++)
+        CHECK(findServicePortByName(servicesInfo[i].isNamedPort, servicesInfo[i].name, strnlen(servicesInfo[i].name, 8)) == (s32)i);
+}
+
+static void checkServices(void)
+{
+    SessionData session = { .pid = 1 };
+    char name[8];
+    s32 nameSize;
+
+    for(u32 round = 0; round < 2000; round++)
+    {
+        bool isNamedPort = (checkRand() & 3) == 0;
+        randomName(name, &nameSize);
+        s32 expected = linearFind(isNamedPort, name, nameSize);
+
+        CHECK(findServicePortByName(isNamedPort, name, nameSize) == expected);
+
+        if(expected == -1)
+        {
+            Handle serverPort;
+            Result res = isNamedPort ? RegisterPort(&session, 0x1234, name, nameSize) : RegisterService(&session, &serverPort, name, nameSize, 1);
+            CHECK(nbServices <= 0xA0);
+            CHECK(res == 0 || (res == (Result)0xD86067F3 && nbServices == 0xA0));
+        }
+        else
+            CHECK((isNamedPort ? UnregisterPort(&session, name, nameSize) : UnregisterService(&session, name, nameSize)) == 0);
+
+        checkAllServices();
+    }
+
+    // Empty the table from the front, which moves the last entry each time
+    while(nbServices != 0)
+    {
+        memcpy(name, servicesInfo[0].name, 8);
+        nameSize = strnlen(name, 8);
+        CHECK((servicesInfo[0].isNamedPort ? UnregisterPort(&session, name, nameSize) : UnregisterService(&session, name, nameSize)) == 0);
+        checkAllServices();
+    }
+
+    // Duplicates and prefixes
+    Handle serverPort;
+    CHECK(RegisterService(&session, &serverPort, "srv:", 4, 1) == 0);
+    CHECK(RegisterService(&session, &serverPort, "srv:", 4, 1) == (Result)0xD9001BFC);
+    CHECK(RegisterPort(&session, 0x1234, "srv:", 4) == 0);
+    CHECK(findServicePortByName(false, "srv", 3) == -1);
+    CHECK(findServicePortByName(false, "srv:pm", 6) == -1);
+    CHECK(findServicePortByName(true, "srv:", 4) == 1);
+}
+
+static void checkProcesses(void)
+{
+    buildList(&freeProcessDataList, processDataPool, 64, sizeof(ProcessData));
+
+    // PIDs colliding in the direct-mapped table
+    static const u32 pids[] = { 0x10, 0x90, 0x110, 0x11, 0x20, 0x190 };
+    for(u32 i = 0; i < sizeof(pids) / sizeof(pids[0]); i++)
+        CHECK(RegisterProcess(pids[i], NULL, 0) == 0);
+
+    for(u32 round = 0; round < 3; round++)
+    {
+        for(u32 i = 0; i < sizeof(pids) / sizeof(pids[0]); i++)
+            CHECK(findProcessData(pids[i]) != NULL && findProcessData(pids[i])->pid == pids[i]);
+    }
+
+    CHECK(RegisterProcess(0x90, NULL, 0) == (Result)0xD9006403);
+    CHECK(UnregisterProcess(0x90) == 0);
+    CHECK(findProcessData(0x90) == NULL);
+    CHECK(findProcessData(0x10) != NULL && findProcessData(0x110) != NULL);
+    CHECK(UnregisterProcess(0x90) == (Result)0xD8806404);
+    CHECK(findProcessData(0x210) == NULL);
+}
+
+// Lookups per second, best of 10 runs
+#define BENCHMARK_ROUNDS    2000
+#define BENCHMARK(nbLookups, lookup) ({\
+    double best = 0.0;\
+    for(u32 run = 0; run < 10; run++)\
+    {\
+        u64 start = nowNs();\
+        for(u32 round = 0; round < BENCHMARK_ROUNDS; round++)\
+            lookup;\
+        double perSecond = (double)(nbLookups) * BENCHMARK_ROUNDS * 1e9 / (nowNs() - start);\
+        best = perSecond > best ? perSecond : best;\
+    }\
+    best;\
+})
+
+static void benchmarkLookups(void)
+{
+    // Services and named ports of a booted system
+    static const char *services[] =
+    {
+        "fs:USER", "fs:LDR", "fs:REG", "APT:U", "APT:A", "APT:S", "ns:s", "ns:p", "ns:c", "pm:app",
+        "pm:dbg", "ldr:ro", "hid:USER", "hid:SPVR", "ir:USER", "ir:u", "ir:rst", "cfg:u", "cfg:s", "cfg:i",
+        "cfg:nor", "ptm:u", "ptm:s", "ptm:gets", "ptm:sets", "ptm:sysm", "ptm:play", "gsp::Gpu", "gsp::Lcd", "dsp::DSP",
+        "y2r:u", "cam:u", "cam:s", "csnd:SND", "mic:u", "nwm::UDS", "nwm::EXT", "nwm::INF", "nwm::SAP", "nwm::SOC",
+        "soc:U", "soc:P", "ac:u", "ac:i", "frd:u", "frd:a", "boss:U", "boss:P", "news:u", "news:s",
+        "act:u", "act:a", "am:net", "am:app", "am:sys", "am:u", "http:C", "ssl:C", "cecd:u", "cecd:s",
+        "ndm:u", "nim:s", "nim:aoc", "mcu::HWC", "mcu::GPU", "i2c::MCU", "gpio:MCU", "pxi:am9", "pxi:dev", "ps:ps",
+        "qtm:u", "qtm:s", "mvd:STD", "dlp:SRVR", "dlp:CLNT", "pxi:luma", "hb:ldr", "plg:ldr",
+    };
+    static const char *ports[] = { "srv:", "err:f", "srv:pm" };
+    // Names that are looked up but not registered
+    static const char *missing[] = { "y2r:u2", "qtm:sp", "APT:", "hid:" };
+    const u32 nbServicesUsed = sizeof(services) / sizeof(services[0]), nbPorts = sizeof(ports) / sizeof(ports[0]);
+    const u32 nbMissing = sizeof(missing) / sizeof(missing[0]);
+
+    SessionData session = { .pid = 1 };
+    Handle serverPort;
+    while(nbServices != 0)
+        CHECK((servicesInfo[0].isNamedPort ? UnregisterPort : UnregisterService)(&session, servicesInfo[0].name, strnlen(servicesInfo[0].name, 8)) == 0);
+
+    for(u32 i = 0; i < nbServicesUsed; i++)
+        CHECK(RegisterService(&session, &serverPort, services[i], strlen(services[i]), 1) == 0);
+    for(u32 i = 0; i < nbPorts; i++)
+        CHECK(RegisterPort(&session, 0x1234, ports[i], strlen(ports[i])) == 0);
+
+    const u32 nbNames = nbServicesUsed + nbMissing;
+    const char *names[nbNames];
+    s32 nameSizes[nbNames];
+    for(u32 i = 0; i < nbNames; i++)
+    {
+        names[i] = i < nbServicesUsed ? services[i] : missing[i - nbServicesUsed];
+        nameSizes[i] = strlen(names[i]);
+    }
+
+    volatile s32 sum = 0;
+    double hashed = BENCHMARK(nbNames, for(u32 i = 0; i < nbNames; i++) sum += findServicePortByName(false, names[i], nameSizes[i]));
+    double linear = BENCHMARK(nbNames, for(u32 i = 0; i < nbNames; i++) sum += linearFind(false, names[i], nameSizes[i]));
+
+    // PIDs are handed out in order, sysmodules first
+    const u32 nbPids = 40;
+    while(processDataInUseList.first != NULL)
+        CHECK(UnregisterProcess(processDataInUseList.first->pid) == 0);
+    for(u32 pid = 0; pid < nbPids; pid++)
+        CHECK(RegisterProcess(pid, NULL, 0) == 0);
+
+    volatile u32 pidSum = 0;
+    double pidTable = BENCHMARK(nbPids, for(u32 pid = 0; pid < nbPids; pid++) pidSum += findProcessData(pid)->pid);
+    double pidList = BENCHMARK(nbPids, for(u32 pid = 0; pid < nbPids; pid++) pidSum += linearFindProcessData(pid)->pid);
+
+    printf("services: %u registered, %.1f M lookups/s hashed, %.1f M lookups/s with a linear scan (host, %s)\n",
+           nbServices, hashed / 1e6, linear / 1e6, CHECK_BUILD_FLAGS);
+    printf("processes: %u registered, %.1f M lookups/s with the pid table, %.1f M lookups/s walking the list (host, %s)\n",
+           nbPids, pidTable / 1e6, pidList / 1e6, CHECK_BUILD_FLAGS);
+}
+
+int main(void)
+{
+    checkServices();
+    checkProcesses();
+    benchmarkLookups();
+    return 0;
+}